@@ -72,3 +72,6 @@ xpulpimg ?= 1
 # This parameter is only used for TeraPool configurations
 num_sub_groups_per_group ?= 1
 remote_group_latency_cycles ?= 7
+
+# Number of threads of the Verilator model, if the flavor does not set it
+verilator_threads ?= 1
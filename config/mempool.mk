@@ -25,3 +25,12 @@ axi_hier_radix ?= 20
 
 # Number of AXI masters per group
 axi_masters_per_group ?= 1
+
+###############################
+##  Verilator configuration  ##
+###############################
+
+# Number of threads the Verilator model is built for (1 for a
+# single-threaded model). Use `make verilate_scaling` to find the best value
+# for a machine.
+verilator_threads ?= 4
@@ -41,3 +41,12 @@ dmas_per_group ?= 4
 
 # L2 Banks/Channels
 l2_banks = 16
+
+###############################
+##  Verilator configuration  ##
+###############################
+
+# Number of threads the Verilator model is built for (1 for a
+# single-threaded model). Use `make verilate_scaling` to find the best value
+# for a machine.
+verilator_threads ?= 8
@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Copyright 2021 ETH Zurich and University of Bologna.
+# Solderpad Hardware License, Version 0.51, see LICENSE for details.
+# SPDX-License-Identifier: SHL-0.51
+
+# Build the Verilator model once for every number of threads given as an
+# argument, run it, and report the simulation speed in cycles/s. The
+# environment is passed on to `make verilate`, so select the configuration
+# and the workload as usual, e.g.,
+#   config=terapool app=hello_world ./scripts/verilator_scaling.sh 1 2 4 8
+#   tg=1 tg_ncycles=10000 ./scripts/verilator_scaling.sh 1 4 16
+
+MEMPOOL_DIR=$(git rev-parse --show-toplevel 2>/dev/null || echo $MEMPOOL_DIR)
+cd $MEMPOOL_DIR/hardware
+
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 <threads> [<threads> ...]"
+    exit 1
+fi
+
+# Timestamp
+timestamp=`date +%Y%m%d_%H%M%S`
+result=verilator_scaling_$timestamp.csv
+echo "threads,cycles,wallclock_s,cycles_per_s,speedup" > $result
+
+base_speed=""
+for threads in "$@"; do
+    echo "Threads: $threads"
+
+    # Each thread count gets its own model, so they can be rerun without
+    # rebuilding
+    build=build_t$threads
+    verilator_threads=$threads verilator_build=$PWD/verilator_build_t$threads \
+        buildpath=$build make verilate &> $build.log
+
+    transcript=$build/transcript
+    cycles=`grep "Executed cycles" $transcript | awk '{print $3}'`
+    wallclock=`grep "Wallclock time" $transcript | awk '{print $3}'`
+    speed=`grep "Simulation speed" $transcript | awk '{print $3}'`
+    if [ -z "$speed" ]; then
+        echo "Failed to run the model with $threads threads, see $build.log"
+        exit 1
+    fi
+    if [ -z "$base_speed" ]; then
+        base_speed=$speed
+    fi
+    speedup=`echo "$speed $base_speed" | awk '{printf "%.2f", $1 / $2}'`
+
+    echo "$threads,$cycles,$wallclock,$speed,$speedup" >> $result
+    echo "Threads: $threads | Cycles: $cycles | Wallclock: $wallclock s | Speed: $speed cycles/s | Speedup: $speedup"
+done
+
+echo "Wrote the results to $result"
@@ -4,6 +4,10 @@
 
 `include "register_interface/typedef.svh"
 
+// Per-core line and log ports, see tb/dpi/uart.cpp
+import "DPI-C" function void uart_read_elf (input string filename);
+import "DPI-C" function string uart_write (input int offset, input byte data);
+
 module axi_uart #(
   parameter type axi_req_t                = logic,
   parameter type axi_resp_t               = logic
@@ -99,6 +103,17 @@ module axi_uart #(
 
   string str;
 
+  // Offset of the per-core ports, the shared port is below
+  localparam int unsigned CorePortsOffset = 'h1000;
+
+  // The log records need the format strings from the ELF
+  initial begin : read_log_formats
+    string binary;
+    if ($value$plusargs("PRELOAD=%s", binary)) begin
+      uart_read_elf(binary);
+    end
+  end
+
   `ifdef VCS
     `define UARTASSIGNOPERATOR =
   `else
@@ -110,7 +125,17 @@ module axi_uart #(
       str `UARTASSIGNOPERATOR "";
     end else begin
       if (reg_req.valid) begin
-        if (reg_req.write) begin
+        if (reg_req.write && reg_req.addr[15:0] >= CorePortsOffset) begin
+          for (int i = 0; i < StrbWidth; i++) begin
+            if (reg_req.wstrb[i]) begin
+              automatic string line = uart_write(
+                int'(reg_req.addr[15:0] & ~16'(StrbWidth-1)) + i, reg_req.wdata[i*8+:8]);
+              if (line != "") begin
+                $write("[UART] %s", line);
+              end
+            end
+          end
+        end else if (reg_req.write) begin
           for (int i = 0; i < StrbWidth; i++) begin
             if (reg_req.wstrb[i]) begin
               str `UARTASSIGNOPERATOR $sformatf("%s%c", str, reg_req.wdata[i*8+:8]);
@@ -25,6 +25,7 @@
 
 #include <svdpi.h>
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <sys/stat.h>
@@ -153,27 +154,48 @@ typedef struct {
   uint64_t st_size;
 } Elf64_Sym;
 
+// Loadable segments, whose contents stay in the mapped ELF
+struct segment_t {
+  uint64_t address;
+  uint64_t memsz;
+  uint64_t filesz;
+  const uint8_t* data;
+};
+// Symbols sorted by name, whose names stay in the mapped ELF
+struct symbol_t {
+  const char* name;
+  uint64_t address;
+};
+
 // address and size
 std::vector<std::pair<uint64_t, uint64_t>> sections;
-std::map<std::string, uint64_t> symbols;
-// memory based address and content
-std::map<uint64_t, std::vector<uint8_t>> mems;
+std::vector<segment_t> segments;
+std::vector<symbol_t> symbols;
 uint64_t entry;
 int section_index = 0;
 
-static void write (uint64_t address, uint64_t len, uint8_t* buf) {
-  uint64_t datum;
-  std::vector<uint8_t> mem;
-  for (int i = 0; i < len; i++) {
-    mem.push_back(buf[i]);
-  }
-  mems.insert(std::make_pair(address, mem));
-}
+// The ELF is mapped until another one is read
+static std::string elf_name;
+static char* elf_buf = NULL;
+static size_t elf_size = 0;
 
 extern "C" {
+  void read_elf(const char* filename);
   char get_section(long long* address, long long* len);
   char read_section(long long address, const svOpenArrayHandle buffer);
-  void read_elf(const char* filename);
+  char get_symbol(const char* name, long long* address);
+  int preload_l2_bank(int bank, int num_banks, int bank_bytes, long long base,
+                      long long size, const svOpenArrayHandle mem);
+}
+
+// Copy [address, address + len) of a segment, which reads as zeros past
+// the segment's file contents
+static void copy_segment(const segment_t& seg, uint64_t address, uint64_t len,
+                         uint8_t* dst) {
+  uint64_t offset = address - seg.address;
+  uint64_t from_file = offset < seg.filesz ? std::min(len, seg.filesz - offset) : 0;
+  memcpy(dst, seg.data + offset, from_file);
+  memset(dst + from_file, 0, len - from_file);
 }
 
 // Communicate the section address and len
@@ -195,17 +217,93 @@ extern "C" char read_section(long long address, const svOpenArrayHandle buffer)
   // get actual poitner
   void* buf = svGetArrayPtr(buffer);
   // check that the address points to a section
-  assert(mems.count(address) > 0);
+  auto seg = std::find_if(segments.begin(), segments.end(),
+                          [&](const segment_t& s) { return s.address == (uint64_t)address; });
+  assert(seg != segments.end());
   // copy array
-  int i = 0;
-  for (auto &datum : mems.find(address)->second) {
-    *((char *) buf + i) = datum;
-    i++;
-  }
+  copy_segment(*seg, seg->address, std::min<uint64_t>(seg->memsz, svSizeOfArray(buffer)),
+               (uint8_t*)buf);
   return 0;
 }
 
+// Look up the address of a symbol
+// Returns:
+// 0 if the ELF has no such symbol
+// 1 if it has
+extern "C" char get_symbol(const char* name, long long* address) {
+  auto it = std::lower_bound(symbols.begin(), symbols.end(), name,
+                             [](const symbol_t& s, const char* n) { return strcmp(s.name, n) < 0; });
+  if (it == symbols.end() || strcmp(it->name, name) != 0)
+    return 0;
+  *address = it->address;
+  return 1;
+}
+
+// Write the part of the ELF that falls into [base, base + size) to one bank
+// of a memory that interleaves its banks row by row, `bank_bytes` bytes per
+// bank and row. `mem` is the bank's array of rows. If the simulator keeps
+// the array as plain bytes, as Verilator does, the segments are copied right
+// into it. Otherwise, e.g., for the four-state arrays of Questa and VCS, the
+// rows are put one by one.
+// Returns the number of rows written
+extern "C" int preload_l2_bank(int bank, int num_banks, int bank_bytes, long long base,
+                               long long size, const svOpenArrayHandle mem) {
+  uint64_t num_rows = svSize(mem, 1);
+  uint64_t stride = (uint64_t)bank_bytes * num_banks;
+  uint8_t* rows = (uint8_t*)svGetArrayPtr(mem);
+  if (rows && (uint64_t)svSizeOfArray(mem) != num_rows * bank_bytes)
+    rows = NULL;
+  std::vector<uint8_t> row(bank_bytes);
+  std::vector<svLogicVecVal> vec((bank_bytes + 3) / 4);
+  int written = 0;
+
+  for (const segment_t& seg : segments) {
+    uint64_t start = std::max(seg.address, (uint64_t)base);
+    uint64_t end = std::min(seg.address + seg.memsz, (uint64_t)(base + size));
+    if (start >= end) {
+      if (bank == 0 && seg.filesz)
+        printf("Cannot initialize address %lx, which doesn't fall into the L2 region.\n",
+               (unsigned long)seg.address);
+      continue;
+    }
+    for (uint64_t r = (start - base) / stride; r <= (end - base - 1) / stride && r < num_rows; r++) {
+      uint64_t row_address = base + r * stride + (uint64_t)bank * bank_bytes;
+      uint64_t lo = std::max(row_address, start);
+      uint64_t hi = std::min(row_address + bank_bytes, end);
+      if (lo >= hi)
+        continue;
+      if (rows) {
+        copy_segment(seg, lo, hi - lo, rows + r * bank_bytes + (lo - row_address));
+      } else {
+        // Keep the bytes of the row that the segment does not cover
+        svGetLogicArrElem1VecVal(vec.data(), mem, (int)r);
+        for (int i = 0; i < bank_bytes; i++)
+          row[i] = vec[i / 4].aval >> (8 * (i % 4));
+        copy_segment(seg, lo, hi - lo, row.data() + (lo - row_address));
+        for (int i = 0; i < bank_bytes; i++) {
+          if (i % 4 == 0)
+            vec[i / 4].aval = vec[i / 4].bval = 0;
+          vec[i / 4].aval |= (uint32_t)row[i] << (8 * (i % 4));
+        }
+        svPutLogicArrElem1VecVal(mem, vec.data(), (int)r);
+      }
+      written++;
+    }
+  }
+  return written;
+}
+
 extern "C" void read_elf(const char* filename) {
+  // Every L2 bank reads the same ELF
+  if (elf_buf && elf_name == filename)
+    return;
+  if (elf_buf)
+    munmap(elf_buf, elf_size);
+  sections.clear();
+  segments.clear();
+  symbols.clear();
+  section_index = 0;
+
   int fd = open(filename, O_RDONLY);
   struct stat s;
   assert(fd != -1);
@@ -216,16 +314,14 @@ extern "C" void read_elf(const char* filename) {
   char* buf = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
   assert(buf != MAP_FAILED);
   close(fd);
+  elf_name = filename;
+  elf_buf = buf;
+  elf_size = size;
 
   assert(size >= sizeof(Elf64_Ehdr));
   const Elf64_Ehdr* eh64 = (const Elf64_Ehdr*)buf;
   assert(IS_ELF32(*eh64) || IS_ELF64(*eh64));
 
-
-
-  std::vector<uint8_t> zeros;
-  std::map<std::string, uint64_t> symbols;
-
   #define LOAD_ELF(ehdr_t, phdr_t, shdr_t, sym_t) do { \
   ehdr_t* eh = (ehdr_t*)buf; \
   phdr_t* ph = (phdr_t*)(buf + eh->e_phoff); \
@@ -236,9 +332,9 @@ extern "C" void read_elf(const char* filename) {
     if (ph[i].p_filesz) { \
       assert(size >= ph[i].p_offset + ph[i].p_filesz); \
       sections.push_back(std::make_pair(ph[i].p_paddr, ph[i].p_memsz)); \
-      write(ph[i].p_paddr, ph[i].p_filesz, (uint8_t*)buf + ph[i].p_offset); \
     } \
-    zeros.resize(ph[i].p_memsz - ph[i].p_filesz); \
+    segments.push_back({ph[i].p_paddr, ph[i].p_memsz, ph[i].p_filesz, \
+                        (const uint8_t*)buf + ph[i].p_offset}); \
     } \
   } \
   shdr_t* sh = (shdr_t*)(buf + eh->e_shoff); \
@@ -251,7 +347,7 @@ extern "C" void read_elf(const char* filename) {
     unsigned max_len = sh[eh->e_shstrndx].sh_size - sh[i].sh_name; \
     if ((sh[i].sh_type & SHT_GROUP) && strcmp(shstrtab + sh[i].sh_name, ".strtab") != 0 && strcmp(shstrtab + sh[i].sh_name, ".shstrtab") != 0) \
     assert(strnlen(shstrtab + sh[i].sh_name, max_len) < max_len); \
-    if (sh[i].sh_type & SHT_PROGBITS) continue; \
+    if (sh[i].sh_type == SHT_PROGBITS) continue; \
     if (strcmp(shstrtab + sh[i].sh_name, ".strtab") == 0) \
       strtabidx = i; \
     if (strcmp(shstrtab + sh[i].sh_name, ".symtab") == 0) \
@@ -264,7 +360,7 @@ extern "C" void read_elf(const char* filename) {
       unsigned max_len = sh[strtabidx].sh_size - sym[i].st_name; \
       assert(sym[i].st_name < sh[strtabidx].  sh_size); \
       assert(strnlen(strtab + sym[i].st_name, max_len) < max_len); \
-      symbols[strtab + sym[i].st_name] = sym[i].st_value; \
+      symbols.push_back({strtab + sym[i].st_name, sym[i].st_value}); \
     } \
   } \
   } while(0)
@@ -274,5 +370,10 @@ extern "C" void read_elf(const char* filename) {
   else
     LOAD_ELF(Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Sym);
 
-  munmap(buf, size);
+  // Sort by name, and keep the first of several symbols with the same name
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const symbol_t& a, const symbol_t& b) { return strcmp(a.name, b.name) < 0; });
+  symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                            [](const symbol_t& a, const symbol_t& b) { return strcmp(a.name, b.name) == 0; }),
+                symbols.end());
 }
@@ -5,13 +5,12 @@
 // Author: Matheus Cavalcante, ETH Zurich
 
 // Includes
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <limits.h>
-#include <map>
-#include <mutex>
-#include <queue>
 #include <random>
 #include <stdint.h>
+#include <string>
 
 // Typedefs
 typedef uint32_t addr_t;
@@ -33,15 +32,6 @@ void probe_response(const core_id_t *core_id, const uint32_t *cycle,
 void print_histogram();
 }
 
-// Request probabilities
-#ifndef TG_REQ_PROB
-#define TG_REQ_PROB 0.2
-#endif
-
-#ifndef TG_SEQ_PROB
-#define TG_SEQ_PROB 0
-#endif
-
 // Number of cycles the simulation has ran
 #ifndef TG_NCYCLES
 #define TG_NCYCLES 10000
@@ -52,14 +42,107 @@ void print_histogram();
 #define NUM_CORES 256
 #endif
 
-// Randomizer
-std::random_device r;
-std::default_random_engine e1(r());
-std::uniform_int_distribution<addr_t> addr_dist(0, INT_MAX);
-std::uniform_real_distribution<float> real_dist(0, 1);
+// Number of transaction IDs per core
+#define TG_NUM_IDS 2048
+
+// Latencies are counted exactly up to this value. Longer ones share the
+// last bin of the histogram, but still count towards the average.
+#define TG_MAX_LATENCY 1024
+
+/*******************
+ *  Configuration  *
+ *******************/
 
-// Mutexes
-std::mutex g_mutex;
+// The traffic is configured at runtime through environment variables, so
+// that one model can be used for all patterns:
+//   TG_PATTERN       uniform: random words in the whole TCDM (default)
+//                    local:   like uniform, with TG_SEQ_PROB defaulting to 0.5
+//                    strided: core c requests c * 4 + k * TG_STRIDE in
+//                             its k-th request
+//                    hotspot: a request goes to TG_HOTSPOT_ADDR with
+//                             probability TG_HOTSPOT_PROB and to a random
+//                             word otherwise
+//   TG_REQ_PROB      Probability of a new request per cycle (default 0.2)
+//   TG_SEQ_PROB      Probability that a request of any pattern is moved to
+//                    the core's own tile (default 0, 0.5 for local)
+//   TG_STRIDE        See strided, in bytes (default 4)
+//   TG_HOTSPOT_PROB  See hotspot (default 0.5)
+//   TG_HOTSPOT_ADDR  See hotspot (default 0)
+//   TG_SEED          Seed of the random number generators (default: random)
+enum pattern_t { UNIFORM, LOCAL, STRIDED, HOTSPOT };
+
+struct config_t {
+  pattern_t pattern;
+  uint32_t req_threshold; // Probabilities scaled to 2^32
+  uint32_t seq_threshold;
+  uint32_t hotspot_threshold;
+  addr_t stride;
+  addr_t hotspot_addr;
+  bool seeded;
+  uint64_t seed;
+};
+
+static void config_error(const char *name, const char *value) {
+  std::cerr << "[traffic_generator] Invalid value for " << name << ": "
+            << value << std::endl;
+  std::exit(1);
+}
+
+static uint32_t env_probability(const char *name, double def) {
+  const char *value = std::getenv(name);
+  double prob = def;
+  if (value) {
+    char *end;
+    prob = std::strtod(value, &end);
+    if (!*value || *end || prob < 0 || prob > 1)
+      config_error(name, value);
+  }
+  // A probability of 1 saturates instead of wrapping around
+  return prob >= 1 ? UINT32_MAX : (uint32_t)(prob * 4294967296.0);
+}
+
+static uint64_t env_integer(const char *name, uint64_t def) {
+  const char *value = std::getenv(name);
+  if (!value)
+    return def;
+  char *end;
+  uint64_t result = std::strtoull(value, &end, 0);
+  if (!*value || *end)
+    config_error(name, value);
+  return result;
+}
+
+static config_t read_config() {
+  config_t config;
+
+  const char *pattern = std::getenv("TG_PATTERN");
+  if (!pattern || !std::strcmp(pattern, "uniform"))
+    config.pattern = UNIFORM;
+  else if (!std::strcmp(pattern, "local"))
+    config.pattern = LOCAL;
+  else if (!std::strcmp(pattern, "strided"))
+    config.pattern = STRIDED;
+  else if (!std::strcmp(pattern, "hotspot"))
+    config.pattern = HOTSPOT;
+  else
+    config_error("TG_PATTERN", pattern);
+
+  config.req_threshold = env_probability("TG_REQ_PROB", 0.2);
+  config.seq_threshold =
+      env_probability("TG_SEQ_PROB", config.pattern == LOCAL ? 0.5 : 0);
+  config.hotspot_threshold = env_probability("TG_HOTSPOT_PROB", 0.5);
+  config.stride = env_integer("TG_STRIDE", 4);
+  config.hotspot_addr = env_integer("TG_HOTSPOT_ADDR", 0);
+  config.seeded = std::getenv("TG_SEED") != nullptr;
+  config.seed = env_integer("TG_SEED", 0);
+  return config;
+}
+
+static const config_t config = read_config();
+
+/****************
+ *  Core state  *
+ ****************/
 
 // Request struct
 typedef struct {
@@ -67,61 +150,119 @@ typedef struct {
   req_id_t id;
 } request_t;
 
-// Map the starting cycle of each request
-std::map<std::pair<core_id_t, req_id_t>, uint32_t> starting_cycle;
-// Latency histogram
-std::map<uint32_t, uint32_t> latency_histogram;
-// Request queues
-std::map<core_id_t, std::queue<request_t>> requests;
+// State of a core's traffic generator. With a multi-threaded Verilator
+// model, the traffic generators of different cores are evaluated in
+// parallel, but each one only ever touches its own state. There is no
+// shared state, so the DPI functions need no locks. All queues are rings
+// of TG_NUM_IDS entries, which is as many requests as a core can have
+// outstanding, and everything that is tracked per request is indexed by
+// its ID.
+struct core_state_t {
+  // xorshift64* random number generator
+  uint64_t rng;
+  // Offset of the next request of the strided pattern
+  addr_t next_offset;
+
+  // Requests waiting to be accepted
+  request_t requests[TG_NUM_IDS];
+  uint32_t requests_head;
+  uint32_t requests_size;
+  // Free transaction IDs
+  req_id_t tran_id[TG_NUM_IDS];
+  uint32_t tran_id_head;
+  uint32_t tran_id_size;
+  // Starting cycle of each request
+  uint32_t starting_cycle[TG_NUM_IDS];
 
-// Transaction IDs
-uint32_t tran_id_initialized = 0;
-std::map<core_id_t, std::queue<req_id_t>> tran_id;
+  // Latency histogram
+  uint64_t latency_histogram[TG_MAX_LATENCY + 1];
+  uint64_t latency_sum;
+
+  uint32_t random() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (rng * 0x2545F4914F6CDD1DULL) >> 32;
+  }
+};
+
+static core_state_t *init_cores() {
+  std::random_device r;
+  core_state_t *cores = new core_state_t[NUM_CORES]();
+  for (uint32_t c = 0; c < NUM_CORES; c++) {
+    core_state_t &core = cores[c];
+    // Different, non-zero streams for every core
+    uint64_t seed = config.seeded ? config.seed : ((uint64_t)r() << 32 | r());
+    core.rng = (seed + c) * 0x9E3779B97F4A7C15ULL | 1;
+    core.next_offset = c * 4;
+    for (req_id_t id = 0; id < TG_NUM_IDS; id++)
+      core.tran_id[id] = id;
+    core.tran_id_size = TG_NUM_IDS;
+  }
+  return cores;
+}
+
+// Initialized before the simulation starts
+static core_state_t *const cores = init_cores();
+
+/*******************
+ *  DPI functions  *
+ *******************/
+
+static addr_t next_address(core_state_t &core, const addr_t tcdm_base_addr,
+                           const addr_t tcdm_mask, const addr_t tile_mask,
+                           const addr_t seq_mask) {
+  addr_t addr;
+  switch (config.pattern) {
+  case STRIDED:
+    addr = core.next_offset;
+    core.next_offset += config.stride;
+    break;
+  case HOTSPOT:
+    if (core.random() < config.hotspot_threshold)
+      addr = config.hotspot_addr;
+    else
+      addr = core.random() & INT32_MAX;
+    break;
+  default:
+    addr = core.random() & INT32_MAX;
+  }
+
+  // Make sure the request is in the TCDM region
+  addr = (addr & ~tcdm_mask) | (tcdm_base_addr & tcdm_mask);
+
+  // Should the request be in the sequential region?
+  if (config.seq_threshold && core.random() < config.seq_threshold)
+    addr = (addr & ~tile_mask) | (seq_mask & tile_mask);
+
+  // Address is aligned to 32 bits
+  return (addr >> 2) << 2;
+}
 
 extern "C" void create_request(const core_id_t *core_id, const uint32_t *cycle,
                                const addr_t *tcdm_base_addr,
                                const addr_t *tcdm_mask, const addr_t *tile_mask,
                                const addr_t *seq_mask, bool *req_valid,
                                req_id_t *req_id, addr_t *req_addr) {
-  // Lock the function
-  std::lock_guard<std::mutex> guard(g_mutex);
-
-  // Initialize the transaction ID queues
-  if (!tran_id_initialized) {
-    for (int c = 0; c < NUM_CORES; c++)
-      for (int id = 0; id < 2048; id++)
-        tran_id[c].push(id);
-    tran_id_initialized = 1;
-  }
+  core_state_t &core = cores[*core_id];
 
   // Generate new request
-  if (!tran_id[*core_id].empty()) {
-    if (real_dist(e1) < TG_REQ_PROB) {
-      // Generate new address
-      request_t next_request;
-
+  if (core.tran_id_size) {
+    if (core.random() < config.req_threshold) {
       // Transaction id
-      req_id_t req_id = tran_id[*core_id].front();
-      tran_id[*core_id].pop();
-
-      next_request.id = req_id;
-      next_request.addr = addr_dist(e1);
-      // Make sure the request is in the TCDM region
-      next_request.addr =
-          (next_request.addr & ~(*tcdm_mask)) | (*tcdm_base_addr & *tcdm_mask);
-
-      // Should the request be in the sequential region?
-      if (real_dist(e1) < TG_SEQ_PROB) {
-        next_request.addr =
-            (next_request.addr & ~(*tile_mask)) | (*seq_mask & *tile_mask);
-      }
-
-      // Address is aligned to 32 bits
-      next_request.addr = (next_request.addr >> 2) << 2;
+      req_id_t id = core.tran_id[core.tran_id_head];
+      core.tran_id_head = (core.tran_id_head + 1) % TG_NUM_IDS;
+      core.tran_id_size--;
 
       // Push the request
-      starting_cycle[std::make_pair(*core_id, req_id)] = *cycle;
-      requests[*core_id].push(next_request);
+      request_t &next_request =
+          core.requests[(core.requests_head + core.requests_size) %
+                        TG_NUM_IDS];
+      core.requests_size++;
+      next_request.id = id;
+      next_request.addr = next_address(core, *tcdm_base_addr, *tcdm_mask,
+                                       *tile_mask, *seq_mask);
+      core.starting_cycle[id % TG_NUM_IDS] = *cycle;
     }
   } else {
     std::cerr
@@ -130,10 +271,10 @@ extern "C" void create_request(const core_id_t *core_id, const uint32_t *cycle,
   }
 
   // Is there a request to be sent?
-  if (!requests[*core_id].empty()) {
+  if (core.requests_size) {
     *req_valid = true;
-    *req_id = requests[*core_id].front().id;
-    *req_addr = requests[*core_id].front().addr;
+    *req_id = core.requests[core.requests_head].id;
+    *req_addr = core.requests[core.requests_head].addr;
   } else {
     *req_valid = false;
     *req_id = 0;
@@ -144,39 +285,51 @@ extern "C" void create_request(const core_id_t *core_id, const uint32_t *cycle,
 extern "C" void probe_response(const core_id_t *core_id, const uint32_t *cycle,
                                const bool req_ready, const bool resp_valid,
                                const req_id_t *resp_id) {
-  // Lock the function
-  std::lock_guard<std::mutex> guard(g_mutex);
+  core_state_t &core = cores[*core_id];
 
   // Acknowledged request
-  if (req_ready && !requests[*core_id].empty()) {
+  if (req_ready && core.requests_size) {
     // Pop the request
-    requests[*core_id].pop();
+    core.requests_head = (core.requests_head + 1) % TG_NUM_IDS;
+    core.requests_size--;
   }
 
   // Acknowledged response
   if (resp_valid) {
     // Free the request ID
-    tran_id[*core_id].push(*resp_id);
+    if (core.tran_id_size < TG_NUM_IDS) {
+      core.tran_id[(core.tran_id_head + core.tran_id_size) % TG_NUM_IDS] =
+          *resp_id;
+      core.tran_id_size++;
+    }
 
     // Account for the latency
-    uint32_t latency =
-        *cycle - starting_cycle[std::make_pair(*core_id, *resp_id)];
-    if (latency_histogram.count(latency) != 0)
-      latency_histogram[latency]++;
-    else
-      latency_histogram[latency] = 1;
+    uint32_t latency = *cycle - core.starting_cycle[*resp_id % TG_NUM_IDS];
+    core.latency_histogram[latency < TG_MAX_LATENCY ? latency
+                                                    : TG_MAX_LATENCY]++;
+    core.latency_sum += latency;
   }
 }
 
 extern "C" void print_histogram() {
-  uint32_t latency = 0;
-  uint32_t tran_counter = 0;
+  uint64_t latency = 0;
+  uint64_t tran_counter = 0;
+
+  // Merge the histograms of all cores, now that the simulation is over
+  static uint64_t latency_histogram[TG_MAX_LATENCY + 1];
+  for (uint32_t c = 0; c < NUM_CORES; c++) {
+    for (uint32_t l = 0; l <= TG_MAX_LATENCY; l++)
+      latency_histogram[l] += cores[c].latency_histogram[l];
+    latency += cores[c].latency_sum;
+  }
 
   std::cout << "Latency\tCount" << std::endl;
-  for (const auto &it : latency_histogram) {
-    tran_counter += it.second;
-    latency += it.first * it.second;
-    std::cout << it.first << "\t" << it.second << std::endl;
+  for (uint32_t l = 0; l <= TG_MAX_LATENCY; l++) {
+    if (!latency_histogram[l])
+      continue;
+    tran_counter += latency_histogram[l];
+    std::cout << l << (l == TG_MAX_LATENCY ? "+" : "") << "\t"
+              << latency_histogram[l] << std::endl;
   }
 
   std::cout << "Average latency: " << (1.0 * latency) / tran_counter
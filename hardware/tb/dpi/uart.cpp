@@ -0,0 +1,201 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Host side of the per-core UART ports of the runtime. Above the shared port
+// at offset 0, every core has a word for the characters of its lines
+// (software/runtime/serial.c) and one for its binary log records
+// (software/runtime/log.h):
+//
+//   0x1000 + 4 * core_id   line port
+//   0x2000 + 4 * core_id   log port
+//
+// The testbench passes every byte written to these ports to `uart_write`,
+// which collects them per core and returns a line, with its newline, once it
+// is complete, and an empty string otherwise. Log records are formatted with
+// their format string from the `.log_fmt` section of the ELF, which
+// `uart_read_elf` reads.
+
+// Includes
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Bytes per port
+#define UART_PORT_SIZE 0x1000
+#define UART_LINE_PORT 1
+#define UART_LOG_PORT 2
+
+// Maximum number of arguments of a log record
+#define UART_LOG_MAX_ARGS 8
+
+// Function declarations
+extern "C" {
+void uart_read_elf(const char *filename);
+const char *uart_write(int offset, char data);
+}
+
+struct uart_core_t {
+  // Characters of the current line
+  std::string line;
+  // Word of the log port and how many of its bytes arrived
+  uint32_t word;
+  unsigned bytes;
+  // Words of the current log record
+  std::vector<uint32_t> record;
+};
+
+static std::vector<uart_core_t> cores;
+// Contents of the `.log_fmt` section
+static std::string formats;
+// Last line returned to the testbench
+static std::string output;
+
+extern "C" void uart_read_elf(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat s;
+  if (fstat(fd, &s) < 0 || (size_t)s.st_size < sizeof(Elf32_Ehdr)) {
+    close(fd);
+    return;
+  }
+  size_t size = s.st_size;
+  char *buf = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    return;
+  }
+  const Elf32_Ehdr *eh = (const Elf32_Ehdr *)buf;
+  const Elf32_Shdr *sh = (const Elf32_Shdr *)(buf + eh->e_shoff);
+  if (eh->e_ident[EI_CLASS] == ELFCLASS32 && eh->e_shstrndx < eh->e_shnum &&
+      eh->e_shoff + eh->e_shnum * sizeof(Elf32_Shdr) <= size) {
+    const char *shstrtab = buf + sh[eh->e_shstrndx].sh_offset;
+    for (unsigned i = 0; i < eh->e_shnum; ++i) {
+      if (strcmp(shstrtab + sh[i].sh_name, ".log_fmt") == 0 &&
+          sh[i].sh_offset + sh[i].sh_size <= size) {
+        formats.assign(buf + sh[i].sh_offset, sh[i].sh_size);
+        formats.push_back('\0');
+      }
+    }
+  }
+  munmap(buf, size);
+}
+
+// Format a log record like printf does, with 32-bit integer arguments
+static std::string uart_format(const char *fmt, const uint32_t *args,
+                               size_t nargs) {
+  std::string out;
+  size_t arg = 0;
+  char buf[64];
+  for (const char *p = fmt; *p; ++p) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    }
+    // Keep flags, width and precision, and drop length modifiers
+    std::string spec = "%";
+    const char *q = p + 1;
+    while (*q && strchr("-+ #0123456789.", *q)) {
+      spec += *q++;
+    }
+    while (*q && strchr("hlLjzt", *q)) {
+      q++;
+    }
+    if (!*q) {
+      break;
+    }
+    p = q;
+    if (*q == '%') {
+      out += '%';
+      continue;
+    }
+    uint32_t value = arg < nargs ? args[arg++] : 0;
+    switch (*q) {
+    case 'd':
+    case 'i':
+      snprintf(buf, sizeof(buf), (spec + 'd').c_str(), (int32_t)value);
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+      snprintf(buf, sizeof(buf), (spec + *q).c_str(), value);
+      break;
+    case 'p':
+      snprintf(buf, sizeof(buf), "0x%08x", value);
+      break;
+    default:
+      // Strings and floats do not fit into a word
+      snprintf(buf, sizeof(buf), "<%%%c 0x%08x>", *q, value);
+    }
+    out += buf;
+  }
+  // Every record is a line of its own
+  if (!out.empty() && out.back() == '\n') {
+    out.pop_back();
+  }
+  return out;
+}
+
+static void uart_log_word(uart_core_t &core, uint32_t word) {
+  core.record.push_back(word);
+  uint32_t nargs = core.record[0] >> 24;
+  uint32_t offset = core.record[0] & 0xFFFFFF;
+  if (nargs > UART_LOG_MAX_ARGS) {
+    // Not a header, drop it
+    core.record.clear();
+    return;
+  }
+  if (core.record.size() < 1 + nargs) {
+    return;
+  }
+  if (offset < formats.size()) {
+    output = uart_format(formats.c_str() + offset, core.record.data() + 1,
+                         nargs);
+  } else {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "<unknown log format 0x%06x>", offset);
+    output = buf;
+  }
+  output += '\n';
+  core.record.clear();
+}
+
+extern "C" const char *uart_write(int offset, char data) {
+  unsigned port = offset / UART_PORT_SIZE;
+  unsigned core_id = offset % UART_PORT_SIZE / 4;
+  if (core_id >= cores.size()) {
+    cores.resize(core_id + 1);
+  }
+  uart_core_t &core = cores[core_id];
+  output.clear();
+  if (port == UART_LINE_PORT) {
+    if (data == '\n') {
+      output.swap(core.line);
+      output += '\n';
+    } else {
+      core.line += data;
+    }
+  } else if (port == UART_LOG_PORT) {
+    // The bytes of a word arrive in order
+    if (core.bytes == 0) {
+      core.word = 0;
+    }
+    core.word |= (uint32_t)(uint8_t)data << (8 * (offset % 4));
+    if (++core.bytes == 4) {
+      core.bytes = 0;
+      uart_log_word(core, core.word);
+    }
+  }
+  return output.c_str();
+}
@@ -308,6 +308,13 @@ module mempool_tb;
    *  L2 Initialization  *
    ***********************/
 
+  // Writes the ELF's part of L2 right into a bank, see tb/dpi/elfloader.cpp
+  import "DPI-C" context function int preload_l2_bank(input int bank, input int num_banks,
+    input int bank_bytes, input longint base, input longint size,
+    inout logic [L2BankWidth-1:0] mem []);
+
+  // The banks are filled section by section, unless +L2_DPI_PRELOAD selects
+  // preload_l2_bank
   for (genvar bank = 0; bank < NumL2Banks; bank++) begin : gen_l2_banks_init
     initial begin : l2_init
       automatic logic [L2BankWidth-1:0] mem_row;
@@ -319,25 +326,32 @@ module mempool_tb;
       // Initialize memories
       void'($value$plusargs("PRELOAD=%s", binary));
       if (binary != "") begin
-        // Read ELF
+        // Read ELF, which all banks share
         read_elf(binary);
-        $display("Loading %s", binary);
-        while (get_section(address, length)) begin
-          // Read sections
-          automatic int nwords = (length + L2BeWidth - 1)/L2BeWidth;
-          $display("Loading section %x of length %x", address, length);
-          buffer = new[nwords * L2BeWidth];
-          void'(read_section(address, buffer));
-          // Initializing memories
-          for (int w = 0; w < nwords; w++) begin
-            mem_row = '0;
-            for (int b = 0; b < L2BankBeWidth; b++) begin
-              mem_row[8 * b +: 8] = buffer[(bank + w * NumL2Banks) * L2BankBeWidth + b];
-            end
-            if (address >= dut.L2MemoryBaseAddr && address < dut.L2MemoryEndAddr) begin
-              dut.gen_l2_banks[bank].l2_mem.init_val[(address - dut.L2MemoryBaseAddr + (w << L2ByteOffset)) >> L2ByteOffset] = mem_row;
-            end else begin
-              $display("Cannot initialize address %x, which doesn't fall into the L2 region.", address);
+        if ($test$plusargs("L2_DPI_PRELOAD")) begin
+          if (bank == 0)
+            $display("Loading %s", binary);
+          void'(preload_l2_bank(bank, NumL2Banks, L2BankBeWidth, dut.L2MemoryBaseAddr, L2Size,
+              dut.gen_l2_banks[bank].l2_mem.init_val));
+        end else begin
+          $display("Loading %s", binary);
+          while (get_section(address, length)) begin
+            // Read sections
+            automatic int nwords = (length + L2BeWidth - 1)/L2BeWidth;
+            $display("Loading section %x of length %x", address, length);
+            buffer = new[nwords * L2BeWidth];
+            void'(read_section(address, buffer));
+            // Initializing memories
+            for (int w = 0; w < nwords; w++) begin
+              mem_row = '0;
+              for (int b = 0; b < L2BankBeWidth; b++) begin
+                mem_row[8 * b +: 8] = buffer[(bank + w * NumL2Banks) * L2BankBeWidth + b];
+              end
+              if (address >= dut.L2MemoryBaseAddr && address < dut.L2MemoryEndAddr) begin
+                dut.gen_l2_banks[bank].l2_mem.init_val[(address - dut.L2MemoryBaseAddr + (w << L2ByteOffset)) >> L2ByteOffset] = mem_row;
+              end else begin
+                $display("Cannot initialize address %x, which doesn't fall into the L2 region.", address);
+              end
             end
           end
         end
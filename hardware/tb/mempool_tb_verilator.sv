@@ -95,6 +95,30 @@ module mempool_tb_verilator (
 
   // TODO: Add XBAR and infinite host memory?
 
+  /***********************
+   *  L2 Initialization  *
+   ***********************/
+
+  // Writes the ELF's part of L2 right into a bank, see tb/dpi/elfloader.cpp
+  import "DPI-C" function void read_elf (input string filename);
+  import "DPI-C" context function int preload_l2_bank(input int bank, input int num_banks,
+    input int bank_bytes, input longint base, input longint size,
+    inout logic [L2BankWidth-1:0] mem []);
+
+  // The banks of tc_sram ignore init_val under Verilator, so with
+  // +L2_DPI_PRELOAD the ELF goes straight into their arrays. Otherwise
+  // --meminit loads L2.
+  for (genvar bank = 0; bank < NumL2Banks; bank++) begin : gen_l2_banks_init
+    initial begin : l2_init
+      string binary;
+      if ($test$plusargs("L2_DPI_PRELOAD") && $value$plusargs("PRELOAD=%s", binary)) begin
+        read_elf(binary);
+        void'(preload_l2_bank(bank, NumL2Banks, L2BankBeWidth, dut.L2MemoryBaseAddr, L2Size,
+            dut.gen_l2_banks[bank].l2_mem.sram));
+      end
+    end : l2_init
+  end : gen_l2_banks_init
+
   /*********
    *  EOC  *
    *********/
@@ -0,0 +1 @@
+../../../dpi/elfloader.cpp
\ No newline at end of file
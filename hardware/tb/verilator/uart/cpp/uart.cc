@@ -0,0 +1 @@
+../../../dpi/uart.cpp
\ No newline at end of file
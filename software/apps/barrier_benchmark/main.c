@@ -0,0 +1,109 @@
+// Copyright 2021 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Measure the cycles per barrier of the central, logarithmic and tree
+// barriers. Build it with config=minpool, mempool or terapool to compare
+// the topologies.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "encoding.h"
+#include "printf.h"
+#include "runtime.h"
+#include "synchronization.h"
+
+// Number of barriers per measurement
+#ifndef REPETITIONS
+#define REPETITIONS 16
+#endif
+
+// Cycles of independent work that the split tree barrier overlaps
+#ifndef WORK
+#define WORK 64
+#endif
+
+typedef enum {
+  CENTRAL,
+  LOG,
+  TREE_TILE,
+  TREE_GROUP,
+  TREE,
+  TREE_WORK,
+  TREE_SPLIT_WORK,
+  NUM_BENCHMARKS
+} benchmark_t;
+
+static const char *const benchmark_names[NUM_BENCHMARKS] = {
+    "mempool_barrier",        "mempool_log_barrier",
+    "tree barrier (tile)",    "tree barrier (group)",
+    "tree barrier (cluster)", "tree barrier + work",
+    "tree arrive/work/wait"};
+
+static void run(benchmark_t benchmark, uint32_t core_id) {
+  switch (benchmark) {
+  case CENTRAL:
+    mempool_barrier(NUM_CORES);
+    break;
+  case LOG:
+    mempool_log_barrier(2, core_id);
+    break;
+  case TREE_TILE:
+    mempool_tree_barrier_arrive(core_id, MEMPOOL_SCOPE_TILE);
+    mempool_tree_barrier_wait();
+    break;
+  case TREE_GROUP:
+    mempool_tree_barrier_arrive(core_id, MEMPOOL_SCOPE_GROUP);
+    mempool_tree_barrier_wait();
+    break;
+  case TREE:
+    mempool_tree_barrier(core_id);
+    break;
+  case TREE_WORK:
+    mempool_tree_barrier(core_id);
+    mempool_wait(WORK);
+    break;
+  case TREE_SPLIT_WORK:
+    mempool_tree_barrier_arrive(core_id, MEMPOOL_SCOPE_CLUSTER);
+    mempool_wait(WORK);
+    mempool_tree_barrier_wait();
+    break;
+  default:
+    break;
+  }
+}
+
+int main() {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t cycles[NUM_BENCHMARKS];
+
+  mempool_barrier_init(core_id);
+
+  for (uint32_t b = 0; b < NUM_BENCHMARKS; b++) {
+    // Start all cores together, and warm up the instruction cache
+    run((benchmark_t)b, core_id);
+    mempool_barrier(NUM_CORES);
+
+    mempool_start_benchmark();
+    mempool_timer_t time = mempool_get_timer();
+    for (uint32_t i = 0; i < REPETITIONS; i++) {
+      run((benchmark_t)b, core_id);
+    }
+    time = mempool_get_timer() - time;
+    mempool_stop_benchmark();
+    cycles[b] = time / REPETITIONS;
+    mempool_barrier(NUM_CORES);
+  }
+
+  if (core_id == 0) {
+    printf("Barrier cycles on %d cores (%d groups, %d cores per tile):\n",
+           NUM_CORES, NUM_GROUPS, NUM_CORES_PER_TILE);
+    for (uint32_t b = 0; b < NUM_BENCHMARKS; b++) {
+      printf("%-24s %6d\n", benchmark_names[b], cycles[b]);
+    }
+  }
+
+  mempool_barrier(NUM_CORES);
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "encoding.h"
+#include "log.h"
 #include "printf.h"
 #include "runtime.h"
 #include "synchronization.h"
@@ -23,6 +24,7 @@ int main() {
   }
 
   printf("Core %3d says Hello!\n", core_id);
+  mempool_log("Core %3d logs Hello! (%d cores)", core_id, num_cores);
   wake_up(core_id + 1);
 
   // wait until all cores have finished
@@ -7,6 +7,9 @@
 #include <stdint.h>
 #include <string.h>
 
+// Give a quarter of the interleaved heap to local_malloc
+#define ALLOC_LOCAL_FRACTION 4
+
 #include "alloc.h"
 #include "encoding.h"
 #include "printf.h"
@@ -16,6 +19,93 @@
 #define ARRAY_SIZE 16
 #define OTHER_ARRAY_SIZE 32
 
+// Contention benchmark: every core allocates and frees NUM_BLOCKS blocks of
+// BLOCK_SIZE bytes ROUNDS times, all cores at the same time
+#define NUM_BLOCKS 8
+#define BLOCK_SIZE 24
+#define ROUNDS 4
+
+typedef void *(*malloc_fn_t)(const uint32_t size);
+typedef void (*free_fn_t)(void *const ptr);
+
+// Results of all cores
+uint32_t volatile total_cycles __attribute__((section(".l2"))) = 0;
+uint32_t volatile total_errors __attribute__((section(".l2"))) = 0;
+uint32_t volatile total_remote __attribute__((section(".l2"))) = 0;
+
+// Tile whose banks hold an address of the interleaved region
+static inline uint32_t tile_of(const void *ptr) {
+  return (uint32_t)ptr / (NUM_CORES_PER_TILE * BANKING_FACTOR * 4) %
+         (NUM_CORES / NUM_CORES_PER_TILE);
+}
+
+void benchmark(const char *name, malloc_fn_t malloc_fn, free_fn_t free_fn,
+               uint32_t core_id, uint32_t num_cores) {
+  uint32_t *blocks[NUM_BLOCKS];
+  uint32_t errors = 0;
+  uint32_t remote = 0;
+
+  if (core_id == 0) {
+    total_cycles = 0;
+    total_errors = 0;
+    total_remote = 0;
+  }
+  mempool_barrier(num_cores);
+
+  // Measure malloc and free under contention
+  mempool_start_benchmark();
+  mempool_timer_t cycles = mempool_get_timer();
+  for (uint32_t r = 0; r < ROUNDS; ++r) {
+    for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+      blocks[i] = (uint32_t *)malloc_fn(BLOCK_SIZE);
+    }
+    for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+      free_fn(blocks[i]);
+    }
+  }
+  cycles = mempool_get_timer() - cycles;
+  mempool_stop_benchmark();
+
+  // Check that no two cores got the same memory, and where the blocks are
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    blocks[i] = (uint32_t *)malloc_fn(BLOCK_SIZE);
+    if (!blocks[i]) {
+      errors++;
+      continue;
+    }
+    for (uint32_t j = 0; j < BLOCK_SIZE / sizeof(uint32_t); ++j) {
+      blocks[i][j] = core_id;
+    }
+    if (tile_of(blocks[i]) != core_id / NUM_CORES_PER_TILE) {
+      remote++;
+    }
+  }
+  mempool_barrier(num_cores);
+  for (uint32_t i = 0; i < NUM_BLOCKS; ++i) {
+    if (!blocks[i]) {
+      continue;
+    }
+    for (uint32_t j = 0; j < BLOCK_SIZE / sizeof(uint32_t); ++j) {
+      if (blocks[i][j] != core_id) {
+        errors++;
+      }
+    }
+    free_fn(blocks[i]);
+  }
+
+  __atomic_fetch_add(&total_cycles, cycles, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total_errors, errors, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&total_remote, remote, __ATOMIC_RELAXED);
+  mempool_barrier(num_cores);
+
+  if (core_id == 0) {
+    printf("%s: %d cycles per malloc and free, %d errors, %d/%d blocks in "
+           "other tiles\n",
+           name, total_cycles / (num_cores * ROUNDS * NUM_BLOCKS), total_errors,
+           total_remote, num_cores * NUM_BLOCKS);
+  }
+}
+
 int main() {
   uint32_t core_id = mempool_get_core_id();
   uint32_t num_cores = mempool_get_core_count();
@@ -162,6 +252,14 @@ int main() {
     }
   }
 
+  mempool_barrier(num_cores);
+
+  // --------------------------------------------------------------------------
+  // Contention Benchmark
+  // --------------------------------------------------------------------------
+  benchmark("simple_malloc", simple_malloc, simple_free, core_id, num_cores);
+  benchmark("local_malloc", local_malloc, local_free, core_id, num_cores);
+
   // wait until all cores have finished
   mempool_barrier(num_cores);
   return 0;
@@ -0,0 +1,216 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Matrix multiplication on matrices in L2 that do not fit into L1. B stays in
+// L1, while the rows of A and C stream through ping-pong buffers in L1. Core 0
+// drives the DMA: it fetches the next tile of A and stores the last tile of C
+// while all cores compute on the current tile.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "dma_stream.h"
+#include "encoding.h"
+#include "printf.h"
+#include "runtime.h"
+#include "synchronization.h"
+#include "xpulp/mat_mul.h"
+
+// Define Matrix dimensions:
+// C = AB with A=[MxN], B=[NxP], C=[MxP]
+#define matrix_N 32
+#define matrix_P 64
+
+// Rows that the kernel spreads over all cores
+#define CHUNK_M (NUM_CORES / 4)
+// Rows of A and C per tile
+#ifndef TILE_M
+#define TILE_M (NUM_CORES)
+#endif
+// By default, A and C fill half of L2, which is twice the L1 of MemPool
+#ifndef matrix_M
+#define matrix_M                                                               \
+  ((L2_SIZE / 2) / ((matrix_N + matrix_P) * 4) / TILE_M * TILE_M)
+#endif
+
+#define NUM_TILES (matrix_M / TILE_M)
+
+int32_t matrix_b[matrix_N * matrix_P] __attribute__((section(".l1_prio")));
+int32_t tile_a[2][TILE_M * matrix_N] __attribute__((section(".l1_prio")));
+int32_t tile_c[2][TILE_M * matrix_P] __attribute__((section(".l1_prio")));
+
+dma_stream_t stream __attribute__((section(".l1")));
+dma_tiles_t tiles_a __attribute__((section(".l1")));
+dma_tiles_t tiles_c __attribute__((section(".l1")));
+
+int volatile error __attribute__((section(".l1")));
+
+// A and C live in the free L2 after the program
+extern int32_t __l2_alloc_base;
+
+void init_matrix(int32_t *matrix, uint32_t num_rows, uint32_t num_columns,
+                 int32_t a, int32_t b, int32_t c, uint32_t core_id,
+                 uint32_t num_cores) {
+  uint32_t const split = 8; // How many rows/columns to split the matrix into
+  if (num_columns > num_rows) {
+    // Parallelize over columns
+    uint32_t const c_start = (num_rows / split) * (core_id % split);
+    uint32_t const c_end = (num_rows / split) * ((core_id % split) + 1);
+    for (uint32_t j = (core_id / split); j < num_columns;
+         j += (num_cores / split)) {
+      for (uint32_t i = c_start; i < c_end; ++i) {
+        matrix[i * num_columns + j] = a * (int32_t)i + b * (int32_t)j + c;
+      }
+    }
+  } else {
+    // Parallelize over rows
+    uint32_t const c_start = (num_columns / split) * (core_id % split);
+    uint32_t const c_end = (num_columns / split) * ((core_id % split) + 1);
+    for (uint32_t i = (core_id / split); i < num_rows;
+         i += (num_cores / split)) {
+      for (uint32_t j = c_start; j < c_end; ++j) {
+        matrix[i * num_columns + j] = a * (int32_t)i + b * (int32_t)j + c;
+      }
+    }
+  }
+}
+
+int verify_matrix(int32_t *matrix, uint32_t num_rows, uint32_t num_columns,
+                  uint32_t inner_dim, int32_t aa, int32_t ab, int32_t ac,
+                  int32_t ba, int32_t bb, int32_t bc, uint32_t core_id,
+                  uint32_t num_cores) {
+  // Convert to signed
+  int32_t n = (int32_t)inner_dim;
+  // Parallelize over rows
+  for (uint32_t i = core_id; i < num_rows; i += num_cores) {
+    for (uint32_t j = 0; j < num_columns; ++j) {
+      int32_t ii = (int32_t)i;
+      int32_t jj = (int32_t)j;
+      int32_t lin =
+          (aa * bb * ii * jj + aa * bc * ii + ac * bb * jj + ac * bc) * n;
+      int32_t qua =
+          ((aa * ba * ii + ab * bb * jj + ab * bc + ba * ac) * (n * (n - 1))) /
+          2;
+      int32_t cub = ((ab * ba) * (n * (n - 1) * (2 * n - 1))) / 6;
+      int32_t golden = lin + qua + cub;
+      if (matrix[i * num_columns + j] != golden) {
+        return (i + j) == 0 ? -1 : (int)(i * num_columns + j);
+      }
+      matrix[i * num_columns + j] = 0;
+    }
+  }
+  return 0;
+}
+
+/* Multiply the tiles of A with B into the tiles of C, while core 0 streams
+   them from and to L2 */
+void matmul_stream(int32_t *A, int32_t *B, int32_t *C, uint32_t core_id,
+                   uint32_t num_cores) {
+  if (core_id == 0) {
+    dma_stream_init(&stream);
+    dma_tiles_init(&tiles_a, A, tile_a[0], tile_a[1],
+                   TILE_M * matrix_N * sizeof(int32_t), 1, 0,
+                   TILE_M * matrix_N * sizeof(int32_t), NUM_TILES);
+    dma_tiles_init(&tiles_c, C, tile_c[0], tile_c[1],
+                   TILE_M * matrix_P * sizeof(int32_t), 1, 0,
+                   TILE_M * matrix_P * sizeof(int32_t), NUM_TILES);
+    dma_tiles_fetch(&tiles_a, &stream, 0);
+  }
+  for (uint32_t t = 0; t < NUM_TILES; ++t) {
+    if (core_id == 0) {
+      // Wait for this tile of A and for the buffer of C to be free again
+      dma_tiles_wait(&tiles_a, &stream, t);
+      dma_tiles_wait(&tiles_c, &stream, t);
+      // The other buffer of A was done with at the end of the last tile
+      dma_tiles_fetch(&tiles_a, &stream, t + 1);
+    }
+    mempool_barrier(num_cores);
+    int32_t *a = dma_tiles_buffer(&tiles_a, t);
+    int32_t *c = dma_tiles_buffer(&tiles_c, t);
+    for (uint32_t i = 0; i < TILE_M; i += CHUNK_M) {
+#ifdef __XPULPIMG
+      matmul_unrolled_2x2_parallel_i32_xpulpv2(a + i * matrix_N, B,
+                                               c + i * matrix_P, CHUNK_M,
+                                               matrix_N, matrix_P, core_id,
+                                               num_cores);
+#else
+      matmul_unrolled_2x2_parallel_i32_rv32im(a + i * matrix_N, B,
+                                              c + i * matrix_P, CHUNK_M,
+                                              matrix_N, matrix_P, core_id,
+                                              num_cores);
+#endif
+      if (core_id == 0) {
+        // Launch the next transfer if the last one is done
+        dma_stream_progress(&stream);
+      }
+    }
+    mempool_barrier(num_cores);
+    if (core_id == 0) {
+      dma_tiles_store(&tiles_c, &stream, t);
+    }
+  }
+  if (core_id == 0) {
+    dma_stream_flush(&stream);
+  }
+}
+
+int main() {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t num_cores = mempool_get_core_count();
+  int32_t *matrix_a = &__l2_alloc_base;
+  int32_t *matrix_c = matrix_a + matrix_M * matrix_N;
+  int32_t const A_a = 1;
+  int32_t const A_b = 1;
+  int32_t const A_c = -32;
+  int32_t const B_a = 2;
+  int32_t const B_b = 1;
+  int32_t const B_c = 16;
+  // Initialize barrier and synchronize
+  mempool_barrier_init(core_id);
+
+  if (core_id == 0) {
+    error = 0;
+    if ((uint32_t)(matrix_c + matrix_M * matrix_P) > L2_BASE + L2_SIZE) {
+      printf("Matrices of %d rows do not fit into L2\n", matrix_M);
+      error = 1;
+    }
+  }
+  mempool_barrier(num_cores);
+  if (error) {
+    return error;
+  }
+
+  // Initialize Matrices
+  init_matrix(matrix_a, matrix_M, matrix_N, A_a, A_b, A_c, core_id, num_cores);
+  init_matrix(matrix_b, matrix_N, matrix_P, B_a, B_b, B_c, core_id, num_cores);
+  // Wait at barrier until everyone is ready
+  mempool_barrier(num_cores);
+
+  mempool_start_benchmark();
+  mempool_timer_t time = mempool_get_timer();
+  matmul_stream(matrix_a, matrix_b, matrix_c, core_id, num_cores);
+  time = mempool_get_timer() - time;
+  mempool_stop_benchmark();
+
+  if (core_id == 0) {
+    uint32_t bytes = matrix_M * (matrix_N + matrix_P) * sizeof(int32_t);
+    uint32_t macs = matrix_M * matrix_N * matrix_P;
+    printf("%dx%dx%d in %d tiles of %d rows: %d cycles\n", matrix_M, matrix_N,
+           matrix_P, NUM_TILES, TILE_M, time);
+    printf("Streamed %d bytes, %d.%02d bytes/cycle, %d.%02d MACs/cycle\n",
+           bytes, bytes / time, bytes % time * 100 / time, macs / time,
+           macs % time * 100 / time);
+  }
+
+  // Wait at barrier befor checking
+  mempool_barrier(num_cores);
+  if (verify_matrix(matrix_c, matrix_M, matrix_P, matrix_N, A_a, A_b, A_c, B_a,
+                    B_b, B_c, core_id, num_cores)) {
+    error = 1;
+  }
+  // wait until all cores have finished
+  mempool_barrier(num_cores);
+
+  return error;
+}
@@ -0,0 +1,276 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Throughput of the L1 queues. Every even core produces and the next core
+// consumes, either through a queue per pair (SPSC) or through a single queue
+// that all cores share (MPMC). The systolic queue serves as a baseline.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "encoding.h"
+#include "printf.h"
+#include "queue.h"
+#include "runtime.h"
+#include "synchronization.h"
+#include "systolic/queue.h"
+
+// Elements that every producer pushes
+#ifndef NUM_ELEMENTS
+#define NUM_ELEMENTS 256
+#endif
+#define QUEUE_ENTRIES 16
+#define BATCH 8
+
+typedef struct {
+  int32_t value;
+  int32_t square;
+  int16_t core;
+  int16_t index;
+  int32_t check;
+} payload_t;
+
+typedef enum {
+  SYSTOLIC,
+  SPSC,
+  SPSC_BATCH,
+  SPSC_WFI,
+  MPMC,
+  MPMC_BATCH,
+  MPMC_WFI,
+  MPMC_INT16,
+  MPMC_STRUCT,
+  NUM_TESTS
+} test_t;
+
+static const char *test_names[NUM_TESTS] = {
+    "systolic",   "spsc",     "spsc batch", "spsc wfi",   "mpmc",
+    "mpmc batch", "mpmc wfi", "mpmc int16", "mpmc struct"};
+
+queue_t *systolic_queues[NUM_CORES / 2] __attribute__((section(".l1")));
+spsc_queue_t *spsc_queues[NUM_CORES / 2] __attribute__((section(".l1")));
+mpmc_queue_t *mpmc_queue __attribute__((section(".l1")));
+
+int32_t volatile pushed_sum __attribute__((section(".l1")));
+int32_t volatile popped_sum __attribute__((section(".l1")));
+int volatile error __attribute__((section(".l1")));
+
+static inline int32_t element(uint32_t core_id, uint32_t i) {
+  return (int32_t)(core_id * NUM_ELEMENTS + i);
+}
+
+/* Set up the queues of a test. The producers create the queues of their pair
+   in their own tile. */
+void setup(test_t test, uint32_t core_id) {
+  uint32_t pair = core_id / 2;
+  alloc_t *alloc = get_alloc_tile(core_id / NUM_CORES_PER_TILE);
+  if (core_id % 2 == 0) {
+    switch (test) {
+    case SYSTOLIC:
+      queue_domain_create(alloc, &systolic_queues[pair], QUEUE_ENTRIES);
+      break;
+    case SPSC:
+    case SPSC_BATCH:
+    case SPSC_WFI:
+      spsc_queue_domain_create(alloc, &spsc_queues[pair], QUEUE_ENTRIES,
+                               sizeof(int32_t), test == SPSC_WFI);
+      break;
+    default:
+      break;
+    }
+  }
+  if (core_id == 0) {
+    pushed_sum = 0;
+    popped_sum = 0;
+    switch (test) {
+    case MPMC:
+    case MPMC_BATCH:
+    case MPMC_WFI:
+      mpmc_queue_create(&mpmc_queue, QUEUE_ENTRIES * NUM_CORES / 2,
+                        sizeof(int32_t), test == MPMC_WFI);
+      break;
+    case MPMC_INT16:
+      mpmc_queue_create(&mpmc_queue, QUEUE_ENTRIES * NUM_CORES / 2,
+                        sizeof(int16_t), 0);
+      break;
+    case MPMC_STRUCT:
+      mpmc_queue_create(&mpmc_queue, QUEUE_ENTRIES * NUM_CORES / 2,
+                        sizeof(payload_t), 0);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void teardown(test_t test, uint32_t core_id) {
+  uint32_t pair = core_id / 2;
+  alloc_t *alloc = get_alloc_tile(core_id / NUM_CORES_PER_TILE);
+  if (core_id % 2 == 0) {
+    if (test == SYSTOLIC) {
+      queue_domain_destroy(alloc, systolic_queues[pair]);
+    } else if (test <= SPSC_WFI) {
+      spsc_queue_domain_destroy(alloc, spsc_queues[pair]);
+    }
+  }
+  if (core_id == 0 && test >= MPMC) {
+    mpmc_queue_destroy(mpmc_queue);
+  }
+}
+
+/* Push all elements of a producer, and return their checksum */
+int32_t produce(test_t test, uint32_t core_id) {
+  uint32_t pair = core_id / 2;
+  int32_t sum = 0;
+  int32_t batch[BATCH];
+  for (uint32_t i = 0; i < NUM_ELEMENTS; ++i) {
+    int32_t data = element(core_id, i);
+    sum += data;
+    switch (test) {
+    case SYSTOLIC:
+      blocking_queue_push(systolic_queues[pair], &data);
+      break;
+    case SPSC:
+    case SPSC_WFI:
+      blocking_spsc_queue_push(spsc_queues[pair], &data);
+      break;
+    case MPMC:
+    case MPMC_WFI:
+      blocking_mpmc_queue_push(mpmc_queue, &data);
+      break;
+    case SPSC_BATCH:
+    case MPMC_BATCH:
+      batch[i % BATCH] = data;
+      if (i % BATCH == BATCH - 1) {
+        if (test == SPSC_BATCH) {
+          blocking_spsc_queue_push_n(spsc_queues[pair], batch, BATCH);
+        } else {
+          blocking_mpmc_queue_push_n(mpmc_queue, batch, BATCH);
+        }
+      }
+      break;
+    case MPMC_INT16: {
+      int16_t half = (int16_t)data;
+      sum += half - data;
+      blocking_mpmc_queue_push(mpmc_queue, &half);
+      break;
+    }
+    case MPMC_STRUCT: {
+      payload_t payload = {data, data * data, (int16_t)core_id, (int16_t)i,
+                           data ^ 0x5a5a5a5a};
+      blocking_mpmc_queue_push(mpmc_queue, &payload);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  return sum;
+}
+
+/* Pop as many elements as a producer pushes, and return their checksum */
+int32_t consume(test_t test, uint32_t core_id) {
+  uint32_t pair = core_id / 2;
+  int32_t sum = 0;
+  int32_t batch[BATCH];
+  for (uint32_t i = 0; i < NUM_ELEMENTS; ++i) {
+    int32_t data = 0;
+    switch (test) {
+    case SYSTOLIC:
+      blocking_queue_pop(systolic_queues[pair], &data);
+      break;
+    case SPSC:
+    case SPSC_WFI:
+      blocking_spsc_queue_pop(spsc_queues[pair], &data);
+      break;
+    case MPMC:
+    case MPMC_WFI:
+      blocking_mpmc_queue_pop(mpmc_queue, &data);
+      break;
+    case SPSC_BATCH:
+    case MPMC_BATCH:
+      if (i % BATCH == 0) {
+        if (test == SPSC_BATCH) {
+          blocking_spsc_queue_pop_n(spsc_queues[pair], batch, BATCH);
+        } else {
+          blocking_mpmc_queue_pop_n(mpmc_queue, batch, BATCH);
+        }
+      }
+      data = batch[i % BATCH];
+      break;
+    case MPMC_INT16: {
+      int16_t half;
+      blocking_mpmc_queue_pop(mpmc_queue, &half);
+      data = half;
+      break;
+    }
+    case MPMC_STRUCT: {
+      payload_t payload;
+      blocking_mpmc_queue_pop(mpmc_queue, &payload);
+      data = payload.value;
+      if (payload.square != data * data ||
+          payload.check != (data ^ 0x5a5a5a5a) ||
+          element((uint32_t)payload.core, (uint32_t)payload.index) != data) {
+        error = 1;
+      }
+      break;
+    }
+    default:
+      break;
+    }
+    sum += data;
+  }
+  return sum;
+}
+
+int main() {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t num_cores = mempool_get_core_count();
+
+  // Initialize synchronization variables
+  mempool_barrier_init(core_id);
+
+  // Initialization
+  mempool_init(core_id);
+  if (core_id == 0) {
+    error = 0;
+  }
+
+  // Wait for all cores
+  mempool_barrier(num_cores);
+
+  for (test_t test = SYSTOLIC; test < NUM_TESTS; ++test) {
+    setup(test, core_id);
+    mempool_barrier(num_cores);
+
+    mempool_start_benchmark();
+    mempool_timer_t time = mempool_get_timer();
+    if (core_id % 2 == 0) {
+      int32_t sum = produce(test, core_id);
+      __atomic_add_fetch(&pushed_sum, sum, __ATOMIC_SEQ_CST);
+    } else {
+      int32_t sum = consume(test, core_id);
+      __atomic_add_fetch(&popped_sum, sum, __ATOMIC_SEQ_CST);
+    }
+    mempool_barrier(num_cores);
+    time = mempool_get_timer() - time;
+    mempool_stop_benchmark();
+
+    if (core_id == 0) {
+      uint32_t elements = NUM_ELEMENTS * (num_cores / 2);
+      printf("%-12s %6d cycles, %d.%02d elements/cycle\n", test_names[test],
+             time, elements / time, elements % time * 100 / time);
+      if (pushed_sum != popped_sum) {
+        printf("%-12s checksum mismatch: %d != %d\n", test_names[test],
+               pushed_sum, popped_sum);
+        error = 1;
+      }
+    }
+    teardown(test, core_id);
+    mempool_barrier(num_cores);
+  }
+
+  return error;
+}
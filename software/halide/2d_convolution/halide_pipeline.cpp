@@ -57,6 +57,9 @@ int main(int argc, char **argv) {
   convolution_x.update().unroll(r);
   convolution_y.update().unroll(r);
   convolution.parallel(y);
+  // Compute the rows that each output row needs within its parallel iteration
+  convolution_y.compute_at(convolution, y);
+  convolution_x.compute_at(convolution, y);
 
   // Quickly test the pipeline
   const uint32_t WIDTH = 16;
@@ -11,9 +11,10 @@
 #include <stdint.h>
 #include <string.h>
 
-#define N 16
-#define M 16
 #define KERNEL_N 3
+// One output row per core
+#define N (NUM_CORES + KERNEL_N - 1)
+#define M 16
 #define PADDING (KERNEL_N / 2)
 // #define VERBOSE
 
@@ -113,10 +114,17 @@ int halide_convolution(uint32_t core_id, uint32_t num_cores) {
 
   mempool_barrier(num_cores);
 
+  // Core 0 calls the Halide pipeline, while the other cores run its parallel
+  // loops
+  int error = 0;
   mempool_start_benchmark();
-  // Call the Halide pipeline
-  int error = halide_pipeline((halide_buffer_t *)&halide_buffer_in, M, N,
-                              (halide_buffer_t *)&halide_buffer_out);
+  if (core_id == 0) {
+    error = halide_pipeline((halide_buffer_t *)&halide_buffer_in, M, N,
+                            (halide_buffer_t *)&halide_buffer_out);
+    halide_mempool_stop();
+  } else {
+    halide_mempool_worker(core_id);
+  }
   mempool_stop_benchmark();
 
   mempool_barrier(num_cores);
@@ -142,6 +150,7 @@ int main() {
   uint32_t num_cores = mempool_get_core_count();
   // Initialize barrier and synchronize
   mempool_barrier_init(core_id);
+  halide_mempool_init(core_id);
 
   if (core_id == 0) {
 #ifdef VERBOSE
@@ -22,6 +22,9 @@ int main(int argc, char **argv) {
   // Cast the result to uint_8
   gradient(x, y) = Halide::cast<uint8_t>(offset);
 
+  // Distribute the rows over the cores
+  gradient.parallel(y);
+
   // Quickly test the pipeline
   Halide::ParamMap params;
   params.set(center_x, (uint32_t)7);
@@ -19,7 +19,13 @@
 #include <string.h>
 
 int main() {
-  if (mempool_get_core_id() == 0) {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t num_cores = mempool_get_core_count();
+  // Initialize barrier and synchronize
+  mempool_barrier_init(core_id);
+  halide_mempool_init(core_id);
+
+  if (core_id == 0) {
     // Specify a two-dimensional buffer
     halide_dimension_t buffer_dim[2];
     // Fill both dimensions' parameters
@@ -59,6 +65,7 @@ int main() {
     // Call the Halide pipeline
     printf("Start calculation around x=%d, y=%d\n", center_x, center_y);
     int error = gradient(center_x, center_y, &output);
+    halide_mempool_stop();
 
     // Print the result
     printf("Gradient finished with exit code %d\n", error);
@@ -70,10 +77,11 @@ int main() {
       }
       printf("\n");
     }
-
-    wake_up((uint32_t)-1);
+  } else {
+    // Run the parallel loops of the pipeline
+    halide_mempool_worker(core_id);
   }
-  mempool_wfi();
 
+  mempool_barrier(num_cores);
   return 0;
 }
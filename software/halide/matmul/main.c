@@ -156,11 +156,18 @@ int halide_matmul(uint32_t core_id, uint32_t num_cores) {
 
   mempool_barrier(num_cores);
 
+  // Core 0 calls the Halide pipeline, while the other cores run its parallel
+  // loops
+  int error = 0;
   mempool_start_benchmark();
-  // Call the Halide pipeline
-  int error = halide_pipeline((halide_buffer_t *)&halide_buffer_matrix_a,
-                              (halide_buffer_t *)&halide_buffer_matrix_b,
-                              (halide_buffer_t *)&halide_buffer_matrix_c);
+  if (core_id == 0) {
+    error = halide_pipeline((halide_buffer_t *)&halide_buffer_matrix_a,
+                            (halide_buffer_t *)&halide_buffer_matrix_b,
+                            (halide_buffer_t *)&halide_buffer_matrix_c);
+    halide_mempool_stop();
+  } else {
+    halide_mempool_worker(core_id);
+  }
   mempool_stop_benchmark();
 
   mempool_barrier(num_cores);
@@ -188,6 +195,7 @@ int main() {
   uint32_t num_cores = mempool_get_core_count();
   // Initialize barrier and synchronize
   mempool_barrier_init(core_id);
+  halide_mempool_init(core_id);
 
   if (core_id == 0) {
     error = 0;
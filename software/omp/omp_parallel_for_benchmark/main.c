@@ -72,6 +72,35 @@ int verify_matrix(int32_t *matrix, uint32_t num_rows, uint32_t num_columns,
   return 0;
 }
 
+// Loop schedules to compare, through `schedule(runtime)`
+typedef struct {
+  const char *name;
+  omp_sched_t kind;
+  int chunk_size;
+} schedule_t;
+
+#define NUM_SCHEDULES 6
+static const schedule_t schedules[NUM_SCHEDULES] = {
+    {"static", omp_sched_static, 0},     {"static,1", omp_sched_static, 1},
+    {"static,4", omp_sched_static, 4},   {"dynamic,1", omp_sched_dynamic, 1},
+    {"dynamic,4", omp_sched_dynamic, 4}, {"guided,1", omp_sched_guided, 1},
+};
+
+void mat_mul_schedule_omp(int32_t const *__restrict__ A,
+                          int32_t const *__restrict__ B,
+                          int32_t *__restrict__ C) {
+#pragma omp parallel for schedule(runtime)
+  for (uint32_t i = 0; i < M; i++) {
+    for (uint32_t j = 0; j < P; ++j) {
+      int32_t c = 0;
+      for (uint32_t k = 0; k < N; ++k) {
+        c += A[i * N + k] * B[k * P + j];
+      }
+      C[i * P + j] = c;
+    }
+  }
+}
+
 void print_matrix(int32_t const *matrix, uint32_t num_rows,
                   uint32_t num_columns) {
   printf("0x%8X\n", (uint32_t)matrix);
@@ -180,6 +209,21 @@ int main() {
       printf("c[%d]=%d\n", error, c[error]);
     }
 
+    for (uint32_t s = 0; s < NUM_SCHEDULES; s++) {
+      omp_set_schedule(schedules[s].kind, schedules[s].chunk_size);
+      cycles = mempool_get_timer();
+      mempool_start_benchmark();
+      mat_mul_schedule_omp(a, b, c);
+      mempool_stop_benchmark();
+      cycles = mempool_get_timer() - cycles;
+      printf("OpenMP schedule(%s) Duration: %d\n", schedules[s].name, cycles);
+      error = verify_matrix(c, M, P, A_a, A_b, A_c, B_a, B_b, B_c);
+      if (error != 0) {
+        printf("Error code %d\n", error);
+        printf("c[%d]=%d\n", error, c[error]);
+      }
+    }
+
   } else {
     while (1) {
       mempool_wfi();
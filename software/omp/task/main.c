@@ -0,0 +1,109 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdint.h>
+#include <string.h>
+
+#include "encoding.h"
+#include "libgomp.h"
+#include "printf.h"
+#include "runtime.h"
+#include "synchronization.h"
+
+#define REPETITIONS 10 /* Number of times to run each test */
+#define NUM_TASKS 64
+
+void work1() {
+  int sum = 0;
+  for (int i = 0; i < 100; i++) {
+    sum++;
+  }
+}
+
+uint32_t fib(uint32_t n) {
+  uint32_t x, y;
+  if (n < 2) {
+    return n;
+  }
+#pragma omp task shared(x)
+  x = fib(n - 1);
+#pragma omp task shared(y)
+  y = fib(n - 2);
+#pragma omp taskwait
+  return x + y;
+}
+
+uint32_t test_omp_task_fib() {
+  uint32_t result = 0;
+
+#pragma omp parallel shared(result)
+  {
+#pragma omp single
+    { result = fib(12); }
+  }
+  return result == 144;
+}
+
+uint32_t test_omp_task_barrier() {
+  uint32_t done[NUM_TASKS];
+  uint32_t result = 1;
+
+  memset(done, 0, sizeof(done));
+#pragma omp parallel shared(done)
+  {
+#pragma omp single
+    {
+      for (uint32_t i = 0; i < NUM_TASKS; i++) {
+#pragma omp task firstprivate(i)
+        {
+          work1();
+          __atomic_add_fetch(&done[i], 1, __ATOMIC_SEQ_CST);
+        }
+      }
+    }
+    // The implicit barrier of single completes all tasks
+  }
+  for (uint32_t i = 0; i < NUM_TASKS; i++) {
+    if (done[i] != 1) {
+      printf("Task %d ran %d times\n", i, done[i]);
+      result = 0;
+    }
+  }
+  return result;
+}
+
+uint32_t test_omp_task_if() {
+  uint32_t count = 0;
+
+#pragma omp parallel shared(count)
+  {
+#pragma omp task if (0) shared(count)
+    { __atomic_add_fetch(&count, 1, __ATOMIC_SEQ_CST); }
+  }
+  return count == omp_get_num_threads();
+}
+
+int main() {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t i;
+
+  if (core_id == 0) {
+    printf("Master Thread start\n");
+    for (i = 0; i < REPETITIONS; i++) {
+      printf("Test: %d\n", i);
+      printf("Fibonacci is t/f: %d\n", test_omp_task_fib());
+      printf("Tasks done at barrier is t/f: %d\n", test_omp_task_barrier());
+      printf("Undeferred tasks is t/f: %d\n", test_omp_task_if());
+      printf("Test finished: %d\n", i);
+    }
+    printf("Master Thread end\n\n\n");
+  } else {
+    while (1) {
+      mempool_wfi();
+      run_task(core_id);
+    }
+  }
+
+  return 0;
+}
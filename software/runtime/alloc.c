@@ -6,6 +6,7 @@
 
 #include "alloc.h"
 #include "printf.h"
+#include "runtime.h"
 
 // ----------------------------------------------------------------------------
 // Block Alignment
@@ -34,6 +35,27 @@ alloc_t alloc_l1;
 // Allocators for L1 local sequential heap memory
 alloc_t alloc_tile[NUM_CORES / NUM_CORES_PER_TILE];
 
+// Tile-local allocators, one per segment of a row, i.e., in each tile's banks
+alloc_local_t alloc_local[NUM_CORES / NUM_CORES_PER_TILE]
+    __attribute__((aligned(NUM_CORES * BANKING_FACTOR * 4), section(".l1")));
+
+// Rows of the interleaved memory that belong to the tile-local allocators
+static uint32_t alloc_local_base;
+static uint32_t alloc_local_end;
+
+// ----------------------------------------------------------------------------
+// Locking
+// ----------------------------------------------------------------------------
+static inline void alloc_lock(uint32_t volatile *lock) {
+  while (__atomic_fetch_or(lock, 1, __ATOMIC_SEQ_CST)) {
+    mempool_wait(NUM_CORES_PER_TILE);
+  }
+}
+
+static inline void alloc_unlock(uint32_t volatile *lock) {
+  __atomic_fetch_and(lock, 0, __ATOMIC_SEQ_CST);
+}
+
 // ----------------------------------------------------------------------------
 // Canary System based on LSBs of block pointer
 // ----------------------------------------------------------------------------
@@ -63,6 +85,14 @@ void alloc_init(alloc_t *alloc, void *base, const uint32_t size) {
   uint32_t aligned_base = ALIGN_UP((uint32_t)base, MIN_BLOCK_SIZE);
   alloc_block_t *block_ptr = (alloc_block_t *)aligned_base;
 
+  alloc->lock = 0;
+
+  // An empty region, e.g., a sequential heap without space, has no blocks
+  if (size < aligned_base - (uint32_t)base + MIN_BLOCK_SIZE) {
+    alloc->first_block = NULL;
+    return;
+  }
+
   // Calculate block size aligned down
   uint32_t block_size = size - ((uint32_t)block_ptr - (uint32_t)base);
   block_size = ALIGN_DOWN(block_size, MIN_BLOCK_SIZE);
@@ -73,6 +103,30 @@ void alloc_init(alloc_t *alloc, void *base, const uint32_t size) {
   alloc->first_block = block_ptr;
 }
 
+void alloc_local_init(void *base, const uint32_t size) {
+  // Only use whole rows, so that every tile has the same number of segments
+  const uint32_t row_size = NUM_CORES * BANKING_FACTOR * 4;
+  uint32_t first_row = ALIGN_UP((uint32_t)base, row_size);
+  uint32_t end = (uint32_t)base + size;
+  end = ALIGN_DOWN(end, row_size);
+  if (end < first_row) {
+    end = first_row;
+  }
+  alloc_local_base = first_row;
+  alloc_local_end = end;
+
+  for (uint32_t tile_id = 0; tile_id < NUM_CORES / NUM_CORES_PER_TILE;
+       ++tile_id) {
+    alloc_local_t *alloc = &alloc_local[tile_id];
+    alloc->lock = 0;
+    alloc->next_segment = (char *)(first_row + tile_id * ALLOC_SEGMENT_SIZE);
+    alloc->end = (char *)end;
+    for (uint32_t i = 0; i < ALLOC_NUM_CLASSES; ++i) {
+      alloc->free_list[i] = NULL;
+    }
+  }
+}
+
 // ----------------------------------------------------------------------------
 // Allocate Memory
 // ----------------------------------------------------------------------------
@@ -116,20 +170,66 @@ static void *allocate_memory(alloc_t *alloc, const uint32_t size) {
   }
 }
 
-void *domain_malloc(alloc_t *alloc, const uint32_t size) {
-  // Calculate actually required block size
-  uint32_t data_size = size + sizeof(uint32_t); // add size/metadata
-  uint32_t block_size = ALIGN_UP(data_size, MIN_BLOCK_SIZE); // add alignment
+static void *allocate_memory_locked(alloc_t *alloc, const uint32_t size) {
+  alloc_lock(&alloc->lock);
+  void *block_ptr = allocate_memory(alloc, size);
+  alloc_unlock(&alloc->lock);
+  return block_ptr;
+}
+
+// Index of the smallest size class that holds `block_size` bytes
+static inline uint32_t size_class(const uint32_t block_size) {
+  return (uint32_t)(32 - __builtin_clz(block_size - 1) -
+                    __builtin_ctz(MIN_BLOCK_SIZE));
+}
+
+static void *allocate_local(alloc_local_t *alloc, const uint32_t class) {
+  const uint32_t class_size = MIN_BLOCK_SIZE << class;
+  alloc_block_t *block;
+
+  alloc_lock(&alloc->lock);
+  block = alloc->free_list[class];
+  if (!block && alloc->next_segment < alloc->end) {
+    // Cut the next segment into blocks of the class
+    char *segment = alloc->next_segment;
+    alloc->next_segment += NUM_CORES * BANKING_FACTOR * 4;
+    block = (alloc_block_t *)segment;
+    block->next = NULL;
+    for (uint32_t offset = class_size; offset < ALLOC_SEGMENT_SIZE;
+         offset += class_size) {
+      alloc_block_t *next = (alloc_block_t *)(segment + offset);
+      next->next = block;
+      block = next;
+    }
+  }
+  if (block) {
+    alloc->free_list[class] = block->next;
+  }
+  alloc_unlock(&alloc->lock);
+  return (void *)block;
+}
 
+static inline uint32_t block_size_valid(const uint32_t block_size) {
   // 32-bit metadata = 8-bit canary + 24-bit size
   // i.e. max allowed block_size == (2^24 - 1) bytes
   if (block_size >= (1 << (sizeof(uint32_t) * 8 - sizeof(uint8_t) * 8))) {
     printf("Memory allocator: Requested memory exceeds max block size\n");
+    return 0;
+  }
+  return 1;
+}
+
+void *domain_malloc(alloc_t *alloc, const uint32_t size) {
+  // Calculate actually required block size
+  uint32_t data_size = size + sizeof(uint32_t); // add size/metadata
+  uint32_t block_size = ALIGN_UP(data_size, MIN_BLOCK_SIZE); // add alignment
+
+  if (!block_size_valid(block_size)) {
     return NULL;
   }
 
   // Allocate memory
-  void *block_ptr = allocate_memory(alloc, block_size);
+  void *block_ptr = allocate_memory_locked(alloc, block_size);
   if (!block_ptr) {
     printf("Memory allocator: No large enough block found (%d)\n", block_size);
     return NULL;
@@ -147,6 +247,46 @@ void *simple_malloc(const uint32_t size) {
   return domain_malloc(&alloc_l1, size);
 }
 
+void *local_malloc(const uint32_t size) {
+  const uint32_t tile_id = mempool_get_core_id() / NUM_CORES_PER_TILE;
+  uint32_t data_size = size + sizeof(uint32_t); // add size/metadata
+  uint32_t block_size = ALIGN_UP(data_size, MIN_BLOCK_SIZE); // add alignment
+  void *block_ptr = NULL;
+
+  if (!block_size_valid(block_size)) {
+    return NULL;
+  }
+
+  // Small blocks come from the tile's segments
+  if (block_size <= ALLOC_SEGMENT_SIZE &&
+      size_class(block_size) < ALLOC_NUM_CLASSES) {
+    const uint32_t class = size_class(block_size);
+    block_ptr = allocate_local(&alloc_local[tile_id], class);
+    if (block_ptr) {
+      block_size = MIN_BLOCK_SIZE << class;
+    }
+  }
+  // Larger blocks come from the tile's sequential heap, and everything else
+  // from the interleaved heap
+  if (!block_ptr) {
+    block_ptr = allocate_memory_locked(&alloc_tile[tile_id], block_size);
+  }
+  if (!block_ptr) {
+    block_ptr = allocate_memory_locked(&alloc_l1, block_size);
+  }
+  if (!block_ptr) {
+    printf("Memory allocator: No large enough block found (%d)\n", block_size);
+    return NULL;
+  }
+
+  // Store canary and size into first four bytes
+  *((uint32_t *)block_ptr) = canary_encode(block_ptr, block_size);
+
+  // Return data pointer
+  void *data_ptr = (void *)((uint32_t *)block_ptr + 1);
+  return data_ptr;
+}
+
 // ----------------------------------------------------------------------------
 // Free Memory
 // ----------------------------------------------------------------------------
@@ -203,11 +343,50 @@ void domain_free(alloc_t *alloc, void *const ptr) {
   }
 
   // Free memory
+  alloc_lock(&alloc->lock);
   free_memory(alloc, block_ptr, canary_and_size.size);
+  alloc_unlock(&alloc->lock);
 }
 
 void simple_free(void *const ptr) { domain_free(&alloc_l1, ptr); }
 
+void local_free(void *const ptr) {
+  extern uint32_t __seq_start, __seq_end;
+  const uint32_t row_size = NUM_CORES * BANKING_FACTOR * 4;
+
+  // Get block pointer from data pointer
+  void *block_ptr = (void *)((uint32_t *)ptr - 1);
+  uint32_t addr = (uint32_t)block_ptr;
+
+  if (addr >= alloc_local_base && addr < alloc_local_end) {
+    // Retrieve canary and size
+    const canary_and_size_t canary_and_size =
+        canary_decode(*(const uint32_t *)block_ptr);
+
+    // Check for memory overflow
+    if (canary_and_size.canary != canary(block_ptr)) {
+      printf("Memory Overflow at %p\n", block_ptr);
+      return;
+    }
+
+    // Return the block to the free list of the tile that owns the segment
+    uint32_t tile_id = (addr - alloc_local_base) % row_size / ALLOC_SEGMENT_SIZE;
+    alloc_local_t *alloc = &alloc_local[tile_id];
+    uint32_t class = size_class(canary_and_size.size);
+    alloc_block_t *block = (alloc_block_t *)block_ptr;
+    alloc_lock(&alloc->lock);
+    block->next = alloc->free_list[class];
+    alloc->free_list[class] = block;
+    alloc_unlock(&alloc->lock);
+  } else if (addr < (uint32_t)&__seq_end) {
+    uint32_t tile_id = (addr - (uint32_t)&__seq_start) /
+                       (NUM_CORES_PER_TILE * SEQ_MEM_SIZE);
+    domain_free(&alloc_tile[tile_id], ptr);
+  } else {
+    domain_free(&alloc_l1, ptr);
+  }
+}
+
 // ----------------------------------------------------------------------------
 // Debugging Functions
 // ----------------------------------------------------------------------------
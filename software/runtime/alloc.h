@@ -5,7 +5,14 @@
 // Author: Gua Hao Khov, ETH Zurich
 
 /* Dynamic memory allocation based on linked list of free blocks with
- * first-fit search and coalescing with next and previous block
+ * first-fit search and coalescing with next and previous block.
+ * Each allocator has a lock, so that all cores can use it concurrently.
+ *
+ * The tile-local allocator serves small blocks from the banks of the calling
+ * core's tile. It owns a share of the interleaved heap, where every row of
+ * all banks holds one segment of NUM_BANKS_PER_TILE words per tile. Each tile
+ * cuts its segments into blocks of power-of-two size classes and keeps a free
+ * list per class, so that both malloc and free take constant time.
  */
 
 #ifndef _ALLOC_H_
@@ -25,8 +32,33 @@ typedef struct alloc_block_s {
 // Allocator
 typedef struct {
   alloc_block_t *first_block;
+  uint32_t volatile lock;
 } alloc_t;
 
+// Bytes of a tile's segment in every row of the interleaved memory
+#define ALLOC_SEGMENT_SIZE (NUM_CORES_PER_TILE * BANKING_FACTOR * 4)
+
+// Size classes of the tile-local allocator, from 8 bytes to 128 bytes, as far
+// as they fit in a segment
+#define ALLOC_NUM_CLASSES 5
+
+// Share of the interleaved heap that mempool_init gives to the tile-local
+// allocators (1/N). None by default, in which case local_malloc falls back
+// to the other heaps. Apps that use local_malloc define it before including
+// runtime.h.
+#ifndef ALLOC_LOCAL_FRACTION
+#define ALLOC_LOCAL_FRACTION 0
+#endif
+
+// Tile-local allocator, padded to a segment to lie in the tile's own banks
+typedef struct {
+  uint32_t volatile lock;
+  // Next unused segment of the tile and end of the segments
+  char *next_segment;
+  char *end;
+  alloc_block_t *free_list[ALLOC_NUM_CLASSES];
+} __attribute__((aligned(ALLOC_SEGMENT_SIZE))) alloc_local_t;
+
 // Initialization
 void alloc_init(alloc_t *alloc, void *base, const uint32_t size);
 
@@ -42,6 +74,16 @@ void simple_free(void *const ptr);
 // Free with specified allocator
 void domain_free(alloc_t *alloc, void *const ptr);
 
+// Initialize the tile-local allocators with the rows in [base, base + size)
+void alloc_local_init(void *base, const uint32_t size);
+
+// Malloc in the L1 banks of the calling core's tile, or in L1 memory if the
+// block is too large, the tile ran out of segments or there are none
+void *local_malloc(const uint32_t size);
+
+// Free memory of local_malloc, from any core
+void local_free(void *const ptr);
+
 // Print out linked list of free blocks
 void alloc_dump(alloc_t *alloc);
 
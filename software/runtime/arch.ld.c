@@ -59,4 +59,7 @@ SECTIONS {
   wake_up_tile_g7_reg = 0x4000005C;
 
   fake_uart              = 0xC0000000;
+  // A word per core for its lines and for its binary log records
+  fake_uart_line         = 0xC0001000;
+  fake_uart_log          = 0xC0002000;
 }
@@ -0,0 +1,208 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Streaming layer on top of the DMA frontend for tiled kernels that work on
+// data in L2 through L1 buffers.
+//
+// The frontend runs one transfer at a time, and its done flag only tracks the
+// last one. The stream therefore queues transfers in a small ring and launches
+// the next one whenever the previous one completed. Every transfer gets an ID
+// that tells when it is done. The ring only moves on when one core calls into
+// the stream, so a single core should drive it and poll it between chunks of
+// its own work. The other cores learn about completed transfers through a
+// barrier.
+//
+// The distributed midend splits every transfer by its L1 address over the
+// groups, and within a group over its DMAS_PER_GROUP backends. A transfer
+// that covers whole rows of L1 (DMA_STREAM_ROW_BYTES) keeps all backends busy.
+
+#ifndef _DMA_STREAM_H_
+#define _DMA_STREAM_H_
+
+#include <stdint.h>
+
+#include "dma.h"
+#include "runtime.h"
+
+#ifndef DMAS_PER_GROUP
+#define DMAS_PER_GROUP 1
+#endif
+
+// DMA backends of the cluster
+#define DMA_STREAM_BACKENDS (NUM_GROUPS * DMAS_PER_GROUP)
+// Bytes of a row of all L1 banks, the granularity that reaches all backends
+#define DMA_STREAM_ROW_BYTES (NUM_CORES * BANKING_FACTOR * 4)
+
+// Queued transfers (must be a power of 2)
+#ifndef DMA_STREAM_DEPTH
+#define DMA_STREAM_DEPTH 8
+#endif
+
+/* A 2D transfer of `rows` rows of `row_bytes` bytes each */
+typedef struct {
+  uint32_t dst;
+  uint32_t src;
+  uint32_t row_bytes;
+  uint32_t rows;
+  uint32_t dst_stride;
+  uint32_t src_stride;
+} dma_desc_t;
+
+typedef struct {
+  dma_desc_t ring[DMA_STREAM_DEPTH];
+  // ID of the oldest transfer that is not done
+  uint32_t head;
+  // ID of the next transfer to queue
+  uint32_t tail;
+  // Row of the oldest transfer that the DMA copies
+  uint32_t row;
+  // Whether a row is in flight
+  uint32_t busy;
+} dma_stream_t;
+
+static inline void dma_stream_init(dma_stream_t *stream) {
+  stream->head = 0;
+  stream->tail = 0;
+  stream->row = 0;
+  stream->busy = 0;
+}
+
+/* Retire the transfer in flight if it completed, and launch the next one.
+   Returns the ID of the oldest transfer that is not done. */
+static inline uint32_t dma_stream_progress(dma_stream_t *stream) {
+  if (stream->busy) {
+    if (!dma_done()) {
+      return stream->head;
+    }
+    stream->busy = 0;
+    if (++stream->row == stream->ring[stream->head % DMA_STREAM_DEPTH].rows) {
+      stream->row = 0;
+      stream->head++;
+    }
+  }
+  if (stream->head != stream->tail) {
+    dma_desc_t *desc = &stream->ring[stream->head % DMA_STREAM_DEPTH];
+    dma_memcpy_nonblocking(
+        (void *)(desc->dst + stream->row * desc->dst_stride),
+        (const void *)(desc->src + stream->row * desc->src_stride),
+        desc->row_bytes);
+    stream->busy = 1;
+  }
+  return stream->head;
+}
+
+static inline int dma_stream_done(dma_stream_t *stream, uint32_t id) {
+  return (int32_t)(dma_stream_progress(stream) - id) > 0;
+}
+
+static inline void dma_stream_wait(dma_stream_t *stream, uint32_t id) {
+  while (!dma_stream_done(stream, id)) {
+    mempool_wait(64);
+  }
+}
+
+/* Wait until all queued transfers are done */
+static inline void dma_stream_flush(dma_stream_t *stream) {
+  while (dma_stream_progress(stream) != stream->tail) {
+    mempool_wait(64);
+  }
+}
+
+/* Queue a 2D transfer and return its ID. Rows that follow each other in both
+   memories are merged into a single transfer. Blocks while the ring is full. */
+static inline uint32_t dma_stream_push_2d(dma_stream_t *stream, void *dst,
+                                          const void *src, uint32_t row_bytes,
+                                          uint32_t rows, uint32_t dst_stride,
+                                          uint32_t src_stride) {
+  if (rows == 0 || row_bytes == 0) {
+    // Nothing to copy, done once the earlier transfers are
+    return stream->tail - 1;
+  }
+  while (stream->tail - dma_stream_progress(stream) == DMA_STREAM_DEPTH) {
+    mempool_wait(64);
+  }
+  dma_desc_t *desc = &stream->ring[stream->tail % DMA_STREAM_DEPTH];
+  if (rows > 1 && dst_stride == row_bytes && src_stride == row_bytes) {
+    row_bytes *= rows;
+    rows = 1;
+  }
+  desc->dst = (uint32_t)dst;
+  desc->src = (uint32_t)src;
+  desc->row_bytes = row_bytes;
+  desc->rows = rows;
+  desc->dst_stride = dst_stride;
+  desc->src_stride = src_stride;
+  uint32_t id = stream->tail++;
+  dma_stream_progress(stream);
+  return id;
+}
+
+static inline uint32_t dma_stream_push(dma_stream_t *stream, void *dst,
+                                       const void *src, uint32_t len) {
+  return dma_stream_push_2d(stream, dst, src, len, 1, len, len);
+}
+
+/* Ping-pong buffers for a sequence of tiles of a matrix in L2. Tile `index`
+   starts `tile_step` bytes after the previous one and has `rows` rows of
+   `row_bytes` bytes, `pitch` bytes apart. In L1, tile `index` lives densely
+   in buffer `index % 2`, so that the next tile can move while the cores work
+   on the current one. */
+typedef struct {
+  char *l2;
+  char *buf[2];
+  uint32_t id[2];
+  uint32_t row_bytes;
+  uint32_t rows;
+  uint32_t pitch;
+  uint32_t tile_step;
+  uint32_t num_tiles;
+} dma_tiles_t;
+
+static inline void dma_tiles_init(dma_tiles_t *tiles, void *l2, void *buf0,
+                                  void *buf1, uint32_t row_bytes, uint32_t rows,
+                                  uint32_t pitch, uint32_t tile_step,
+                                  uint32_t num_tiles) {
+  tiles->l2 = (char *)l2;
+  tiles->buf[0] = (char *)buf0;
+  tiles->buf[1] = (char *)buf1;
+  // Buffers without transfers are free
+  tiles->id[0] = (uint32_t)-1;
+  tiles->id[1] = (uint32_t)-1;
+  tiles->row_bytes = row_bytes;
+  tiles->rows = rows;
+  tiles->pitch = pitch;
+  tiles->tile_step = tile_step;
+  tiles->num_tiles = num_tiles;
+}
+
+static inline void *dma_tiles_buffer(dma_tiles_t *tiles, uint32_t index) {
+  return tiles->buf[index % 2];
+}
+
+/* Queue the copy of tile `index` from L2 to its buffer, if it exists */
+static inline void dma_tiles_fetch(dma_tiles_t *tiles, dma_stream_t *stream,
+                                   uint32_t index) {
+  if (index < tiles->num_tiles) {
+    tiles->id[index % 2] = dma_stream_push_2d(
+        stream, tiles->buf[index % 2], tiles->l2 + index * tiles->tile_step,
+        tiles->row_bytes, tiles->rows, tiles->row_bytes, tiles->pitch);
+  }
+}
+
+/* Queue the copy of tile `index` from its buffer back to L2 */
+static inline void dma_tiles_store(dma_tiles_t *tiles, dma_stream_t *stream,
+                                   uint32_t index) {
+  tiles->id[index % 2] = dma_stream_push_2d(
+      stream, tiles->l2 + index * tiles->tile_step, tiles->buf[index % 2],
+      tiles->row_bytes, tiles->rows, tiles->pitch, tiles->row_bytes);
+}
+
+/* Wait for the last transfer of the buffer of tile `index`. For fetched
+   tiles, the tile is then ready. For stored tiles, the buffer is free again. */
+static inline void dma_tiles_wait(dma_tiles_t *tiles, dma_stream_t *stream,
+                                  uint32_t index) {
+  dma_stream_wait(stream, tiles->id[index % 2]);
+}
+
+#endif // _DMA_STREAM_H_
@@ -5,6 +5,7 @@
 // Author: Samuel Riedel, ETH Zurich
 
 #include "halide_runtime.h"
+#include "alloc.h"
 #include "printf.h"
 #include "runtime.h"
 #include "synchronization.h"
@@ -16,9 +17,182 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
-void *halide_malloc(void *user_context, size_t x) { return (void *)0x0000b000; }
+/* Core 0 runs the pipelines, while the other cores wait in
+   `halide_mempool_worker` for parallel loops. Core 0 starts a round when it
+   reaches a parallel loop outside of any other: it wakes all workers, which
+   then take chunks of every loop that is posted until the round's loop is
+   done, and go back to sleep. Every round is a single wake-up per core, so
+   that no wake-up is left over for the barriers that follow. Nested loops and
+   the producer-consumer tasks of `async` are jobs that the cores of the
+   round share, and whose owners help with them until they are done.
 
-void halide_free(void *user_context, void *ptr) {}
+   The buffers that core 0 allocates outside of the parallel loops live in an
+   arena in the interleaved L1 memory, which all cores access alike. They
+   nest, so the arena works like a stack that frees its top blocks once they
+   are freed. Allocations within parallel loops, such as the buffers of
+   `compute_at` stages, come from local_malloc, i.e., from the tile-local
+   allocator of the core if the app sets ALLOC_LOCAL_FRACTION. */
+
+// Bytes of the arena for the buffers of the pipelines
+#ifndef HALIDE_ARENA_SIZE
+#define HALIDE_ARENA_SIZE (NUM_CORES * BANKING_FACTOR * 4 * 4)
+#endif
+// Alignment of the buffers
+#define HALIDE_ALIGNMENT 32
+// Loops and tasks that can be active at the same time (at most 32)
+#ifndef HALIDE_MAX_JOBS
+#define HALIDE_MAX_JOBS 16
+#endif
+// Chunks of a parallel loop per core
+#ifndef HALIDE_CHUNKS_PER_CORE
+#define HALIDE_CHUNKS_PER_CORE 2
+#endif
+
+typedef struct {
+  // Either a parallel loop, or a loop task of `halide_do_parallel_tasks`
+  halide_task_t task;
+  halide_loop_task_t loop_task;
+  void *user_context;
+  uint8_t *closure;
+  void *task_parent;
+  struct halide_semaphore_acquire_t *semaphores;
+  int num_semaphores;
+  int serial;
+  int min;
+  int extent;
+  int chunk;
+  // Next iteration to take, iterations done, and cores that run the job
+  int32_t volatile next;
+  int32_t volatile done;
+  int32_t volatile running;
+  // First non-zero result of an iteration. The other iterations still run,
+  // as the tasks of `async` may wait for each other's semaphores.
+  int32_t volatile result;
+  // Cores that look at the job, which must be none before it is reused
+  int32_t volatile users;
+  // Order in which the jobs were posted
+  uint32_t seq;
+} halide_job_t;
+
+typedef struct {
+  // Start of the free part of the arena and the last block
+  char *top;
+  char *last;
+} halide_arena_t;
+
+// Header of a block of the arena, in front of its data
+typedef struct {
+  // Previous block and the top of the arena before this block
+  char *prev;
+  // The top before this block, with bit 0 set once the block is freed
+  uintptr_t start;
+} halide_arena_block_t;
+
+halide_job_t halide_jobs[HALIDE_MAX_JOBS] __attribute__((section(".l1")));
+// Jobs in use, which the lock protects
+uint32_t volatile halide_job_mask __attribute__((section(".l1")));
+uint32_t volatile halide_job_lock __attribute__((section(".l1")));
+uint32_t volatile halide_job_seq __attribute__((section(".l1")));
+// Whether a round is running, workers waiting for one, and whether to stop
+uint32_t volatile halide_round __attribute__((section(".l1")));
+uint32_t volatile halide_idle __attribute__((section(".l1")));
+uint32_t volatile halide_stop __attribute__((section(".l1")));
+
+char halide_arena_data[HALIDE_ARENA_SIZE]
+    __attribute__((aligned(HALIDE_ALIGNMENT), section(".l1")));
+halide_arena_t halide_arena __attribute__((section(".l1")));
+
+static inline void halide_lock(uint32_t volatile *lock) {
+  while (__atomic_fetch_or(lock, 1, __ATOMIC_SEQ_CST)) {
+    mempool_wait(16);
+  }
+}
+
+static inline void halide_unlock(uint32_t volatile *lock) {
+  __atomic_fetch_and(lock, 0, __ATOMIC_SEQ_CST);
+}
+
+void halide_mempool_init(uint32_t core_id) {
+  if (core_id == 0) {
+    mempool_init(core_id);
+    halide_job_mask = 0;
+    halide_job_lock = 0;
+    halide_job_seq = 0;
+    halide_round = 0;
+    halide_idle = 0;
+    halide_stop = 0;
+    halide_arena.top = halide_arena_data;
+    halide_arena.last = NULL;
+    for (uint32_t i = 0; i < HALIDE_MAX_JOBS; ++i) {
+      halide_jobs[i].users = 0;
+    }
+  }
+  mempool_barrier(mempool_get_core_count());
+}
+
+////////////
+// Memory //
+////////////
+
+static void *halide_arena_malloc(size_t x) {
+  char *data = (char *)(((uintptr_t)halide_arena.top +
+                         sizeof(halide_arena_block_t) + HALIDE_ALIGNMENT - 1) &
+                        ~(uintptr_t)(HALIDE_ALIGNMENT - 1));
+  if (data + x > halide_arena_data + HALIDE_ARENA_SIZE) {
+    return NULL;
+  }
+  halide_arena_block_t *block = (halide_arena_block_t *)data - 1;
+  block->prev = halide_arena.last;
+  block->start = (uintptr_t)halide_arena.top;
+  halide_arena.last = data;
+  halide_arena.top = data + x;
+  return data;
+}
+
+static void halide_arena_free(void *ptr) {
+  ((halide_arena_block_t *)ptr - 1)->start |= 1;
+  // Pop the freed blocks from the top
+  while (halide_arena.last) {
+    halide_arena_block_t *block = (halide_arena_block_t *)halide_arena.last - 1;
+    if (!(block->start & 1)) {
+      break;
+    }
+    halide_arena.top = (char *)(block->start & ~(uintptr_t)1);
+    halide_arena.last = block->prev;
+  }
+}
+
+void *halide_malloc(void *user_context, size_t x) {
+  // Outside of the parallel loops, only core 0 runs the pipeline
+  if (!halide_round) {
+    void *ptr = halide_arena_malloc(x);
+    if (ptr) {
+      return ptr;
+    }
+  }
+  // Keep the pointer of the block in front of the aligned data
+  char *block = local_malloc(x + HALIDE_ALIGNMENT + sizeof(void *));
+  if (!block) {
+    return NULL;
+  }
+  char *data =
+      (char *)(((uintptr_t)block + sizeof(void *) + HALIDE_ALIGNMENT - 1) &
+               ~(uintptr_t)(HALIDE_ALIGNMENT - 1));
+  ((void **)data)[-1] = block;
+  return data;
+}
+
+void halide_free(void *user_context, void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  if ((char *)ptr >= halide_arena_data &&
+      (char *)ptr < halide_arena_data + HALIDE_ARENA_SIZE) {
+    halide_arena_free(ptr);
+  } else {
+    local_free(((void **)ptr)[-1]);
+  }
+}
 
 char *getenv(const char *name) { return NULL; };
 
@@ -67,15 +241,318 @@ void halide_print(void *user_context, const char *msg) { printf("%s\n", msg); }
 // Parallel //
 //////////////
 
+int halide_do_task(void *user_context, halide_task_t f, int idx,
+                   uint8_t *closure) {
+  return f(user_context, idx, closure);
+}
+
+int halide_do_loop_task(void *user_context, halide_loop_task_t f, int min,
+                        int extent, uint8_t *closure, void *task_parent) {
+  return f(user_context, min, extent, closure, task_parent);
+}
+
+int halide_semaphore_init(struct halide_semaphore_t *sema, int n) {
+  __atomic_store_n((int32_t *)sema, n, __ATOMIC_SEQ_CST);
+  return n;
+}
+
+int halide_semaphore_release(struct halide_semaphore_t *sema, int n) {
+  return __atomic_add_fetch((int32_t *)sema, n, __ATOMIC_SEQ_CST);
+}
+
+bool halide_semaphore_try_acquire(struct halide_semaphore_t *sema, int n) {
+  int32_t volatile *value = (int32_t volatile *)sema;
+  int32_t expected = *value;
+  while (expected >= n) {
+    if (__atomic_compare_exchange_n(value, &expected, expected - n, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Acquire all semaphores of a task, or none of them */
+static bool halide_acquire_all(struct halide_semaphore_acquire_t *semaphores,
+                               int num_semaphores) {
+  for (int i = 0; i < num_semaphores; ++i) {
+    if (!halide_semaphore_try_acquire(semaphores[i].semaphore,
+                                      semaphores[i].count)) {
+      while (i--) {
+        halide_semaphore_release(semaphores[i].semaphore, semaphores[i].count);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Run iterations [start, end) of a job */
+static int halide_job_run(halide_job_t *job, int start, int end) {
+  int result = 0;
+  if (job->task) {
+    for (int i = start; i < end && !result; ++i) {
+      result = halide_do_task(job->user_context, job->task, job->min + i,
+                              job->closure);
+    }
+  } else {
+    result = halide_do_loop_task(job->user_context, job->loop_task,
+                                 job->min + start, end - start, job->closure,
+                                 job->task_parent);
+  }
+  return result;
+}
+
+/* Take a chunk of a job and run it. Returns whether there was one. Jobs with
+   semaphores or that run serially take a single iteration at a time. */
+static int halide_job_step(halide_job_t *job) {
+  int start, end;
+  if (job->next >= job->extent) {
+    return 0;
+  }
+  if (!job->num_semaphores && !job->serial) {
+    start = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_SEQ_CST);
+    if (start >= job->extent) {
+      return 0;
+    }
+    end = start + job->chunk < job->extent ? start + job->chunk : job->extent;
+  } else {
+    halide_lock(&halide_job_lock);
+    start = job->next;
+    if (start >= job->extent || (job->serial && job->running) ||
+        !halide_acquire_all(job->semaphores, job->num_semaphores)) {
+      halide_unlock(&halide_job_lock);
+      return 0;
+    }
+    job->next = start + 1;
+    job->running = 1;
+    halide_unlock(&halide_job_lock);
+    end = start + 1;
+  }
+  int32_t result = halide_job_run(job, start, end);
+  int32_t expected = 0;
+  if (result) {
+    __atomic_compare_exchange_n(&job->result, &expected, result, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+  job->running = 0;
+  __atomic_add_fetch(&job->done, end - start, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+/* Run a chunk of any job posted at or after `min_seq` */
+static int halide_find_work(uint32_t min_seq) {
+  uint32_t mask = halide_job_mask;
+  while (mask) {
+    uint32_t slot = (uint32_t)__builtin_ctz(mask);
+    halide_job_t *job = &halide_jobs[slot];
+    int found = 0;
+    mask &= mask - 1;
+    __atomic_add_fetch(&job->users, 1, __ATOMIC_SEQ_CST);
+    if ((halide_job_mask & (1U << slot)) &&
+        (int32_t)(job->seq - min_seq) >= 0) {
+      found = halide_job_step(job);
+    }
+    __atomic_add_fetch(&job->users, -1, __ATOMIC_SEQ_CST);
+    if (found) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Take `count` free job slots. Returns their mask, or 0 if there are not
+   enough. */
+static uint32_t halide_jobs_alloc(int count) {
+  uint32_t slots = 0;
+  halide_lock(&halide_job_lock);
+  for (uint32_t i = 0; i < HALIDE_MAX_JOBS && count; ++i) {
+    if (!(halide_job_mask & (1U << i)) && !halide_jobs[i].users) {
+      slots |= 1U << i;
+      count--;
+    }
+  }
+  if (count) {
+    slots = 0;
+  }
+  halide_unlock(&halide_job_lock);
+  return slots;
+}
+
+/* Publish the jobs of `slots`, in order */
+static void halide_jobs_post(uint32_t slots) {
+  halide_lock(&halide_job_lock);
+  for (uint32_t mask = slots; mask; mask &= mask - 1) {
+    halide_jobs[__builtin_ctz(mask)].seq = halide_job_seq++;
+  }
+  __sync_synchronize();
+  halide_job_mask |= slots;
+  halide_unlock(&halide_job_lock);
+}
+
+static void halide_jobs_retire(uint32_t slots) {
+  halide_lock(&halide_job_lock);
+  halide_job_mask &= ~slots;
+  halide_unlock(&halide_job_lock);
+}
+
+/* Post the jobs of `slots` and help with them until they are done. From core
+   0 outside of a round, this starts a round on all cores. Returns the result
+   of the first job that failed, or 0. */
+static int halide_jobs_run(uint32_t slots) {
+  uint32_t core_id = mempool_get_core_id();
+  uint32_t num_cores = mempool_get_core_count();
+  uint32_t first = (uint32_t)__builtin_ctz(slots);
+  int start_round = core_id == 0 && !halide_round;
+
+  if (start_round) {
+    // Wait for all workers to be back from the last round
+    while (halide_idle != num_cores - 1) {
+      mempool_wait(16);
+    }
+    halide_idle = 0;
+    halide_stop = 0;
+    halide_jobs_post(slots);
+    halide_round = 1;
+    __sync_synchronize();
+    wake_up_all();
+    // Clear the own wake-up trigger
+    mempool_wfi();
+  } else {
+    halide_jobs_post(slots);
+  }
+
+  // Help with the own jobs, and the jobs posted after them
+  for (uint32_t mask = slots; mask; mask &= mask - 1) {
+    halide_job_t *job = &halide_jobs[__builtin_ctz(mask)];
+    while (job->done < job->extent) {
+      if (!halide_find_work(halide_jobs[first].seq)) {
+        mempool_wait(16);
+      }
+    }
+  }
+
+  if (start_round) {
+    halide_round = 0;
+  }
+  int result = 0;
+  for (uint32_t mask = slots; mask && !result; mask &= mask - 1) {
+    result = halide_jobs[__builtin_ctz(mask)].result;
+  }
+  halide_jobs_retire(slots);
+  return result;
+}
+
+static void halide_job_init(halide_job_t *job, void *user_context, int min,
+                            int extent, uint8_t *closure) {
+  uint32_t num_cores = mempool_get_core_count();
+  int chunks = (int)(num_cores * HALIDE_CHUNKS_PER_CORE);
+  job->task = NULL;
+  job->loop_task = NULL;
+  job->user_context = user_context;
+  job->closure = closure;
+  job->task_parent = NULL;
+  job->semaphores = NULL;
+  job->num_semaphores = 0;
+  job->serial = 0;
+  job->min = min;
+  job->extent = extent;
+  job->chunk = (extent + chunks - 1) / chunks;
+  job->next = 0;
+  job->done = 0;
+  job->running = 0;
+  job->result = 0;
+}
+
 // Halide calls this function
 int halide_do_par_for(void *user_context, halide_task_t task, int min, int size,
                       uint8_t *closure) {
-  for (uint32_t core_id = mempool_get_core_id(); core_id < (uint32_t)size;
-       core_id += mempool_get_core_count()) {
-    task(user_context, (int32_t)core_id, closure);
+  uint32_t slots = size > 1 ? halide_jobs_alloc(1) : 0;
+  if (!slots) {
+    // Run the loop right away
+    for (int i = min; i < min + size; ++i) {
+      int result = halide_do_task(user_context, task, i, closure);
+      if (result) {
+        return result;
+      }
+    }
+    return 0;
   }
+  halide_job_t *job = &halide_jobs[__builtin_ctz(slots)];
+  halide_job_init(job, user_context, min, size, closure);
+  job->task = task;
+  return halide_jobs_run(slots);
+}
 
-  return 0;
+// Halide calls this function for the producers and consumers of `async`
+int halide_do_parallel_tasks(void *user_context, int num_tasks,
+                             struct halide_parallel_task_t *tasks,
+                             void *task_parent) {
+  uint32_t slots = halide_jobs_alloc(num_tasks);
+  if (!slots) {
+    // Run the tasks here, in turns, as their semaphores allow
+    int remaining = 0;
+    for (int i = 0; i < num_tasks; ++i) {
+      remaining += tasks[i].extent > 0;
+    }
+    while (remaining) {
+      for (int i = 0; i < num_tasks; ++i) {
+        struct halide_parallel_task_t *t = &tasks[i];
+        if (t->extent > 0 &&
+            halide_acquire_all(t->semaphores, t->num_semaphores)) {
+          int extent = t->num_semaphores ? 1 : t->extent;
+          int result = halide_do_loop_task(user_context, t->fn, t->min, extent,
+                                           t->closure, task_parent);
+          if (result) {
+            return result;
+          }
+          t->min += extent;
+          t->extent -= extent;
+          remaining -= t->extent == 0;
+        }
+      }
+    }
+    return 0;
+  }
+  uint32_t mask = slots;
+  for (int i = 0; i < num_tasks; ++i, mask &= mask - 1) {
+    halide_job_t *job = &halide_jobs[__builtin_ctz(mask)];
+    halide_job_init(job, user_context, tasks[i].min, tasks[i].extent,
+                    tasks[i].closure);
+    job->loop_task = tasks[i].fn;
+    job->task_parent = task_parent;
+    job->semaphores = tasks[i].semaphores;
+    job->num_semaphores = tasks[i].num_semaphores;
+    job->serial = tasks[i].serial;
+  }
+  return halide_jobs_run(slots);
+}
+
+void halide_mempool_worker(uint32_t core_id) {
+  while (1) {
+    __atomic_add_fetch(&halide_idle, 1, __ATOMIC_SEQ_CST);
+    mempool_wfi();
+    if (halide_stop) {
+      break;
+    }
+    while (halide_round) {
+      if (!halide_find_work(0)) {
+        mempool_wait(16);
+      }
+    }
+  }
+}
+
+void halide_mempool_stop(void) {
+  uint32_t num_cores = mempool_get_core_count();
+  while (halide_idle != num_cores - 1) {
+    mempool_wait(16);
+  }
+  halide_idle = 0;
+  halide_stop = 1;
+  __sync_synchronize();
+  wake_up_all();
+  mempool_wfi();
 }
 
 #pragma GCC diagnostic pop
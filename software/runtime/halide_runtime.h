@@ -23,4 +23,11 @@ void halide_print(void *user_context, const char *msg);
 int halide_do_par_for(void *user_context, halide_task_t task, int min, int size,
                       uint8_t *closure);
 
+// Initialize the runtime on all cores before running pipelines
+void halide_mempool_init(uint32_t core_id);
+// Serve the parallel loops of the pipelines that core 0 runs, until core 0
+// calls `halide_mempool_stop`
+void halide_mempool_worker(uint32_t core_id);
+void halide_mempool_stop(void);
+
 #endif // __HALIDE_RUNTIME_H__
@@ -0,0 +1,79 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+/* Binary logging. `mempool_log(fmt, ...)` prints a line like `printf` does,
+ * but leaves the formatting to the host. The format string only lives in the
+ * ELF's `.log_fmt` section, which is not loaded, and the core sends a record
+ * of 32-bit words to its own log port of the UART:
+ *
+ *   (number of arguments << 24) | offset of the format in `.log_fmt`
+ *   argument 0
+ *   ...
+ *
+ * The Verilator and VCS/Questa testbenches and Spike (`--uart`) look the
+ * format up in the ELF and print the line. A record costs a store per word,
+ * instead of a call to `printf` and a store per character.
+ *
+ * The format must be a string literal, and it takes up to 8 arguments. They
+ * are sent as 32-bit integers, so only integer, character and pointer
+ * conversions make sense. Define LOG_TEXT to format on the core with `printf`
+ * instead, e.g., for simulators that cannot decode the records.
+ */
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+
+#include "printf.h"
+#include "runtime.h"
+
+extern uint32_t volatile fake_uart_log[];
+
+static inline void mempool_log_write(const uint32_t *record, uint32_t words) {
+  uint32_t volatile *port = &fake_uart_log[mempool_get_core_id()];
+  for (uint32_t i = 0; i < words; ++i) {
+    *port = record[i];
+  }
+}
+
+// Count the arguments, up to 8
+#define LOG_NARGS(...) LOG_NARGS_(, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+// Cast every argument to a word
+#define LOG_WORDS(...) LOG_WORDS_(LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define LOG_WORDS_(n, ...) LOG_WORDS__(n, ##__VA_ARGS__)
+#define LOG_WORDS__(n, ...) LOG_WORDS_##n(__VA_ARGS__)
+#define LOG_WORDS_0()
+#define LOG_WORDS_1(a) (uint32_t)(a)
+#define LOG_WORDS_2(a, ...) (uint32_t)(a), LOG_WORDS_1(__VA_ARGS__)
+#define LOG_WORDS_3(a, ...) (uint32_t)(a), LOG_WORDS_2(__VA_ARGS__)
+#define LOG_WORDS_4(a, ...) (uint32_t)(a), LOG_WORDS_3(__VA_ARGS__)
+#define LOG_WORDS_5(a, ...) (uint32_t)(a), LOG_WORDS_4(__VA_ARGS__)
+#define LOG_WORDS_6(a, ...) (uint32_t)(a), LOG_WORDS_5(__VA_ARGS__)
+#define LOG_WORDS_7(a, ...) (uint32_t)(a), LOG_WORDS_6(__VA_ARGS__)
+#define LOG_WORDS_8(a, ...) (uint32_t)(a), LOG_WORDS_7(__VA_ARGS__)
+
+#ifdef LOG_TEXT
+#define mempool_log(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#else
+// `.log_fmt` is linked at 0, so the address of a format is its offset. That
+// is out of reach of the PC-relative addresses of -mcmodel=medany, so the
+// address is loaded as an absolute value.
+#define mempool_log(fmt, ...)                                                  \
+  do {                                                                         \
+    static const char log_fmt[] __attribute__((section(".log_fmt"))) = fmt;    \
+    uint32_t log_offset;                                                       \
+    asm("lui %0, %%hi(%1)\n\taddi %0, %0, %%lo(%1)"                            \
+        : "=r"(log_offset)                                                     \
+        : "i"(log_fmt));                                                       \
+    const uint32_t log_record[] = {                                            \
+        (uint32_t)LOG_NARGS(__VA_ARGS__) << 24 | log_offset,                   \
+        LOG_WORDS(__VA_ARGS__)};                                               \
+    mempool_log_write(log_record, sizeof(log_record) / sizeof(uint32_t));      \
+  } while (0)
+#endif
+
+#endif // _LOG_H_
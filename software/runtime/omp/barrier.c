@@ -11,21 +11,14 @@
 #include "synchronization.h"
 
 extern uint32_t volatile barrier;
-extern uint32_t volatile barrier_iteration;
-extern uint32_t volatile barrier_init;
-uint32_t volatile barrier_init_gomp __attribute__((section(".l2"))) = 0;
+
+/* The barrier counter is reset by gomp_new_work_share() before the first
+   parallel region, while the master is the only core running. */
+void gomp_barrier_init() { barrier = 0; }
 
 void mempool_barrier_gomp(uint32_t core_id, uint32_t num_cores) {
-  if (barrier_init_gomp == 0) {
-    if (core_id == 0) {
-      // Initialize the barrier
-      barrier = 0;
-      wake_up_all();
-      mempool_wfi();
-    } else {
-      mempool_wfi();
-    }
-  }
+  // All tasks complete at a barrier
+  gomp_task_drain(core_id);
   mempool_barrier(num_cores);
 }
 
@@ -36,6 +36,7 @@
 #include "printf.h"
 #include "runtime.h"
 #include "synchronization.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -46,6 +47,7 @@
 /* barrier.c */
 extern void GOMP_barrier(void);
 extern void mempool_barrier_gomp(uint32_t, uint32_t);
+extern void gomp_barrier_init(void);
 
 /* critical.c */
 extern void GOMP_atomic_start(void);
@@ -54,10 +56,23 @@ extern void GOMP_critical_start(void);
 extern void GOMP_critical_end(void);
 
 /* loop.c */
+extern void gomp_loop_init(int, int, int, int);
+extern int GOMP_loop_static_start(int, int, int, int, int *, int *);
+extern int GOMP_loop_static_next(int *, int *);
 extern int GOMP_loop_dynamic_start(int, int, int, int, int *, int *);
 extern int GOMP_loop_dynamic_next(int *, int *);
+extern int GOMP_loop_guided_start(int, int, int, int, int *, int *);
+extern int GOMP_loop_guided_next(int *, int *);
+extern int GOMP_loop_runtime_start(int, int, int, int *, int *);
+extern int GOMP_loop_runtime_next(int *, int *);
+extern void GOMP_parallel_loop_static(void (*)(void *), void *, unsigned, long,
+                                      long, long, long);
 extern void GOMP_parallel_loop_dynamic(void (*)(void *), void *, unsigned, long,
                                        long, long, long);
+extern void GOMP_parallel_loop_guided(void (*)(void *), void *, unsigned, long,
+                                      long, long, long);
+extern void GOMP_parallel_loop_runtime(void (*)(void *), void *, unsigned, long,
+                                       long, long);
 extern void GOMP_loop_end(void);
 extern void GOMP_loop_end_nowait(void);
 
@@ -80,9 +95,16 @@ extern int GOMP_single_start(void);
 extern void *GOMP_single_copy_start(void);
 extern void GOMP_single_copy_end(void *);
 
+/* task.c */
+extern void GOMP_task(void (*)(void *), void *, void (*)(void *, void *), long,
+                      long, bool, unsigned);
+extern void GOMP_taskwait(void);
+extern void gomp_task_drain(uint32_t);
+
 /* work.c */
 extern void gomp_new_work_share(void);
 extern int gomp_work_share_start(void);
+extern uint32_t gomp_victim(uint32_t, uint32_t, uint32_t);
 
 /* parallel.c */
 extern void set_event(void (*fn)(void *), void *data, uint32_t nthreads);
@@ -93,14 +115,22 @@ typedef struct {
   void *data;
   uint32_t nthreads;
   uint32_t barrier;
+  // Core that started the team, woken up by the last thread to finish
+  uint32_t master;
+  // Whether any task was deferred in this parallel region
+  uint32_t tasks;
   uint8_t thread_pool[NUM_CORES];
 } event_t;
 
 typedef struct {
+  int start;
   int end;
   int next;
   int chunk_size;
   int incr;
+  // Number of iterations and generation of the current dynamic loop
+  int num_iterations;
+  uint32_t loop_gen;
 
   omp_lock_t lock;
 
@@ -115,6 +145,44 @@ typedef struct {
   omp_lock_t atomic_lock;
 } work_t;
 
+/* Scheduling queues of each thread, for work stealing. Both structures are
+   16 bytes, so that with a banking factor of 4 and arrays aligned to a row of
+   all banks, a thread's queues lie in its own banks. The lock of the loop
+   queue also protects the task queue. */
+typedef struct {
+  omp_lock_t lock;
+  // Generation of the loop that the range belongs to
+  uint32_t gen;
+  // Range of iterations (numbered from 0) that are left
+  int next;
+  int end;
+} gomp_loop_queue_t;
+
+typedef struct {
+  // Ring of GOMP_TASK_SLOTS deferred tasks. The owner pushes and pops at the
+  // tail, thieves steal at the head.
+  uint32_t head;
+  uint32_t tail;
+  // Children of the thread's implicit task that have not completed
+  uint32_t children;
+  // Children counter of the task that the thread currently runs
+  uint32_t volatile *current;
+} gomp_task_queue_t;
+
+/* Iterations of a thread in a static loop, in the loop's own units. Only the
+   thread itself uses them, so they are kept in its banks as well. */
+typedef struct {
+  // Start of the next chunk and end of the thread's iterations
+  int next;
+  int end;
+  // Size of a chunk and distance to the thread's following chunk
+  int chunk;
+  int stride;
+} gomp_static_loop_t;
+
 extern event_t event;
 extern work_t works;
+extern gomp_loop_queue_t volatile gomp_loop_queues[NUM_CORES];
+extern gomp_task_queue_t volatile gomp_task_queues[NUM_CORES];
+extern gomp_static_loop_t gomp_static_loops[NUM_CORES];
 #endif /* __LIBGOMP_H__ */
@@ -10,71 +10,292 @@
 #include "runtime.h"
 #include "synchronization.h"
 
+/* Dynamic and guided loops are scheduled by work stealing. Every thread
+   starts with an equal share of the chunks of the loop in its own queue and
+   takes chunks from its front. Once its queue is empty, it steals the back
+   half of the chunks of another thread. This replaces a single counter shared
+   by all threads with queues that are mostly accessed by their owner only.
+   Guided loops take half of what is left in the own queue at once, down to a
+   single chunk.
+
+   Static loops need no shared state at all. Every thread computes its
+   iterations from the bounds of the loop and keeps them in its own banks. */
+
+// Schedule of `schedule(runtime)` loops (the run-sched-var ICV)
+static omp_sched_t gomp_run_sched_var = omp_sched_static;
+static int gomp_run_sched_chunk = 0;
+
+static int gomp_loop_iterations(int start, int end, int incr) {
+  int n;
+  if (incr > 0) {
+    n = (end - start + incr - 1) / incr;
+  } else {
+    n = (start - end - incr - 1) / -incr;
+  }
+  return n > 0 ? n : 0;
+}
+
 void gomp_loop_init(int start, int end, int incr, int chunk_size) {
-  works.chunk_size = chunk_size;
+  works.chunk_size = chunk_size > 0 ? chunk_size : 1;
+  works.start = start;
   works.end = end;
   works.incr = incr;
   works.next = start;
+  works.num_iterations = gomp_loop_iterations(start, end, incr);
+  // Invalidates the queues of the previous loop
+  __atomic_add_fetch(&works.loop_gen, 1, __ATOMIC_SEQ_CST);
 }
 
-/*********************** APIs *****************************/
+/* Set up the static loop of `thread`. Without a chunk size, every thread gets
+   one block of consecutive iterations, and the first `n % nthreads` threads
+   one iteration more. With a chunk size, the threads take turns on the
+   chunks. Full teams divide by the constant NUM_CORES, a power of two that
+   turns the divisions into shifts. */
+static void gomp_loop_static_init(uint32_t thread, uint32_t nthreads,
+                                  int start, int end, int incr,
+                                  int chunk_size) {
+  gomp_static_loop_t *loop = &gomp_static_loops[thread];
+  uint32_t n = (uint32_t)gomp_loop_iterations(start, end, incr);
+  uint32_t first, last;
 
-int GOMP_loop_dynamic_start(int start, int end, int incr, int chunk_size,
-                            int *istart, int *iend) {
-  int chunk, left;
-  int ret = 1;
+  if (chunk_size <= 0) {
+    uint32_t q, t;
+    if (nthreads == NUM_CORES) {
+      q = n / NUM_CORES;
+      t = n % NUM_CORES;
+    } else {
+      q = n / nthreads;
+      t = n % nthreads;
+    }
+    if (thread < t) {
+      q++;
+      t = 0;
+    }
+    first = q * thread + t;
+    last = first + q;
+    loop->chunk = (int)q * incr;
+    loop->stride = loop->chunk;
+  } else {
+    uint32_t chunk = (uint32_t)chunk_size;
+    // Beyond the last chunk of the thread, the stride only has to reach `n`
+    uint32_t stride = chunk > n / nthreads ? n : chunk * nthreads;
+    first = thread && chunk > n / thread ? n : chunk * thread;
+    last = n;
+    loop->chunk = chunk_size * incr;
+    loop->stride = (int)stride * incr;
+  }
+  loop->next = start + (int)first * incr;
+  loop->end = start + (int)last * incr;
+}
 
-  if (gomp_work_share_start()) { // work returns locked
-    gomp_loop_init(start, end, incr, chunk_size);
+/* Return the next chunk of the thread's static loop. The bounds are always
+   on the iteration grid, so the loop ends exactly at `end`. */
+static int gomp_loop_static_next(int *istart, int *iend) {
+  gomp_static_loop_t *loop = &gomp_static_loops[omp_get_thread_num()];
+  int left = loop->end - loop->next;
+
+  if (left == 0) {
+    return 0;
   }
-  gomp_hal_unlock(&works.lock);
+  *istart = loop->next;
+  if (loop->chunk > 0 ? left <= loop->chunk : left >= loop->chunk) {
+    *iend = loop->end;
+  } else {
+    *iend = loop->next + loop->chunk;
+  }
+  if (loop->stride > 0 ? left <= loop->stride : left >= loop->stride) {
+    loop->next = loop->end;
+  } else {
+    loop->next += loop->stride;
+  }
+  return 1;
+}
+
+/* Set up the static loops of all threads of the team before it starts */
+static void gomp_loop_static_init_team(unsigned num_threads, int start,
+                                       int end, int incr, int chunk_size) {
+  uint32_t nthreads = num_threads ? num_threads : mempool_get_core_count();
+  for (uint32_t i = 0; i < nthreads; i++) {
+    gomp_loop_static_init(i, nthreads, start, end, incr, chunk_size);
+  }
+}
 
-  chunk = chunk_size * incr;
+/* Give the queue of `thread` its initial share of the current loop, unless
+   it already has it. Thieves do this for threads that did not get to the loop
+   yet. The queue must be locked. */
+static void gomp_loop_queue_init(uint32_t thread) {
+  gomp_loop_queue_t volatile *queue = &gomp_loop_queues[thread];
+  if (queue->gen != works.loop_gen) {
+    int chunk = works.chunk_size;
+    int num_chunks = (works.num_iterations + chunk - 1) / chunk;
+    int nthreads = (int)event.nthreads;
+    int first = (int)thread * num_chunks / nthreads * chunk;
+    int last = ((int)thread + 1) * num_chunks / nthreads * chunk;
+    queue->gen = works.loop_gen;
+    queue->next = first;
+    queue->end = last < works.num_iterations ? last : works.num_iterations;
+  }
+}
 
-  start = __atomic_fetch_add(&works.next, chunk, __ATOMIC_SEQ_CST);
+/* Take the next chunk from the front of the thread's own queue, or half of
+   the queue's chunks for guided loops */
+static int gomp_loop_take(uint32_t thread, int guided, int *first,
+                          int *last) {
+  gomp_loop_queue_t volatile *queue = &gomp_loop_queues[thread];
+  int ret = 0;
 
-  if (start >= works.end) {
-    ret = 0;
+  gomp_hal_lock(&queue->lock);
+  gomp_loop_queue_init(thread);
+  if (queue->next < queue->end) {
+    int chunk = works.chunk_size;
+    int size = chunk;
+    if (guided) {
+      int half = (queue->end - queue->next) / 2;
+      if (half > chunk) {
+        size = half / chunk * chunk;
+      }
+    }
+    *first = queue->next;
+    *last = *first + size;
+    if (*last > queue->end) {
+      *last = queue->end;
+    }
+    queue->next = *last;
+    ret = 1;
   }
+  gomp_hal_unlock(&queue->lock);
+  return ret;
+}
 
-  if (ret) {
-    left = works.end - start;
+/* Move the back half of the chunks of another thread to the own queue */
+static int gomp_loop_steal(uint32_t thread) {
+  uint32_t offset = mempool_get_timer() * 2654435761U;
+  uint32_t attempts = NUM_CORES_PER_TILE - 1 + event.nthreads;
 
-    if (chunk > left) {
-      end = works.end;
-    } else {
-      end = start + chunk;
+  for (uint32_t attempt = 0; attempt < attempts; attempt++) {
+    uint32_t victim = gomp_victim(thread, attempt, offset);
+    gomp_loop_queue_t volatile *queue = &gomp_loop_queues[victim];
+    int first, last;
+
+    // Skip busy victims rather than waiting for them
+    if (victim == thread || !gomp_hal_trylock(&queue->lock)) {
+      continue;
+    }
+    gomp_loop_queue_init(victim);
+    int chunk = works.chunk_size;
+    int num_chunks = (queue->end - queue->next + chunk - 1) / chunk;
+    if (num_chunks <= 0) {
+      gomp_hal_unlock(&queue->lock);
+      continue;
     }
+    first = queue->next + (num_chunks / 2) * chunk;
+    last = queue->end;
+    queue->end = first;
+    gomp_hal_unlock(&queue->lock);
+
+    queue = &gomp_loop_queues[thread];
+    gomp_hal_lock(&queue->lock);
+    queue->next = first;
+    queue->end = last;
+    gomp_hal_unlock(&queue->lock);
+    return 1;
   }
+  return 0;
+}
 
-  *istart = start;
-  *iend = end;
+static int gomp_loop_stealing_next(int guided, int *istart, int *iend) {
+  uint32_t thread = omp_get_thread_num();
+  int first, last;
 
-  return ret;
+  while (!gomp_loop_take(thread, guided, &first, &last)) {
+    if (!gomp_loop_steal(thread)) {
+      return 0;
+    }
+  }
+
+  *istart = works.start + first * works.incr;
+  *iend = works.start + last * works.incr;
+  return 1;
 }
 
-int GOMP_loop_dynamic_next(int *istart, int *iend) {
-  int start, end, chunk, left;
+/*********************** APIs *****************************/
 
-  chunk = works.chunk_size * works.incr;
-  start = __atomic_fetch_add(&works.next, chunk, __ATOMIC_SEQ_CST);
+int GOMP_loop_static_start(int start, int end, int incr, int chunk_size,
+                           int *istart, int *iend) {
+  gomp_loop_static_init(omp_get_thread_num(), event.nthreads, start, end, incr,
+                        chunk_size);
+  return gomp_loop_static_next(istart, iend);
+}
 
-  if (start >= works.end) {
-    return 0;
+int GOMP_loop_static_next(int *istart, int *iend) {
+  return gomp_loop_static_next(istart, iend);
+}
+
+int GOMP_loop_dynamic_start(int start, int end, int incr, int chunk_size,
+                            int *istart, int *iend) {
+  if (gomp_work_share_start()) { // work returns locked
+    gomp_loop_init(start, end, incr, chunk_size);
   }
+  gomp_hal_unlock(&works.lock);
 
-  left = works.end - start;
+  return gomp_loop_stealing_next(0, istart, iend);
+}
 
-  if (chunk > left) {
-    end = works.end;
-  } else {
-    end = start + chunk;
+int GOMP_loop_dynamic_next(int *istart, int *iend) {
+  return gomp_loop_stealing_next(0, istart, iend);
+}
+
+int GOMP_loop_guided_start(int start, int end, int incr, int chunk_size,
+                           int *istart, int *iend) {
+  if (gomp_work_share_start()) { // work returns locked
+    gomp_loop_init(start, end, incr, chunk_size);
   }
+  gomp_hal_unlock(&works.lock);
 
-  *istart = start;
-  *iend = end;
+  return gomp_loop_stealing_next(1, istart, iend);
+}
 
-  return 1;
+int GOMP_loop_guided_next(int *istart, int *iend) {
+  return gomp_loop_stealing_next(1, istart, iend);
+}
+
+int GOMP_loop_runtime_start(int start, int end, int incr, int *istart,
+                            int *iend) {
+  switch (gomp_run_sched_var) {
+  case omp_sched_dynamic:
+    return GOMP_loop_dynamic_start(start, end, incr, gomp_run_sched_chunk,
+                                   istart, iend);
+  case omp_sched_guided:
+    return GOMP_loop_guided_start(start, end, incr, gomp_run_sched_chunk,
+                                  istart, iend);
+  default:
+    return GOMP_loop_static_start(start, end, incr, gomp_run_sched_chunk,
+                                  istart, iend);
+  }
+}
+
+int GOMP_loop_runtime_next(int *istart, int *iend) {
+  switch (gomp_run_sched_var) {
+  case omp_sched_dynamic:
+    return GOMP_loop_dynamic_next(istart, iend);
+  case omp_sched_guided:
+    return GOMP_loop_guided_next(istart, iend);
+  default:
+    return GOMP_loop_static_next(istart, iend);
+  }
+}
+
+void GOMP_parallel_loop_static(void (*fn)(void *), void *data,
+                               unsigned num_threads, long start, long end,
+                               long incr, long chunk_size) {
+  uint32_t core_id = mempool_get_core_id();
+
+  gomp_new_work_share();
+  gomp_loop_static_init_team(num_threads, start, end, incr, chunk_size);
+
+  GOMP_parallel_start(fn, data, num_threads);
+  run_task(core_id);
+  GOMP_parallel_end();
 }
 
 void GOMP_parallel_loop_dynamic(void (*fn)(void *), void *data,
@@ -90,6 +311,26 @@ void GOMP_parallel_loop_dynamic(void (*fn)(void *), void *data,
   GOMP_parallel_end();
 }
 
+void GOMP_parallel_loop_guided(void (*fn)(void *), void *data,
+                               unsigned num_threads, long start, long end,
+                               long incr, long chunk_size) {
+  GOMP_parallel_loop_dynamic(fn, data, num_threads, start, end, incr,
+                             chunk_size);
+}
+
+void GOMP_parallel_loop_runtime(void (*fn)(void *), void *data,
+                                unsigned num_threads, long start, long end,
+                                long incr) {
+  if (gomp_run_sched_var == omp_sched_dynamic ||
+      gomp_run_sched_var == omp_sched_guided) {
+    GOMP_parallel_loop_dynamic(fn, data, num_threads, start, end, incr,
+                               gomp_run_sched_chunk);
+  } else {
+    GOMP_parallel_loop_static(fn, data, num_threads, start, end, incr,
+                              gomp_run_sched_chunk);
+  }
+}
+
 void GOMP_loop_end() {
   uint32_t core_id = mempool_get_core_id();
   mempool_barrier_gomp(core_id, event.nthreads);
@@ -97,6 +338,13 @@ void GOMP_loop_end() {
 
 void GOMP_loop_end_nowait() {}
 
+int GOMP_loop_ull_static_start(int start, int end, int incr, int chunk_size,
+                               int *istart, int *iend) {
+  return GOMP_loop_static_start(start, end, incr, chunk_size, istart, iend);
+}
+int GOMP_loop_ull_static_next(int *istart, int *iend) {
+  return GOMP_loop_static_next(istart, iend);
+}
 int GOMP_loop_ull_dynamic_start(int start, int end, int incr, int chunk_size,
                                 int *istart, int *iend) {
   return GOMP_loop_dynamic_start(start, end, incr, chunk_size, istart, iend);
@@ -104,3 +352,21 @@ int GOMP_loop_ull_dynamic_start(int start, int end, int incr, int chunk_size,
 int GOMP_loop_ull_dynamic_next(int *istart, int *iend) {
   return GOMP_loop_dynamic_next(istart, iend);
 }
+int GOMP_loop_ull_guided_start(int start, int end, int incr, int chunk_size,
+                               int *istart, int *iend) {
+  return GOMP_loop_guided_start(start, end, incr, chunk_size, istart, iend);
+}
+int GOMP_loop_ull_guided_next(int *istart, int *iend) {
+  return GOMP_loop_guided_next(istart, iend);
+}
+
+/* The public OpenMP API for the schedule of `schedule(runtime)` loops.  */
+void omp_set_schedule(omp_sched_t kind, int chunk_size) {
+  gomp_run_sched_var = kind;
+  gomp_run_sched_chunk = chunk_size;
+}
+
+void omp_get_schedule(omp_sched_t *kind, int *chunk_size) {
+  *kind = gomp_run_sched_var;
+  *chunk_size = gomp_run_sched_chunk;
+}
@@ -14,7 +14,7 @@
 typedef uint32_t omp_lock_t;
 
 /* gomp_hal_lock() - block until able to acquire lock "lock" */
-static inline void gomp_hal_lock(omp_lock_t *lock) {
+static inline void gomp_hal_lock(omp_lock_t volatile *lock) {
   uint32_t islocked;
   uint32_t num_cores = mempool_get_core_count();
 
@@ -25,8 +25,14 @@ static inline void gomp_hal_lock(omp_lock_t *lock) {
   }
 }
 
+/* gomp_hal_trylock() - acquire lock "lock" if it is free, return whether it
+   was */
+static inline int gomp_hal_trylock(omp_lock_t volatile *lock) {
+  return !__atomic_fetch_or(lock, 1, __ATOMIC_SEQ_CST);
+}
+
 /* gomp_hal_unlock() - release lock "lock" */
-static inline void gomp_hal_unlock(omp_lock_t *lock) {
+static inline void gomp_hal_unlock(omp_lock_t volatile *lock) {
   __atomic_fetch_and(lock, 0, __ATOMIC_SEQ_CST);
 }
 
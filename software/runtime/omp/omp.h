@@ -7,6 +7,17 @@
 #ifndef __OMP_H__
 #define __OMP_H__
 
+typedef enum omp_sched_t {
+  omp_sched_static = 1,
+  omp_sched_dynamic = 2,
+  omp_sched_guided = 3,
+  omp_sched_auto = 4
+} omp_sched_t;
+
+/* loop.c */
+extern void omp_set_schedule(omp_sched_t, int);
+extern void omp_get_schedule(omp_sched_t *, int *);
+
 /* parallel.c */
 extern uint32_t omp_get_num_threads(void);
 extern uint32_t omp_get_thread_num(void);
@@ -17,6 +17,8 @@ void set_event(void (*fn)(void *), void *data, uint32_t nthreads) {
   uint32_t num_cores = mempool_get_core_count();
   event.fn = fn;
   event.data = data;
+  event.master = mempool_get_core_id();
+  event.tasks = 0;
   if (nthreads == 0) {
     event.nthreads = num_cores;
     event.barrier = num_cores;
@@ -33,22 +35,34 @@ void set_event(void (*fn)(void *), void *data, uint32_t nthreads) {
 void run_task(uint32_t core_id) {
   if (event.thread_pool[core_id]) {
     event.fn(event.data);
-    __atomic_add_fetch(&event.barrier, -1, __ATOMIC_SEQ_CST);
+    gomp_task_drain(core_id);
+    // The last thread to finish wakes up the master
+    if (__atomic_add_fetch(&event.barrier, -1, __ATOMIC_SEQ_CST) == 0) {
+      wake_up(event.master);
+    }
   }
 }
 
 void GOMP_parallel_start(void (*fn)(void *), void *data,
                          unsigned int num_threads) {
   set_event(fn, data, num_threads);
-  wake_up_all();
-  mempool_wfi();
+  if (event.nthreads == mempool_get_core_count()) {
+    wake_up_all();
+    mempool_wfi();
+  } else {
+    // Only wake up the team, so that the other cores do not pick up a later
+    // event while they are still handling the wake-up for this one
+    for (uint32_t i = 0; i < event.nthreads; i++) {
+      if (i != event.master) {
+        wake_up(i);
+      }
+    }
+  }
 }
 
 void GOMP_parallel_end(void) {
-  uint32_t num_cores = mempool_get_core_count();
-  while (event.barrier > 0) {
-    mempool_wait(4 * num_cores);
-  }
+  // Sleep until the last thread finished, rather than polling event.barrier
+  mempool_wfi();
 }
 
 #pragma GCC diagnostic push
@@ -0,0 +1,188 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+/* This file handles the TASK and TASKWAIT constructs.  */
+
+#include "encoding.h"
+#include "libgomp.h"
+#include "printf.h"
+#include "runtime.h"
+#include "synchronization.h"
+
+/* Every thread queues the tasks that it defers in a small ring of task slots
+   in its own tile. The thread itself runs its newest task first, while idle
+   threads steal the oldest ones. When the ring is full, or the task needs
+   more than the slot offers, the task runs right away instead. */
+
+// Deferred tasks per thread (must be a power of 2)
+#ifndef GOMP_TASK_SLOTS
+#define GOMP_TASK_SLOTS 4
+#endif
+
+#define GOMP_TASK_FLAG_FINAL (1 << 1)
+#define GOMP_TASK_FLAG_DEPEND (1 << 3)
+
+typedef struct {
+  void (*fn)(void *);
+  // Children counter of the task that created this one
+  uint32_t volatile *parent;
+  // Copy of the task's arguments
+  uint64_t data[3];
+} gomp_task_t;
+
+// Task slots that fit in one row of a tile's banks, and of all banks
+#define GOMP_TASKS_PER_TILE_ROW                                                \
+  (NUM_CORES_PER_TILE * BANKING_FACTOR * 4 / sizeof(gomp_task_t))
+#define GOMP_TASKS_PER_ROW (NUM_CORES * BANKING_FACTOR * 4 / sizeof(gomp_task_t))
+
+gomp_task_t gomp_task_pool[NUM_CORES * GOMP_TASK_SLOTS]
+    __attribute__((aligned(NUM_CORES * BANKING_FACTOR * 4), section(".l1")));
+
+/* Return the `index`-th slot of `thread`. The slots of a tile fill the
+   tile's part of consecutive rows, so that they stay in the tile's banks. */
+static inline gomp_task_t *gomp_task_slot(uint32_t thread, uint32_t index) {
+  uint32_t tile = thread / NUM_CORES_PER_TILE;
+  uint32_t slot = (thread % NUM_CORES_PER_TILE) * GOMP_TASK_SLOTS +
+                  index % GOMP_TASK_SLOTS;
+  return &gomp_task_pool[slot / GOMP_TASKS_PER_TILE_ROW * GOMP_TASKS_PER_ROW +
+                         tile * GOMP_TASKS_PER_TILE_ROW +
+                         slot % GOMP_TASKS_PER_TILE_ROW];
+}
+
+/* Take a task of `victim`, the newest one if it is the thread itself and the
+   oldest one otherwise, and copy it to `task` */
+static int gomp_task_pop(uint32_t thread, uint32_t victim, gomp_task_t *task) {
+  gomp_task_queue_t volatile *queue = &gomp_task_queues[victim];
+  omp_lock_t volatile *lock = &gomp_loop_queues[victim].lock;
+  uint32_t index;
+
+  if (queue->head == queue->tail) {
+    return 0;
+  }
+  if (victim == thread) {
+    gomp_hal_lock(lock);
+  } else if (!gomp_hal_trylock(lock)) {
+    return 0;
+  }
+  if (queue->head == queue->tail) {
+    gomp_hal_unlock(lock);
+    return 0;
+  }
+  index = victim == thread ? --queue->tail : queue->head++;
+  *task = *gomp_task_slot(victim, index);
+  gomp_hal_unlock(lock);
+  return 1;
+}
+
+/* Find a task to run, in the own queue first and then in those of others */
+static int gomp_task_next(uint32_t thread, gomp_task_t *task) {
+  uint32_t offset = mempool_get_timer() * 2654435761U;
+  uint32_t attempts = NUM_CORES_PER_TILE - 1 + event.nthreads;
+
+  if (gomp_task_pop(thread, thread, task)) {
+    return 1;
+  }
+  for (uint32_t attempt = 0; attempt < attempts; attempt++) {
+    uint32_t victim = gomp_victim(thread, attempt, offset);
+    if (victim != thread && gomp_task_pop(thread, victim, task)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void gomp_task_wait(uint32_t thread, uint32_t volatile *children);
+
+/* Run a task. It has its own children counter and waits for its children
+   before it completes, so that they never update the counter of a task that
+   is gone. */
+static void gomp_task_run(uint32_t thread, void (*fn)(void *), void *data,
+                          uint32_t volatile *parent) {
+  gomp_task_queue_t volatile *queue = &gomp_task_queues[thread];
+  uint32_t volatile *current = queue->current;
+  uint32_t volatile children = 0;
+
+  queue->current = &children;
+  fn(data);
+  gomp_task_wait(thread, &children);
+  queue->current = current;
+  if (parent) {
+    __atomic_add_fetch(parent, -1, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* Run other tasks until all children counted by `children` completed */
+static void gomp_task_wait(uint32_t thread, uint32_t volatile *children) {
+  gomp_task_t task;
+
+  while (*children) {
+    if (gomp_task_next(thread, &task)) {
+      gomp_task_run(thread, task.fn, task.data, task.parent);
+    } else {
+      mempool_wait(16);
+    }
+  }
+}
+
+/* Run the tasks that are still queued, before a barrier or the end of the
+   parallel region */
+void gomp_task_drain(uint32_t thread) {
+  gomp_task_t task;
+
+  if (!event.tasks) {
+    return;
+  }
+  while (gomp_task_next(thread, &task)) {
+    gomp_task_run(thread, task.fn, task.data, task.parent);
+  }
+}
+
+/*********************** APIs *****************************/
+
+void GOMP_task(void (*fn)(void *), void *data,
+               void (*cpyfn)(void *, void *), long arg_size, long arg_align,
+               bool if_clause, unsigned flags) {
+  uint32_t thread = omp_get_thread_num();
+  gomp_task_queue_t volatile *queue = &gomp_task_queues[thread];
+  omp_lock_t volatile *lock = &gomp_loop_queues[thread].lock;
+
+  // Dependencies are only met by running the task after all earlier ones
+  if (flags & GOMP_TASK_FLAG_DEPEND) {
+    GOMP_taskwait();
+  } else if (if_clause && !(flags & GOMP_TASK_FLAG_FINAL) && !cpyfn &&
+             arg_size <= (long)sizeof(((gomp_task_t *)0)->data) &&
+             arg_align <= 8 && event.nthreads > 1) {
+    gomp_hal_lock(lock);
+    if (queue->tail - queue->head < GOMP_TASK_SLOTS) {
+      gomp_task_t *task = gomp_task_slot(thread, queue->tail);
+      task->fn = fn;
+      task->parent = queue->current;
+      memcpy(task->data, data, (size_t)arg_size);
+      __atomic_add_fetch(queue->current, 1, __ATOMIC_SEQ_CST);
+      queue->tail++;
+      gomp_hal_unlock(lock);
+      if (!event.tasks) {
+        event.tasks = 1;
+      }
+      return;
+    }
+    gomp_hal_unlock(lock);
+  }
+
+  // Run the task right away
+  if (cpyfn) {
+    char buf[arg_size + arg_align - 1];
+    char *arg = (char *)(((uintptr_t)buf + (uintptr_t)arg_align - 1) &
+                         ~((uintptr_t)arg_align - 1));
+    cpyfn(arg, data);
+    gomp_task_run(thread, fn, arg, NULL);
+  } else {
+    gomp_task_run(thread, fn, data, NULL);
+  }
+}
+
+void GOMP_taskwait(void) {
+  uint32_t thread = omp_get_thread_num();
+  gomp_task_wait(thread, gomp_task_queues[thread].current);
+}
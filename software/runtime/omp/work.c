@@ -8,7 +8,35 @@
 #include "runtime.h"
 #include "synchronization.h"
 
+gomp_loop_queue_t volatile gomp_loop_queues[NUM_CORES]
+    __attribute__((aligned(NUM_CORES * 16), section(".l1")));
+gomp_task_queue_t volatile gomp_task_queues[NUM_CORES]
+    __attribute__((aligned(NUM_CORES * 16), section(".l1")));
+gomp_static_loop_t gomp_static_loops[NUM_CORES]
+    __attribute__((aligned(NUM_CORES * 16), section(".l1")));
+uint32_t volatile gomp_inited __attribute__((section(".l2"))) = 0;
+
+/* The shared state in L1 is only reset before the first parallel region,
+   while the master is the only core running. Afterwards, a loop queue of an
+   earlier loop is recognized by its generation, and all task queues are empty
+   at the end of a parallel region. */
+static void gomp_init() {
+  gomp_barrier_init();
+  for (uint32_t i = 0; i < NUM_CORES; i++) {
+    gomp_loop_queues[i].lock = 0;
+    gomp_loop_queues[i].gen = works.loop_gen;
+    gomp_task_queues[i].head = 0;
+    gomp_task_queues[i].tail = 0;
+    gomp_task_queues[i].children = 0;
+    gomp_task_queues[i].current = &gomp_task_queues[i].children;
+  }
+  gomp_inited = 1;
+}
+
 void gomp_new_work_share() {
+  if (!gomp_inited) {
+    gomp_init();
+  }
   works.lock = 0;
   works.checkfirst = WS_NOT_INITED;
   works.completed = 0;
@@ -30,3 +58,19 @@ int gomp_work_share_start(void) {
 
   return ret;
 }
+
+/* Return the victim of the `attempt`-th steal of thread `thread`. Thieves
+   first try the other threads of their own tile, whose queues are close, and
+   then all threads of the team, starting from a random one so that they do
+   not all rush to the same victim. Attempts from 0 to NUM_CORES_PER_TILE - 2
+   and the following nthreads attempts cover every other thread at least
+   once. */
+uint32_t gomp_victim(uint32_t thread, uint32_t attempt, uint32_t offset) {
+  uint32_t nthreads = event.nthreads;
+  if (attempt < NUM_CORES_PER_TILE - 1) {
+    uint32_t tile = thread - thread % NUM_CORES_PER_TILE;
+    uint32_t victim = tile + (thread + attempt + 1) % NUM_CORES_PER_TILE;
+    return victim < nthreads ? victim : thread;
+  }
+  return (offset + attempt) % nthreads;
+}
@@ -46,6 +46,14 @@ extern "C" {
  */
 void _putchar(char character);
 
+/**
+ * _putchar buffers the characters of each core in its own tile and sends them
+ * to the UART line by line. serial_init empties the buffer of the calling
+ * core, and serial_flush sends what it holds. crt0 calls both around main.
+ */
+void serial_init(void);
+void serial_flush(void);
+
 /**
  * Tiny printf implementation
  * You have to implement _putchar if you use printf()
@@ -0,0 +1,455 @@
+// Copyright 2022 ETH Zurich and University of Bologna.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+/* This library implements bounded queues in L1 for any element type.
+ *
+ * Both queues have a power-of-two capacity, so that free-running head and
+ * tail counters map to slots with a mask.
+ *
+ * The single-producer single-consumer queue (spsc_queue_t) only needs loads
+ * and stores. All slots are usable, because the counters tell full from
+ * empty.
+ *
+ * The multi-producer multi-consumer queue (mpmc_queue_t) hands out tickets
+ * with atomic adds. Each slot has a turn counter that tells which ticket may
+ * use it next. A blocking push or pop therefore takes a single AMO and never
+ * retries, and a batch of n elements takes n consecutive tickets with one
+ * AMO. The non-blocking variants take a ticket with compare-and-swap only if
+ * its slot is ready.
+ *
+ * Blocking calls either poll with a backoff, or, for queues created with
+ * `wfi` set, sleep until the other side wakes them. A sleeping core
+ * registers in a waiter word. Whoever swaps a core out of that word wakes
+ * it, so that every wake-up meets exactly one `wfi`.
+ */
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <stdint.h>
+
+#include "alloc.h"
+#include "runtime.h"
+
+// Cycles between two polls of a blocking call
+#ifndef QUEUE_BACKOFF
+#define QUEUE_BACKOFF 8
+#endif
+
+typedef struct {
+  char *array;
+  uint32_t mask;
+  uint32_t size; // Bytes per element
+  uint32_t wfi;
+  uint32_t volatile head;
+  uint32_t volatile tail;
+  // Cores that sleep until there is data or space (core ID + 1, or 0)
+  uint32_t volatile pop_waiter;
+  uint32_t volatile push_waiter;
+} spsc_queue_t;
+
+typedef struct {
+  char *array;
+  // Ticket that may use each slot next, and the core that sleeps on it
+  uint32_t volatile *turn;
+  uint32_t volatile *waiter;
+  uint32_t mask;
+  uint32_t size; // Bytes per element
+  uint32_t volatile head;
+  uint32_t volatile tail;
+} mpmc_queue_t;
+
+// ----------------------------------------------------------------------------
+// Helpers
+// ----------------------------------------------------------------------------
+
+static inline uint32_t queue_capacity(uint32_t capacity) {
+  uint32_t pow2 = 1;
+  while (pow2 < capacity) {
+    pow2 <<= 1;
+  }
+  return pow2;
+}
+
+/* Copy elements of any other size, out of line since they are rarely hot */
+static void __attribute__((noinline))
+queue_copy_any(void *dst, const void *src, const uint32_t size) {
+  if (!(size & 3)) {
+    for (uint32_t i = 0; i < size / 4; ++i) {
+      ((int32_t *)dst)[i] = ((const int32_t *)src)[i];
+    }
+  } else {
+    for (uint32_t i = 0; i < size; ++i) {
+      ((int8_t *)dst)[i] = ((const int8_t *)src)[i];
+    }
+  }
+}
+
+static inline void queue_copy(void *dst, const void *src, const uint32_t size) {
+  switch (size) {
+  case 1:
+    *(int8_t *)dst = *(const int8_t *)src;
+    break;
+  case 2:
+    *(int16_t *)dst = *(const int16_t *)src;
+    break;
+  case 4:
+    *(int32_t *)dst = *(const int32_t *)src;
+    break;
+  default:
+    queue_copy_any(dst, src, size);
+  }
+}
+
+/* Wake the core that sleeps on `waiter`, after the caller changed the state
+   that it waits for */
+static inline void queue_signal(uint32_t volatile *waiter) {
+  __sync_synchronize();
+  if (*waiter) {
+    uint32_t core = __atomic_exchange_n(waiter, 0, __ATOMIC_SEQ_CST);
+    if (core) {
+      wake_up(core - 1);
+    }
+  }
+}
+
+/* Whether the counter `value` reached `expected` */
+static inline int queue_reached(uint32_t volatile *value, uint32_t expected) {
+  return (int32_t)(*value - expected) >= 0;
+}
+
+/* Sleep on `waiter` until the counter `value` reaches `expected` */
+static inline void queue_sleep(uint32_t volatile *waiter,
+                               uint32_t volatile *value, uint32_t expected) {
+  const uint32_t self = mempool_get_core_id() + 1;
+  while (!queue_reached(value, expected)) {
+    uint32_t other = __atomic_exchange_n(waiter, self, __ATOMIC_SEQ_CST);
+    if (other) {
+      // Hand the slot back to the core that waited before
+      wake_up(other - 1);
+    }
+    if (!queue_reached(value, expected)) {
+      // Whoever swaps us out wakes us
+      mempool_wfi();
+      continue;
+    }
+    // Take us out again, unless someone did it and owes us a wake-up
+    other = __atomic_exchange_n(waiter, 0, __ATOMIC_SEQ_CST);
+    if (other != self) {
+      if (other) {
+        wake_up(other - 1);
+      }
+      mempool_wfi();
+    }
+  }
+}
+
+static inline void queue_poll(uint32_t volatile *value, uint32_t expected) {
+  while (!queue_reached(value, expected)) {
+    mempool_wait(QUEUE_BACKOFF);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Single-producer single-consumer queue
+// ----------------------------------------------------------------------------
+
+static inline void spsc_queue_domain_create(alloc_t *alloc,
+                                            spsc_queue_t **queue,
+                                            const uint32_t capacity,
+                                            const uint32_t size,
+                                            const uint32_t wfi) {
+  const uint32_t slots = queue_capacity(capacity);
+  spsc_queue_t *new_queue =
+      (spsc_queue_t *)domain_malloc(alloc, sizeof(spsc_queue_t));
+  new_queue->array = (char *)domain_malloc(alloc, slots * size);
+  new_queue->mask = slots - 1;
+  new_queue->size = size;
+  new_queue->wfi = wfi;
+  new_queue->head = 0;
+  new_queue->tail = 0;
+  new_queue->pop_waiter = 0;
+  new_queue->push_waiter = 0;
+  *queue = new_queue;
+}
+
+static inline void spsc_queue_domain_destroy(alloc_t *alloc,
+                                             spsc_queue_t *queue) {
+  domain_free(alloc, queue->array);
+  domain_free(alloc, queue);
+}
+
+static inline void spsc_queue_create(spsc_queue_t **queue,
+                                     const uint32_t capacity,
+                                     const uint32_t size, const uint32_t wfi) {
+  spsc_queue_domain_create(get_alloc_l1(), queue, capacity, size, wfi);
+}
+
+static inline void spsc_queue_destroy(spsc_queue_t *queue) {
+  spsc_queue_domain_destroy(get_alloc_l1(), queue);
+}
+
+/* Push up to `count` elements, and return how many fit */
+static inline uint32_t spsc_queue_push_n(spsc_queue_t *const queue,
+                                         const void *data, uint32_t count) {
+  const uint32_t tail = queue->tail;
+  const uint32_t space = queue->mask + 1 - (tail - queue->head);
+  if (count > space) {
+    count = space;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    queue_copy(queue->array + ((tail + i) & queue->mask) * queue->size,
+               (const char *)data + i * queue->size, queue->size);
+  }
+  __asm__ __volatile__("" : : : "memory");
+  queue->tail = tail + count;
+  if (count && queue->wfi) {
+    queue_signal(&queue->pop_waiter);
+  }
+  return count;
+}
+
+/* Pop up to `count` elements, and return how many there were */
+static inline uint32_t spsc_queue_pop_n(spsc_queue_t *const queue, void *data,
+                                        uint32_t count) {
+  const uint32_t head = queue->head;
+  const uint32_t used = queue->tail - head;
+  if (count > used) {
+    count = used;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    queue_copy((char *)data + i * queue->size,
+               queue->array + ((head + i) & queue->mask) * queue->size,
+               queue->size);
+  }
+  __asm__ __volatile__("" : : : "memory");
+  queue->head = head + count;
+  if (count && queue->wfi) {
+    queue_signal(&queue->push_waiter);
+  }
+  return count;
+}
+
+/* Returns 0 on success and 1 if the queue is full */
+static inline int32_t spsc_queue_push(spsc_queue_t *const queue,
+                                      const void *data) {
+  return !spsc_queue_push_n(queue, data, 1);
+}
+
+/* Returns 0 on success and 1 if the queue is empty */
+static inline int32_t spsc_queue_pop(spsc_queue_t *const queue, void *data) {
+  return !spsc_queue_pop_n(queue, data, 1);
+}
+
+static inline void blocking_spsc_queue_push_n(spsc_queue_t *const queue,
+                                              const void *data,
+                                              uint32_t count) {
+  while (count) {
+    uint32_t pushed = spsc_queue_push_n(queue, data, count);
+    data = (const char *)data + pushed * queue->size;
+    count -= pushed;
+    if (!count) {
+      break;
+    }
+    // Wait for the consumer to free one slot
+    uint32_t expected = queue->tail - queue->mask;
+    if (queue->wfi) {
+      queue_sleep(&queue->push_waiter, &queue->head, expected);
+    } else {
+      queue_poll(&queue->head, expected);
+    }
+  }
+}
+
+static inline void blocking_spsc_queue_pop_n(spsc_queue_t *const queue,
+                                             void *data, uint32_t count) {
+  while (count) {
+    uint32_t popped = spsc_queue_pop_n(queue, data, count);
+    data = (char *)data + popped * queue->size;
+    count -= popped;
+    if (!count) {
+      break;
+    }
+    // Wait for the producer to fill one slot
+    uint32_t expected = queue->head + 1;
+    if (queue->wfi) {
+      queue_sleep(&queue->pop_waiter, &queue->tail, expected);
+    } else {
+      queue_poll(&queue->tail, expected);
+    }
+  }
+}
+
+static inline void blocking_spsc_queue_push(spsc_queue_t *const queue,
+                                            const void *data) {
+  blocking_spsc_queue_push_n(queue, data, 1);
+}
+
+static inline void blocking_spsc_queue_pop(spsc_queue_t *const queue,
+                                           void *data) {
+  blocking_spsc_queue_pop_n(queue, data, 1);
+}
+
+// ----------------------------------------------------------------------------
+// Multi-producer multi-consumer queue
+// ----------------------------------------------------------------------------
+
+static inline void mpmc_queue_domain_create(alloc_t *alloc,
+                                            mpmc_queue_t **queue,
+                                            const uint32_t capacity,
+                                            const uint32_t size,
+                                            const uint32_t wfi) {
+  const uint32_t slots = queue_capacity(capacity);
+  mpmc_queue_t *new_queue =
+      (mpmc_queue_t *)domain_malloc(alloc, sizeof(mpmc_queue_t));
+  new_queue->array = (char *)domain_malloc(alloc, slots * size);
+  new_queue->turn =
+      (uint32_t volatile *)domain_malloc(alloc, slots * sizeof(uint32_t));
+  new_queue->waiter = NULL;
+  if (wfi) {
+    new_queue->waiter =
+        (uint32_t volatile *)domain_malloc(alloc, slots * sizeof(uint32_t));
+  }
+  for (uint32_t i = 0; i < slots; ++i) {
+    new_queue->turn[i] = i;
+    if (wfi) {
+      new_queue->waiter[i] = 0;
+    }
+  }
+  new_queue->mask = slots - 1;
+  new_queue->size = size;
+  new_queue->head = 0;
+  new_queue->tail = 0;
+  *queue = new_queue;
+}
+
+static inline void mpmc_queue_domain_destroy(alloc_t *alloc,
+                                             mpmc_queue_t *queue) {
+  if (queue->waiter) {
+    domain_free(alloc, (void *)queue->waiter);
+  }
+  domain_free(alloc, (void *)queue->turn);
+  domain_free(alloc, queue->array);
+  domain_free(alloc, queue);
+}
+
+static inline void mpmc_queue_create(mpmc_queue_t **queue,
+                                     const uint32_t capacity,
+                                     const uint32_t size, const uint32_t wfi) {
+  mpmc_queue_domain_create(get_alloc_l1(), queue, capacity, size, wfi);
+}
+
+static inline void mpmc_queue_destroy(mpmc_queue_t *queue) {
+  mpmc_queue_domain_destroy(get_alloc_l1(), queue);
+}
+
+/* Wait until the slot of `ticket` reaches `turn` */
+static inline void mpmc_queue_wait(mpmc_queue_t *const queue, uint32_t ticket,
+                                   uint32_t turn) {
+  const uint32_t slot = ticket & queue->mask;
+  if (queue->waiter) {
+    queue_sleep(&queue->waiter[slot], &queue->turn[slot], turn);
+  } else {
+    queue_poll(&queue->turn[slot], turn);
+  }
+}
+
+/* Hand the slot of `ticket` over to `turn` */
+static inline void mpmc_queue_pass(mpmc_queue_t *const queue, uint32_t ticket,
+                                   uint32_t turn) {
+  const uint32_t slot = ticket & queue->mask;
+  __asm__ __volatile__("" : : : "memory");
+  queue->turn[slot] = turn;
+  if (queue->waiter) {
+    queue_signal(&queue->waiter[slot]);
+  }
+}
+
+static inline void mpmc_queue_write(mpmc_queue_t *const queue, uint32_t ticket,
+                                    const void *data) {
+  mpmc_queue_wait(queue, ticket, ticket);
+  queue_copy(queue->array + (ticket & queue->mask) * queue->size, data,
+             queue->size);
+  mpmc_queue_pass(queue, ticket, ticket + 1);
+}
+
+static inline void mpmc_queue_read(mpmc_queue_t *const queue, uint32_t ticket,
+                                   void *data) {
+  mpmc_queue_wait(queue, ticket, ticket + 1);
+  queue_copy(data, queue->array + (ticket & queue->mask) * queue->size,
+             queue->size);
+  mpmc_queue_pass(queue, ticket, ticket + queue->mask + 1);
+}
+
+static inline void blocking_mpmc_queue_push_n(mpmc_queue_t *const queue,
+                                              const void *data,
+                                              uint32_t count) {
+  uint32_t ticket = __atomic_fetch_add(&queue->tail, count, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < count; ++i) {
+    mpmc_queue_write(queue, ticket + i, (const char *)data + i * queue->size);
+  }
+}
+
+static inline void blocking_mpmc_queue_pop_n(mpmc_queue_t *const queue,
+                                             void *data, uint32_t count) {
+  uint32_t ticket = __atomic_fetch_add(&queue->head, count, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < count; ++i) {
+    mpmc_queue_read(queue, ticket + i, (char *)data + i * queue->size);
+  }
+}
+
+static inline void blocking_mpmc_queue_push(mpmc_queue_t *const queue,
+                                            const void *data) {
+  blocking_mpmc_queue_push_n(queue, data, 1);
+}
+
+static inline void blocking_mpmc_queue_pop(mpmc_queue_t *const queue,
+                                           void *data) {
+  blocking_mpmc_queue_pop_n(queue, data, 1);
+}
+
+/* Returns 0 on success and 1 if the queue is full */
+static inline int32_t mpmc_queue_push(mpmc_queue_t *const queue,
+                                      const void *data) {
+  uint32_t ticket = queue->tail;
+  while (1) {
+    int32_t diff = (int32_t)(queue->turn[ticket & queue->mask] - ticket);
+    if (diff < 0) {
+      return 1;
+    }
+    if (diff == 0 &&
+        __atomic_compare_exchange_n(&queue->tail, &ticket, ticket + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      break;
+    }
+    if (diff > 0) {
+      ticket = queue->tail;
+    }
+  }
+  mpmc_queue_write(queue, ticket, data);
+  return 0;
+}
+
+/* Returns 0 on success and 1 if the queue is empty */
+static inline int32_t mpmc_queue_pop(mpmc_queue_t *const queue, void *data) {
+  uint32_t ticket = queue->head;
+  while (1) {
+    int32_t diff = (int32_t)(queue->turn[ticket & queue->mask] - (ticket + 1));
+    if (diff < 0) {
+      return 1;
+    }
+    if (diff == 0 &&
+        __atomic_compare_exchange_n(&queue->head, &ticket, ticket + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      break;
+    }
+    if (diff > 0) {
+      ticket = queue->head;
+    }
+  }
+  mpmc_queue_read(queue, ticket, data);
+  return 0;
+}
+
+#endif // _QUEUE_H_
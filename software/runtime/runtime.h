@@ -74,7 +74,17 @@ static inline void mempool_init(const uint32_t core_id) {
     // Initialize L1 Interleaved Heap Allocator
     extern uint32_t __heap_start, __heap_end;
     uint32_t heap_size = (uint32_t)&__heap_end - (uint32_t)&__heap_start;
+#if ALLOC_LOCAL_FRACTION
+    // The end of the heap belongs to the tile-local allocators
+    uint32_t local_size = heap_size / ALLOC_LOCAL_FRACTION;
+    alloc_init(get_alloc_l1(), &__heap_start, heap_size - local_size);
+    alloc_local_init((char *)&__heap_end - local_size, local_size);
+#else
     alloc_init(get_alloc_l1(), &__heap_start, heap_size);
+    // L1 is not zeroed, so the tile-local allocators still need their locks
+    // and free lists, with no segments to hand out
+    alloc_local_init(&__heap_end, 0);
+#endif
 
     // Initialize L1 Sequential Heap Allocator per Tile
     extern uint32_t __seq_start;
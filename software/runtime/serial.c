@@ -4,9 +4,69 @@
 
 #include <stdint.h>
 
-extern char fake_uart;
+#include "runtime.h"
+
+// Characters that a core buffers before it sends them
+#define SERIAL_LINE_BYTES 28
+
+/* Every core writes its characters to its own word of the UART, so that the
+   testbench and Spike collect the lines of the cores separately. The UART
+   takes the bytes of a word in order, and prints a line at every newline. */
+extern uint32_t volatile fake_uart_line[];
+
+typedef struct {
+  uint32_t count;
+  char data[SERIAL_LINE_BYTES];
+} serial_line_t;
+
+// Lines that fit in one row of a tile's banks, and of all banks
+#define SERIAL_LINES_PER_TILE_ROW                                              \
+  (NUM_CORES_PER_TILE * BANKING_FACTOR * 4 / sizeof(serial_line_t))
+#define SERIAL_LINES_PER_ROW                                                   \
+  (NUM_CORES * BANKING_FACTOR * 4 / sizeof(serial_line_t))
+
+serial_line_t serial_lines[NUM_CORES]
+    __attribute__((aligned(NUM_CORES * BANKING_FACTOR * 4), section(".l1")));
+
+/* Return the line of `core_id`. The lines of a tile fill the tile's part of
+   consecutive rows, so that they stay in the tile's banks. */
+static inline serial_line_t *serial_line(uint32_t core_id) {
+  uint32_t tile = core_id / NUM_CORES_PER_TILE;
+  uint32_t index = core_id % NUM_CORES_PER_TILE;
+  return &serial_lines[index / SERIAL_LINES_PER_TILE_ROW *
+                           SERIAL_LINES_PER_ROW +
+                       tile * SERIAL_LINES_PER_TILE_ROW +
+                       index % SERIAL_LINES_PER_TILE_ROW];
+}
+
+/* Send the buffered characters in as few stores as possible */
+static void serial_send(uint32_t core_id, serial_line_t *line) {
+  uint32_t volatile *port = &fake_uart_line[core_id];
+  uint32_t words = line->count / 4;
+  for (uint32_t i = 0; i < words; ++i) {
+    *port = ((uint32_t *)line->data)[i];
+  }
+  for (uint32_t i = words * 4; i < line->count; ++i) {
+    ((char volatile *)port)[i % 4] = line->data[i];
+  }
+  line->count = 0;
+}
+
+void serial_init(void) { serial_line(mempool_get_core_id())->count = 0; }
+
+void serial_flush(void) {
+  uint32_t core_id = mempool_get_core_id();
+  serial_line_t *line = serial_line(core_id);
+  if (line->count) {
+    serial_send(core_id, line);
+  }
+}
 
 void _putchar(char character) {
-  // send char to console
-  fake_uart = character;
+  uint32_t core_id = mempool_get_core_id();
+  serial_line_t *line = serial_line(core_id);
+  line->data[line->count++] = character;
+  if (character == '\n' || line->count == SERIAL_LINE_BYTES) {
+    serial_send(core_id, line);
+  }
 }
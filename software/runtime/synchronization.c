@@ -15,6 +15,13 @@ uint32_t volatile log_barrier[NUM_CORES * 4]
     __attribute__((aligned(NUM_CORES * 4), section(".l1")));
 uint32_t volatile partial_barrier[NUM_CORES * 4]
     __attribute__((aligned(NUM_CORES * 4), section(".l1")));
+// Counters of the tree barrier. The array spans one row of all L1 banks, so
+// that word `t * NUM_BANKS_PER_TILE + i` lies in the i-th bank of tile t. Each
+// tile counts its cores in its bank 0, the first tile of a sub-group counts the
+// sub-group's tiles in its bank 1, the first tile of a group counts the group's
+// tiles or sub-groups in its bank 2, and tile 0 counts the groups in its bank 3.
+uint32_t volatile tree_barrier[NUM_CORES * BANKING_FACTOR] __attribute__((
+    aligned(NUM_CORES * BANKING_FACTOR * 4), section(".l1")));
 
 void mempool_barrier_init(uint32_t core_id) {
   if (core_id == 0) {
@@ -30,6 +37,9 @@ void mempool_barrier_init(uint32_t core_id) {
     log_barrier[i] = 0;
     partial_barrier[i] = 0;
   }
+  for (uint32_t i = core_id; i < NUM_CORES * BANKING_FACTOR; i += NUM_CORES) {
+    tree_barrier[i] = 0;
+  }
   mempool_barrier(NUM_CORES);
 }
 
@@ -183,3 +193,80 @@ void mempool_partial_barrier(uint32_t volatile core_id,
     mempool_wfi();
   }
 }
+
+// Count an arrival at one level of the tree barrier and tell whether it
+// completes the level. The counters are never reset: a level is complete
+// whenever its count reaches a multiple of its `num` participants, which also
+// holds across the wrap-around since `num` is a power of two.
+static inline bool tree_barrier_complete(uint32_t volatile *counter,
+                                         uint32_t num) {
+  if (num == 1) {
+    return true;
+  }
+  return (__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED) + 1) % num == 0;
+}
+
+void mempool_tree_barrier_arrive(uint32_t core_id, mempool_scope_t scope) {
+  uint32_t tile_id = core_id / NUM_CORES_PER_TILE;
+  uint32_t group_id = core_id / NUM_CORES_PER_GROUP;
+  uint32_t group_tile = group_id * NUM_TILES_PER_GROUP;
+  uint32_t num_arrivals_per_group = NUM_TILES_PER_GROUP;
+
+  // Tile level, in the tile's own bank
+  if (!tree_barrier_complete(&tree_barrier[tile_id * NUM_BANKS_PER_TILE],
+                             NUM_CORES_PER_TILE)) {
+    return;
+  }
+  if (scope == MEMPOOL_SCOPE_TILE) {
+    __sync_synchronize(); // Full memory barrier
+    wake_up_tile(group_id, 1U << (tile_id - group_tile));
+    return;
+  }
+
+#ifdef NUM_SUB_GROUPS_PER_GROUP
+  // Sub-group level, combining the sub-group's tiles
+  uint32_t sub_group_tile = tile_id - tile_id % NUM_TILES_PER_SUB_GROUP;
+  if (!tree_barrier_complete(
+          &tree_barrier[sub_group_tile * NUM_BANKS_PER_TILE + 1],
+          NUM_TILES_PER_SUB_GROUP)) {
+    return;
+  }
+  if (scope == MEMPOOL_SCOPE_SUB_GROUP) {
+    __sync_synchronize(); // Full memory barrier
+    wake_up_tile(group_id,
+                 (uint32_t)((1ULL << NUM_TILES_PER_SUB_GROUP) - 1)
+                     << (sub_group_tile - group_tile));
+    return;
+  }
+  num_arrivals_per_group = NUM_SUB_GROUPS_PER_GROUP;
+#endif
+
+  // Group level, combining the group's tiles (or sub-groups)
+  if (!tree_barrier_complete(&tree_barrier[group_tile * NUM_BANKS_PER_TILE + 2],
+                             num_arrivals_per_group)) {
+    return;
+  }
+  if (scope != MEMPOOL_SCOPE_CLUSTER) {
+    __sync_synchronize(); // Full memory barrier
+    wake_up_group(1U << group_id);
+    return;
+  }
+
+  // Cluster level, combining the groups
+  if (!tree_barrier_complete(&tree_barrier[3], NUM_GROUPS)) {
+    return;
+  }
+  __sync_synchronize(); // Full memory barrier
+  wake_up_all();
+}
+
+void mempool_tree_barrier_wait() {
+  // Sleep until the last core of the scope wakes us up. If it already did,
+  // the wake-up trigger is pending and this returns immediately.
+  mempool_wfi();
+}
+
+void mempool_tree_barrier(uint32_t core_id) {
+  mempool_tree_barrier_arrive(core_id, MEMPOOL_SCOPE_CLUSTER);
+  mempool_tree_barrier_wait();
+}
@@ -7,6 +7,15 @@
 #ifndef __SYNCHRONIZATION_H__
 #define __SYNCHRONIZATION_H__
 
+// Levels of MemPool's hierarchy that a tree barrier synchronizes. Without
+// sub-groups, a sub-group is the whole group.
+typedef enum {
+  MEMPOOL_SCOPE_TILE,
+  MEMPOOL_SCOPE_SUB_GROUP,
+  MEMPOOL_SCOPE_GROUP,
+  MEMPOOL_SCOPE_CLUSTER
+} mempool_scope_t;
+
 // Barrier functions
 void mempool_barrier_init(uint32_t core_id);
 void mempool_barrier(uint32_t num_cores);
@@ -18,4 +27,18 @@ void mempool_partial_barrier(uint32_t volatile core_id,
                              uint32_t volatile num_sleeping_cores,
                              uint32_t volatile memloc);
 
+// Tree barrier following the tile, sub-group, group and cluster hierarchy.
+// Cores first combine on a counter in their tile's banks, and only the last
+// core of every tile (sub-group, group) moves up to the next level. The last
+// core of the scope wakes up its cores through the tile and group wake-up
+// registers. `arrive` and `wait` split the barrier, so that work that does
+// not depend on the other cores can overlap with it:
+//   mempool_tree_barrier_arrive(core_id, MEMPOOL_SCOPE_GROUP);
+//   ... independent work ...
+//   mempool_tree_barrier_wait();
+// All cores of the scope must call both, and in this order.
+void mempool_tree_barrier_arrive(uint32_t core_id, mempool_scope_t scope);
+void mempool_tree_barrier_wait();
+void mempool_tree_barrier(uint32_t core_id);
+
 #endif // __SYNCHRONIZATION_H__
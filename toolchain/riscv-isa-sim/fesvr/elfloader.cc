@@ -36,7 +36,6 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
   assert(IS_ELF_RISCV(*eh64) || IS_ELF_EM_NONE(*eh64));
   assert(IS_ELF_VCURRENT(*eh64));
 
-  std::vector<uint8_t> zeros;
   std::map<std::string, uint64_t> symbols;
 
   #define LOAD_ELF(ehdr_t, phdr_t, shdr_t, sym_t, bswap) do { \
@@ -50,8 +49,8 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
           assert(size >= bswap(ph[i].p_offset) + bswap(ph[i].p_filesz)); \
           memif->write(bswap(ph[i].p_paddr), bswap(ph[i].p_filesz), (uint8_t*)buf + bswap(ph[i].p_offset)); \
         } \
-        zeros.resize(bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz)); \
-        memif->write(bswap(ph[i].p_paddr) + bswap(ph[i].p_filesz), bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz), &zeros[0]); \
+        if (bswap(ph[i].p_memsz) > bswap(ph[i].p_filesz)) \
+          memif->clear(bswap(ph[i].p_paddr) + bswap(ph[i].p_filesz), bswap(ph[i].p_memsz) - bswap(ph[i].p_filesz)); \
       } \
     } \
     shdr_t* sh = (shdr_t*)(buf + bswap(eh->e_shoff)); \
@@ -92,3 +91,51 @@ std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t*
 
   return symbols;
 }
+
+std::string load_elf_section(const char* fn, const char* name)
+{
+  int fd = open(fn, O_RDONLY);
+  struct stat s;
+  if (fd == -1)
+    return std::string();
+  if (fstat(fd, &s) < 0 || (size_t)s.st_size < sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return std::string();
+  }
+  size_t size = s.st_size;
+
+  char* buf = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED)
+    return std::string();
+
+  std::string contents;
+  const Elf64_Ehdr* eh64 = (const Elf64_Ehdr*)buf;
+
+  #define FIND_SECTION(ehdr_t, shdr_t, bswap) do { \
+    ehdr_t* eh = (ehdr_t*)buf; \
+    shdr_t* sh = (shdr_t*)(buf + bswap(eh->e_shoff)); \
+    unsigned shnum = bswap(eh->e_shnum), shstrndx = bswap(eh->e_shstrndx); \
+    if (size < bswap(eh->e_shoff) + shnum*sizeof(*sh) || shstrndx >= shnum) \
+      break; \
+    const char* shstrtab = buf + bswap(sh[shstrndx].sh_offset); \
+    for (unsigned i = 0; i < shnum; i++) { \
+      if (bswap(sh[i].sh_name) >= bswap(sh[shstrndx].sh_size) || \
+          strcmp(shstrtab + bswap(sh[i].sh_name), name) != 0 || \
+          (bswap(sh[i].sh_type) & SHT_NOBITS) || \
+          size < bswap(sh[i].sh_offset) + bswap(sh[i].sh_size)) \
+        continue; \
+      contents.assign(buf + bswap(sh[i].sh_offset), bswap(sh[i].sh_size)); \
+      break; \
+    } \
+  } while(0)
+
+  if (IS_ELF32(*eh64) && IS_ELFLE(*eh64))
+    FIND_SECTION(Elf32_Ehdr, Elf32_Shdr, from_le);
+  else if (IS_ELF64(*eh64) && IS_ELFLE(*eh64))
+    FIND_SECTION(Elf64_Ehdr, Elf64_Shdr, from_le);
+
+  munmap(buf, size);
+
+  return contents;
+}
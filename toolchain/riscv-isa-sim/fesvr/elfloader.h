@@ -9,5 +9,7 @@
 
 class memif_t;
 std::map<std::string, uint64_t> load_elf(const char* fn, memif_t* memif, reg_t* entry);
+// Contents of the section `name`, or an empty string if there is none
+std::string load_elf_section(const char* fn, const char* name);
 
 #endif
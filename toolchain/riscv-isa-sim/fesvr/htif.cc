@@ -112,6 +112,12 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
         memif_t::write(taddr, len, src);
     }
 
+    void clear(addr_t taddr, size_t len) override
+    {
+      if (!htif->is_address_preloaded(taddr, len))
+        memif_t::clear(taddr, len);
+    }
+
    private:
     htif_t* htif;
   } preload_aware_memif(this);
@@ -149,6 +155,7 @@ void htif_t::load_program()
      if ( it == addr2symbol.end())
        addr2symbol[i.second] = i.first;
    }
+   symbol2addr.swap(symbols);
 
    return;
 }
@@ -163,6 +170,31 @@ const char* htif_t::get_symbol(uint64_t addr)
   return it->second.c_str();
 }
 
+const char* htif_t::get_symbol_containing(uint64_t addr, uint64_t* base)
+{
+  // Skip unnamed symbols and assembler-local labels (.L*), which lie
+  // inside functions
+  auto it = addr2symbol.upper_bound(addr);
+  while (it != addr2symbol.begin()) {
+    --it;
+    if (!it->second.empty() && it->second.compare(0, 2, ".L") != 0) {
+      *base = it->first;
+      return it->second.c_str();
+    }
+  }
+
+  return nullptr;
+}
+
+bool htif_t::get_symbol_address(const std::string& name, uint64_t* addr)
+{
+  auto it = symbol2addr.find(name);
+  if (it == symbol2addr.end())
+    return false;
+  *addr = it->second;
+  return true;
+}
+
 void htif_t::stop()
 {
   if (!sig_file.empty() && sig_len) // print final torture test signature
@@ -51,6 +51,11 @@ class htif_t : public chunked_memif_t
 
   // Given an address, return symbol from addr2symbol map
   const char* get_symbol(uint64_t addr);
+  // Given an address, return the closest symbol at or below it that is
+  // not a local label, and set *base to the symbol's address
+  const char* get_symbol_containing(uint64_t addr, uint64_t* base);
+  // Given a symbol name, set *addr to its address; false if there is none
+  bool get_symbol_address(const std::string& name, uint64_t* addr);
 
  private:
   void parse_arguments(int argc, char ** argv);
@@ -79,6 +84,7 @@ class htif_t : public chunked_memif_t
   const std::vector<std::string>& target_args() { return targs; }
 
   std::map<uint64_t, std::string> addr2symbol;
+  std::map<std::string, uint64_t> symbol2addr;
 
   friend class memif_t;
   friend class syscall_t;
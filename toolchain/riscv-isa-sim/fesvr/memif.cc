@@ -8,6 +8,9 @@
 
 void memif_t::read(addr_t addr, size_t len, void* bytes)
 {
+  if (cmemif->read_bulk(addr, len, bytes))
+    return;
+
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
   {
@@ -41,6 +44,9 @@ void memif_t::read(addr_t addr, size_t len, void* bytes)
 
 void memif_t::write(addr_t addr, size_t len, const void* bytes)
 {
+  if (cmemif->write_bulk(addr, len, bytes))
+    return;
+
   size_t align = cmemif->chunk_align();
   if (len && (addr & (align-1)))
   {
@@ -70,9 +76,9 @@ void memif_t::write(addr_t addr, size_t len, const void* bytes)
   }
 
   // now we're aligned
-  bool all_zero = len != 0;
-  for (size_t i = 0; i < len; i++)
-    all_zero &= ((const char*)bytes)[i] == 0;
+  // the bytes are all zero if the first one is and each equals the next
+  bool all_zero = len != 0 && ((const char*)bytes)[0] == 0 &&
+                  memcmp(bytes, (const char*)bytes + 1, len - 1) == 0;
 
   if (all_zero) {
     cmemif->clear_chunk(addr, len);
@@ -83,6 +89,18 @@ void memif_t::write(addr_t addr, size_t len, const void* bytes)
   }
 }
 
+void memif_t::clear(addr_t addr, size_t len)
+{
+  if (cmemif->clear_bulk(addr, len))
+    return;
+
+  // write zeros a block at a time, which write turns into clear_chunk
+  static const size_t block = 4096;
+  static const uint8_t zeros[block] = {0};
+  for (size_t pos = 0; pos < len; pos += block)
+    write(addr + pos, std::min(block, len - pos), zeros);
+}
+
 #define MEMIF_READ_FUNC \
   if(addr & (sizeof(val)-1)) \
     throw std::runtime_error("misaligned address"); \
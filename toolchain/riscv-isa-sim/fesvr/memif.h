@@ -19,6 +19,12 @@ public:
 
   virtual size_t chunk_align() = 0;
   virtual size_t chunk_max_size() = 0;
+
+  // Access a whole range at once, if the target can, e.g., because it is
+  // backed by host memory. Return false to fall back to chunks.
+  virtual bool read_bulk(addr_t taddr, size_t len, void* dst) { return false; }
+  virtual bool write_bulk(addr_t taddr, size_t len, const void* src) { return false; }
+  virtual bool clear_bulk(addr_t taddr, size_t len) { return false; }
 };
 
 class memif_t
@@ -30,6 +36,8 @@ public:
   // read and write byte arrays
   virtual void read(addr_t addr, size_t len, void* bytes);
   virtual void write(addr_t addr, size_t len, const void* bytes);
+  // zero a byte array
+  virtual void clear(addr_t addr, size_t len);
 
   // read and write 8-bit words
   virtual uint8_t read_uint8(addr_t addr);
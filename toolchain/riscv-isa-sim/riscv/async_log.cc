@@ -0,0 +1,212 @@
+// See LICENSE for license details.
+
+#include "async_log.h"
+#include <algorithm>
+#include <cinttypes>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+spsc_ring_t::spsc_ring_t(size_t capacity)
+  : buf(new uint8_t[capacity]), capacity(capacity), mask(capacity - 1),
+    head(0), tail(0)
+{
+}
+
+bool spsc_ring_t::try_push(uint32_t type, const void* data, size_t len)
+{
+  size_t size = sizeof(entry_header_t) + ((len + 7) & ~size_t(7));
+  size_t h = head.load(std::memory_order_relaxed);
+  if (size > capacity - (h - tail.load(std::memory_order_acquire)))
+    return false;
+
+  entry_header_t header = {type, (uint32_t)len};
+  copy_in(h, &header, sizeof(header));
+  copy_in(h + sizeof(header), data, len);
+  head.store(h + size, std::memory_order_release);
+  return true;
+}
+
+bool spsc_ring_t::try_pop(uint32_t& type, std::vector<uint8_t>& data)
+{
+  size_t t = tail.load(std::memory_order_relaxed);
+  if (t == head.load(std::memory_order_acquire))
+    return false;
+
+  entry_header_t header;
+  copy_out(t, &header, sizeof(header));
+  data.resize(header.len);
+  copy_out(t + sizeof(header), data.data(), header.len);
+  type = header.type;
+  tail.store(t + sizeof(header) + ((header.len + 7) & ~size_t(7)),
+             std::memory_order_release);
+  return true;
+}
+
+void spsc_ring_t::copy_in(size_t pos, const void* src, size_t len)
+{
+  size_t off = pos & mask;
+  size_t n = std::min(len, capacity - off);
+  memcpy(&buf[off], src, n);
+  memcpy(&buf[0], (const uint8_t*)src + n, len - n);
+}
+
+void spsc_ring_t::copy_out(size_t pos, void* dst, size_t len)
+{
+  size_t off = pos & mask;
+  size_t n = std::min(len, capacity - off);
+  memcpy(dst, &buf[off], n);
+  memcpy((uint8_t*)dst + n, &buf[0], len - n);
+}
+
+async_log_port_t::async_log_port_t(async_log_t* log, uint32_t hartid)
+  : log(log), hartid(hartid), ring(async_log_t::RING_SIZE), dropped(0),
+    text_buf(NULL), text_size(0), binary_buffer(NULL)
+{
+  text_stream = open_memstream(&text_buf, &text_size);
+  if (!text_stream)
+    throw std::runtime_error("Failed to create a log buffer");
+}
+
+async_log_port_t::~async_log_port_t()
+{
+  fclose(text_stream);
+  free(text_buf);
+}
+
+bool async_log_port_t::binary() const
+{
+  return log->binary != NULL;
+}
+
+void async_log_port_t::push_record(commit_log_record_t& rec)
+{
+  // Text that was logged before this instruction retired goes first.
+  push_text();
+  rec.hartid = hartid;
+  push(async_log_t::RECORD, &rec, sizeof(rec));
+}
+
+void async_log_port_t::push_text()
+{
+  fflush(text_stream);
+  if (text_size == 0)
+    return;
+
+  for (size_t begin = 0, len; begin < text_size; begin += len) {
+    len = std::min(text_size - begin, async_log_t::MAX_ENTRY);
+    if (begin + len < text_size) {
+      size_t line = len;
+      while (line > 0 && text_buf[begin + line - 1] != '\n')
+        line--;
+      if (line > 0)
+        len = line;
+    }
+    push(async_log_t::TEXT, text_buf + begin, len);
+  }
+
+  fseeko(text_stream, 0, SEEK_SET);
+}
+
+void async_log_port_t::push(uint32_t type, const void* data, size_t len)
+{
+  while (!ring.try_push(type, data, len)) {
+    if (log->policy == async_log_t::DROP) {
+      dropped++;
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+async_log_t::async_log_t(FILE* log_file, commit_log_writer_t* binary, policy_t policy)
+  : log_file(log_file), binary(binary), policy(policy), stop(false),
+    batch_buf(NULL), batch_size(0)
+{
+  batch = open_memstream(&batch_buf, &batch_size);
+  if (!batch)
+    throw std::runtime_error("Failed to create a log buffer");
+}
+
+async_log_t::~async_log_t()
+{
+  stop.store(true, std::memory_order_release);
+  if (writer.joinable())
+    writer.join();
+  else
+    writer_main();
+
+  for (auto& port : ports) {
+    if (port->dropped)
+      fprintf(stderr, "Dropped %" PRIu64 " log entries of core %" PRIu32 "\n",
+              port->dropped, port->hartid);
+  }
+
+  fclose(batch);
+  free(batch_buf);
+}
+
+async_log_port_t* async_log_t::add_port(uint32_t hartid)
+{
+  ports.emplace_back(new async_log_port_t(this, hartid));
+  if (binary)
+    ports.back()->binary_buffer = binary->add_buffer(hartid);
+  return ports.back().get();
+}
+
+void async_log_t::start()
+{
+  writer = std::thread(&async_log_t::writer_main, this);
+}
+
+void async_log_t::writer_main()
+{
+  while (true) {
+    // Whatever the harts queued before stop was set is drained by the
+    // passes that follow, until a pass finds all rings empty.
+    bool stopping = stop.load(std::memory_order_acquire);
+    bool busy = false;
+    for (auto& port : ports)
+      busy |= drain(port.get());
+    flush_batch();
+
+    if (!busy) {
+      if (stopping)
+        break;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  fflush(log_file);
+}
+
+bool async_log_t::drain(async_log_port_t* port)
+{
+  // Take a bounded number of entries, so that a busy hart does not hold up
+  // the others.
+  uint32_t type;
+  size_t n = 0;
+
+  while (n < DRAIN_ENTRIES && port->ring.try_pop(type, entry)) {
+    n++;
+    if (type == TEXT) {
+      fwrite(entry.data(), 1, entry.size(), batch);
+    } else if (binary) {
+      *port->binary_buffer->next() = *(const commit_log_record_t*)entry.data();
+    } else {
+      commit_log_print_record(batch, *(const commit_log_record_t*)entry.data());
+    }
+
+    if (ftello(batch) >= (off_t)BATCH_SIZE)
+      flush_batch();
+  }
+  return n > 0;
+}
+
+void async_log_t::flush_batch()
+{
+  fflush(batch);
+  if (batch_size)
+    fwrite(batch_buf, 1, batch_size, log_file);
+  fseeko(batch, 0, SEEK_SET);
+}
@@ -0,0 +1,128 @@
+// See LICENSE for license details.
+#ifndef _RISCV_ASYNC_LOG_H
+#define _RISCV_ASYNC_LOG_H
+
+#include "commit_log.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// A ring of variable-sized entries with one producer and one consumer.
+class spsc_ring_t
+{
+ public:
+  // capacity must be a power of two.
+  spsc_ring_t(size_t capacity);
+
+  // Append an entry, or return false if there is no room for it.
+  bool try_push(uint32_t type, const void* data, size_t len);
+
+  // Remove the oldest entry into data, or return false if there is none.
+  bool try_pop(uint32_t& type, std::vector<uint8_t>& data);
+
+ private:
+  struct entry_header_t { uint32_t type, len; };
+
+  void copy_in(size_t pos, const void* src, size_t len);
+  void copy_out(size_t pos, void* dst, size_t len);
+
+  // head and tail are padded to lie in cache lines of their own. alignas
+  // would do the same, but operator new ignores extended alignment before
+  // C++17.
+  static const size_t CACHE_LINE = 64;
+
+  std::unique_ptr<uint8_t[]> buf;
+  size_t capacity;
+  size_t mask;
+  char pad0[CACHE_LINE];
+  std::atomic<size_t> head; // written by the producer
+  char pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail; // written by the consumer
+  char pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+class async_log_t;
+
+// One hart's side of an async_log_t. Only the thread stepping the hart
+// touches it.
+class async_log_port_t
+{
+ public:
+  async_log_port_t(async_log_t* log, uint32_t hartid);
+  ~async_log_port_t();
+
+  // Whether commit records end up in a binary log rather than as text.
+  bool binary() const;
+
+  // Queue a commit record; its hartid is filled in here.
+  void push_record(commit_log_record_t& rec);
+
+  // A stream to format text into; push_text() queues what was written to
+  // it since the last push_text(). Text is queued in pieces that end at a
+  // line break, so lines of different harts don't get mixed up.
+  FILE* text() { return text_stream; }
+  void push_text();
+
+ private:
+  void push(uint32_t type, const void* data, size_t len);
+
+  friend class async_log_t;
+  async_log_t* log;
+  uint32_t hartid;
+  spsc_ring_t ring;
+  uint64_t dropped;
+  FILE* text_stream;
+  char* text_buf;
+  size_t text_size;
+  commit_log_buffer_t* binary_buffer; // only used by the writer thread
+};
+
+// Takes the execution log and commit log off the simulation threads. Each
+// hart queues its entries into its own ring, and a writer thread drains all
+// rings into the log files in large batches. The entries of a hart stay in
+// order; those of different harts are interleaved batch by batch.
+class async_log_t
+{
+ public:
+  // What a hart does when its ring is full.
+  enum policy_t { BLOCK, DROP };
+
+  static const size_t RING_SIZE = 1 << 20;
+  static const size_t MAX_ENTRY = 1 << 16;
+  static const size_t BATCH_SIZE = 1 << 16;
+  static const size_t DRAIN_ENTRIES = 1 << 12;
+
+  // Text goes to log_file; commit records go to the binary log when there
+  // is one and are printed to log_file otherwise.
+  async_log_t(FILE* log_file, commit_log_writer_t* binary, policy_t policy);
+  // Drains all rings and reports the entries that were dropped.
+  ~async_log_t();
+
+  // Add the ports of all harts, then start the writer thread.
+  async_log_port_t* add_port(uint32_t hartid);
+  void start();
+
+ private:
+  enum { RECORD, TEXT };
+
+  void writer_main();
+  bool drain(async_log_port_t* port);
+  void flush_batch();
+
+  friend class async_log_port_t;
+  FILE* log_file;
+  commit_log_writer_t* binary;
+  policy_t policy;
+  std::vector<std::unique_ptr<async_log_port_t>> ports;
+  std::atomic<bool> stop;
+  std::vector<uint8_t> entry;
+  FILE* batch; // output is gathered here and written BATCH_SIZE at a time
+  char* batch_buf;
+  size_t batch_size;
+  std::thread writer;
+};
+
+#endif
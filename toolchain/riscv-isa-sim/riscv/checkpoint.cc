@@ -0,0 +1,180 @@
+// See LICENSE for license details.
+
+#include "checkpoint.h"
+#include "config.h"
+#include "devices.h"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <sstream>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+const size_t checkpoint_writer_t::CHUNK_SIZE;
+
+static std::runtime_error file_error(const std::string& what, const std::string& path)
+{
+  std::ostringstream oss;
+  oss << what << " `" << path << "'";
+  if (errno)
+    oss << ": " << strerror(errno);
+  return std::runtime_error(oss.str());
+}
+
+static bool all_zero(const char* data, size_t len)
+{
+  return data[0] == 0 && memcmp(data, data + 1, len - 1) == 0;
+}
+
+checkpoint_writer_t::checkpoint_writer_t(const char* path)
+  : file(fopen(path, "wb"), &fclose), path(path)
+{
+  if (!file)
+    throw file_error("Failed to create checkpoint", path);
+}
+
+void checkpoint_writer_t::write_mem(reg_t base, mem_t* mem)
+{
+  checkpoint_mem_header_t header = {
+    checkpoint_mem_header_t::MAGIC, 0, base, mem->size()
+  };
+  write(&header, sizeof(header));
+
+  // Split the written ranges into runs of zero pages and of data pages
+  for (auto& range : mem->dirty_ranges()) {
+    reg_t start = range.first, end = range.first + range.second;
+    bool zero = true;
+    for (reg_t page = start; page < end; page += mem_t::PAGE_SIZE) {
+      bool page_zero = all_zero(mem->contents() + page,
+                                std::min(mem_t::PAGE_SIZE, end - page));
+      if (page > start && (page_zero != zero || (!zero && page - start >= CHUNK_SIZE))) {
+        write_range(start, mem->contents() + start, page - start, zero);
+        start = page;
+      }
+      zero = page_zero;
+    }
+    write_range(start, mem->contents() + start, end - start, zero);
+  }
+
+  checkpoint_range_t last = {0, 0, checkpoint_range_t::ZERO, 0, 0};
+  write(&last, sizeof(last));
+}
+
+void checkpoint_writer_t::write_range(reg_t offset, const char* data, size_t len, bool zero)
+{
+  checkpoint_range_t range = {
+    offset, len, zero ? checkpoint_range_t::ZERO : checkpoint_range_t::RAW, 0,
+    zero ? 0 : len
+  };
+  const void* out = data;
+
+#ifdef HAVE_LIBZ
+  if (!zero) {
+    uLongf size = compressBound(len);
+    scratch.resize(size);
+    if (compress2(scratch.data(), &size, (const Bytef*)data, len, Z_BEST_SPEED) == Z_OK &&
+        size < len) {
+      range.encoding = checkpoint_range_t::ZLIB;
+      range.size = size;
+      out = scratch.data();
+    }
+  }
+#endif
+
+  write(&range, sizeof(range));
+  write(out, range.size);
+}
+
+void checkpoint_writer_t::write(const void* data, size_t len)
+{
+  errno = 0;
+  if (fwrite(data, 1, len, file.get()) != len)
+    throw file_error("Failed to write checkpoint", path);
+}
+
+void checkpoint_writer_t::close()
+{
+  errno = 0;
+  if (fflush(file.get()) != 0)
+    throw file_error("Failed to write checkpoint", path);
+}
+
+checkpoint_reader_t::checkpoint_reader_t(const char* path)
+  : file(fopen(path, "rb"), &fclose), path(path)
+{
+  if (!file)
+    throw file_error("Failed to open checkpoint", path);
+
+  if (fread(&header, sizeof(header), 1, file.get()) != 1 ||
+      header.magic != checkpoint_header_t::MAGIC)
+    throw std::runtime_error("Not a checkpoint: `" + std::string(path) + "'");
+  if (header.version != checkpoint_header_t::VERSION)
+    throw std::runtime_error("Unsupported checkpoint version: `" + std::string(path) + "'");
+}
+
+void checkpoint_reader_t::read_mem(reg_t base, mem_t* mem)
+{
+  checkpoint_mem_header_t header;
+  read(&header, sizeof(header));
+  if (header.magic != checkpoint_mem_header_t::MAGIC)
+    throw corrupt();
+  if (header.base != base || header.size != mem->size()) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "memory at 0x%" PRIx64 " of 0x%" PRIx64 " bytes, not at 0x%"
+             PRIx64 " of 0x%zx bytes", header.base, header.size, base, mem->size());
+    throw std::runtime_error("Checkpoint `" + path + "' holds " + buf);
+  }
+
+  while (true) {
+    checkpoint_range_t range;
+    read(&range, sizeof(range));
+    if (!range.len)
+      break;
+    if (range.offset > mem->size() || range.len > mem->size() - range.offset)
+      throw corrupt();
+
+    char* data = mem->contents() + range.offset;
+    switch (range.encoding) {
+      case checkpoint_range_t::ZERO:
+        if (range.size)
+          throw corrupt();
+        mem->clear(range.offset, range.len);
+        break;
+      case checkpoint_range_t::RAW:
+        if (range.size != range.len)
+          throw corrupt();
+        read(data, range.len);
+        mem->mark_dirty(range.offset, range.len);
+        break;
+      case checkpoint_range_t::ZLIB: {
+#ifdef HAVE_LIBZ
+        scratch.resize(range.size);
+        read(scratch.data(), range.size);
+        uLongf len = range.len;
+        if (uncompress((Bytef*)data, &len, scratch.data(), range.size) != Z_OK ||
+            len != range.len)
+          throw corrupt();
+        mem->mark_dirty(range.offset, range.len);
+        break;
+#else
+        throw std::runtime_error("Checkpoint is compressed, but Spike was built without zlib: `" + path + "'");
+#endif
+      }
+      default:
+        throw corrupt();
+    }
+  }
+}
+
+void checkpoint_reader_t::read(void* data, size_t len)
+{
+  if (fread(data, 1, len, file.get()) != len)
+    throw corrupt();
+}
+
+std::runtime_error checkpoint_reader_t::corrupt()
+{
+  return std::runtime_error("Truncated or corrupt checkpoint: `" + path + "'");
+}
@@ -0,0 +1,127 @@
+// See LICENSE for license details.
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+#include "decode.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class mem_t;
+
+// Checkpoints
+//
+// A checkpoint holds what a run needs to go on from some point of the
+// program instead of from reset: the architectural state of every hart, the
+// CLINT, the hart scheduler's position in its round and the pages of target
+// memory that were written since Spike started. Pages that were never
+// written hold the same data in every run of the same program, so they are
+// left out. Written pages that are all zeros only have their range recorded,
+// and the others are compressed with zlib when Spike was built with it.
+//
+// The file is a checkpoint_header_t, the state of each hart, the CLINT and
+// the scheduler, and for each memory a checkpoint_mem_header_t followed by
+// its ranges, each one a checkpoint_range_t and its data, and a range of
+// length zero. All fields are in host byte order, and the layout of the
+// state is that of the Spike binary that wrote it.
+
+struct checkpoint_header_t
+{
+  static const uint64_t MAGIC = 0x504b43454b495053; // "SPIKECKP"
+  static const uint32_t VERSION = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t nprocs;
+  uint32_t nmems;
+  uint32_t reserved;
+};
+
+struct checkpoint_mem_header_t
+{
+  static const uint32_t MAGIC = 0x524d454d; // "MEMR"
+
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t base;
+  uint64_t size;
+};
+
+struct checkpoint_range_t
+{
+  enum { ZERO, RAW, ZLIB };
+
+  uint64_t offset;
+  uint64_t len;
+  uint32_t encoding;
+  uint32_t reserved;
+  uint64_t size; // bytes of data that follow
+};
+
+class checkpoint_writer_t
+{
+ public:
+  // Data ranges are compressed in pieces of this many bytes
+  static const size_t CHUNK_SIZE = 1 << 20;
+
+  // Throws std::runtime_error if the file cannot be created.
+  checkpoint_writer_t(const char* path);
+
+  // Append a plain value, such as a field of state_t
+  template<typename T> void operator()(const T& value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "checkpoints hold plain values only");
+    write(&value, sizeof(value));
+  }
+
+  // Append the written pages of a memory at base
+  void write_mem(reg_t base, mem_t* mem);
+
+  // Flush the file; throws std::runtime_error if that fails
+  void close();
+
+ private:
+  void write(const void* data, size_t len);
+  void write_range(reg_t offset, const char* data, size_t len, bool zero);
+
+  std::unique_ptr<FILE, decltype(&fclose)> file;
+  std::string path;
+  std::vector<uint8_t> scratch;
+};
+
+class checkpoint_reader_t
+{
+ public:
+  // Throws std::runtime_error if the file is not a checkpoint.
+  checkpoint_reader_t(const char* path);
+
+  const checkpoint_header_t& get_header() const { return header; }
+
+  // Read a plain value back
+  template<typename T> void operator()(T& value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "checkpoints hold plain values only");
+    read(&value, sizeof(value));
+  }
+
+  // Read the pages of a memory at base back into it. Throws
+  // std::runtime_error if the memory does not match the one saved.
+  void read_mem(reg_t base, mem_t* mem);
+
+ private:
+  void read(void* data, size_t len);
+  std::runtime_error corrupt();
+
+  std::unique_ptr<FILE, decltype(&fclose)> file;
+  std::string path;
+  checkpoint_header_t header;
+  std::vector<uint8_t> scratch;
+};
+
+#endif
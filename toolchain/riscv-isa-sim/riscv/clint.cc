@@ -1,6 +1,7 @@
 #include <sys/time.h>
 #include "devices.h"
 #include "processor.h"
+#include "checkpoint.h"
 
 clint_t::clint_t(std::vector<processor_t*>& procs, uint64_t freq_hz, bool real_time)
   : procs(procs), freq_hz(freq_hz), real_time(real_time), mtime(0), mtimecmp(procs.size())
@@ -54,9 +55,12 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
     memset((uint8_t*)&mask[0] + addr - MSIP_BASE, 0xff, len);
     for (size_t i = 0; i < procs.size(); ++i) {
       if (!(mask[i] & 0xFF)) continue;
-      procs[i]->state.mip &= ~MIP_MSIP;
+      // The target hart may be running on another host thread and update
+      // its own mip concurrently, so set/clear the bit atomically.
       if (!!(msip[i] & 1))
-        procs[i]->state.mip |= MIP_MSIP;
+        __atomic_fetch_or(&procs[i]->state.mip, MIP_MSIP, __ATOMIC_RELAXED);
+      else
+        __atomic_fetch_and(&procs[i]->state.mip, ~(reg_t)MIP_MSIP, __ATOMIC_RELAXED);
     }
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy((uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, bytes, len);
@@ -87,3 +91,18 @@ void clint_t::increment(reg_t inc)
       procs[i]->state.mip |= MIP_MTIP;
   }
 }
+
+void clint_t::save(checkpoint_writer_t& out)
+{
+  out(mtime);
+  for (auto& cmp : mtimecmp)
+    out(cmp);
+}
+
+void clint_t::restore(checkpoint_reader_t& in)
+{
+  in(mtime);
+  for (auto& cmp : mtimecmp)
+    in(cmp);
+  increment(0);
+}
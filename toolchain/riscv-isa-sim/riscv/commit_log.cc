@@ -0,0 +1,274 @@
+// See LICENSE for license details.
+
+#include "commit_log.h"
+#include "config.h"
+#include "disasm.h"
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+static_assert(sizeof(commit_log_record_t) % 8 == 0,
+              "commit log records must stay 8-byte aligned in a chunk");
+
+static std::runtime_error file_error(const std::string& what, const std::string& path)
+{
+  std::ostringstream oss;
+  oss << what << " `" << path << "'";
+  if (errno)
+    oss << ": " << strerror(errno);
+  return std::runtime_error(oss.str());
+}
+
+void commit_log_print_value(FILE* log_file, int width, const void* data)
+{
+  assert(log_file);
+
+  switch (width) {
+    case 8:
+      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
+      break;
+    case 16:
+      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
+      break;
+    case 32:
+      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
+      break;
+    case 64:
+      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
+      break;
+    default:
+      // max lengh of vector
+      if (((width - 1) & width) == 0) {
+        const uint64_t *arr = (const uint64_t *)data;
+
+        fprintf(log_file, "0x");
+        for (int idx = width / 64 - 1; idx >= 0; --idx) {
+          fprintf(log_file, "%016" PRIx64, arr[idx]);
+        }
+      } else {
+        abort();
+      }
+      break;
+  }
+}
+
+void commit_log_print_record(FILE* log_file, const commit_log_record_t& rec)
+{
+  fprintf(log_file, "core%4" PRId64 ": ", (int64_t)rec.hartid);
+
+  fprintf(log_file, "%1d ", rec.priv);
+  commit_log_print_value(log_file, rec.xlen, &rec.pc);
+  fprintf(log_file, " (");
+  commit_log_print_value(log_file, rec.insn_length * 8, &rec.insn);
+  fprintf(log_file, ")");
+
+  for (size_t i = 0; i < rec.nregs; i++) {
+    int rd = rec.regs[i].key >> 4;
+    switch (rec.regs[i].key & 0xf) {
+      case 0:
+        fprintf(log_file, " x%2d ", rd);
+        commit_log_print_value(log_file, rec.xlen, rec.regs[i].value);
+        break;
+      case 1:
+        fprintf(log_file, " f%2d ", rd);
+        commit_log_print_value(log_file, rec.flen, rec.regs[i].value);
+        break;
+      case 4:
+        fprintf(log_file, " c%d_%s ", rd, csr_name(rd));
+        commit_log_print_value(log_file, rec.xlen, rec.regs[i].value);
+        break;
+    }
+  }
+
+  if (rec.flags & commit_log_record_t::LOAD) {
+    fprintf(log_file, " mem ");
+    commit_log_print_value(log_file, rec.xlen, &rec.load_addr);
+  }
+
+  if (rec.flags & commit_log_record_t::STORE) {
+    fprintf(log_file, " mem ");
+    commit_log_print_value(log_file, rec.xlen, &rec.store_addr);
+    fprintf(log_file, " ");
+    commit_log_print_value(log_file, rec.store_size << 3, &rec.store_data);
+  }
+  fprintf(log_file, "\n");
+}
+
+commit_log_buffer_t::commit_log_buffer_t(commit_log_writer_t* writer, uint32_t hartid)
+  : writer(writer), hartid(hartid),
+    records(commit_log_writer_t::CHUNK_RECORDS), used(0)
+{
+}
+
+void commit_log_buffer_t::flush()
+{
+  if (used)
+    writer->write_chunk(hartid, records.data(), used, scratch);
+  used = 0;
+}
+
+commit_log_writer_t::commit_log_writer_t(const char* path)
+  : file(fopen(path, "wb"), &fclose), path(path), offset(0)
+{
+  if (!file)
+    throw file_error("Failed to open commit log at", path);
+
+  commit_log_file_header_t header = {
+    commit_log_file_header_t::MAGIC, commit_log_file_header_t::VERSION,
+    sizeof(commit_log_record_t)
+  };
+  write(&header, sizeof(header));
+}
+
+commit_log_writer_t::~commit_log_writer_t()
+{
+  try {
+    for (auto& buffer : buffers)
+      buffer->flush();
+
+    commit_log_trailer_t trailer = {offset, index.size(), commit_log_trailer_t::MAGIC};
+    write(index.data(), index.size() * sizeof(commit_log_index_entry_t));
+    write(&trailer, sizeof(trailer));
+  } catch (std::exception& e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
+}
+
+commit_log_buffer_t* commit_log_writer_t::add_buffer(uint32_t hartid)
+{
+  buffers.emplace_back(new commit_log_buffer_t(this, hartid));
+  return buffers.back().get();
+}
+
+void commit_log_writer_t::write_chunk(uint32_t hartid,
+                                      const commit_log_record_t* records,
+                                      size_t nrecords,
+                                      std::vector<uint8_t>& scratch)
+{
+  commit_log_chunk_header_t header = {
+    commit_log_chunk_header_t::MAGIC, commit_log_chunk_header_t::RAW,
+    hartid, (uint32_t)nrecords, nrecords * sizeof(commit_log_record_t)
+  };
+  const void* data = records;
+
+#ifdef HAVE_LIBZ
+  uLongf size = compressBound(header.size);
+  scratch.resize(size);
+  if (compress2(scratch.data(), &size, (const Bytef*)records, header.size,
+                Z_BEST_SPEED) == Z_OK) {
+    header.encoding = commit_log_chunk_header_t::ZLIB;
+    header.size = size;
+    data = scratch.data();
+  }
+#endif
+
+  std::lock_guard<std::mutex> guard(lock);
+  index.push_back({offset, hartid, (uint32_t)nrecords});
+  write(&header, sizeof(header));
+  write(data, header.size);
+}
+
+void commit_log_writer_t::write(const void* data, size_t len)
+{
+  errno = 0;
+  if (fwrite(data, 1, len, file.get()) != len)
+    throw file_error("Failed to write commit log", path);
+  offset += len;
+}
+
+commit_log_reader_t::commit_log_reader_t(const char* path)
+  : file(fopen(path, "rb"), &fclose), path(path), offset(0), end(0), pos(0)
+{
+  if (!file)
+    throw file_error("Failed to open commit log at", path);
+
+  commit_log_file_header_t header;
+  if (fread(&header, sizeof(header), 1, file.get()) != 1 ||
+      header.magic != commit_log_file_header_t::MAGIC)
+    throw std::runtime_error("Not a binary commit log: `" + std::string(path) + "'");
+  if (header.version != commit_log_file_header_t::VERSION ||
+      header.record_size != sizeof(commit_log_record_t))
+    throw std::runtime_error("Unsupported commit log version: `" + std::string(path) + "'");
+  offset = sizeof(header);
+
+  // A log whose writer did not finish has no index; read its chunks up to
+  // the end of the file.
+  commit_log_trailer_t trailer;
+  fseek(file.get(), 0, SEEK_END);
+  end = ftell(file.get());
+  if (end >= offset + sizeof(trailer) &&
+      fseek(file.get(), end - sizeof(trailer), SEEK_SET) == 0 &&
+      fread(&trailer, sizeof(trailer), 1, file.get()) == 1 &&
+      trailer.magic == commit_log_trailer_t::MAGIC) {
+    index.resize(trailer.nchunks);
+    fseek(file.get(), trailer.index_offset, SEEK_SET);
+    if (fread(index.data(), sizeof(commit_log_index_entry_t), index.size(),
+              file.get()) != index.size())
+      throw std::runtime_error("Corrupt commit log index: `" + std::string(path) + "'");
+    end = trailer.index_offset;
+  }
+  fseek(file.get(), offset, SEEK_SET);
+}
+
+bool commit_log_reader_t::next(commit_log_record_t& rec)
+{
+  while (pos == records.size()) {
+    if (!read_chunk())
+      return false;
+  }
+  rec = records[pos++];
+  return true;
+}
+
+void commit_log_reader_t::seek_chunk(size_t i)
+{
+  if (i >= index.size())
+    throw std::out_of_range("commit log chunk out of range");
+  offset = index[i].offset;
+  fseek(file.get(), offset, SEEK_SET);
+  records.clear();
+  pos = 0;
+}
+
+bool commit_log_reader_t::read_chunk()
+{
+  commit_log_chunk_header_t header;
+  if (offset + sizeof(header) > end ||
+      fread(&header, sizeof(header), 1, file.get()) != 1 ||
+      header.magic != commit_log_chunk_header_t::MAGIC ||
+      offset + sizeof(header) + header.size > end)
+    return false;
+
+  records.resize(header.nrecords);
+  pos = 0;
+  size_t raw_size = header.nrecords * sizeof(commit_log_record_t);
+
+  if (header.encoding == commit_log_chunk_header_t::RAW) {
+    if (header.size != raw_size ||
+        fread(records.data(), 1, raw_size, file.get()) != raw_size)
+      return false;
+  } else if (header.encoding == commit_log_chunk_header_t::ZLIB) {
+#ifdef HAVE_LIBZ
+    scratch.resize(header.size);
+    uLongf size = raw_size;
+    if (fread(scratch.data(), 1, header.size, file.get()) != header.size ||
+        uncompress((Bytef*)records.data(), &size, scratch.data(), header.size) != Z_OK ||
+        size != raw_size)
+      throw std::runtime_error("Corrupt commit log chunk: `" + path + "'");
+#else
+    throw std::runtime_error("Commit log is compressed, but Spike was built without zlib: `" + path + "'");
+#endif
+  } else {
+    throw std::runtime_error("Unknown commit log chunk encoding: `" + path + "'");
+  }
+
+  offset += sizeof(header) + header.size;
+  return true;
+}
@@ -0,0 +1,186 @@
+// See LICENSE for license details.
+#ifndef _RISCV_COMMIT_LOG_H
+#define _RISCV_COMMIT_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary commit log
+//
+// The binary form of --log-commits holds one fixed-size record per retired
+// instruction. Every hart fills its own buffer of records, and a full buffer
+// is appended to the file as one chunk, compressed with zlib when Spike was
+// built with it. Within a hart the records are in retirement order; the
+// chunks of different harts follow each other in the order they filled up.
+//
+// The file is a commit_log_file_header_t, the chunks (each one a
+// commit_log_chunk_header_t followed by its data), an index with one
+// commit_log_index_entry_t per chunk and a commit_log_trailer_t. All fields
+// are in host byte order.
+
+struct commit_log_record_t
+{
+  static const size_t MAX_REGS = 3;
+
+  // flags
+  static const uint8_t LOAD = 1;      // load_addr is valid
+  static const uint8_t STORE = 2;     // store_addr/data/size are valid
+  static const uint8_t TRUNCATED = 4; // more writes than the record holds
+
+  uint64_t pc;
+  uint64_t insn;
+  uint32_t hartid;
+  uint8_t priv;
+  uint8_t xlen;
+  uint8_t flen;
+  uint8_t insn_length;
+  uint8_t flags;
+  uint8_t nregs;
+  uint8_t store_size;
+  uint8_t reserved[5];
+  uint64_t load_addr;
+  uint64_t store_addr;
+  uint64_t store_data;
+  struct {
+    uint64_t key; // as in state_t::log_reg_write
+    uint64_t value[2];
+  } regs[MAX_REGS];
+};
+
+struct commit_log_file_header_t
+{
+  static const uint64_t MAGIC = 0x474f4c454b495053; // "SPIKELOG"
+  static const uint32_t VERSION = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+};
+
+struct commit_log_chunk_header_t
+{
+  static const uint32_t MAGIC = 0x4b4e4843; // "CHNK"
+  enum { RAW, ZLIB };
+
+  uint32_t magic;
+  uint32_t encoding;
+  uint32_t hartid;
+  uint32_t nrecords;
+  uint64_t size;
+};
+
+struct commit_log_index_entry_t
+{
+  uint64_t offset;
+  uint32_t hartid;
+  uint32_t nrecords;
+};
+
+struct commit_log_trailer_t
+{
+  static const uint64_t MAGIC = 0x58444e49474f4c43; // "CLOGINDX"
+
+  uint64_t index_offset;
+  uint64_t nchunks;
+  uint64_t magic;
+};
+
+// Print a record in the text form of --log-commits.
+void commit_log_print_record(FILE* log_file, const commit_log_record_t& rec);
+
+// Print a value of the given width in bits the way the commit log does.
+void commit_log_print_value(FILE* log_file, int width, const void* data);
+
+class commit_log_writer_t;
+
+// The records of one hart. Only the thread stepping that hart touches it.
+class commit_log_buffer_t
+{
+ public:
+  commit_log_buffer_t(commit_log_writer_t* writer, uint32_t hartid);
+
+  // Return the record for the next retired instruction, flushing the buffer
+  // first when it is full.
+  commit_log_record_t* next()
+  {
+    if (used == records.size())
+      flush();
+    // Start from zeros, so that fields a record leaves unused are the same
+    // in every run
+    records[used] = commit_log_record_t();
+    records[used].hartid = hartid;
+    return &records[used++];
+  }
+
+  void flush();
+
+ private:
+  commit_log_writer_t* writer;
+  uint32_t hartid;
+  std::vector<commit_log_record_t> records;
+  size_t used;
+  std::vector<uint8_t> scratch;
+};
+
+class commit_log_writer_t
+{
+ public:
+  static const size_t CHUNK_RECORDS = 1024;
+
+  // Throws std::runtime_error if the file cannot be created.
+  commit_log_writer_t(const char* path);
+  // Flushes the buffers of all harts and writes the index.
+  ~commit_log_writer_t();
+
+  commit_log_buffer_t* add_buffer(uint32_t hartid);
+
+  // Compress nrecords records and append them as a chunk; scratch is the
+  // caller's space for the compressed data.
+  void write_chunk(uint32_t hartid, const commit_log_record_t* records,
+                   size_t nrecords, std::vector<uint8_t>& scratch);
+
+ private:
+  void write(const void* data, size_t len);
+
+  std::unique_ptr<FILE, decltype(&fclose)> file;
+  std::string path;
+  std::vector<std::unique_ptr<commit_log_buffer_t>> buffers;
+  std::vector<commit_log_index_entry_t> index;
+  uint64_t offset;
+  std::mutex lock;
+};
+
+// Reads the records of a binary commit log chunk by chunk, in file order.
+class commit_log_reader_t
+{
+ public:
+  // Throws std::runtime_error if the file is not a binary commit log.
+  commit_log_reader_t(const char* path);
+
+  // Fill in the next record; false at the end of the log.
+  bool next(commit_log_record_t& rec);
+
+  // The chunk index, which is empty if the writer did not finish the log.
+  const std::vector<commit_log_index_entry_t>& chunks() const { return index; }
+
+  // Continue reading at the given chunk of the index.
+  void seek_chunk(size_t i);
+
+ private:
+  bool read_chunk();
+
+  std::unique_ptr<FILE, decltype(&fclose)> file;
+  std::string path;
+  std::vector<commit_log_index_entry_t> index;
+  uint64_t offset;
+  uint64_t end;
+  std::vector<commit_log_record_t> records;
+  size_t pos;
+  std::vector<uint8_t> scratch;
+};
+
+#endif
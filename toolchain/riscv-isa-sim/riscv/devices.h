@@ -3,13 +3,19 @@
 
 #include "decode.h"
 #include "mmio_plugin.h"
+#include <atomic>
 #include <cstdlib>
+#include <functional>
+#include <memory>
 #include <string>
 #include <map>
 #include <vector>
 #include <stdexcept>
 
 class processor_t;
+class mem_t;
+class checkpoint_writer_t;
+class checkpoint_reader_t;
 
 class abstract_device_t {
  public:
@@ -25,9 +31,44 @@ class bus_t : public abstract_device_t {
   void add_device(reg_t addr, abstract_device_t* dev);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
+  // The memory that contains addr and the offset of addr in it, if any
+  mem_t* find_mem(reg_t addr, reg_t* offset) {
+    size_t i = lookup(addr);
+    if (i == NONE || !regions[i].mem || addr - bases[i] >= regions[i].size)
+      return NULL;
+    *offset = addr - bases[i];
+    return regions[i].mem;
+  }
 
  private:
+  static const size_t NONE = -1;
+
+  // Index of the device with the highest base not above addr
+  size_t lookup(reg_t addr) {
+    size_t n = bases.size();
+    if (n == 0 || addr < bases[0])
+      return NONE;
+    const reg_t* base = bases.data();
+    while (n > 1) {
+      size_t half = n / 2;
+      base = base[half] <= addr ? base + half : base;
+      n -= half;
+    }
+    return base - bases.data();
+  }
+
   std::map<reg_t, abstract_device_t*> devices;
+
+  // The devices sorted by their base, for lookups that only touch a couple
+  // of cache lines. Memories are resolved when they are added, so that
+  // addr_to_mem needs no dynamic_cast.
+  struct region_t {
+    abstract_device_t* dev;
+    mem_t* mem;
+    reg_t size;
+  };
+  std::vector<reg_t> bases;
+  std::vector<region_t> regions;
 };
 
 class rom_device_t : public abstract_device_t {
@@ -40,26 +81,55 @@ class rom_device_t : public abstract_device_t {
   std::vector<char> data;
 };
 
+// Target memory. The region is reserved with mmap but not committed, so
+// the host only allocates the pages that the target touches. A region can
+// start out with the contents of a file, whose pages are mapped copy-on-write.
+// Pages that are written are marked dirty, so that dumps and checkpoints only
+// need to visit these.
 class mem_t : public abstract_device_t {
  public:
-  mem_t(size_t size) : len(size) {
-    if (!size)
-      throw std::runtime_error("zero bytes of target memory requested");
-    data = (char*)calloc(1, size);
-    if (!data)
-      throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
-  }
+  mem_t(size_t size, const char* file = nullptr);
   mem_t(const mem_t& that) = delete;
-  ~mem_t() { free(data); }
+  ~mem_t();
 
   bool load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
   char* contents() { return data; }
   size_t size() { return len; }
+  const std::string& file() { return path; }
+  // Zero [addr, addr + len), returning whole pages to the host
+  void clear(reg_t addr, size_t len);
+
+  // Granularity of the dirty tracking, the same as the MMU's pages
+  static const reg_t PAGE_SIZE = 4096;
+
+  // Mark the pages of [addr, addr + len) as written
+  void mark_dirty(reg_t addr, size_t len = 1) {
+    if (!len)
+      return;
+    for (reg_t page = addr / PAGE_SIZE; page <= (addr + len - 1) / PAGE_SIZE; page++) {
+      auto& word = dirty[page / 64];
+      uint64_t bit = uint64_t(1) << (page % 64);
+      if (!(word.load(std::memory_order_relaxed) & bit))
+        word.fetch_or(bit, std::memory_order_relaxed);
+    }
+  }
+  bool is_dirty(reg_t addr) {
+    reg_t page = addr / PAGE_SIZE;
+    return dirty[page / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (page % 64));
+  }
+  // Runs of dirty pages as (offset, length) in bytes
+  std::vector<std::pair<reg_t, size_t>> dirty_ranges();
+  // The MMUs keep writing to the pages in their TLBs without marking them,
+  // so flush the TLBs after clearing
+  void clear_dirty();
 
  private:
   char* data;
   size_t len;
+  std::string path;
+  size_t image_len; // bytes at the start that map the file
+  std::unique_ptr<std::atomic<uint64_t>[]> dirty;
 };
 
 class clint_t : public abstract_device_t {
@@ -69,6 +139,9 @@ class clint_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  // The timers; the MSIP bits are part of the harts' mip
+  void save(checkpoint_writer_t& out);
+  void restore(checkpoint_reader_t& in);
  private:
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
@@ -82,6 +155,47 @@ class clint_t : public abstract_device_t {
   std::vector<mtimecmp_t> mtimecmp;
 };
 
+// MemPool's fake UART. Bytes written to offset 0 form the lines of all harts.
+// Above, every hart has a word for its own lines at 0x1000 + 4 * hartid and
+// one for the binary log records of software/runtime/log.h at 0x2000 + 4 *
+// hartid. The records are formatted with the `.log_fmt` section of the ELF.
+class mempool_uart_t : public abstract_device_t {
+ public:
+  mempool_uart_t(const char* elf);
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return 0x10000; }
+ private:
+  struct port_t {
+    std::string line;
+    uint32_t word = 0;
+    unsigned bytes = 0;
+    std::vector<uint32_t> record;
+  };
+  void write(reg_t offset, uint8_t byte);
+  void log_word(port_t& port, uint32_t word);
+  std::string formats;
+  port_t shared;
+  std::vector<port_t> ports;
+};
+
+// MemPool's control registers (hardware/src/ctrl_registers.sv), usually at
+// 0x40000000. Each register reads back what was last written to it. Writes
+// to the wake-up registers call the handler given to on_wake_up() with the
+// hart ID written to wake_up_reg, or with -1 to wake every hart. Spike does
+// not know how the harts are grouped into tiles and groups, so the group
+// and tile wake-up registers wake every hart as well.
+class mempool_ctrl_t : public abstract_device_t {
+ public:
+  bool load(reg_t addr, size_t len, uint8_t* bytes);
+  bool store(reg_t addr, size_t len, const uint8_t* bytes);
+  size_t size() { return sizeof(regs); }
+  void on_wake_up(std::function<void(reg_t)> handler) { wake_up = handler; }
+ private:
+  uint8_t regs[0x60] = {};
+  std::function<void(reg_t)> wake_up;
+};
+
 class mmio_plugin_device_t : public abstract_device_t {
  public:
   mmio_plugin_device_t(const std::string& name, const std::string& args);
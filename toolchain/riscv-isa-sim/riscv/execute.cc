@@ -3,7 +3,11 @@
 #include "processor.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "commit_log.h"
+#include "async_log.h"
+#include "profile.h"
 #include <cassert>
+#include <cstring>
 
 #ifdef RISCV_ENABLE_COMMITLOG
 static void commit_log_reset(processor_t* p)
@@ -21,39 +25,6 @@ static void commit_log_stash_privilege(processor_t* p)
   state->last_inst_flen = p->get_flen();
 }
 
-static void commit_log_print_value(FILE *log_file, int width, const void *data)
-{
-  assert(log_file);
-
-  switch (width) {
-    case 8:
-      fprintf(log_file, "0x%01" PRIx8, *(const uint8_t *)data);
-      break;
-    case 16:
-      fprintf(log_file, "0x%04" PRIx16, *(const uint16_t *)data);
-      break;
-    case 32:
-      fprintf(log_file, "0x%08" PRIx32, *(const uint32_t *)data);
-      break;
-    case 64:
-      fprintf(log_file, "0x%016" PRIx64, *(const uint64_t *)data);
-      break;
-    default:
-      // max lengh of vector
-      if (((width - 1) & width) == 0) {
-        const uint64_t *arr = (const uint64_t *)data;
-
-        fprintf(log_file, "0x");
-        for (int idx = width / 64 - 1; idx >= 0; --idx) {
-          fprintf(log_file, "%016" PRIx64, arr[idx]);
-        }
-      } else {
-        abort();
-      }
-      break;
-  }
-}
-
 static void commit_log_print_value(FILE *log_file, int width, uint64_t val)
 {
   commit_log_print_value(log_file, width, &val);
@@ -75,6 +46,9 @@ static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
   int xlen = p->get_state()->last_inst_xlen;
   int flen = p->get_state()->last_inst_flen;
 
+  // keep the line in one piece when harts run on several host threads
+  flockfile(log_file);
+
   // print core id on all lines so it is easy to grep
   uint64_t id = p->get_csr(CSR_MHARTID);
   fprintf(log_file, "core%4" PRId64 ": ", id);
@@ -154,17 +128,86 @@ static void commit_log_print_insn(processor_t *p, reg_t pc, insn_t insn)
     commit_log_print_value(log_file, std::get<2>(item) << 3, std::get<1>(item));
   }
   fprintf(log_file, "\n");
+
+  funlockfile(log_file);
+}
+
+// The binary counterpart of commit_log_print_insn. Vector register writes
+// are not recorded.
+static void commit_log_write_insn(processor_t *p, reg_t pc, insn_t insn,
+                                  commit_log_record_t* rec)
+{
+  state_t* state = p->get_state();
+
+  rec->pc = pc;
+  rec->insn = insn.bits();
+  rec->priv = state->last_inst_priv;
+  rec->xlen = state->last_inst_xlen;
+  rec->flen = state->last_inst_flen;
+  rec->insn_length = insn.length();
+  rec->flags = 0;
+  rec->nregs = 0;
+
+  for (auto item : state->log_reg_write) {
+    if (item.first == 0)
+      continue;
+    if ((item.first & 0xf) == 2 || (item.first & 0xf) == 3 ||
+        rec->nregs == commit_log_record_t::MAX_REGS) {
+      rec->flags |= commit_log_record_t::TRUNCATED;
+      continue;
+    }
+    rec->regs[rec->nregs].key = item.first;
+    memcpy(rec->regs[rec->nregs].value, item.second.v, sizeof(rec->regs[0].value));
+    rec->nregs++;
+  }
+
+  auto& load = state->log_mem_read;
+  if (!load.empty()) {
+    rec->flags |= commit_log_record_t::LOAD;
+    rec->load_addr = std::get<0>(load[0]);
+    if (load.size() > 1)
+      rec->flags |= commit_log_record_t::TRUNCATED;
+  }
+
+  auto& store = state->log_mem_write;
+  if (!store.empty()) {
+    rec->flags |= commit_log_record_t::STORE;
+    rec->store_addr = std::get<0>(store[0]);
+    rec->store_data = std::get<1>(store[0]);
+    rec->store_size = std::get<2>(store[0]);
+    if (store.size() > 1)
+      rec->flags |= commit_log_record_t::TRUNCATED;
+  }
+}
+
+static void commit_log_insn(processor_t *p, reg_t pc, insn_t insn)
+{
+  if (p->get_commit_log()) {
+    commit_log_write_insn(p, pc, insn, p->get_commit_log()->next());
+  } else if (async_log_port_t* port = p->get_async_log()) {
+    // Leave the formatting to the writer thread, unless the record cannot
+    // hold everything the text log would show.
+    commit_log_record_t rec = commit_log_record_t();
+    commit_log_write_insn(p, pc, insn, &rec);
+    if ((rec.flags & commit_log_record_t::TRUNCATED) && !port->binary())
+      commit_log_print_insn(p, pc, insn);
+    else
+      port->push_record(rec);
+  } else {
+    commit_log_print_insn(p, pc, insn);
+  }
 }
 #else
 static void commit_log_reset(processor_t* p) {}
 static void commit_log_stash_privilege(processor_t* p) {}
-static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn) {}
+static void commit_log_insn(processor_t* p, reg_t pc, insn_t insn) {}
 #endif
 
-inline void processor_t::update_histogram(reg_t pc)
+inline void processor_t::update_histogram(reg_t pc, insn_t insn)
 {
 #ifdef RISCV_ENABLE_HISTOGRAM
-  pc_histogram[pc]++;
+  if (profile)
+    profile->retire(pc, insn);
 #endif
 }
 
@@ -180,10 +223,11 @@ static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   try {
     npc = fetch.func(p, fetch.insn, pc);
     if (npc != PC_SERIALIZE_BEFORE) {
+      p->update_histogram(pc, fetch.insn);
 
 #ifdef RISCV_ENABLE_COMMITLOG
       if (p->get_log_commits_enabled()) {
-        commit_log_print_insn(p, pc, fetch.insn);
+        commit_log_insn(p, pc, fetch.insn);
       }
 #endif
 
@@ -194,7 +238,7 @@ static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
       if (p->get_log_commits_enabled()) {
         for (auto item : p->get_state()->log_reg_write) {
           if ((item.first & 3) == 3) {
-            commit_log_print_insn(p, pc, fetch.insn);
+            commit_log_insn(p, pc, fetch.insn);
             break;
           }
         }
@@ -204,7 +248,6 @@ static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
   } catch(...) {
     throw;
   }
-  p->update_histogram(pc);
 
   return npc;
 }
@@ -217,6 +260,8 @@ bool processor_t::slow_path()
 // fetch/decode/execute loop
 void processor_t::step(size_t n)
 {
+  in_wfi = false;
+
   if (!state.debug_mode) {
     if (halt_request == HR_REGULAR) {
       enter_debug_mode(DCSR_CAUSE_DEBUGINT);
@@ -232,6 +277,7 @@ void processor_t::step(size_t n)
     size_t instret = 0;
     reg_t pc = state.pc;
     mmu_t* _mmu = mmu;
+    insn_block_t* last_block = NULL;
 
     #define advance_pc() \
      if (unlikely(invalid_pc(pc))) { \
@@ -269,6 +315,8 @@ void processor_t::step(size_t n)
             state.single_step = state.STEP_STEPPED;
           }
 
+          if (unlikely(pc == checkpoint_pc))
+            throw checkpoint_trigger_t();
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
@@ -278,50 +326,46 @@ void processor_t::step(size_t n)
       }
       else while (instret < n)
       {
-        // This code uses a modified Duff's Device to improve the performance
-        // of executing instructions. While typical Duff's Devices are used
-        // for software pipelining, the switch statement below primarily
-        // benefits from separate call points for the fetch.func function call
-        // found in each execute_insn. This function call is an indirect jump
-        // that depends on the current instruction. By having an indirect jump
-        // dedicated for each icache entry, you improve the performance of the
-        // host's next address predictor. Each case in the switch statement
-        // allows for the program flow to contine to the next case if it
-        // corresponds to the next instruction in the program and instret is
-        // still less than n.
+        // Instructions are executed a basic block at a time. A block is a
+        // run of straight-line code that the MMU decodes once (see
+        // mmu_t::refill_block), so the loop below does not look anything up
+        // per instruction: it only checks that each instruction continued to
+        // the next one in the block. The block is unrolled into one call site
+        // per position, which gives the indirect jump to each instruction's
+        // function (found in execute_insn) its own entry in the host's
+        // branch predictor, like the Duff's device that preceded it.
         //
-        // According to Andrew Waterman's recollection, this optimization
-        // resulted in approximately a 2x performance increase.
-
-        // This figures out where to jump to in the switch statement
-        size_t idx = _mmu->icache_index(pc);
-
-        // This gets the cached decoded instruction from the MMU. If the MMU
-        // does not have the current pc cached, it will refill the MMU and
-        // return the correct entry. ic_entry->data.func is the C++ function
-        // corresponding to the instruction.
-        auto ic_entry = _mmu->access_icache(pc);
-
-        // This macro is included in "icache.h" included within the switch
-        // statement below. The indirect jump corresponding to the instruction
-        // is located within the execute_insn() function call.
-        #define ICACHE_ACCESS(i) { \
-          insn_fetch_t fetch = ic_entry->data; \
+        // Blocks remember their successor, so a loop body that spans several
+        // blocks goes from one to the next without indexing the block cache.
+        if (unlikely(pc == checkpoint_pc))
+          throw checkpoint_trigger_t();
+
+        insn_block_t* block;
+        if (likely(last_block && last_block->next && last_block->next->tag == pc)) {
+          block = last_block->next;
+        } else {
+          block = _mmu->access_block(pc);
+          if (last_block)
+            last_block->next = block;
+        }
+        last_block = block;
+
+        // This macro is included in "block.h" included within the loop
+        // below, once for each position in the block.
+        #define BLOCK_ACCESS(i) { \
+          insn_fetch_t fetch = block->insns[i]; \
           pc = execute_insn(this, pc, fetch); \
-          ic_entry = ic_entry->next; \
-          if (i == mmu_t::ICACHE_ENTRIES-1) break; \
-          if (unlikely(ic_entry->tag != pc)) break; \
+          if (i == insn_block_t::MAX_INSNS-1) break; \
+          if (unlikely(pc != block->pc[i+1])) break; \
           if (unlikely(instret+1 == n)) break; \
           instret++; \
           state.pc = pc; \
         }
 
-        // This switch statement implements the modified Duff's device as
-        // explained above.
-        switch (idx) {
-          // "icache.h" is generated by the gen_icache script
-          #include "icache.h"
-        }
+        do {
+          // "block.h" is generated by the gen_block script
+          #include "block.h"
+        } while (0);
 
         advance_pc();
       }
@@ -364,6 +408,15 @@ void processor_t::step(size_t n)
           abort();
       }
     }
+    catch (checkpoint_trigger_t&)
+    {
+      // The instruction at state.pc has not run yet. Return to the outer
+      // simulation loop, which saves the checkpoint there.
+      n = instret;
+      checkpoint_pc = -1;
+      checkpoint_cycle_reads = 0;
+      checkpoint_hit = true;
+    }
     catch (wait_for_interrupt_t &t)
     {
       // Return to the outer simulation loop, which gives other devices/harts a
@@ -373,9 +426,13 @@ void processor_t::step(size_t n)
       // allows us to switch to other threads only once per idle loop in case
       // there is activity.
       n = instret;
+      in_wfi = true;
     }
 
     state.minstret += instret;
     n -= instret;
   }
+
+  if (async_log)
+    async_log->push_text();
 }
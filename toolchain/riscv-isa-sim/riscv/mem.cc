@@ -0,0 +1,105 @@
+#include "devices.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const reg_t mem_t::PAGE_SIZE;
+
+mem_t::mem_t(size_t size, const char* file)
+  : len(size), path(file ? file : ""), image_len(0)
+{
+  if (!size)
+    throw std::runtime_error("zero bytes of target memory requested");
+
+  // Only reserve the address space. The kernel hands out zeroed pages when
+  // they are first touched, and does not account for the untouched ones.
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map == MAP_FAILED)
+    throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
+  data = (char*)map;
+
+  if (file) {
+    // Map the pages of the image over the start of the region. They are
+    // private, so the target's writes never reach the file.
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      int err = errno;
+      if (fd >= 0)
+        close(fd);
+      munmap(data, len);
+      throw std::runtime_error("couldn't open memory image " + path + ": " + strerror(err));
+    }
+    size_t bytes = std::min((size_t)st.st_size, size);
+    if (bytes && mmap(data, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                      fd, 0) == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      munmap(data, len);
+      throw std::runtime_error("couldn't map memory image " + path + ": " + strerror(err));
+    }
+    close(fd);
+    image_len = bytes;
+  }
+
+  dirty.reset(new std::atomic<uint64_t>[(size + 64 * PAGE_SIZE - 1) / (64 * PAGE_SIZE)]);
+  clear_dirty();
+}
+
+mem_t::~mem_t()
+{
+  munmap(data, len);
+}
+
+void mem_t::clear(reg_t addr, size_t len)
+{
+  // Anonymous pages that are dropped read as zeros again, and the host only
+  // commits them when they are touched. Dropped pages of the image would
+  // read as the file, so these are written.
+  reg_t page = sysconf(_SC_PAGESIZE);
+  reg_t start = (std::max(addr, (reg_t)image_len) + page - 1) / page * page;
+  reg_t end = (addr + len) / page * page;
+  if (start < end && madvise(data + start, end - start, MADV_DONTNEED) == 0) {
+    memset(data + addr, 0, start - addr);
+    memset(data + end, 0, addr + len - end);
+  } else {
+    memset(data + addr, 0, len);
+  }
+  mark_dirty(addr, len);
+}
+
+std::vector<std::pair<reg_t, size_t>> mem_t::dirty_ranges()
+{
+  std::vector<std::pair<reg_t, size_t>> ranges;
+  size_t pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+  for (reg_t page = 0; page < pages; page++) {
+    // Skip clean words of the bitmap at once
+    if (page % 64 == 0 && !dirty[page / 64].load(std::memory_order_relaxed)) {
+      page += 63;
+      continue;
+    }
+    if (!is_dirty(page * PAGE_SIZE))
+      continue;
+    reg_t addr = page * PAGE_SIZE;
+    if (!ranges.empty() && ranges.back().first + ranges.back().second == addr)
+      ranges.back().second += PAGE_SIZE;
+    else
+      ranges.emplace_back(addr, PAGE_SIZE);
+  }
+  // The last page can be partial
+  if (!ranges.empty() && ranges.back().first + ranges.back().second > len)
+    ranges.back().second = len - ranges.back().first;
+  return ranges;
+}
+
+void mem_t::clear_dirty()
+{
+  size_t words = (len + 64 * PAGE_SIZE - 1) / (64 * PAGE_SIZE);
+  for (size_t i = 0; i < words; i++)
+    dirty[i].store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,40 @@
+// See LICENSE for license details.
+
+#include "devices.h"
+#include "byteorder.h"
+#include <cstring>
+
+#define WAKE_UP_REG        0x04
+#define WAKE_UP_GROUP_REG  0x08
+#define WAKE_UP_TILE_BASE  0x40
+#define WAKE_UP_TILE_END   0x60
+
+bool mempool_ctrl_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (addr + len > size())
+    return false;
+  memcpy(bytes, regs + addr, len);
+  return true;
+}
+
+bool mempool_ctrl_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (addr + len > size())
+    return false;
+  memcpy(regs + addr, bytes, len);
+  if (!wake_up)
+    return true;
+
+  // Like the hardware, act on any write that touches a register
+  for (reg_t reg = addr & ~reg_t(3); reg < addr + len; reg += 4) {
+    uint32_t value;
+    memcpy(&value, regs + reg, sizeof(value));
+    value = from_le(value);
+    if (reg == WAKE_UP_REG)
+      wake_up(value == UINT32_MAX ? reg_t(-1) : reg_t(value));
+    else if (reg == WAKE_UP_GROUP_REG || (reg >= WAKE_UP_TILE_BASE && reg < WAKE_UP_TILE_END))
+      if (value)
+        wake_up(reg_t(-1));
+  }
+  return true;
+}
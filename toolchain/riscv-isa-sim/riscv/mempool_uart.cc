@@ -0,0 +1,140 @@
+// See LICENSE for license details.
+
+#include "devices.h"
+#include "elfloader.h"
+#include <cstdio>
+#include <cstring>
+
+#define LINE_PORT_BASE 0x1000
+#define LOG_PORT_BASE  0x2000
+#define PORT_SIZE      0x1000
+
+// A log record has a header and at most this many arguments
+#define LOG_MAX_ARGS 8
+
+mempool_uart_t::mempool_uart_t(const char* elf)
+  : formats(load_elf_section(elf, ".log_fmt"))
+{
+  formats.push_back('\0');
+}
+
+bool mempool_uart_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  if (addr + len > size())
+    return false;
+  memset(bytes, 0, len);
+  return true;
+}
+
+bool mempool_uart_t::store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+  if (addr + len > size())
+    return false;
+  for (size_t i = 0; i < len; i++)
+    write(addr + i, bytes[i]);
+  return true;
+}
+
+// Format a log record like printf does, with 32-bit integer arguments
+static std::string format_record(const char* fmt, const uint32_t* args, size_t nargs)
+{
+  std::string out;
+  size_t arg = 0;
+  char buf[64];
+  for (const char* p = fmt; *p; p++) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    }
+    // Keep flags, width and precision, and drop length modifiers
+    std::string spec = "%";
+    const char* q = p + 1;
+    while (*q && strchr("-+ #0123456789.", *q))
+      spec += *q++;
+    while (*q && strchr("hlLjzt", *q))
+      q++;
+    if (!*q)
+      break;
+    p = q;
+    if (*q == '%') {
+      out += '%';
+      continue;
+    }
+    uint32_t value = arg < nargs ? args[arg++] : 0;
+    switch (*q) {
+      case 'd':
+      case 'i':
+        snprintf(buf, sizeof(buf), (spec + 'd').c_str(), (int32_t)value);
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+      case 'c':
+        snprintf(buf, sizeof(buf), (spec + *q).c_str(), value);
+        break;
+      case 'p':
+        snprintf(buf, sizeof(buf), "0x%08x", value);
+        break;
+      default:
+        // Strings and floats do not fit into a word
+        snprintf(buf, sizeof(buf), "<%%%c 0x%08x>", *q, value);
+    }
+    out += buf;
+  }
+  if (!out.empty() && out.back() == '\n')
+    out.pop_back();
+  return out;
+}
+
+void mempool_uart_t::log_word(port_t& port, uint32_t word)
+{
+  port.record.push_back(word);
+  uint32_t nargs = port.record[0] >> 24;
+  uint32_t offset = port.record[0] & 0xffffff;
+  if (nargs > LOG_MAX_ARGS) {
+    // Not a header, drop it
+    port.record.clear();
+    return;
+  }
+  if (port.record.size() < 1 + nargs)
+    return;
+  if (offset < formats.size() - 1) {
+    std::string line = format_record(&formats[offset], &port.record[1], nargs);
+    printf("[UART] %s\n", line.c_str());
+  } else {
+    printf("[UART] <unknown log format 0x%06x>\n", offset);
+  }
+  fflush(stdout);
+  port.record.clear();
+}
+
+void mempool_uart_t::write(reg_t offset, uint8_t byte)
+{
+  if (offset >= LOG_PORT_BASE + PORT_SIZE)
+    return;
+  port_t* port = &shared;
+  if (offset >= LINE_PORT_BASE) {
+    size_t hart = offset % PORT_SIZE / 4;
+    if (hart >= ports.size())
+      ports.resize(hart + 1);
+    port = &ports[hart];
+  }
+
+  if (offset >= LOG_PORT_BASE) {
+    // The bytes of a word arrive in order
+    if (port->bytes == 0)
+      port->word = 0;
+    port->word |= (uint32_t)byte << (8 * (offset % 4));
+    if (++port->bytes == 4) {
+      port->bytes = 0;
+      log_word(*port, port->word);
+    }
+  } else if (byte == '\n') {
+    printf("[UART] %s\n", port->line.c_str());
+    fflush(stdout);
+    port->line.clear();
+  } else {
+    port->line += (char)byte;
+  }
+}
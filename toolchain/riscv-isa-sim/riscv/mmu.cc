@@ -5,7 +5,7 @@
 #include "processor.h"
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
- : sim(sim), proc(proc),
+ : sim(sim), proc(proc), amo_lock(NULL), reservations(NULL),
   check_triggers_fetch(false),
   check_triggers_load(false),
   check_triggers_store(false),
@@ -23,6 +23,148 @@ void mmu_t::flush_icache()
 {
   for (size_t i = 0; i < ICACHE_ENTRIES; i++)
     icache[i].tag = -1;
+  for (size_t i = 0; i < BLOCK_ENTRIES; i++)
+    blocks[i].tag = -1;
+  code_pages.clear();
+}
+
+// Whether execution can leave a block after this instruction by anything
+// other than a taken branch: jumps, and instructions that may flush the
+// icache or change the translation (FENCE.I, SFENCE.VMA, CSR writes).
+static bool insn_ends_block(insn_bits_t bits)
+{
+  switch (bits & 0x3) {
+    case 0x1: // C.J, C.JAL
+      return ((bits >> 13) & 0x7) == 0x5 || ((bits >> 13) & 0x7) == 0x1;
+    case 0x2: // C.JR, C.JALR
+      return ((bits >> 13) & 0x7) == 0x4 && ((bits >> 2) & 0x1f) == 0;
+    case 0x3:
+      switch (bits & 0x7f) {
+        case 0x0f: // MISC-MEM
+        case 0x67: // JALR
+        case 0x6f: // JAL
+        case 0x73: // SYSTEM
+          return true;
+      }
+  }
+  return false;
+}
+
+insn_block_t* mmu_t::refill_block(reg_t addr, insn_block_t* block)
+{
+  // A trap on the first instruction is the caller's to take.
+  icache_entry_t* entry = access_icache(addr);
+  block->tag = -1;
+  block->next = NULL;
+  block->insns[0] = entry->data;
+  block->pc[0] = addr;
+  block->pc[1] = -1;
+  block->n = 1;
+
+  // Instructions that are traced or can hit a fetch trigger are executed
+  // one at a time, without caching the block.
+  if (entry->tag != addr || check_triggers_fetch)
+    return block;
+
+  reg_t paddr = translate_insn_addr(addr).target_offset + addr;
+  reg_t page_end = (addr & PGMASK) + PGSIZE;
+  reg_t pc = addr + insn_length(entry->data.insn.bits());
+  try {
+    while (block->n < insn_block_t::MAX_INSNS && pc + 2 <= page_end &&
+           !insn_ends_block(block->insns[block->n - 1].insn.bits()) &&
+           pc != proc->checkpoint_pc) {
+      entry = access_icache(pc);
+      reg_t length = insn_length(entry->data.insn.bits());
+      if (entry->tag != pc || pc + length > page_end)
+        break;
+      block->insns[block->n] = entry->data;
+      block->pc[block->n++] = pc;
+      pc += length;
+    }
+  } catch (trap_t&) {
+    // The block ends before the faulting instruction, which traps when it
+    // is fetched on its own.
+  }
+
+  block->pc[block->n] = -1;
+  block->tag = addr;
+  block->paddr = paddr;
+  block->size = pc - addr;
+
+  // Stores must not bypass invalidation through the TLB fast path.
+  auto inserted = code_pages.emplace(paddr >> PGSHIFT, code_page_t());
+  code_page_t& page = inserted.first->second;
+  reg_t offset = paddr & (PGSIZE - 1);
+  if (inserted.second) {
+    page.begin = offset;
+    page.end = offset + block->size;
+    reg_t idx = (addr >> PGSHIFT) % TLB_ENTRIES;
+    if ((tlb_store_tag[idx] & ~TLB_CHECK_TRIGGERS) == (addr >> PGSHIFT))
+      tlb_store_tag[idx] = -1;
+  } else {
+    page.begin = std::min(page.begin, offset);
+    page.end = std::max(page.end, offset + block->size);
+  }
+  size_t slot = block - blocks;
+  page.blocks[slot / 64] |= uint64_t(1) << (slot % 64);
+  for (size_t i = 0; i < block->n; i++) {
+    slot = icache_index(block->pc[i]);
+    page.icache[slot / 64] |= uint64_t(1) << (slot % 64);
+  }
+  return block;
+}
+
+static bool overlaps(reg_t a, reg_t a_len, reg_t b, reg_t b_len)
+{
+  return a < b + b_len && b < a + a_len;
+}
+
+void mmu_t::invalidate_code(reg_t vaddr, reg_t paddr, reg_t len)
+{
+  auto it = code_pages.find(paddr >> PGSHIFT);
+  if (it == code_pages.end())
+    return;
+  code_page_t& page = it->second;
+  reg_t offset = paddr & (PGSIZE - 1);
+  if (!overlaps(page.begin, page.end - page.begin, offset, len))
+    return;
+  bool live = false;
+
+  // Slots that were refilled since they were recorded, and those that
+  // the store drops, leave the page's set.
+  for (size_t w = 0; w < BLOCK_ENTRIES / 64; w++) {
+    for (uint64_t bits = page.blocks[w]; bits; bits &= bits - 1) {
+      size_t slot = w * 64 + __builtin_ctzll(bits);
+      insn_block_t* block = &blocks[slot];
+      if (block->tag == reg_t(-1) || (block->paddr >> PGSHIFT) != (paddr >> PGSHIFT)) {
+        page.blocks[w] &= ~(uint64_t(1) << (slot % 64));
+      } else if (overlaps(block->paddr, block->size, paddr, len)) {
+        block->tag = -1;
+        page.blocks[w] &= ~(uint64_t(1) << (slot % 64));
+      } else {
+        live = true;
+      }
+    }
+  }
+  for (size_t w = 0; w < ICACHE_ENTRIES / 64; w++) {
+    for (uint64_t bits = page.icache[w]; bits; bits &= bits - 1) {
+      size_t slot = w * 64 + __builtin_ctzll(bits);
+      icache_entry_t* entry = &icache[slot];
+      if ((entry->tag >> PGSHIFT) != (vaddr >> PGSHIFT)) {
+        page.icache[w] &= ~(uint64_t(1) << (slot % 64));
+      } else if (overlaps(entry->tag, insn_length(entry->data.insn.bits()), vaddr, len)) {
+        entry->tag = -1;
+        page.icache[w] &= ~(uint64_t(1) << (slot % 64));
+      } else {
+        live = true;
+      }
+    }
+  }
+
+  // Once nothing decoded from the page is left, stores to it take the fast
+  // path again after the next refill of the TLB.
+  if (!live)
+    code_pages.erase(it);
 }
 
 void mmu_t::flush_tlb()
@@ -171,8 +313,13 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
       throw *matched_trigger;
   }
 
-  if (auto host_addr = sim->addr_to_mem(paddr)) {
+  if (auto host_addr = sim->addr_to_store_mem(paddr)) {
+    if (unlikely(reservations != NULL))
+      reservations->before_store(reservation_hart, paddr);
     memcpy(host_addr, bytes, len);
+    if (unlikely(reservations != NULL))
+      reservations->after_store(reservation_hart, paddr);
+    check_code_page(addr, paddr, len);
     if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
       tracer.trace(paddr, len, STORE);
     else
@@ -182,6 +329,23 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes, uint32_
   }
 }
 
+char* mmu_t::atomic_host_addr(reg_t addr, reg_t len, reg_t data, reg_t* paddr)
+{
+  reg_t vpn = addr >> PGSHIFT;
+  if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) {
+    *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr;
+    return tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
+  }
+
+  *paddr = translate(addr, len, STORE, 0);
+  if (!matched_trigger) {
+    matched_trigger = trigger_exception(OPERATION_STORE, addr, data);
+    if (matched_trigger)
+      throw *matched_trigger;
+  }
+  return sim->addr_to_store_mem(*paddr);
+}
+
 tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
 {
   reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
@@ -201,7 +365,10 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
 
   if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
-    else if (type == STORE) tlb_store_tag[idx] = expected_tag;
+    else if (type == STORE) {
+      if (!code_pages.count(paddr >> PGSHIFT))
+        tlb_store_tag[idx] = expected_tag;
+    }
     else tlb_load_tag[idx] = expected_tag;
   }
 
@@ -341,6 +508,7 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, bool virt, bool mxr
       if ((pte & ad) != ad) {
         if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
           throw_access_exception(gva, type);
+        ppte = sim->addr_to_store_mem(pte_paddr);
         *(uint32_t*)ppte |= to_le((uint32_t)ad);
       }
 #else
@@ -414,6 +582,7 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode, bool virt, bool mxr)
       if ((pte & ad) != ad) {
         if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
           throw_access_exception(addr, type);
+        ppte = sim->addr_to_store_mem(pte_paddr);
         *(uint32_t*)ppte |= to_le((uint32_t)ad);
       }
 #else
@@ -11,7 +11,9 @@
 #include "processor.h"
 #include "memtracer.h"
 #include "byteorder.h"
+#include "parallel.h"
 #include <stdlib.h>
+#include <unordered_map>
 #include <vector>
 
 // virtual memory configuration
@@ -32,6 +34,23 @@ struct icache_entry_t {
   insn_fetch_t data;
 };
 
+// A run of straight-line code from a single page, decoded once and then
+// executed back to back by processor_t::step. Execution leaves the block as
+// soon as an instruction does not fall through to the next one. pc[i] is the
+// address of insns[i], and pc[n] is -1, so running off the end of the block
+// looks just like a taken branch.
+struct insn_block_t {
+  static const size_t MAX_INSNS = 16;
+
+  reg_t tag;
+  reg_t paddr;
+  reg_t size; // bytes of code from paddr on
+  size_t n;
+  struct insn_block_t* next; // the block that followed this one last time
+  reg_t pc[MAX_INSNS + 1];
+  insn_fetch_t insns[MAX_INSNS];
+};
+
 struct tlb_entry_t {
   char* host_offset;
   reg_t target_offset;
@@ -165,7 +184,7 @@ public:
       size_t size = sizeof(type##_t); \
       if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) { \
         if (proc) WRITE_MEM(addr, val, size); \
-        *(type##_t*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_le(val); \
+        store_host(addr, tlb_data[vpn % TLB_ENTRIES], to_le(val)); \
       } \
       else if (unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
         if (!matched_trigger) { \
@@ -174,7 +193,7 @@ public:
             throw *matched_trigger; \
         } \
         if (proc) WRITE_MEM(addr, val, size); \
-        *(type##_t*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_le(val); \
+        store_host(addr, tlb_data[vpn % TLB_ENTRIES], to_le(val)); \
       } \
       else { \
         type##_t le_val = to_le(val); \
@@ -192,6 +211,24 @@ public:
       if (addr & (sizeof(type##_t)-1)) \
         throw trap_store_address_misaligned(addr, 0, 0); \
       try { \
+        if (reservations) { \
+          /* Update memory in place, so that plain stores of other harts */ \
+          /* cannot land between the load and the store */ \
+          auto lhs = load_##type(addr); \
+          reg_t paddr = 0; \
+          if (auto host_addr = (type##_t*)atomic_host_addr(addr, sizeof(type##_t), f(lhs), &paddr)) { \
+            type##_t old = to_le(lhs); \
+            reservations->before_store(reservation_hart, paddr); \
+            while (!__atomic_compare_exchange_n(host_addr, &old, to_le(f(lhs)), false, \
+                                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) \
+              lhs = from_le(old); \
+            reservations->after_store(reservation_hart, paddr); \
+            if (proc) WRITE_MEM(addr, f(lhs), sizeof(type##_t)); \
+            check_code_page(addr, paddr, sizeof(type##_t)); \
+            return lhs; \
+          } \
+        } \
+        spinlock_guard_t guard(amo_lock); \
         auto lhs = load_##type(addr); \
         store_##type(addr, f(lhs)); \
         return lhs; \
@@ -223,6 +260,17 @@ public:
     return (float128_t){load_uint64(addr), load_uint64(addr + 8)};
   }
 
+  // Write a value through the TLB. With concurrent harts, this breaks the
+  // reservations of the other harts on its line.
+  template<typename T> inline void store_host(reg_t addr, const tlb_entry_t& entry, T val)
+  {
+    if (unlikely(reservations != NULL))
+      reservations->before_store(reservation_hart, entry.target_offset + addr);
+    *(T*)(entry.host_offset + addr) = val;
+    if (unlikely(reservations != NULL))
+      reservations->after_store(reservation_hart, entry.target_offset + addr);
+  }
+
   // store value to memory at aligned address
   store_func(uint8, store, 0)
   store_func(uint16, store, 0)
@@ -235,22 +283,81 @@ public:
   store_func(uint32, guest_store, RISCV_XLATE_VIRT)
   store_func(uint64, guest_store, RISCV_XLATE_VIRT)
 
+  // template for functions that perform a store-conditional; the check of
+  // the reservation and the store are atomic with respect to other harts
+  #define sc_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      if (reservations) { \
+        bool have_reservation = check_load_reservation(addr, sizeof(type##_t)); \
+        reg_t paddr = 0; \
+        if (have_reservation) { \
+          auto host_addr = (type##_t*)atomic_host_addr(addr, sizeof(type##_t), val, &paddr); \
+          /* The SC fails as well if a store that has not broken the */ \
+          /* reservation yet changed the location since the LR */ \
+          type##_t expected = to_le((type##_t)load_reservation_value); \
+          have_reservation = reservations->store_conditional(reservation_hart, paddr, [&]() { \
+            return __atomic_compare_exchange_n(host_addr, &expected, to_le(val), false, \
+                                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+          }); \
+        } \
+        if (have_reservation) { \
+          if (proc) WRITE_MEM(addr, val, sizeof(type##_t)); \
+          check_code_page(addr, paddr, sizeof(type##_t)); \
+        } \
+        yield_load_reservation(); \
+        return have_reservation; \
+      } \
+      bool have_reservation = check_load_reservation(addr, sizeof(type##_t)); \
+      if (have_reservation) \
+        store_##type(addr, val); \
+      yield_load_reservation(); \
+      return have_reservation; \
+    }
+
   // perform an atomic memory operation at an aligned address
   amo_func(uint32)
   amo_func(uint64)
 
+  // perform a store-conditional at an aligned address
+  sc_func(uint32)
+  sc_func(uint64)
+
+  // When harts are stepped concurrently on several host threads, AMOs to
+  // I/O space are serialized through amo_lock, and the reservations of all
+  // harts are kept in a shared set, in which this hart is number hart. Both
+  // are NULL otherwise.
+  void set_concurrency(spinlock_t* lock, reservation_set_t* set, size_t hart)
+  {
+    amo_lock = lock;
+    reservations = set;
+    reservation_hart = hart;
+  }
+
   inline void yield_load_reservation()
   {
     load_reservation_address = (reg_t)-1;
+    if (reservations)
+      reservations->yield(reservation_hart);
   }
 
-  inline void acquire_load_reservation(reg_t vaddr)
+  // The value returned by the LR is kept so that, with concurrent harts, an
+  // SC can tell whether another hart wrote the location in the meantime.
+  template<typename T> inline void acquire_load_reservation(reg_t vaddr, T value)
   {
     reg_t paddr = translate(vaddr, 1, LOAD, 0);
-    if (auto host_addr = sim->addr_to_mem(paddr))
+    if (auto host_addr = sim->addr_to_mem(paddr)) {
       load_reservation_address = refill_tlb(vaddr, paddr, host_addr, LOAD).target_offset + vaddr;
-    else
+      load_reservation_value = value;
+      if (reservations) {
+        // A store between the LR's load and taking the reservation did not
+        // break it, so look at the location again
+        reservations->acquire(reservation_hart, load_reservation_address);
+        if (from_le(*(volatile T*)host_addr) != value)
+          yield_load_reservation();
+      }
+    } else {
       throw trap_load_access_fault(vaddr, 0, 0); // disallow LR to I/O space
+    }
   }
 
   inline bool check_load_reservation(reg_t vaddr, size_t size)
@@ -259,10 +366,13 @@ public:
       throw trap_store_address_misaligned(vaddr, 0, 0);
 
     reg_t paddr = translate(vaddr, 1, STORE, 0);
-    if (auto host_addr = sim->addr_to_mem(paddr))
-      return load_reservation_address == refill_tlb(vaddr, paddr, host_addr, STORE).target_offset + vaddr;
-    else
+    if (auto host_addr = sim->addr_to_store_mem(paddr)) {
+      if (load_reservation_address != refill_tlb(vaddr, paddr, host_addr, STORE).target_offset + vaddr)
+        return false;
+      return !reservations || reservations->held(reservation_hart, load_reservation_address);
+    } else {
       throw trap_store_access_fault(vaddr, 0, 0); // disallow SC to I/O space
+    }
   }
 
   static const reg_t ICACHE_ENTRIES = 1024;
@@ -313,6 +423,21 @@ public:
     return refill_icache(addr, entry);
   }
 
+  static const reg_t BLOCK_ENTRIES = 256;
+
+  inline size_t block_index(reg_t addr)
+  {
+    return (addr / PC_ALIGN) % BLOCK_ENTRIES;
+  }
+
+  inline insn_block_t* access_block(reg_t addr)
+  {
+    insn_block_t* block = &blocks[block_index(addr)];
+    if (likely(block->tag == addr))
+      return block;
+    return refill_block(addr, block);
+  }
+
   inline insn_fetch_t load_insn(reg_t addr)
   {
     icache_entry_t entry;
@@ -347,11 +472,42 @@ private:
   processor_t* proc;
   memtracer_list_t tracer;
   reg_t load_reservation_address;
+  reg_t load_reservation_value;
+  spinlock_t* amo_lock;
+  reservation_set_t* reservations;
+  size_t reservation_hart;
   uint16_t fetch_temp;
 
   // implement an instruction cache for simulator performance
   icache_entry_t icache[ICACHE_ENTRIES];
 
+  // Decoded basic blocks. Stores to a page that blocks were built from
+  // take the slow path, which drops the blocks and icache entries that
+  // overlap the bytes stored. code_pages maps the physical page numbers
+  // concerned to the range of the page that code was decoded from and to
+  // the slots that may hold it, so that a store only looks at those; a page
+  // leaves it when none of them is left.
+  struct code_page_t {
+    reg_t begin, end;
+    uint64_t blocks[BLOCK_ENTRIES / 64];
+    uint64_t icache[ICACHE_ENTRIES / 64];
+  };
+  insn_block_t blocks[BLOCK_ENTRIES];
+  std::unordered_map<reg_t, code_page_t> code_pages;
+  insn_block_t* refill_block(reg_t addr, insn_block_t* block);
+  void invalidate_code(reg_t vaddr, reg_t paddr, reg_t len);
+
+  // For a store that bypassed the TLB
+  void check_code_page(reg_t vaddr, reg_t paddr, reg_t len)
+  {
+    if (unlikely(!code_pages.empty()))
+      invalidate_code(vaddr, paddr, len);
+  }
+
+  // Host address of the memory that an AMO or SC of a concurrent hart
+  // updates in place, or NULL for I/O space. Throws the store's traps.
+  char* atomic_host_addr(reg_t addr, reg_t len, reg_t data, reg_t* paddr);
+
   // implement a TLB for simulator performance
   static const reg_t TLB_ENTRIES = 256;
   // If a TLB tag has TLB_CHECK_TRIGGERS set, then the MMU must check for a
@@ -0,0 +1,112 @@
+// See LICENSE for license details.
+
+#include "parallel.h"
+
+const uint64_t reservation_set_t::NONE;
+
+reservation_set_t::reservation_set_t(size_t nharts)
+  : nharts(nharts), lines(new std::atomic<uint64_t>[nharts])
+{
+  for (size_t i = 0; i < nharts; i++)
+    lines[i].store(NONE, std::memory_order_relaxed);
+  for (auto& count : counts)
+    count.store(0, std::memory_order_relaxed);
+}
+
+void reservation_set_t::acquire(size_t hart, uint64_t addr)
+{
+  yield(hart);
+  uint64_t l = line(addr);
+  lines[hart].store(l, std::memory_order_relaxed);
+  // A full barrier, so that the LR's second read of memory sees every
+  // store that missed the reservation
+  counts[bucket(l)].fetch_add(1, std::memory_order_seq_cst);
+}
+
+void reservation_set_t::yield(size_t hart)
+{
+  uint64_t l = lines[hart].exchange(NONE, std::memory_order_relaxed);
+  if (l != NONE)
+    counts[bucket(l)].fetch_sub(1, std::memory_order_relaxed);
+}
+
+void reservation_set_t::break_line(size_t hart, uint64_t addr)
+{
+  uint64_t l = line(addr);
+  for (size_t i = 0; i < nharts; i++) {
+    uint64_t expected = l;
+    if (i != hart && lines[i].compare_exchange_strong(expected, NONE, std::memory_order_relaxed))
+      counts[bucket(l)].fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+void spin_barrier_t::wait()
+{
+  bool my_sense = !sense.load(std::memory_order_relaxed);
+
+  if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // Last one in: re-arm the barrier and release everybody else.
+    count.store(n, std::memory_order_relaxed);
+    sense.store(my_sense, std::memory_order_release);
+    return;
+  }
+
+  for (unsigned spins = 0; sense.load(std::memory_order_acquire) != my_sense; spins++) {
+    if (spins >= SPINS_BEFORE_YIELD)
+      std::this_thread::yield();
+  }
+}
+
+thread_pool_t::thread_pool_t(size_t nthreads)
+  : nthreads(nthreads), start(nthreads), finish(nthreads), job(NULL),
+    stop(false), errors(nthreads)
+{
+  for (size_t i = 1; i < nthreads; i++)
+    threads.emplace_back(&thread_pool_t::worker, this, i);
+}
+
+thread_pool_t::~thread_pool_t()
+{
+  stop = true;
+  start.wait();
+  for (auto& t : threads)
+    t.join();
+}
+
+void thread_pool_t::run(const std::function<void(size_t)>& job)
+{
+  this->job = &job;
+  start.wait();
+  execute(0);
+  finish.wait();
+  this->job = NULL;
+
+  std::exception_ptr error;
+  for (auto& e : errors) {
+    if (e && !error)
+      error = e;
+    e = nullptr;
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void thread_pool_t::worker(size_t id)
+{
+  while (true) {
+    start.wait();
+    if (stop)
+      return;
+    execute(id);
+    finish.wait();
+  }
+}
+
+void thread_pool_t::execute(size_t id)
+{
+  try {
+    (*job)(id);
+  } catch (...) {
+    errors[id] = std::current_exception();
+  }
+}
@@ -0,0 +1,151 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_PARALLEL_H
+#define _RISCV_PARALLEL_H
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// A test-and-set lock for short critical sections, e.g. a single AMO.
+class spinlock_t
+{
+ public:
+  spinlock_t() { flag.clear(); }
+  void lock()
+  {
+    while (flag.test_and_set(std::memory_order_acquire))
+      std::this_thread::yield();
+  }
+  void unlock() { flag.clear(std::memory_order_release); }
+
+ private:
+  std::atomic_flag flag;
+};
+
+// Holds a spinlock for the lifetime of the guard. A NULL lock makes the
+// guard a no-op, which is what a single-threaded simulation uses.
+class spinlock_guard_t
+{
+ public:
+  spinlock_guard_t(spinlock_t* l) : l(l) { if (l) l->lock(); }
+  ~spinlock_guard_t() { if (l) l->unlock(); }
+  spinlock_guard_t(const spinlock_guard_t&) = delete;
+
+ private:
+  spinlock_t* l;
+};
+
+// The LR reservations of harts that are stepped concurrently. A store of
+// one hart breaks the reservations of the other harts on its line, so that
+// their SCs fail even if the store wrote back the value their LRs read.
+// Stores call before_store() and after_store() around the write. The first
+// call orders the store against a concurrent SC. The second one catches an
+// LR that reserved the line while the store was in flight, as an LR reads
+// memory again after acquire(). Both are a single load unless some hart
+// holds a reservation near the address.
+class reservation_set_t
+{
+ public:
+  reservation_set_t(size_t nharts);
+
+  void acquire(size_t hart, uint64_t addr);
+  void yield(size_t hart);
+  bool held(size_t hart, uint64_t addr) const
+  {
+    return lines[hart].load(std::memory_order_relaxed) == line(addr);
+  }
+
+  void before_store(size_t hart, uint64_t addr)
+  {
+    if (busy(addr)) {
+      spinlock_guard_t guard(&lock);
+      break_line(hart, addr);
+    }
+  }
+  void after_store(size_t hart, uint64_t addr)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    before_store(hart, addr);
+  }
+
+  // Call store() if hart still holds its reservation on addr, and return
+  // whether it succeeded. No other store breaks the reservation meanwhile.
+  template<typename F> bool store_conditional(size_t hart, uint64_t addr, F store)
+  {
+    spinlock_guard_t guard(&lock);
+    if (!held(hart, addr))
+      return false;
+    break_line(hart, addr);
+    bool stored = store();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    break_line(hart, addr);
+    return stored;
+  }
+
+ private:
+  static const unsigned LINE_SHIFT = 6;
+  static const size_t BUCKETS = 256;
+  static const uint64_t NONE = UINT64_MAX;
+
+  static uint64_t line(uint64_t addr) { return addr >> LINE_SHIFT; }
+  static size_t bucket(uint64_t line) { return line % BUCKETS; }
+  bool busy(uint64_t addr) const
+  {
+    return counts[bucket(line(addr))].load(std::memory_order_relaxed) != 0;
+  }
+  void break_line(size_t hart, uint64_t addr);
+
+  const size_t nharts;
+  spinlock_t lock;
+  std::unique_ptr<std::atomic<uint64_t>[]> lines; // reserved line per hart
+  std::atomic<uint32_t> counts[BUCKETS];          // reservations per bucket
+};
+
+// A sense-reversing barrier. Waiters spin for a while and then start
+// yielding the host CPU, so an oversubscribed host still makes progress.
+class spin_barrier_t
+{
+ public:
+  spin_barrier_t(size_t n) : n(n), count(n), sense(false) {}
+  void wait();
+
+ private:
+  static const unsigned SPINS_BEFORE_YIELD = 1024;
+  const size_t n;
+  std::atomic<size_t> count;
+  std::atomic<bool> sense;
+};
+
+// A fixed pool of host threads that runs one job per thread and waits for
+// all of them. The thread calling run() takes part as thread 0.
+class thread_pool_t
+{
+ public:
+  thread_pool_t(size_t nthreads);
+  ~thread_pool_t();
+
+  size_t size() const { return nthreads; }
+
+  // Call job(i) for every i in [0, size()) concurrently and return once all
+  // calls have finished. An exception thrown by any call is rethrown here.
+  void run(const std::function<void(size_t)>& job);
+
+ private:
+  void worker(size_t id);
+  void execute(size_t id);
+
+  const size_t nthreads;
+  spin_barrier_t start;
+  spin_barrier_t finish;
+  const std::function<void(size_t)>* job;
+  bool stop;
+  std::vector<std::exception_ptr> errors;
+  std::vector<std::thread> threads;
+};
+
+#endif
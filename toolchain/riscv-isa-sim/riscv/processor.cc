@@ -8,6 +8,9 @@
 #include "simif.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "async_log.h"
+#include "profile.h"
+#include "checkpoint.h"
 #include <cinttypes>
 #include <cmath>
 #include <cstdlib>
@@ -17,6 +20,7 @@
 #include <stdexcept>
 #include <string>
 #include <algorithm>
+#include <mutex>
 
 #undef STATE
 #define STATE state
@@ -26,8 +30,10 @@ processor_t::processor_t(const char* isa, const char* priv, const char* varch,
                          FILE* log_file)
   : debug(false), halt_request(HR_NONE), sim(sim), ext(NULL), id(id), xlen(0),
   histogram_enabled(false), log_commits_enabled(false),
-  log_file(log_file), halt_on_reset(halt_on_reset),
-  extension_table(256, false), last_pc(1), executions(1)
+  log_file(log_file), commit_log(NULL), async_log(NULL),
+  halt_on_reset(halt_on_reset),
+  in_wfi(false), checkpoint_pc(-1), checkpoint_cycle_reads(0),
+  checkpoint_hit(false), extension_table(256, false), last_pc(1), executions(1)
 {
   VU.p = this;
 
@@ -53,9 +59,10 @@ processor_t::~processor_t()
 #ifdef RISCV_ENABLE_HISTOGRAM
   if (histogram_enabled)
   {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
+    auto pcs = profile->get_pcs();
+    fprintf(stderr, "PC Histogram size:%zu\n", pcs.size());
+    for (auto& it : pcs)
+      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.pc, it.count);
   }
 #endif
 
@@ -429,12 +436,19 @@ void processor_t::set_debug(bool value)
 void processor_t::set_histogram(bool value)
 {
   histogram_enabled = value;
+  if (value)
+    enable_profile();
+}
+
+void processor_t::enable_profile()
+{
 #ifndef RISCV_ENABLE_HISTOGRAM
-  if (value) {
-    fprintf(stderr, "PC Histogram support has not been properly enabled;");
-    fprintf(stderr, " please re-build the riscv-isa-sim project using \"configure --enable-histogram\".\n");
-    abort();
-  }
+  fprintf(stderr, "PC Histogram support has not been properly enabled;");
+  fprintf(stderr, " please re-build the riscv-isa-sim project using \"configure --enable-histogram\".\n");
+  abort();
+#else
+  if (!profile)
+    profile.reset(new hart_profile_t(id, max_xlen));
 #endif
 }
 
@@ -445,6 +459,12 @@ void processor_t::enable_log_commits()
 }
 #endif
 
+void processor_t::set_async_log(async_log_port_t* port)
+{
+  async_log = port;
+  log_file = port->text();
+}
+
 void processor_t::reset()
 {
   state.reset(max_isa);
@@ -470,6 +490,40 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::set_checkpoint_trigger(reg_t pc, uint64_t cycle_reads)
+{
+  checkpoint_pc = sext_xlen(pc); // as in state.pc
+  checkpoint_cycle_reads = cycle_reads;
+  checkpoint_hit = false;
+  // Decoded blocks must end before the trigger
+  mmu->flush_icache();
+}
+
+void processor_t::save(checkpoint_writer_t& out)
+{
+  if (supports_extension('V'))
+    throw std::runtime_error("Checkpoints do not hold the state of the vector unit");
+  out(id);
+  out(xlen);
+  state.for_each_field(out);
+}
+
+void processor_t::restore(checkpoint_reader_t& in)
+{
+  uint32_t saved_id;
+  unsigned saved_xlen;
+  in(saved_id);
+  in(saved_xlen);
+  if (saved_id != id || saved_xlen > max_xlen)
+    throw std::runtime_error("Checkpoint does not match hart " + std::to_string(id));
+  xlen = saved_xlen;
+  state.for_each_field(in);
+  in_wfi = false;
+
+  // The TLBs, decoded blocks and trigger checks derive from the state
+  trigger_updated();
+}
+
 // Count number of contiguous 0 bits starting from the LSB.
 static int ctz(reg_t val)
 {
@@ -1319,6 +1373,13 @@ reg_t processor_t::get_csr(int which, insn_t insn, bool write, bool peek)
     ctr_en &= state.scounteren;
   bool ctr_ok = (ctr_en >> (which & 31)) & 1;
 
+  // A read of the cycle counter can be the trigger of a checkpoint
+  if (unlikely(checkpoint_cycle_reads) && !peek &&
+      (which == CSR_MCYCLE || which == CSR_CYCLE ||
+       which == CSR_MCYCLEH || which == CSR_CYCLEH) &&
+      --checkpoint_cycle_reads == 0)
+    throw checkpoint_trigger_t();
+
   reg_t res = 0;
 #define ret(n) do { \
     res = (n); \
@@ -1684,31 +1745,18 @@ reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc)
 
 insn_func_t processor_t::decode_insn(insn_t insn)
 {
-  // look up opcode in hash table
-  size_t idx = insn.bits() % OPCODE_CACHE_SIZE;
-  insn_desc_t desc = opcode_cache[idx];
-
-  if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p-1)->match && p->match != (p+1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p+1) = *p;
-        instructions[0] = desc;
-      }
-    }
-
-    opcode_cache[idx] = desc;
-    opcode_cache[idx].match = insn.bits();
-  }
-
-  return xlen == 64 ? desc.rv64 : desc.rv32;
+  typedef decode_table_t t;
+  insn_bits_t bits = insn.bits();
+  uint32_t entry = decode_table->entries[decode_index(bits)];
+  if (entry & t::SPLIT)
+    entry = decode_table->subentries[(entry & ~t::SPLIT) * t::SUBENTRIES +
+                                     ((bits >> 25) & (t::SUBENTRIES - 1))];
+
+  const insn_desc_t* p = &decode_table->candidates[entry];
+  while ((bits & p->mask) != p->match)
+    p++;
+
+  return xlen == 64 ? p->rv64 : p->rv32;
 }
 
 void processor_t::register_insn(insn_desc_t desc)
@@ -1727,8 +1775,70 @@ void processor_t::build_opcode_map()
   };
   std::sort(instructions.begin(), instructions.end(), cmp());
 
-  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction};
+  // Harts normally have the same instructions, so they reuse the table that
+  // was built last.
+  static std::mutex last_lock;
+  static std::shared_ptr<const decode_table_t> last;
+  std::lock_guard<std::mutex> guard(last_lock);
+
+  auto same = [](const insn_desc_t& lhs, const insn_desc_t& rhs) {
+    return lhs.match == rhs.match && lhs.mask == rhs.mask &&
+           lhs.rv32 == rhs.rv32 && lhs.rv64 == rhs.rv64;
+  };
+  if (last && last->instructions.size() == instructions.size() &&
+      std::equal(instructions.begin(), instructions.end(),
+                 last->instructions.begin(), same)) {
+    decode_table = last;
+    return;
+  }
+
+  typedef decode_table_t t;
+  std::shared_ptr<decode_table_t> table(new decode_table_t);
+  table->instructions = instructions;
+
+  // An instruction is a candidate for every table entry whose index agrees
+  // with its match value in the bits of the index that it masks, so the
+  // first match among an entry's candidates is also the first match in
+  // instructions. Entries with the same candidates share their list.
+  auto select = [&](const std::vector<size_t>& from, insn_bits_t key, insn_bits_t key_mask) {
+    std::vector<size_t> candidates;
+    for (size_t i : from)
+      if (((instructions[i].match ^ key) & instructions[i].mask & key_mask) == 0)
+        candidates.push_back(i);
+    return candidates;
+  };
+
+  std::map<std::vector<size_t>, uint32_t> lists;
+  auto add_list = [&](const std::vector<size_t>& candidates) {
+    auto it = lists.find(candidates);
+    if (it != lists.end())
+      return it->second;
+    uint32_t offset = table->candidates.size();
+    for (size_t i : candidates)
+      table->candidates.push_back(instructions[i]);
+    lists[candidates] = offset;
+    return offset;
+  };
+
+  std::vector<size_t> all(instructions.size());
+  for (size_t i = 0; i < all.size(); i++)
+    all[i] = i;
+
+  table->entries.resize(t::ENTRIES);
+  for (size_t idx = 0; idx < t::ENTRIES; idx++) {
+    insn_bits_t key = ((idx & 0x380) << 5) | (idx & 0x7f);
+    auto candidates = select(all, key, 0x707f);
+    if (candidates.size() <= t::SPLIT_CANDIDATES) {
+      table->entries[idx] = add_list(candidates);
+      continue;
+    }
+
+    table->entries[idx] = t::SPLIT | (table->subentries.size() / t::SUBENTRIES);
+    for (size_t sub = 0; sub < t::SUBENTRIES; sub++)
+      table->subentries.push_back(add_list(select(candidates, insn_bits_t(sub) << 25, 0xfe000000)));
+  }
+
+  decode_table = last = table;
 }
 
 void processor_t::register_extension(extension_t* x)
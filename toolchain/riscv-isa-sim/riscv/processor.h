@@ -6,10 +6,12 @@
 #include "config.h"
 #include "devices.h"
 #include "trap.h"
+#include "commit_log.h"
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <memory>
 #include <cassert>
 #include "debug_rom_defines.h"
 
@@ -20,6 +22,10 @@ class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class checkpoint_writer_t;
+class checkpoint_reader_t;
+class async_log_port_t;
+class hart_profile_t;
 
 struct insn_desc_t
 {
@@ -223,6 +229,23 @@ struct state_t
       STEP_STEPPED
   } single_step;
 
+  // Call f on every field above, for checkpoints
+  template<typename F> void for_each_field(F& f)
+  {
+    f(pc); f(XPR); f(FPR);
+    f(prv); f(v); f(misa); f(mstatus); f(mepc); f(mtval); f(mscratch);
+    f(mtvec); f(mcause); f(minstret); f(mie); f(mip); f(medeleg); f(mideleg);
+    f(mcounteren); f(scounteren); f(sepc); f(stval); f(sscratch); f(stvec);
+    f(satp); f(scause);
+    f(mtval2); f(mtinst); f(hstatus); f(hideleg); f(hedeleg); f(hcounteren);
+    f(htval); f(htinst); f(hgatp); f(vsstatus); f(vstvec); f(vsscratch);
+    f(vsepc); f(vscause); f(vstval); f(vsatp);
+    f(dpc); f(dscratch0); f(dscratch1); f(dcsr); f(tselect); f(mcontrol);
+    f(tdata2); f(debug_mode);
+    f(pmpcfg); f(pmpaddr);
+    f(fflags); f(frm); f(serialized); f(single_step);
+  }
+
 #ifdef RISCV_ENABLE_COMMITLOG
   commit_log_reg_t log_reg_write;
   commit_log_mem_t log_mem_read;
@@ -245,6 +268,9 @@ typedef enum {
   EXT_ZVEDIV,
 } isa_extension_t;
 
+// Thrown to stop processor_t::step() at a checkpoint trigger
+class checkpoint_trigger_t {};
+
 // Count number of contiguous 1 bits starting from the LSB.
 static int cto(reg_t val)
 {
@@ -265,10 +291,19 @@ public:
 
   void set_debug(bool value);
   void set_histogram(bool value);
+  // Count the retired instructions and call stacks in a hart_profile_t.
+  void enable_profile();
+  const hart_profile_t* get_profile() const { return profile.get(); }
 #ifdef RISCV_ENABLE_COMMITLOG
   void enable_log_commits();
   bool get_log_commits_enabled() const { return log_commits_enabled; }
+  // Log commits as binary records into the buffer instead of as text.
+  void set_commit_log(commit_log_buffer_t* buffer) { commit_log = buffer; }
+  commit_log_buffer_t* get_commit_log() const { return commit_log; }
 #endif
+  // Hand this hart's log over to the writer thread of an async_log_t.
+  void set_async_log(async_log_port_t* port);
+  async_log_port_t* get_async_log() const { return async_log; }
   void reset();
   void step(size_t n); // run for n cycles
   void set_csr(int which, reg_t val);
@@ -301,13 +336,14 @@ public:
   reg_t legalize_privilege(reg_t);
   void set_privilege(reg_t);
   void set_virt(bool);
-  void update_histogram(reg_t pc);
+  void update_histogram(reg_t pc, insn_t insn);
   const disassembler_t* get_disassembler() { return disassembler; }
 
   FILE *get_log_file() { return log_file; }
 
   void register_insn(insn_desc_t);
   void register_extension(extension_t*);
+  insn_func_t decode_insn(insn_t insn);
 
   // MMIO slave interface
   bool load(reg_t addr, size_t len, uint8_t* bytes);
@@ -324,6 +360,25 @@ public:
     HR_GROUP    /* Halt requested due to halt group. */
   } halt_request;
 
+  // True if the last step() ended in a WFI and the hart has no enabled
+  // interrupt pending, i.e. it cannot make progress until one arrives.
+  bool waiting_for_interrupt()
+  {
+    return in_wfi && !state.debug_mode && halt_request == HR_NONE &&
+           !(state.mip & state.mie);
+  }
+
+  // Stop step() before the instruction at pc, or before the n-th read of
+  // the cycle counter (n > 0), so that the simulation can save a
+  // checkpoint. The hart stops once; then checkpoint_reached() is true until
+  // the trigger is set again.
+  void set_checkpoint_trigger(reg_t pc, uint64_t cycle_reads);
+  bool checkpoint_reached() { return checkpoint_hit; }
+
+  // Write the architectural state to a checkpoint, or read it back
+  void save(checkpoint_writer_t& out);
+  void restore(checkpoint_reader_t& in);
+
   // Return the index of a trigger that matched, or -1.
   inline int trigger_match(trigger_operation_t operation, reg_t address, reg_t data)
   {
@@ -425,15 +480,42 @@ private:
   bool histogram_enabled;
   bool log_commits_enabled;
   FILE *log_file;
+  commit_log_buffer_t* commit_log;
+  async_log_port_t* async_log;
   bool halt_on_reset;
+  bool in_wfi;
+  reg_t checkpoint_pc; // -1 when there is none
+  uint64_t checkpoint_cycle_reads; // left until the trigger, 0 for none
+  bool checkpoint_hit;
   std::vector<bool> extension_table;
   
 
   std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
+  std::unique_ptr<hart_profile_t> profile;
+
+  // Decode table, built from instructions by build_opcode_map and shared
+  // by all processors with the same instructions. The first level is
+  // indexed by the opcode and funct3 fields; entries with many candidates
+  // are split again by funct7. Each entry is the offset of a short list in
+  // candidates, in the same order as instructions and ending with the
+  // illegal instruction, that decode_insn searches linearly.
+  struct decode_table_t {
+    static const size_t ENTRIES = 1 << 10;
+    static const size_t SUBENTRIES = 1 << 7;
+    static const size_t SPLIT_CANDIDATES = 4;
+    static const uint32_t SPLIT = uint32_t(1) << 31;
+
+    std::vector<insn_desc_t> instructions;
+    std::vector<uint32_t> entries;
+    std::vector<uint32_t> subentries;
+    std::vector<insn_desc_t> candidates;
+  };
+  std::shared_ptr<const decode_table_t> decode_table;
 
-  static const size_t OPCODE_CACHE_SIZE = 8191;
-  insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
+  static size_t decode_index(insn_bits_t bits)
+  {
+    return ((bits >> 5) & 0x380) | (bits & 0x7f);
+  }
 
   void take_pending_interrupt() { take_interrupt(state.mip & state.mie); }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
@@ -454,7 +536,6 @@ private:
   void parse_isa_string(const char*);
   void build_opcode_map();
   void register_base_instructions();
-  insn_func_t decode_insn(insn_t insn);
 
   // Track repeated executions for processor_t::disasm()
   uint64_t last_pc, last_bits, executions;
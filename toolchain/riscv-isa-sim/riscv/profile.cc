@@ -0,0 +1,291 @@
+// See LICENSE for license details.
+
+#include "profile.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <string>
+
+const char* const insn_class_names[NUM_INSN_CLASSES] = {
+  "other", "load", "store", "amo", "branch", "jump", "simd"
+};
+
+hart_profile_t::hart_profile_t(uint32_t hartid, unsigned xlen)
+  : hartid(hartid), xlen(xlen), last_page(NULL), frame(NO_FRAME),
+    pending(CALL), lost_frames(0)
+{
+  // The first instruction enters the root frame as if it had been called.
+}
+
+hart_profile_t::page_t* hart_profile_t::find_page(reg_t pc)
+{
+  reg_t base = pc & ~reg_t(PAGE_BYTES - 1);
+  auto& page = pages[base];
+  if (!page) {
+    page.reset(new page_t);
+    memset(page.get(), 0, sizeof(page_t));
+    page->base = base;
+  }
+  return page.get();
+}
+
+uint8_t hart_profile_t::classify(insn_t insn) const
+{
+  uint64_t bits = insn.bits();
+  auto is_link = [](uint64_t reg) { return reg == 1 || reg == 5; };
+
+  if ((bits & 3) != 3) {
+    unsigned funct3 = (bits >> 13) & 7;
+    switch (bits & 3) {
+      case 0: // C.ADDI4SPN, loads and stores
+        if (funct3 == 0 || funct3 == 4)
+          return INSN_CLASS_OTHER;
+        return funct3 < 4 ? INSN_CLASS_LOAD : INSN_CLASS_STORE;
+      case 1:
+        if (funct3 == 1 && xlen == 32) // C.JAL
+          return INSN_CLASS_JUMP | CALL;
+        if (funct3 == 5) // C.J
+          return INSN_CLASS_JUMP;
+        if (funct3 >= 6) // C.BEQZ, C.BNEZ
+          return INSN_CLASS_BRANCH;
+        return INSN_CLASS_OTHER;
+      default:
+        if (funct3 == 4 && insn.rvc_rs2() == 0 && insn.rvc_rs1() != 0) {
+          if (bits & (1 << 12)) // C.JALR
+            return INSN_CLASS_JUMP | CALL;
+          // C.JR
+          return INSN_CLASS_JUMP | (is_link(insn.rvc_rs1()) ? RETURN : 0);
+        }
+        if (funct3 == 0 || funct3 == 4)
+          return INSN_CLASS_OTHER;
+        return funct3 < 4 ? INSN_CLASS_LOAD : INSN_CLASS_STORE;
+    }
+  }
+
+  switch (bits & 0x7f) {
+    case 0x03: // LOAD
+    case 0x07: // LOAD-FP
+    case 0x0b: // Xpulp post-increment loads
+      return INSN_CLASS_LOAD;
+    case 0x23: // STORE
+    case 0x27: // STORE-FP
+    case 0x2b: // Xpulp post-increment stores
+      return INSN_CLASS_STORE;
+    case 0x2f:
+      return INSN_CLASS_AMO;
+    case 0x63:
+      return INSN_CLASS_BRANCH;
+    case 0x6f: // JAL
+      return INSN_CLASS_JUMP | (is_link(insn.rd()) ? CALL : 0);
+    case 0x67: // JALR
+      if (is_link(insn.rd()))
+        return INSN_CLASS_JUMP | CALL;
+      return INSN_CLASS_JUMP | (insn.rd() == 0 && is_link(insn.rs1()) ? RETURN : 0);
+    case 0x57: // Xpulp packed SIMD, V
+      return INSN_CLASS_SIMD;
+    default:
+      return INSN_CLASS_OTHER;
+  }
+}
+
+void hart_profile_t::follow_link(reg_t pc, uint8_t link)
+{
+  if (pending & CALL) {
+    if (frame != NO_FRAME && frames[frame].depth >= MAX_DEPTH) {
+      lost_frames++;
+    } else {
+      auto it = children.find(std::make_pair(frame, pc));
+      if (it != children.end()) {
+        frame = it->second;
+      } else {
+        uint32_t depth = frame == NO_FRAME ? 0 : frames[frame].depth + 1;
+        frames.push_back({zext(pc), frame, depth, 0});
+        children[std::make_pair(frame, pc)] = frames.size() - 1;
+        frame = frames.size() - 1;
+      }
+    }
+  } else if (pending & RETURN) {
+    // Returns from the root frame (or past where the hart started) are not
+    // matched by a call; stay in the root frame then.
+    if (lost_frames)
+      lost_frames--;
+    else if (frames[frame].parent != NO_FRAME)
+      frame = frames[frame].parent;
+  }
+  pending = link;
+}
+
+uint64_t hart_profile_t::get_instret() const
+{
+  uint64_t instret = 0;
+  for (auto& f : frames)
+    instret += f.count;
+  return instret;
+}
+
+std::vector<hart_profile_t::pc_count_t> hart_profile_t::get_pcs() const
+{
+  std::vector<pc_count_t> pcs;
+  for (auto& it : pages) {
+    const page_t* page = it.second.get();
+    for (size_t i = 0; i < PAGE_BYTES / 2; i++) {
+      if (page->counts[i])
+        pcs.push_back({zext(page->base + 2 * i), page->counts[i],
+                       insn_class_t(page->kinds[i] & CLASS_MASK)});
+    }
+  }
+  std::sort(pcs.begin(), pcs.end(),
+            [](const pc_count_t& a, const pc_count_t& b) { return a.pc < b.pc; });
+  return pcs;
+}
+
+static double percent(uint64_t n, uint64_t total)
+{
+  return total ? 100.0 * n / total : 0;
+}
+
+void profile_write_report(FILE* out, const std::vector<const hart_profile_t*>& harts,
+                          const symbol_lookup_t& lookup)
+{
+  static const size_t HOT_INSNS = 50;
+
+  struct symbol_stats_t
+  {
+    std::string name;
+    uint64_t count;
+    uint64_t classes[NUM_INSN_CLASSES];
+    size_t harts;
+    size_t last_hart; // index of the last hart counted in harts, plus one
+  };
+
+  // Symbols by address; instructions outside of any symbol go to the
+  // entry at reg_t(-1).
+  std::map<reg_t, symbol_stats_t> symbols;
+  std::map<reg_t, hart_profile_t::pc_count_t> insns;
+  uint64_t total = 0;
+  uint64_t classes[NUM_INSN_CLASSES] = {};
+
+  for (size_t i = 0; i < harts.size(); i++) {
+    for (auto& pc : harts[i]->get_pcs()) {
+      reg_t base;
+      const char* name = lookup(pc.pc, &base);
+      if (!name)
+        base = reg_t(-1);
+
+      auto it = symbols.find(base);
+      if (it == symbols.end()) {
+        symbol_stats_t stats = {name ? name : "[unknown]", 0, {}, 0, 0};
+        it = symbols.insert(std::make_pair(base, stats)).first;
+      }
+      symbol_stats_t& sym = it->second;
+      if (sym.last_hart != i + 1) {
+        sym.harts++;
+        sym.last_hart = i + 1;
+      }
+
+      sym.count += pc.count;
+      sym.classes[pc.insn_class] += pc.count;
+      classes[pc.insn_class] += pc.count;
+      total += pc.count;
+
+      auto& insn = insns[pc.pc];
+      insn.pc = pc.pc;
+      insn.count += pc.count;
+      insn.insn_class = pc.insn_class;
+    }
+  }
+
+  fprintf(out, "Profile of %zu harts: %" PRIu64 " instructions retired\n",
+          harts.size(), total);
+  fprintf(out, "(Spike retires one instruction per cycle, so these are also the cycles.)\n");
+
+  fprintf(out, "\nInstructions by class:\n");
+  for (int c = 0; c < NUM_INSN_CLASSES; c++)
+    fprintf(out, "  %-8s %16" PRIu64 " %7.2f%%\n", insn_class_names[c],
+            classes[c], percent(classes[c], total));
+
+  fprintf(out, "\nInstructions by hart:\n");
+  for (const hart_profile_t* hart : harts) {
+    uint64_t instret = hart->get_instret();
+    fprintf(out, "  hart %-4" PRIu32 " %14" PRIu64 " %7.2f%%\n", hart->get_hartid(),
+            instret, percent(instret, total));
+  }
+
+  std::vector<const symbol_stats_t*> by_count;
+  for (auto& it : symbols)
+    by_count.push_back(&it.second);
+  std::stable_sort(by_count.begin(), by_count.end(),
+                   [](const symbol_stats_t* a, const symbol_stats_t* b) {
+                     return a->count > b->count;
+                   });
+
+  fprintf(out, "\nInstructions by symbol:\n");
+  fprintf(out, "  %16s %8s", "instret", "");
+  for (int c = 0; c < NUM_INSN_CLASSES; c++)
+    fprintf(out, " %14s", insn_class_names[c]);
+  fprintf(out, " %6s  %s\n", "harts", "symbol");
+  for (const symbol_stats_t* sym : by_count) {
+    fprintf(out, "  %16" PRIu64 " %7.2f%%", sym->count, percent(sym->count, total));
+    for (int c = 0; c < NUM_INSN_CLASSES; c++)
+      fprintf(out, " %14" PRIu64, sym->classes[c]);
+    fprintf(out, " %6zu  %s\n", sym->harts, sym->name.c_str());
+  }
+
+  std::vector<const hart_profile_t::pc_count_t*> hot;
+  for (auto& it : insns)
+    hot.push_back(&it.second);
+  std::stable_sort(hot.begin(), hot.end(),
+                   [](const hart_profile_t::pc_count_t* a, const hart_profile_t::pc_count_t* b) {
+                     return a->count > b->count;
+                   });
+  if (hot.size() > HOT_INSNS)
+    hot.resize(HOT_INSNS);
+
+  fprintf(out, "\nHottest instructions:\n");
+  for (auto insn : hot) {
+    reg_t base;
+    const char* name = lookup(insn->pc, &base);
+    fprintf(out, "  0x%016" PRIx64 " %16" PRIu64 " %7.2f%%  %-8s",
+            insn->pc, insn->count, percent(insn->count, total),
+            insn_class_names[insn->insn_class]);
+    if (name)
+      fprintf(out, " %s+0x%" PRIx64, name, insn->pc - base);
+    fprintf(out, "\n");
+  }
+}
+
+void profile_write_folded(FILE* out, const std::vector<const hart_profile_t*>& harts,
+                          const symbol_lookup_t& lookup)
+{
+  std::map<std::string, uint64_t> stacks;
+
+  for (const hart_profile_t* hart : harts) {
+    auto& frames = hart->get_frames();
+    std::vector<std::string> paths(frames.size());
+
+    for (size_t i = 0; i < frames.size(); i++) {
+      reg_t base;
+      const char* name = lookup(frames[i].entry, &base);
+      std::string frame_name;
+      if (name) {
+        frame_name = name;
+      } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "0x%" PRIx64, frames[i].entry);
+        frame_name = buf;
+      }
+
+      if (frames[i].parent == hart_profile_t::NO_FRAME)
+        paths[i] = frame_name;
+      else
+        paths[i] = paths[frames[i].parent] + ";" + frame_name;
+
+      if (frames[i].count)
+        stacks[paths[i]] += frames[i].count;
+    }
+  }
+
+  for (auto& it : stacks)
+    fprintf(out, "%s %" PRIu64 "\n", it.first.c_str(), it.second);
+}
@@ -0,0 +1,139 @@
+// See LICENSE for license details.
+#ifndef _RISCV_PROFILE_H
+#define _RISCV_PROFILE_H
+
+#include "common.h"
+#include "decode.h"
+#include <stdio.h>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// What the profiler counts instructions as
+enum insn_class_t
+{
+  INSN_CLASS_OTHER,
+  INSN_CLASS_LOAD,
+  INSN_CLASS_STORE,
+  INSN_CLASS_AMO,
+  INSN_CLASS_BRANCH,
+  INSN_CLASS_JUMP,
+  INSN_CLASS_SIMD, // Xpulp packed SIMD and V
+  NUM_INSN_CLASSES
+};
+
+extern const char* const insn_class_names[NUM_INSN_CLASSES];
+
+// The instruction profile of one hart: how often each instruction retired,
+// and how often each call stack did. Only the thread stepping the hart
+// touches it.
+//
+// The counters sit in flat pages, each covering PAGE_BYTES bytes of code,
+// so counting an instruction is an array increment unless the hart has
+// left the page of the previous one. Call stacks are followed through the
+// calls and returns of the standard calling convention (jal/jalr that link
+// to ra or t0, and jalr through ra or t0 without linking).
+class hart_profile_t
+{
+ public:
+  static const size_t PAGE_BYTES = 4096;
+  static const uint32_t NO_FRAME = uint32_t(-1);
+
+  struct pc_count_t
+  {
+    reg_t pc;
+    uint64_t count;
+    insn_class_t insn_class;
+  };
+
+  // A node of the call tree. The root is the code the hart started in.
+  struct frame_t
+  {
+    reg_t entry; // address the frame was called at
+    uint32_t parent;
+    uint32_t depth;
+    uint64_t count; // instructions retired in this frame itself
+  };
+
+  hart_profile_t(uint32_t hartid, unsigned xlen);
+
+  // Count an instruction that retired.
+  void retire(reg_t pc, insn_t insn)
+  {
+    page_t* page = last_page;
+    if (unlikely(!page || page->base != (pc & ~reg_t(PAGE_BYTES - 1))))
+      page = last_page = find_page(pc);
+
+    size_t slot = (pc % PAGE_BYTES) / 2;
+    if (unlikely(page->counts[slot]++ == 0))
+      page->kinds[slot] = classify(insn);
+
+    uint8_t link = page->kinds[slot] & (CALL | RETURN);
+    if (unlikely(link | pending))
+      follow_link(pc, link);
+    frames[frame].count++;
+  }
+
+  uint32_t get_hartid() const { return hartid; }
+  uint64_t get_instret() const;
+
+  // The instructions that retired at least once, by address.
+  std::vector<pc_count_t> get_pcs() const;
+
+  // The call tree; a frame's parent always comes before it.
+  const std::vector<frame_t>& get_frames() const { return frames; }
+
+ private:
+  static const uint8_t CLASS_MASK = 0x0f;
+  static const uint8_t CALL = 0x10;
+  static const uint8_t RETURN = 0x20;
+  static const uint32_t MAX_DEPTH = 1024;
+
+  struct page_t
+  {
+    reg_t base;
+    uint64_t counts[PAGE_BYTES / 2];
+    uint8_t kinds[PAGE_BYTES / 2];
+  };
+
+  struct frame_key_hash_t
+  {
+    size_t operator()(const std::pair<uint32_t, reg_t>& key) const
+    {
+      return std::hash<reg_t>()(key.second) * 31 + key.first;
+    }
+  };
+
+  // RV32 harts sign-extend their pc; report addresses as in the ELF.
+  reg_t zext(reg_t pc) const { return xlen == 64 ? pc : pc & 0xffffffff; }
+  page_t* find_page(reg_t pc);
+  uint8_t classify(insn_t insn) const;
+  void follow_link(reg_t pc, uint8_t link);
+
+  uint32_t hartid;
+  unsigned xlen;
+  page_t* last_page;
+  std::unordered_map<reg_t, std::unique_ptr<page_t>> pages;
+
+  std::vector<frame_t> frames;
+  std::unordered_map<std::pair<uint32_t, reg_t>, uint32_t, frame_key_hash_t> children;
+  uint32_t frame;
+  uint8_t pending; // CALL or RETURN of the previous instruction
+  uint64_t lost_frames; // calls deeper than MAX_DEPTH not yet returned from
+};
+
+// Given an address, return the name of the symbol it belongs to and set
+// *base to the symbol's address, or return nullptr.
+typedef std::function<const char*(reg_t addr, reg_t* base)> symbol_lookup_t;
+
+// Write a report of the harts' profiles aggregated by symbol.
+void profile_write_report(FILE* out, const std::vector<const hart_profile_t*>& harts,
+                          const symbol_lookup_t& lookup);
+
+// Write the harts' call stacks in the folded format of flamegraph.pl
+// ("main;foo;bar 1234" per line), merging the harts.
+void profile_write_folded(FILE* out, const std::vector<const hart_profile_t*>& harts,
+                          const symbol_lookup_t& lookup);
+
+#endif
@@ -5,13 +5,20 @@
 #include "dts.h"
 #include "remote_bitbang.h"
 #include "byteorder.h"
+#include "profile.h"
+#include "checkpoint.h"
 #include <fstream>
 #include <map>
 #include <iostream>
 #include <sstream>
 #include <climits>
+#include <stdexcept>
 #include <cstdlib>
 #include <cassert>
+#include <cctype>
+#include <cinttypes>
+#include <cerrno>
+#include <cstring>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -47,12 +54,18 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
     dtb_file(dtb_file ? dtb_file : ""),
     dtb_enabled(dtb_enabled),
     log_file(log_path),
+    interleave(DEFAULT_INTERLEAVE),
     current_step(0),
     current_proc(0),
+    rtc_insns(0),
+    park_wfi(false),
     debug(false),
     histogram_enabled(false),
     log(false),
+    log_async(false),
+    log_async_policy(async_log_t::BLOCK),
     remote_bitbang(NULL),
+    checkpoint_armed(false),
     debug_module(this, dm_config)
 {
   signal(SIGINT, &handle_signal);
@@ -79,7 +92,9 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
     int hart_id = hartids.empty() ? i : hartids[i];
     procs[i] = new processor_t(isa, priv, varch, this, hart_id, halted,
                                log_file.get());
+    ready.push_back(i);
   }
+  woken.resize(nprocs);
 
   make_dtb();
 
@@ -122,8 +137,10 @@ void sim_t::main()
   {
     if (debug || ctrlc_pressed)
       interactive();
+    else if (pool)
+      step_parallel();
     else
-      step(INTERLEAVE);
+      step(interleave);
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
@@ -134,31 +151,249 @@ int sim_t::run()
 {
   host = context_t::current();
   target.init(sim_thread_main, this);
-  return htif_t::run();
+  int exit_code = htif_t::run();
+  if (!profile_path.empty())
+    write_profile();
+  return exit_code;
 }
 
 void sim_t::step(size_t n)
 {
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
-    steps = std::min(n - i, INTERLEAVE - current_step);
-    procs[current_proc]->step(steps);
+    processor_t* proc = procs[ready[current_proc]];
+    steps = std::min(n - i, interleave - current_step);
+    proc->step(steps);
+
+    // A hart that stops at the checkpoint trigger yields the rest of its
+    // quantum, so that checkpoints fall between quanta
+    if (unlikely(checkpoint_armed) && proc->checkpoint_reached())
+      steps = interleave - current_step;
 
     current_step += steps;
-    if (current_step == INTERLEAVE)
+    if (current_step == interleave)
     {
       current_step = 0;
-      procs[current_proc]->get_mmu()->yield_load_reservation();
-      if (++current_proc == procs.size()) {
+      proc->get_mmu()->yield_load_reservation();
+      if (++current_proc == ready.size()) {
         current_proc = 0;
-        clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+        end_round();
       }
 
+      if (unlikely(checkpoint_armed))
+        take_checkpoint();
       host->switch_to();
     }
   }
 }
 
+void sim_t::step_parallel()
+{
+  // Finish a partially stepped round from interactive mode first, so that
+  // every hart starts the parallel round on a quantum boundary.
+  if (current_step != 0 || current_proc != 0) {
+    step((ready.size() - current_proc) * interleave - current_step);
+    return;
+  }
+
+  pool->run([this](size_t shard) {
+    size_t begin = ready.size() * shard / pool->size();
+    size_t end = ready.size() * (shard + 1) / pool->size();
+    for (size_t i = begin; i < end; i++) {
+      procs[ready[i]]->step(interleave);
+      procs[ready[i]]->get_mmu()->yield_load_reservation();
+    }
+  });
+  end_round();
+
+  if (unlikely(checkpoint_armed))
+    take_checkpoint();
+  host->switch_to();
+}
+
+void sim_t::end_round()
+{
+  rtc_insns += interleave;
+  clint->increment(rtc_insns / INSNS_PER_RTC_TICK);
+  rtc_insns %= INSNS_PER_RTC_TICK;
+
+  // Harts wake up once an interrupt is pending for them (e.g. after an MSIP
+  // write to the CLINT) or a wake-up register names them, and join again at
+  // the start of the next round.
+  ready.clear();
+  for (size_t i = 0; i < procs.size(); i++)
+    if (!park_wfi || !procs[i]->waiting_for_interrupt() || woken[i])
+      ready.push_back(i);
+  woken.assign(procs.size(), false);
+
+  // With every hart parked nothing could wake them up any more, so fall
+  // back to treating WFI as a NOP for this round.
+  if (ready.empty())
+    for (size_t i = 0; i < procs.size(); i++)
+      ready.push_back(i);
+}
+
+void sim_t::set_interleave(size_t n)
+{
+  if (n == 0)
+    throw std::invalid_argument("the scheduling quantum must not be zero");
+  if (current_step != 0 || current_proc != 0)
+    throw std::logic_error("the scheduling quantum can only change between rounds");
+  interleave = n;
+}
+
+void sim_t::set_park_wfi(bool value)
+{
+  park_wfi = value;
+}
+
+void sim_t::wake_up(reg_t hartid)
+{
+  // Called from MMIO, i.e. under mmio_lock when the harts run concurrently
+  for (size_t i = 0; i < procs.size(); i++)
+    if (hartid == reg_t(-1) || procs[i]->get_csr(CSR_MHARTID) == hartid)
+      woken[i] = true;
+}
+
+void sim_t::set_checkpoint(const char* path, const char* trigger)
+{
+  checkpoint_path = path;
+  checkpoint_trigger = trigger;
+}
+
+void sim_t::set_restore(const char* path)
+{
+  restore_path = path;
+}
+
+// The trigger names a symbol, so it is resolved once the program is loaded
+void sim_t::arm_checkpoint()
+{
+  const std::string& trigger = checkpoint_trigger;
+  reg_t pc = -1;
+  uint64_t cycle_reads = 0;
+  char* end = NULL;
+  if (trigger == "mcycle") {
+    cycle_reads = 1;
+  } else if (trigger.compare(0, 7, "mcycle:") == 0) {
+    cycle_reads = strtoull(trigger.c_str() + 7, &end, 0);
+    if (*end || !cycle_reads)
+      throw std::invalid_argument("bad checkpoint trigger `" + trigger + "'");
+  } else if (isdigit(trigger[0])) {
+    pc = strtoull(trigger.c_str(), &end, 0);
+    if (*end)
+      throw std::invalid_argument("bad checkpoint trigger `" + trigger + "'");
+  } else if (!get_symbol_address(trigger, &pc)) {
+    throw std::invalid_argument("no symbol `" + trigger + "' for the checkpoint trigger");
+  }
+
+  for (processor_t* proc : procs)
+    proc->set_checkpoint_trigger(pc, cycle_reads);
+  checkpoint_armed = true;
+}
+
+void sim_t::take_checkpoint()
+{
+  processor_t* reached = NULL;
+  for (processor_t* proc : procs) {
+    if (proc->checkpoint_reached()) {
+      reached = proc;
+      break;
+    }
+  }
+  if (!reached)
+    return;
+
+  try {
+    save_checkpoint();
+  } catch (std::exception& e) {
+    fprintf(stderr, "%s\n", e.what());
+    exit(1);
+  }
+  unsigned xlen = reached->get_xlen();
+  fprintf(stderr, "Saved checkpoint to `%s' at hart %" PRIu64 ", pc 0x%" PRIx64 "\n",
+          checkpoint_path.c_str(), reached->get_csr(CSR_MHARTID),
+          zext_xlen(reached->get_state()->pc));
+
+  for (processor_t* proc : procs)
+    proc->set_checkpoint_trigger(-1, 0);
+  checkpoint_armed = false;
+}
+
+// Checkpoints are taken between quanta, when no hart is running and none
+// holds a load reservation.
+void sim_t::save_checkpoint()
+{
+  checkpoint_writer_t out(checkpoint_path.c_str());
+  checkpoint_header_t header = {
+    checkpoint_header_t::MAGIC, checkpoint_header_t::VERSION,
+    (uint32_t)procs.size(), (uint32_t)mems.size(), 0
+  };
+  out(header);
+
+  for (processor_t* proc : procs)
+    proc->save(out);
+  clint->save(out);
+
+  uint64_t nready = ready.size();
+  out(rtc_insns);
+  out(current_proc);
+  out(nready);
+  for (size_t i : ready)
+    out(i);
+
+  for (auto& mem : mems)
+    out.write_mem(mem.first, mem.second);
+  out.close();
+}
+
+// The program has been loaded as in the run that saved the checkpoint, so
+// the pages that the checkpoint does not hold are the same already.
+void sim_t::restore_checkpoint()
+{
+  checkpoint_reader_t in(restore_path.c_str());
+  const checkpoint_header_t& header = in.get_header();
+  if (header.nprocs != procs.size() || header.nmems != mems.size())
+    throw std::runtime_error("Checkpoint `" + restore_path + "' holds " +
+                             std::to_string(header.nprocs) + " harts and " +
+                             std::to_string(header.nmems) + " memories");
+
+  for (processor_t* proc : procs)
+    proc->restore(in);
+  clint->restore(in);
+
+  auto corrupt = [this]() {
+    return std::runtime_error("Truncated or corrupt checkpoint: `" + restore_path + "'");
+  };
+  uint64_t nready;
+  in(rtc_insns);
+  in(current_proc);
+  in(nready);
+  if (nready == 0 || nready > procs.size())
+    throw corrupt();
+  ready.resize(nready);
+  for (size_t& i : ready) {
+    in(i);
+    if (i >= procs.size())
+      throw corrupt();
+  }
+  if (current_proc >= ready.size())
+    throw corrupt();
+  current_step = 0;
+
+  for (auto& mem : mems)
+    in.read_mem(mem.first, mem.second);
+}
+
+void sim_t::set_nthreads(size_t n)
+{
+  n = std::min(n, procs.size());
+  pool.reset(n > 1 ? new thread_pool_t(n) : NULL);
+  reservations.reset(pool ? new reservation_set_t(procs.size()) : NULL);
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->set_concurrency(pool ? &amo_lock : NULL, reservations.get(), i);
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -172,24 +407,73 @@ void sim_t::set_histogram(bool value)
   }
 }
 
-void sim_t::configure_log(bool enable_log, bool enable_commitlog)
+void sim_t::set_profile(const char* path)
 {
-  log = enable_log;
+  profile_path = path;
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->enable_profile();
+  }
+}
+
+void sim_t::write_profile()
+{
+  std::vector<const hart_profile_t*> profiles;
+  for (processor_t* proc : procs)
+    profiles.push_back(proc->get_profile());
+  auto lookup = [this](reg_t addr, reg_t* base) {
+    return get_symbol_containing(addr, base);
+  };
 
-  if (!enable_commitlog)
+  std::string folded_path = profile_path + ".folded";
+  std::unique_ptr<FILE, decltype(&fclose)> report(fopen(profile_path.c_str(), "w"), &fclose);
+  std::unique_ptr<FILE, decltype(&fclose)> folded(fopen(folded_path.c_str(), "w"), &fclose);
+  if (!report || !folded) {
+    fprintf(stderr, "Failed to write profile to `%s': %s\n",
+            (report ? folded_path : profile_path).c_str(), strerror(errno));
     return;
+  }
+
+  profile_write_report(report.get(), profiles, lookup);
+  profile_write_folded(folded.get(), profiles, lookup);
+}
+
+void sim_t::set_log_async(async_log_t::policy_t policy)
+{
+  log_async = true;
+  log_async_policy = policy;
+}
+
+void sim_t::configure_log(bool enable_log, bool enable_commitlog,
+                          const char* commitlog_binary_path)
+{
+  log = enable_log;
 
+  if (enable_commitlog) {
 #ifndef RISCV_ENABLE_COMMITLOG
-  fputs("Commit logging support has not been properly enabled; "
-        "please re-build the riscv-isa-sim project using "
-        "\"configure --enable-commitlog\".\n",
-        stderr);
-  abort();
+    fputs("Commit logging support has not been properly enabled; "
+          "please re-build the riscv-isa-sim project using "
+          "\"configure --enable-commitlog\".\n",
+          stderr);
+    abort();
 #else
-  for (processor_t *proc : procs) {
-    proc->enable_log_commits();
-  }
+    if (commitlog_binary_path)
+      commit_log.reset(new commit_log_writer_t(commitlog_binary_path));
+
+    for (processor_t *proc : procs) {
+      proc->enable_log_commits();
+      if (commit_log && !log_async)
+        proc->set_commit_log(commit_log->add_buffer(proc->get_csr(CSR_MHARTID)));
+    }
 #endif
+  }
+
+  if (log_async && (enable_log || enable_commitlog)) {
+    async_log.reset(new async_log_t(log_file.get(), commit_log.get(),
+                                    log_async_policy));
+    for (processor_t *proc : procs)
+      proc->set_async_log(async_log->add_port(proc->get_csr(CSR_MHARTID)));
+    async_log->start();
+  }
 }
 
 void sim_t::set_procs_debug(bool value)
@@ -207,6 +491,9 @@ bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  if (!pool)
+    return bus.load(addr, len, bytes);
+  std::lock_guard<std::mutex> guard(mmio_lock);
   return bus.load(addr, len, bytes);
 }
 
@@ -214,6 +501,9 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  if (!pool)
+    return bus.store(addr, len, bytes);
+  std::lock_guard<std::mutex> guard(mmio_lock);
   return bus.store(addr, len, bytes);
 }
 
@@ -287,10 +577,20 @@ void sim_t::set_rom()
 char* sim_t::addr_to_mem(reg_t addr) {
   if (!paddr_ok(addr))
     return NULL;
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
+  reg_t offset;
+  if (auto mem = bus.find_mem(addr, &offset))
+    return mem->contents() + offset;
+  return NULL;
+}
+
+char* sim_t::addr_to_store_mem(reg_t addr) {
+  if (!paddr_ok(addr))
+    return NULL;
+  reg_t offset;
+  if (auto mem = bus.find_mem(addr, &offset)) {
+    mem->mark_dirty(offset);
+    return mem->contents() + offset;
+  }
   return NULL;
 }
 
@@ -305,6 +605,16 @@ void sim_t::reset()
 {
   if (dtb_enabled)
     set_rom();
+
+  try {
+    if (!restore_path.empty())
+      restore_checkpoint();
+    if (!checkpoint_path.empty())
+      arm_checkpoint();
+  } catch (std::exception& e) {
+    fprintf(stderr, "%s\n", e.what());
+    exit(1);
+  }
 }
 
 void sim_t::idle()
@@ -327,6 +637,50 @@ void sim_t::write_chunk(addr_t taddr, size_t len, const void* src)
   debug_mmu->store_uint64(taddr, from_le(data));
 }
 
+// The memory that holds all of [taddr, taddr + len), if any, for the bulk
+// accesses of the frontend. They skip the debug MMU, which has no PMP and
+// no TLB of its own worth keeping coherent.
+mem_t* sim_t::bulk_mem(addr_t taddr, size_t len, reg_t* offset)
+{
+  if (!len || taddr + len < taddr || !paddr_ok(taddr) || !paddr_ok(taddr + len - 1))
+    return NULL;
+  mem_t* mem = bus.find_mem(taddr, offset);
+  if (!mem || len > mem->size() - *offset)
+    return NULL;
+  return mem;
+}
+
+bool sim_t::read_bulk(addr_t taddr, size_t len, void* dst)
+{
+  reg_t offset;
+  mem_t* mem = bulk_mem(taddr, len, &offset);
+  if (!mem)
+    return false;
+  memcpy(dst, mem->contents() + offset, len);
+  return true;
+}
+
+bool sim_t::write_bulk(addr_t taddr, size_t len, const void* src)
+{
+  reg_t offset;
+  mem_t* mem = bulk_mem(taddr, len, &offset);
+  if (!mem)
+    return false;
+  memcpy(mem->contents() + offset, src, len);
+  mem->mark_dirty(offset, len);
+  return true;
+}
+
+bool sim_t::clear_bulk(addr_t taddr, size_t len)
+{
+  reg_t offset;
+  mem_t* mem = bulk_mem(taddr, len, &offset);
+  if (!mem)
+    return false;
+  mem->clear(offset, len);
+  return true;
+}
+
 void sim_t::proc_reset(unsigned id)
 {
   debug_module.proc_reset(id);
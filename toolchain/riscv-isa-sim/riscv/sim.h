@@ -3,9 +3,12 @@
 #ifndef _RISCV_SIM_H
 #define _RISCV_SIM_H
 
+#include "async_log.h"
+#include "commit_log.h"
 #include "debug_module.h"
 #include "devices.h"
 #include "log_file.h"
+#include "parallel.h"
 #include "processor.h"
 #include "simif.h"
 
@@ -14,6 +17,7 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <sys/types.h>
 
 class mmu_t;
@@ -38,13 +42,53 @@ public:
   void set_debug(bool value);
   void set_histogram(bool value);
 
+  // Profile the harts, and when the simulation ends write a report of
+  // where they spent their instructions to path, and their call stacks in
+  // the folded format of flamegraph.pl to path.folded.
+  void set_profile(const char* path);
+
+  // Step the harts on n host threads. Every hart runs one quantum per
+  // round, all threads synchronize at the end of each round, and the CLINT,
+  // HTIF and debugger only run between rounds.
+  void set_nthreads(size_t n);
+
+  // Set the number of instructions a hart runs before the next one is
+  // scheduled [default DEFAULT_INTERLEAVE].
+  void set_interleave(size_t n);
+
+  // When enabled, harts that wait in WFI without a pending interrupt are
+  // left out of the schedule until an interrupt becomes pending or
+  // wake_up() is called for them.
+  void set_park_wfi(bool value);
+
+  // Schedule the hart with this ID again from the next round on, even if
+  // it waits in WFI, or every hart for -1. This is how MemPool's wake-up
+  // registers (mempool_ctrl_t) reach parked harts.
+  void wake_up(reg_t hartid);
+
+  // Save a checkpoint to path once a hart reaches the trigger, and go on.
+  // The trigger is "mcycle" to stop before a hart's first read of the cycle
+  // counter, "mcycle:<n>" for its n-th read, or a symbol or an address to
+  // stop before the instruction there.
+  void set_checkpoint(const char* path, const char* trigger);
+
+  // Start from the checkpoint at path instead of from reset. The program
+  // and the memory regions must be those of the run that saved it.
+  void set_restore(const char* path);
+
   // Configure logging
   //
   // If enable_log is true, an instruction trace will be generated. If
   // enable_commitlog is true, so will the commit results (if this
   // build was configured without support for commit logging, the
   // function will print an error message and abort).
-  void configure_log(bool enable_log, bool enable_commitlog);
+  void configure_log(bool enable_log, bool enable_commitlog,
+                     const char* commitlog_binary_path = nullptr);
+
+  // Write the logs configured by configure_log from a separate thread. A
+  // hart whose log buffer is full waits for the writer (BLOCK) or has its
+  // entries counted and thrown away (DROP). Call before configure_log.
+  void set_log_async(async_log_t::policy_t policy);
 
   void set_procs_debug(bool value);
   void set_remote_bitbang(remote_bitbang_t* remote_bitbang) {
@@ -74,24 +118,52 @@ private:
   std::unique_ptr<clint_t> clint;
   bus_t bus;
   log_file_t log_file;
+  std::unique_ptr<commit_log_writer_t> commit_log;
+  std::unique_ptr<async_log_t> async_log; // drains into the two above
 
   processor_t* get_core(const std::string& i);
   void step(size_t n); // step through simulation
-  static const size_t INTERLEAVE = 5000;
+  void step_parallel(); // step every hart by one quantum, concurrently
+  void end_round(); // advance time and pick the harts of the next round
+  static const size_t DEFAULT_INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  size_t interleave;
   size_t current_step;
-  size_t current_proc;
+  size_t current_proc; // index into ready
+  size_t rtc_insns; // instructions not yet accounted for in the CLINT
+  bool park_wfi;
+  std::vector<size_t> ready; // harts scheduled in the current round
+  std::vector<bool> woken; // harts woken up in the current round
   bool debug;
   bool histogram_enabled; // provide a histogram of PCs
+  std::string profile_path;
   bool log;
+  bool log_async;
+  async_log_t::policy_t log_async_policy;
   remote_bitbang_t* remote_bitbang;
+  std::string checkpoint_path;
+  std::string checkpoint_trigger;
+  bool checkpoint_armed;
+  std::string restore_path;
+
+  // state for stepping harts concurrently
+  std::unique_ptr<thread_pool_t> pool;
+  spinlock_t amo_lock;
+  std::unique_ptr<reservation_set_t> reservations;
+  std::mutex mmio_lock;
 
   // memory-mapped I/O routines
   char* addr_to_mem(reg_t addr);
+  char* addr_to_store_mem(reg_t addr);
   bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
   bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
   void make_dtb();
+  void write_profile();
+  void arm_checkpoint();
+  void take_checkpoint(); // if a hart reached the trigger
+  void save_checkpoint();
+  void restore_checkpoint();
   void set_rom();
 
   const char* get_symbol(uint64_t addr);
@@ -138,6 +210,10 @@ private:
   void write_chunk(addr_t taddr, size_t len, const void* src);
   size_t chunk_align() { return 8; }
   size_t chunk_max_size() { return 8; }
+  mem_t* bulk_mem(addr_t taddr, size_t len, reg_t* offset);
+  bool read_bulk(addr_t taddr, size_t len, void* dst);
+  bool write_bulk(addr_t taddr, size_t len, const void* src);
+  bool clear_bulk(addr_t taddr, size_t len);
 
 public:
   // Initialize this after procs, because in debug_module_t::reset() we
@@ -0,0 +1,300 @@
+// See LICENSE for license details.
+
+#include "tcdm_sim.h"
+#include "processor.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+static const char* const param_names[] = {
+  "num_cores", "num_groups", "num_cores_per_tile", "num_sub_groups_per_group",
+  "banking_factor", "l1_bank_size", "seq_mem_size", "remote_group_latency_cycles"
+};
+
+static void help(const std::string& error)
+{
+  std::cerr << "Invalid TCDM configuration: " << error << std::endl;
+  std::cerr << "TCDM configurations are a comma-separated list of config/*.mk" << std::endl;
+  std::cerr << "files and of <name>=<value> settings, where <name> is one of" << std::endl;
+  for (auto name : param_names)
+    std::cerr << "  " << name << std::endl;
+  std::cerr << "All sizes and counts must be powers of two." << std::endl;
+  exit(1);
+}
+
+static bool is_pow2(uint64_t x)
+{
+  return x && !(x & (x - 1));
+}
+
+static unsigned ilog2(uint64_t x)
+{
+  unsigned n = 0;
+  while (x >>= 1)
+    n++;
+  return n;
+}
+
+tcdm_sim_t::tcdm_sim_t(const char* config)
+{
+  // config/mempool.mk and config/config.mk
+  params["num_cores"] = 256;
+  params["num_groups"] = 4;
+  params["num_cores_per_tile"] = 4;
+  params["num_sub_groups_per_group"] = 1;
+  params["banking_factor"] = 4;
+  params["l1_bank_size"] = 1024;
+  params["seq_mem_size"] = 512;
+  params["remote_group_latency_cycles"] = 7;
+
+  std::stringstream ss(config);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == std::string::npos) {
+      parse_mk(item);
+      continue;
+    }
+    char* end;
+    uint64_t value = strtoull(item.c_str() + eq + 1, &end, 0);
+    if (eq + 1 == item.size() || *end)
+      help("`" + item + "' is not a number");
+    set(item.substr(0, eq), value, false);
+  }
+
+  num_cores = params["num_cores"];
+  cores_per_tile = params["num_cores_per_tile"];
+  uint64_t num_groups = params["num_groups"];
+  uint64_t sub_groups = params["num_sub_groups_per_group"];
+  uint64_t banking_factor = params["banking_factor"];
+  uint64_t bank_size = params["l1_bank_size"];
+  uint64_t seq_mem_size = params["seq_mem_size"];
+
+  for (auto name : param_names) {
+    if (name != std::string("remote_group_latency_cycles") && !is_pow2(params[name]))
+      help(std::string(name) + " must be a power of two");
+  }
+  if (cores_per_tile > num_cores)
+    help("num_cores_per_tile is larger than num_cores");
+  num_tiles = num_cores / cores_per_tile;
+  if (num_groups * sub_groups > num_tiles)
+    help("there are fewer tiles than sub-groups");
+  tiles_per_group = num_tiles / num_groups;
+  tiles_per_sub_group = tiles_per_group / sub_groups;
+  banks_per_tile = cores_per_tile * banking_factor;
+  if (banks_per_tile < 2)
+    help("a tile must have at least two banks");
+  seq_mem_size_per_tile = seq_mem_size * cores_per_tile;
+  if (seq_mem_size_per_tile < 4 * banks_per_tile)
+    help("seq_mem_size does not fill a line of the tile's banks");
+  size = num_tiles * banks_per_tile * bank_size;
+
+  latency[TILE] = 1;
+  latency[SUB_GROUP] = 3;
+  latency[GROUP] = sub_groups > 1 ? 5 : 3;
+  latency[REMOTE_GROUP] = sub_groups > 1 ? params["remote_group_latency_cycles"] : 5;
+
+  banks.resize(num_tiles * banks_per_tile);
+  for (auto& bank : banks) {
+    std::fill(bank.busy, bank.busy + WINDOW, 0);
+    bank.accesses = 0;
+    bank.conflicts = 0;
+  }
+}
+
+tcdm_sim_t::~tcdm_sim_t()
+{
+  print_stats();
+}
+
+void tcdm_sim_t::set(const std::string& name, uint64_t value, bool from_file)
+{
+  if (params.count(name))
+    params[name] = value;
+  else if (!from_file)
+    help("unknown setting `" + name + "'");
+}
+
+void tcdm_sim_t::parse_mk(const std::string& path)
+{
+  // Take the numeric assignments ("name ?= value", "name = value" or
+  // "name := value") and skip everything else.
+  std::ifstream mk(path);
+  if (!mk)
+    help("cannot read `" + path + "'");
+
+  std::string line;
+  while (std::getline(mk, line)) {
+    line = line.substr(0, line.find('#'));
+    size_t eq = line.find('=');
+    if (eq == std::string::npos || eq == 0)
+      continue;
+
+    size_t name_end = eq;
+    if (line[name_end - 1] == '?' || line[name_end - 1] == ':')
+      name_end--;
+    std::istringstream name_ss(line.substr(0, name_end));
+    std::istringstream value_ss(line.substr(eq + 1));
+    std::string name, value, rest;
+    if (!(name_ss >> name) || !(value_ss >> value) || (value_ss >> rest))
+      continue;
+
+    char* end;
+    uint64_t v = strtoull(value.c_str(), &end, 0);
+    if (!*end)
+      set(name, v, true);
+  }
+}
+
+memtracer_t* tcdm_sim_t::add_hart(processor_t* proc)
+{
+  hart_stats_t hart = {proc, (uint32_t)proc->get_csr(CSR_MHARTID), 0, 0, {}, 0, 0, 0};
+  harts.push_back(hart);
+  tracers.emplace_back(new hart_tracer_t(this, harts.size() - 1));
+  return tracers.back().get();
+}
+
+size_t tcdm_sim_t::bank_of(uint64_t addr) const
+{
+  const unsigned byte_offset = 2;
+  unsigned bank_bits = ilog2(banks_per_tile);
+  unsigned tile_bits = ilog2(num_tiles);
+  unsigned seq_bits = ilog2(seq_mem_size_per_tile);
+  unsigned constant_lsb = byte_offset + bank_bits;
+
+  // The sequential region swaps the tile ID with the line within the tile,
+  // as in address_scrambler.sv.
+  if (num_tiles > 1 && addr < num_tiles * seq_mem_size_per_tile) {
+    unsigned scramble_bits = seq_bits - constant_lsb;
+    uint64_t scramble = (addr >> constant_lsb) & ((uint64_t(1) << scramble_bits) - 1);
+    uint64_t tile_id = (addr >> seq_bits) & ((uint64_t(1) << tile_bits) - 1);
+    addr = (addr & ((uint64_t(1) << constant_lsb) - 1)) |
+           (((scramble << tile_bits) | tile_id) << constant_lsb);
+  }
+
+  uint64_t bank = (addr >> byte_offset) & (banks_per_tile - 1);
+  uint64_t tile = (addr >> constant_lsb) & (num_tiles - 1);
+  return tile * banks_per_tile + bank;
+}
+
+void tcdm_sim_t::access(size_t hart, uint64_t addr, bool store)
+{
+  hart_stats_t& h = harts[hart];
+  size_t b = bank_of(addr);
+  bank_t& bank = banks[b];
+
+  uint64_t hart_tile = (h.hartid % num_cores) / cores_per_tile;
+  uint64_t bank_tile = b / banks_per_tile;
+  distance_t distance;
+  if (hart_tile == bank_tile)
+    distance = TILE;
+  else if (hart_tile / tiles_per_group != bank_tile / tiles_per_group)
+    distance = REMOTE_GROUP;
+  else if (tiles_per_sub_group != tiles_per_group &&
+           hart_tile / tiles_per_sub_group == bank_tile / tiles_per_sub_group)
+    distance = SUB_GROUP;
+  else
+    distance = GROUP;
+
+  // Wait for the first cycle in which the bank is free.
+  uint64_t now = std::max(h.proc->get_state()->minstret + h.stall_cycles, h.last_cycle);
+  uint64_t cycle = now;
+  while (bank.busy[cycle % WINDOW] == cycle + 1 && cycle - now < WINDOW)
+    cycle++;
+  bank.busy[cycle % WINDOW] = cycle + 1;
+
+  bank.accesses++;
+  h.accesses[distance]++;
+  if (store)
+    h.stores++;
+  else
+    h.loads++;
+  if (cycle != now) {
+    bank.conflicts++;
+    h.conflicts++;
+  }
+  h.stall_cycles += (cycle - now) + (store ? 0 : latency[distance] - 1);
+  h.last_cycle = cycle + 1 + (store ? 0 : latency[distance] - 1);
+}
+
+void tcdm_sim_t::print_stats()
+{
+  static const size_t TOP_BANKS = 16;
+  static const char* const distance_names[NUM_DISTANCES] = {
+    "Local tile", "Sub-group", "Group", "Remote group"
+  };
+
+  hart_stats_t total = {NULL, 0, 0, 0, {}, 0, 0, 0};
+  for (auto& h : harts) {
+    total.loads += h.loads;
+    total.stores += h.stores;
+    for (int d = 0; d < NUM_DISTANCES; d++)
+      total.accesses[d] += h.accesses[d];
+    total.conflicts += h.conflicts;
+    total.stall_cycles += h.stall_cycles;
+  }
+  uint64_t accesses = total.loads + total.stores;
+  if (accesses == 0)
+    return;
+
+  std::cout << std::setprecision(3) << std::fixed;
+  std::cout << "TCDM Loads:                " << total.loads << std::endl;
+  std::cout << "TCDM Stores:               " << total.stores << std::endl;
+  for (int d = 0; d < NUM_DISTANCES; d++) {
+    if (d == SUB_GROUP && tiles_per_sub_group == tiles_per_group)
+      continue;
+    std::cout << "TCDM " << std::left << std::setw(22)
+              << (std::string(distance_names[d]) + " Accesses:") << std::right
+              << total.accesses[d] << " ("
+              << 100.0 * total.accesses[d] / accesses << "%)" << std::endl;
+  }
+  std::cout << "TCDM Bank Conflicts:       " << total.conflicts << std::endl;
+  std::cout << "TCDM Stall Cycles:         " << total.stall_cycles << std::endl;
+
+  std::cout << "TCDM" << std::setw(7) << "hart" << std::setw(14) << "loads"
+            << std::setw(14) << "stores";
+  for (int d = 0; d < NUM_DISTANCES; d++) {
+    if (d == SUB_GROUP && tiles_per_sub_group == tiles_per_group)
+      continue;
+    std::cout << std::setw(14) << distance_names[d];
+  }
+  std::cout << std::setw(12) << "conflicts" << std::setw(14) << "stalls" << std::endl;
+  for (auto& h : harts) {
+    if (h.loads + h.stores == 0)
+      continue;
+    std::cout << "TCDM" << std::setw(7) << h.hartid << std::setw(14) << h.loads
+              << std::setw(14) << h.stores;
+    for (int d = 0; d < NUM_DISTANCES; d++) {
+      if (d == SUB_GROUP && tiles_per_sub_group == tiles_per_group)
+        continue;
+      std::cout << std::setw(14) << h.accesses[d];
+    }
+    std::cout << std::setw(12) << h.conflicts << std::setw(14) << h.stall_cycles
+              << std::endl;
+  }
+
+  std::vector<size_t> order;
+  for (size_t b = 0; b < banks.size(); b++) {
+    if (banks[b].conflicts)
+      order.push_back(b);
+  }
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return banks[a].conflicts > banks[b].conflicts;
+  });
+  if (order.size() > TOP_BANKS)
+    order.resize(TOP_BANKS);
+  if (order.empty())
+    return;
+
+  std::cout << "TCDM Banks with the most conflicts:" << std::endl;
+  std::cout << "TCDM" << std::setw(7) << "bank" << std::setw(7) << "tile"
+            << std::setw(14) << "accesses" << std::setw(12) << "conflicts" << std::endl;
+  for (size_t b : order) {
+    std::cout << "TCDM" << std::setw(7) << b << std::setw(7) << b / banks_per_tile
+              << std::setw(14) << banks[b].accesses << std::setw(12)
+              << banks[b].conflicts << std::endl;
+  }
+}
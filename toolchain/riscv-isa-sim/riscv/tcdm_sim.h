@@ -0,0 +1,120 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_TCDM_SIM_H
+#define _RISCV_TCDM_SIM_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class processor_t;
+
+// A timing model of MemPool's L1 scratchpad, the TCDM. The TCDM starts at
+// address 0 and is split into banks of 32-bit words, banking_factor banks
+// per core. Addresses are scrambled like hardware/src/address_scrambler.sv
+// does, so that the first seq_mem_size bytes of every core are in the
+// banks of its own tile. An access takes 1 cycle within the tile, and more
+// the further the bank is away:
+//
+//                      MemPool   TeraPool
+//   local tile         1         1
+//   same sub-group     -         3
+//   same group         3         5
+//   remote group       5         remote_group_latency_cycles
+//
+// Every bank serves one access per cycle. Each hart runs on its own clock,
+// which is the number of instructions it retired plus the cycles it
+// stalled, and the banks remember which cycles they were busy in during the
+// last WINDOW cycles. Spike only updates minstret after each quantum, so
+// within a quantum the accesses of a hart are taken to be one cycle apart.
+// Conflicts are only seen between harts whose clocks are closer than
+// WINDOW, so run Spike with a small --quantum. Loads stall the hart for
+// their latency, as if their result were used right away; stores only
+// stall on conflicts.
+class tcdm_sim_t
+{
+ public:
+  static const size_t WINDOW = 64;
+
+  // config is a comma-separated list of config/*.mk files and of
+  // <name>=<value> settings with the names of the config/*.mk variables
+  // (num_cores, num_groups, num_cores_per_tile, num_sub_groups_per_group,
+  // banking_factor, l1_bank_size, seq_mem_size and
+  // remote_group_latency_cycles). Later values override earlier ones;
+  // anything not given is as in config/mempool.mk.
+  tcdm_sim_t(const char* config);
+  ~tcdm_sim_t();
+
+  // The tracer to register with the MMU of a hart.
+  memtracer_t* add_hart(processor_t* proc);
+
+  // The bank of an address in the TCDM, after scrambling.
+  size_t bank_of(uint64_t addr) const;
+
+  void print_stats();
+
+ private:
+  enum distance_t { TILE, SUB_GROUP, GROUP, REMOTE_GROUP, NUM_DISTANCES };
+
+  struct hart_stats_t
+  {
+    processor_t* proc;
+    uint32_t hartid;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t accesses[NUM_DISTANCES];
+    uint64_t conflicts;
+    uint64_t stall_cycles;
+    uint64_t last_cycle; // cycle of the last access, plus one
+  };
+
+  struct bank_t
+  {
+    uint64_t busy[WINDOW]; // cycle + 1 of the last access in each slot
+    uint64_t accesses;
+    uint64_t conflicts;
+  };
+
+  class hart_tracer_t : public memtracer_t
+  {
+   public:
+    hart_tracer_t(tcdm_sim_t* tcdm, size_t hart) : tcdm(tcdm), hart(hart) {}
+    bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+    {
+      return type != FETCH && begin < tcdm->size;
+    }
+    void trace(uint64_t addr, size_t bytes, access_type type)
+    {
+      if (type != FETCH && addr < tcdm->size)
+        tcdm->access(hart, addr, type == STORE);
+    }
+
+   private:
+    tcdm_sim_t* tcdm;
+    size_t hart;
+  };
+
+  void set(const std::string& name, uint64_t value, bool from_file);
+  void parse_mk(const std::string& path);
+  void access(size_t hart, uint64_t addr, bool store);
+
+  std::map<std::string, uint64_t> params;
+  uint64_t num_cores;
+  uint64_t cores_per_tile;
+  uint64_t num_tiles;
+  uint64_t tiles_per_group;
+  uint64_t tiles_per_sub_group;
+  uint64_t banks_per_tile;
+  uint64_t seq_mem_size_per_tile;
+  uint64_t size;
+  unsigned latency[NUM_DISTANCES];
+
+  std::vector<hart_stats_t> harts;
+  std::vector<std::unique_ptr<hart_tracer_t>> tracers;
+  std::vector<bank_t> banks;
+};
+
+#endif
@@ -0,0 +1,1221 @@
+// See LICENSE for license details.
+
+// This program turns the instruction traces that MemPool's Snitch cores
+// dump in simulation (trace_hart_*.dasm) into annotated traces with
+// performance metrics. It does what piping every trace through spike-dasm
+// and hardware/scripts/gen_trace.py does, and writes the same output, but
+// reads each trace only once and works on several traces in parallel:
+//
+//   snitch-trace -p --csv=build/traces/results.csv build/*.dasm
+//
+// writes build/trace_hart_*.trace and appends the metrics of all harts to
+// results.csv, in the order of the arguments.
+
+#include "disasm.h"
+#include "extension.h"
+#include <fesvr/option_parser.h>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Configuration
+
+struct config_t
+{
+  const disassembler_t* disassembler;
+  bool saddr;       // signed decimal instead of hex for small addresses
+  bool allkeys;     // also print the metrics that only serve to compute others
+  bool permissive;  // warn instead of failing on loads retired out of thin air
+  const char* csv;  // file to append the metrics to, or NULL
+  // MemPool's memory map, to tell the sequential from the interleaved region
+  double num_tiles;
+  double seq_mem_size;  // per tile
+  double tcdm_size;
+};
+
+static const char* const reg_names[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+static const char* const ls_sizes[] = {"Byte", "Half", "Word", "Doub"};
+
+enum { OPER_GPR = 1, OPER_CSR = 8 };
+enum { REGION_OTHER, REGION_SEQUENTIAL, REGION_INTERLEAVED };
+enum { RAW_LSU, RAW_ACC, NUM_RAW_TYPES };
+static const char* const raw_type_names[NUM_RAW_TYPES] = {"lsu", "acc"};
+
+// Below this absolute value, literals are signed decimals, else 32-bit hex.
+static const int64_t MAX_SIGNED_INT_LIT = 0xffff;
+
+// ---------------------------------------------------------------------------
+// Formatting as Python does
+
+static void appendf(std::string& s, const char* fmt, ...)
+{
+  char buf[128];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  s.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+static void pad_left(std::string& s, const std::string& field, size_t width)
+{
+  if (field.size() < width)
+    s.append(width - field.size(), ' ');
+  s += field;
+}
+
+static void pad_right(std::string& s, const std::string& field, size_t width)
+{
+  s += field;
+  if (field.size() < width)
+    s.append(width - field.size(), ' ');
+}
+
+// The shortest string that reads back as the same double, as repr() has it.
+static std::string float_repr(double x)
+{
+  if (std::isnan(x))
+    return "nan";
+  if (std::isinf(x))
+    return x < 0 ? "-inf" : "inf";
+  if (x == 0)
+    return std::signbit(x) ? "-0.0" : "0.0";
+
+  char buf[32];
+  for (int prec = 1; prec <= 17; prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec - 1, x);
+    if (strtod(buf, NULL) == x)
+      break;
+  }
+
+  std::string sign, digits;
+  const char* p = buf;
+  if (*p == '-')
+    sign = *p++;
+  for (; *p != 'e'; p++) {
+    if (*p != '.')
+      digits += *p;
+  }
+  int decpt = atoi(p + 1) + 1;
+  while (digits.size() > 1 && digits.back() == '0')
+    digits.pop_back();
+
+  std::string s = sign;
+  int ndigits = digits.size();
+  if (decpt <= -4 || decpt > 16) {
+    s += digits[0];
+    if (ndigits > 1)
+      s += "." + digits.substr(1);
+    appendf(s, "e%c%02d", decpt - 1 < 0 ? '-' : '+', abs(decpt - 1));
+  } else if (decpt <= 0) {
+    s += "0." + std::string(-decpt, '0') + digits;
+  } else if (decpt >= ndigits) {
+    s += digits + std::string(decpt - ndigits, '0') + ".0";
+  } else {
+    s += digits.substr(0, decpt) + "." + digits.substr(decpt);
+  }
+  return s;
+}
+
+static std::string int_lit(int64_t num, bool force_hex = false)
+{
+  uint32_t value = num;
+  int32_t value_signed = value;
+  char buf[16];
+  if (force_hex || std::abs((int64_t)value_signed) > MAX_SIGNED_INT_LIT)
+    snprintf(buf, sizeof(buf), "0x%08" PRIx32, value);
+  else
+    snprintf(buf, sizeof(buf), "%" PRId32, value_signed);
+  return buf;
+}
+
+// ---------------------------------------------------------------------------
+// Annotations of a trace line: {'stall': 0x0, 'rd': 0x00000005, ...}
+
+#define ANNOTATION_KEYS \
+  X(source) X(stall) X(stall_tot) X(stall_ins) X(stall_raw) X(stall_lsu) \
+  X(stall_acc) X(rs1) X(rs2) X(rd) X(is_load) X(is_store) X(is_branch) \
+  X(pc_d) X(opa) X(opb) X(opa_select) X(opb_select) X(opc_select) \
+  X(write_rd) X(csr_addr) X(writeback) X(gpr_rdata_1) X(gpr_rdata_2) \
+  X(ls_size) X(ld_result_32) X(lsu_rd) X(retire_load) X(alu_result) \
+  X(ls_amo) X(retire_acc) X(acc_pid) X(acc_pdata_32)
+
+enum annotation_t {
+#define X(name) A_##name,
+  ANNOTATION_KEYS
+#undef X
+  NUM_ANNOTATIONS
+};
+
+static const char* const annotation_names[NUM_ANNOTATIONS] = {
+#define X(name) #name,
+  ANNOTATION_KEYS
+#undef X
+};
+
+// A value of the RTL, which may contain Xs. Those are kept as they are.
+struct field_t
+{
+  int64_t value;
+  bool x;
+  std::string raw;
+
+  bool truthy() const { return x || value != 0; }
+  bool equals(int64_t v) const { return !x && value == v; }
+};
+
+typedef field_t annotations_t[NUM_ANNOTATIONS];
+
+static bool is_space(char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Match "'<key>'\s*:\s*0x<digits>" at s[i], where the digits are hex digits
+// or, if with_x, also x and X. Returns the end of the match, or 0.
+static size_t match_annotation(const std::string& s, size_t i, bool with_x,
+                               size_t* key_end, size_t* value)
+{
+  if (s[i] != '\'')
+    return 0;
+  size_t j = s.find('\'', i + 1);
+  if (j == std::string::npos || j == i + 1)
+    return 0;
+  size_t k = j + 1;
+  while (k < s.size() && is_space(s[k]))
+    k++;
+  if (k == s.size() || s[k] != ':')
+    return 0;
+  k++;
+  while (k < s.size() && is_space(s[k]))
+    k++;
+  if (s.compare(k, 2, "0x") != 0)
+    return 0;
+  size_t end = k + 2;
+  while (end < s.size() && (isxdigit(s[end]) || (with_x && (s[end] == 'x' || s[end] == 'X'))))
+    end++;
+  if (end == k + 2)
+    return 0;
+  *key_end = j;
+  *value = k;
+  return end;
+}
+
+static int annotation_index(const std::string& s, size_t begin, size_t end, int guess)
+{
+  size_t len = end - begin;
+  auto is = [&](int a) {
+    return a < NUM_ANNOTATIONS && strlen(annotation_names[a]) == len &&
+           s.compare(begin, len, annotation_names[a]) == 0;
+  };
+  // The keys normally come in the same order on every line.
+  if (is(guess))
+    return guess;
+  for (int a = 0; a < NUM_ANNOTATIONS; a++) {
+    if (is(a))
+      return a;
+  }
+  return -1;
+}
+
+static void read_annotations(const std::string& s, annotations_t& annot)
+{
+  for (int a = 0; a < NUM_ANNOTATIONS; a++) {
+    annot[a].value = 0;
+    annot[a].x = false;
+  }
+
+  // First the values without Xs, then what is left, like gen_trace.py.
+  std::string rest;
+  bool has_rest = false;
+  size_t copied = 0;
+  int guess = 0;
+  for (size_t i = 0; i < s.size(); ) {
+    size_t key_end, value;
+    size_t end = match_annotation(s, i, false, &key_end, &value);
+    if (!end) {
+      has_rest |= s[i] == '\'';
+      i++;
+      continue;
+    }
+    int a = annotation_index(s, i + 1, key_end, guess);
+    if (a >= 0) {
+      annot[a].value = strtoull(s.c_str() + value + 2, NULL, 16);
+      annot[a].x = false;
+      guess = a + 1;
+    }
+    rest.append(s, copied, i - copied);
+    copied = i = end;
+  }
+  if (!has_rest)
+    return;
+
+  rest.append(s, copied, std::string::npos);
+  for (size_t i = 0; i < rest.size(); ) {
+    size_t key_end, value;
+    size_t end = match_annotation(rest, i, true, &key_end, &value);
+    if (!end) {
+      i++;
+      continue;
+    }
+    int a = annotation_index(rest, i + 1, key_end, 0);
+    if (a >= 0) {
+      annot[a].x = true;
+      annot[a].raw = rest.substr(value, end - value);
+    }
+    i = end;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Performance metrics of a section of a trace
+
+#define METRIC_KEYS \
+  X(core) X(section) X(start) X(end) X(cycles) X(snitch_loads) \
+  X(snitch_stores) X(snitch_avg_load_latency) X(snitch_occupancy) \
+  X(snitch_load_latency) X(total_ipc) X(snitch_issues) X(stall_tot) \
+  X(stall_ins) X(stall_raw) X(stall_raw_lsu) X(stall_raw_acc) X(stall_lsu) \
+  X(stall_acc) X(stall_wfi) X(seq_loads_local) X(seq_loads_global) \
+  X(itl_loads_local) X(itl_loads_global) X(seq_latency_local) \
+  X(seq_latency_global) X(itl_latency_local) X(itl_latency_global) \
+  X(snitch_load_region) X(snitch_load_tile) X(snitch_store_region) \
+  X(snitch_store_tile) X(seq_stores_local) X(seq_stores_global) \
+  X(itl_stores_local) X(itl_stores_global)
+
+enum metric_id_t {
+#define X(name) M_##name,
+  METRIC_KEYS
+#undef X
+  NUM_METRICS
+};
+
+static const char* const metric_names[NUM_METRICS] = {
+#define X(name) #name,
+  METRIC_KEYS
+#undef X
+};
+
+// The columns of the CSV file, as gen_trace.py writes them
+static const metric_id_t csv_columns[] = {
+  M_core, M_section, M_start, M_end, M_cycles, M_snitch_loads, M_snitch_stores,
+  M_snitch_avg_load_latency, M_snitch_occupancy, M_snitch_load_latency,
+  M_total_ipc, M_snitch_issues, M_stall_tot, M_stall_ins, M_stall_raw,
+  M_stall_raw_lsu, M_stall_raw_acc, M_stall_lsu, M_stall_acc, M_stall_wfi,
+  M_seq_loads_local, M_seq_loads_global, M_itl_loads_local, M_itl_loads_global,
+  M_seq_latency_local, M_seq_latency_global, M_itl_latency_local,
+  M_itl_latency_global, M_snitch_load_latency, M_snitch_load_region,
+  M_snitch_load_tile, M_snitch_store_region, M_snitch_store_region,
+  M_snitch_store_tile, M_seq_stores_local, M_seq_stores_global,
+  M_itl_stores_local, M_itl_stores_global
+};
+
+// Metrics that only serve to compute others, not printed without --allkeys
+static bool omitted(int m)
+{
+  return m == M_section || m == M_core || m == M_start || m == M_end ||
+         m == M_snitch_load_latency || m == M_snitch_load_region ||
+         m == M_snitch_load_tile || m == M_snitch_store_region ||
+         m == M_snitch_store_tile;
+}
+
+// A metric only exists once something touched it, so that the output has
+// the same keys as that of gen_trace.py.
+struct metric_t
+{
+  enum { ABSENT, NONE, INT, FLOAT, LIST } kind;
+  int64_t i;
+  double f;
+  std::vector<int64_t> list;
+
+  metric_t() : kind(ABSENT), i(0), f(0) {}
+  int64_t get() { if (kind == ABSENT) kind = INT; return kind == INT ? i : 0; }
+  void add(int64_t v) { get(); i += v; }
+  void set(int64_t v) { kind = INT; i = v; }
+  void set_float(double v) { kind = FLOAT; f = v; }
+  void set_none() { kind = NONE; }
+  void append(int64_t v) { kind = LIST; list.push_back(v); }
+  int64_t get_or_zero() const { return kind == INT ? i : 0; }
+};
+
+struct section_t
+{
+  metric_t m[NUM_METRICS];
+};
+
+static double mean(int64_t sum, size_t n)
+{
+  return n ? (double)sum / n : NAN;
+}
+
+static void eval_perf_metrics(std::vector<section_t>& sections, int64_t core_id)
+{
+  // Python's floor division
+  int64_t tile_id = core_id >= 0 ? core_id / 4 : -((-core_id + 3) / 4);
+
+  for (auto& sec : sections) {
+    metric_t* m = sec.m;
+    int64_t cycles = m[M_end].get_or_zero() - m[M_start].get_or_zero() + 1;
+
+    std::vector<int64_t>& latency = m[M_snitch_load_latency].list;
+    if (m[M_snitch_load_latency].kind == metric_t::LIST) {
+      int64_t sum = 0;
+      for (int64_t l : latency)
+        sum += l;
+      m[M_snitch_avg_load_latency].set_float(mean(sum, latency.size()));
+    } else {
+      m[M_snitch_load_latency].get();
+      m[M_snitch_avg_load_latency].set_float(0);
+    }
+    int64_t issues = m[M_snitch_issues].get();
+    if (cycles)
+      m[M_snitch_occupancy].set_float((double)issues / cycles);
+    else
+      m[M_snitch_occupancy].set_none();
+    m[M_cycles].set(cycles);
+    m[M_total_ipc] = m[M_snitch_occupancy];
+
+    // Accesses to the sequential and interleaved regions, of the hart's
+    // own tile (local) and of others (global)
+    const metric_id_t kinds[2][4] = {
+      {M_seq_loads_local, M_seq_loads_global, M_itl_loads_local, M_itl_loads_global},
+      {M_seq_stores_local, M_seq_stores_global, M_itl_stores_local, M_itl_stores_global},
+    };
+    const metric_id_t latencies[4] = {
+      M_seq_latency_local, M_seq_latency_global, M_itl_latency_local, M_itl_latency_global
+    };
+    for (int store = 0; store < 2; store++) {
+      if (m[store ? M_snitch_stores : M_snitch_loads].get() <= 0)
+        continue;
+      const std::vector<int64_t>& region = m[store ? M_snitch_store_region : M_snitch_load_region].list;
+      const std::vector<int64_t>& tile = m[store ? M_snitch_store_tile : M_snitch_load_tile].list;
+      int64_t count[4] = {}, sum[4] = {};
+      for (size_t i = 0; i < region.size() && i < tile.size(); i++) {
+        int kind;
+        if (region[i] == REGION_SEQUENTIAL)
+          kind = 0;
+        else if (region[i] == REGION_INTERLEAVED)
+          kind = 2;
+        else
+          continue;
+        kind += tile[i] != tile_id;
+        count[kind]++;
+        if (!store && i < latency.size())
+          sum[kind] += latency[i];
+      }
+      for (int k = 0; k < 4; k++) {
+        m[kinds[store][k]].set(count[k]);
+        if (!store)
+          m[latencies[k]].set_float(mean(sum[k], count[k]));
+      }
+    }
+  }
+}
+
+static std::string metric_str(const metric_t& m)
+{
+  switch (m.kind) {
+    case metric_t::NONE:
+      return "None";
+    case metric_t::FLOAT: {
+      std::string s = float_repr(m.f);
+      if (s.size() - 1 <= 4)
+        return s;
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.4f", m.f);
+      return buf;
+    }
+    case metric_t::LIST: {
+      std::string s = "[";
+      for (size_t i = 0; i < m.list.size(); i++)
+        appendf(s, i ? ", %" PRId64 : "%" PRId64, m.list[i]);
+      return s + "]";
+    }
+    default:
+      return int_lit(m.i);
+  }
+}
+
+static std::string csv_str(const metric_t& m)
+{
+  switch (m.kind) {
+    case metric_t::INT:
+      return std::to_string(m.i);
+    case metric_t::FLOAT:
+      return float_repr(m.f);
+    case metric_t::LIST: {
+      std::string s = metric_str(m);
+      return m.list.size() > 1 ? "\"" + s + "\"" : s;
+    }
+    default:
+      return "";
+  }
+}
+
+static std::string start_end_str(const metric_t& m)
+{
+  return m.kind == metric_t::INT ? std::to_string(m.i) : "None";
+}
+
+static void fmt_perf_metrics(std::string& out, const section_t& sec, size_t idx, bool allkeys)
+{
+  static std::vector<int> sorted;
+  static std::once_flag sorted_once;
+  std::call_once(sorted_once, [] {
+    for (int m = 0; m < NUM_METRICS; m++)
+      sorted.push_back(m);
+    std::sort(sorted.begin(), sorted.end(), [](int a, int b) {
+      return strcmp(metric_names[a], metric_names[b]) < 0;
+    });
+  });
+
+  appendf(out, "Performance metrics for section %zu @ (", idx);
+  out += start_end_str(sec.m[M_start]) + ", " + start_end_str(sec.m[M_end]) + "):";
+  for (int m : sorted) {
+    if (sec.m[m].kind == metric_t::ABSENT || (!allkeys && omitted(m)))
+      continue;
+    out += '\n';
+    pad_right(out, metric_names[m], 40);
+    pad_left(out, metric_str(sec.m[m]), 10);
+  }
+}
+
+static void sanity_check_perf_metrics(std::string& out, const section_t& sec)
+{
+  auto get = [&](metric_id_t m) { return sec.m[m].get_or_zero(); };
+  int64_t raw = get(M_stall_raw_acc) + get(M_stall_raw_lsu);
+  int64_t total = get(M_stall_ins) + get(M_stall_lsu) + get(M_stall_raw) + get(M_stall_wfi);
+  int64_t cycles = get(M_stall_tot) + get(M_snitch_issues);
+  int64_t errors[3] = {
+    raw != get(M_stall_raw) ? raw : 0,
+    total != get(M_stall_tot) ? total : 0,
+    cycles != get(M_cycles) ? cycles : 0,
+  };
+  const char* names[3] = {"raw_stalls", "total_stalls", "cycles"};
+  if (!errors[0] && !errors[1] && !errors[2])
+    return;
+
+  out += "\n\nSanity check failed!";
+  for (int e = 0; e < 3; e++) {
+    if (errors[e])
+      appendf(out, "\n%s do not add up. Sum is %" PRId64, names[e], errors[e]);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Annotating a trace
+
+struct trace_t
+{
+  // Input
+  std::string path;
+  std::string out_path;
+  std::string csv_path;
+  int64_t core_id;
+
+  // Output other than the annotated trace, written in the order of the
+  // traces once all are done
+  std::string errors;
+  std::string csv_rows;
+  bool failed;
+};
+
+class annotator_t
+{
+ public:
+  annotator_t(const config_t& config, trace_t& trace, FILE* out)
+    : config(config), trace(trace), out(out), time(0), cycle(0),
+      prev_wfi_time(0), section(0)
+  {
+    retired_reg[RAW_LSU] = retired_reg[RAW_ACC] = -1;
+    sections.resize(1);
+    sections[0].m[M_start].set_none();
+  }
+
+  // Annotate one line of spike-dasm's output; false on fatal errors.
+  bool line(const std::string& s);
+  void finish();
+
+ private:
+  void annotate_snitch(annotations_t& extras, int64_t cycle, int64_t last_cycle,
+                       uint64_t pc, std::string& ret);
+  std::string int_lit(const field_t& f, bool force_hex = false);
+  const char* reg_name(const field_t& f);
+  void addr_to_meta(int64_t address, int64_t* region, int64_t* tile);
+
+  const config_t& config;
+  trace_t& trace;
+  FILE* out;
+
+  // The time and cycle of the last line printed
+  int64_t time;
+  int64_t cycle;
+  int64_t prev_wfi_time;
+  int64_t retired_reg[NUM_RAW_TYPES];
+  // Cycles and addresses of the loads in flight, by destination register
+  std::deque<std::pair<int64_t, int64_t>> gpr_wb_info[256];
+  std::vector<int> gpr_wb_order;
+  bool gpr_wb_seen[256] = {};
+
+  std::vector<section_t> sections;
+  int64_t section;
+
+  annotations_t extras;
+  std::string annotation, output;
+};
+
+std::string annotator_t::int_lit(const field_t& f, bool force_hex)
+{
+  if (f.x) {
+    trace.errors += "WARNING: Trace contains Xs!\n";
+    return f.raw;
+  }
+  return ::int_lit(f.value, force_hex);
+}
+
+const char* annotator_t::reg_name(const field_t& f)
+{
+  if (f.x)
+    return f.raw.c_str();
+  return f.value >= 0 && f.value < 32 ? reg_names[f.value] : "?";
+}
+
+void annotator_t::addr_to_meta(int64_t address, int64_t* region, int64_t* tile)
+{
+  *region = REGION_OTHER;
+  *tile = -1;
+  if (address < config.seq_mem_size * config.num_tiles) {
+    *region = REGION_SEQUENTIAL;
+    *tile = address / (int64_t)config.seq_mem_size;
+  } else if (address < config.tcdm_size) {
+    *region = REGION_INTERLEAVED;
+    double t = std::fmod((double)(address / 64), config.num_tiles);
+    *tile = t < 0 ? t + config.num_tiles : t;
+  }
+}
+
+void annotator_t::annotate_snitch(annotations_t& extras, int64_t cycle, int64_t last_cycle,
+                                  uint64_t pc, std::string& ret)
+{
+  section_t& perf = sections.back();
+  int64_t raw_stall[NUM_RAW_TYPES] = {};
+  auto sep = [&] { if (!ret.empty()) ret += ", "; };
+  auto assign = [&](const char* name, const std::string& value) {
+    sep();
+    pad_right(ret, name, 3);
+    ret += " = " + value;
+  };
+
+  if (perf.m[M_start].kind == metric_t::NONE)
+    perf.m[M_start].set(cycle - extras[A_stall_tot].value);
+
+  bool stall = extras[A_stall].truthy();
+  if (!stall) {
+    // Did the instruction wait for a register that was just retired?
+    for (int k = 0; k < NUM_RAW_TYPES; k++) {
+      for (int reg : {A_rs1, A_rs2, A_rd}) {
+        if (extras[reg].equals(retired_reg[k]))
+          raw_stall[k] = retired_reg[k];
+      }
+    }
+    // Operands from the register file
+    if (extras[A_opc_select].equals(OPER_GPR) && !extras[A_rd].equals(0))
+      assign(reg_name(extras[A_rd]), int_lit(extras[A_gpr_rdata_2]));
+    if (extras[A_opa_select].equals(OPER_GPR) && !extras[A_rs1].equals(0))
+      assign(reg_name(extras[A_rs1]), int_lit(extras[A_opa]));
+    if (extras[A_opb_select].equals(OPER_GPR) && !extras[A_rs2].equals(0))
+      assign(reg_name(extras[A_rs2]), int_lit(extras[A_opb]));
+    // CSRs are always operand b
+    if (extras[A_opb_select].equals(OPER_CSR)) {
+      std::string name;
+      switch (extras[A_csr_addr].value) {
+        case 0xb00: name = "mcycle"; break;
+        case 0xb02: name = "minstret"; break;
+        case 0xf14: name = "mhartid"; break;
+        case 0x7d0: name = "trace"; break;
+        case 0x7d1: name = "stacklimit"; break;
+        default: appendf(name, "csr@%" PRIx64, extras[A_csr_addr].value);
+      }
+      sep();
+      ret += name + " = " + int_lit(extras[A_opb]);
+    }
+    // Loads and stores
+    bool force_hex = !config.saddr;
+    if (extras[A_is_load].truthy()) {
+      perf.m[M_snitch_loads].add(1);
+      int rd = extras[A_rd].value & 0xff;
+      if (!gpr_wb_seen[rd]) {
+        gpr_wb_seen[rd] = true;
+        gpr_wb_order.push_back(rd);
+      }
+      gpr_wb_info[rd].emplace_front(cycle, extras[A_alu_result].value);
+      sep();
+      pad_right(ret, reg_name(extras[A_rd]), 3);
+      ret += std::string(" <~~ ") + ls_sizes[extras[A_ls_size].value & 3] + "[" +
+             int_lit(extras[A_alu_result], force_hex) + "]";
+    } else if (extras[A_is_store].truthy()) {
+      perf.m[M_snitch_stores].add(1);
+      sep();
+      ret += int_lit(extras[A_gpr_rdata_1]) + " ~~> " + ls_sizes[extras[A_ls_size].value & 3] +
+             "[" + int_lit(extras[A_alu_result], force_hex) + "]";
+      int64_t region, tile;
+      addr_to_meta(extras[A_alu_result].value, &region, &tile);
+      perf.m[M_snitch_store_region].append(region);
+      perf.m[M_snitch_store_tile].append(tile);
+    } else if (extras[A_is_branch].truthy()) {
+      sep();
+      ret += extras[A_alu_result].truthy() ? "taken" : "not taken";
+    }
+    // Writeback of the ALU, jump target or bypass
+    if (extras[A_write_rd].truthy() && !extras[A_rd].equals(0)) {
+      sep();
+      ret += "(wrb) ";
+      pad_right(ret, reg_name(extras[A_rd]), 3);
+      ret += " <-- " + int_lit(extras[A_writeback]);
+    }
+  }
+
+  // Loads and accelerator results retire during stalls and other
+  // instructions, too.
+  if (extras[A_retire_load].truthy()) {
+    int rd = extras[A_lsu_rd].value & 0xff;
+    if (!gpr_wb_seen[rd]) {
+      gpr_wb_seen[rd] = true;
+      gpr_wb_order.push_back(rd);
+    }
+    if (!gpr_wb_info[rd].empty()) {
+      auto load = gpr_wb_info[rd].back();
+      gpr_wb_info[rd].pop_back();
+      int64_t region, tile;
+      addr_to_meta(load.second, &region, &tile);
+      perf.m[M_snitch_load_latency].append(cycle - load.first);
+      perf.m[M_snitch_load_region].append(region);
+      perf.m[M_snitch_load_tile].append(tile);
+    } else {
+      appendf(trace.errors, "%s: In cycle %" PRId64 ", LSU attempts writeback to ",
+              config.permissive ? "WARNING" : "FATAL", cycle);
+      trace.errors += reg_name(extras[A_lsu_rd]);
+      trace.errors += ", but none in flight.\n";
+      if (!config.permissive) {
+        trace.failed = true;
+        return;
+      }
+    }
+    sep();
+    ret += "(lsu) ";
+    pad_right(ret, reg_name(extras[A_lsu_rd]), 3);
+    ret += " <-- " + int_lit(extras[A_ld_result_32]);
+    retired_reg[RAW_LSU] = extras[A_lsu_rd].value;
+  }
+  if (extras[A_retire_acc].truthy() && !extras[A_acc_pid].equals(0)) {
+    sep();
+    ret += "(acc) ";
+    pad_right(ret, reg_name(extras[A_acc_pid]), 3);
+    ret += " <-- " + int_lit(extras[A_acc_pdata_32]);
+    retired_reg[RAW_ACC] = extras[A_acc_pid].value;
+  }
+
+  // Any kind of change of the pc: branches, jumps, etc.
+  if (!stall && !extras[A_pc_d].equals(pc + 4)) {
+    sep();
+    ret += "goto " + int_lit(extras[A_pc_d]);
+  }
+
+  // Count stalls, but only in cycles that execute an instruction
+  if (!stall) {
+    if (extras[A_stall_tot].truthy()) {
+      sep();
+      appendf(ret, "// stall %" PRId64 " cycles", extras[A_stall_tot].value);
+      perf.m[M_stall_tot].add(extras[A_stall_tot].value);
+      if (extras[A_stall_ins].truthy()) {
+        perf.m[M_stall_ins].add(extras[A_stall_ins].value);
+        appendf(ret, ", (%" PRId64 " ins)", extras[A_stall_ins].value);
+      }
+      if (extras[A_stall_raw].truthy()) {
+        perf.m[M_stall_raw].add(extras[A_stall_raw].value);
+        appendf(ret, ", (%" PRId64 " raw", extras[A_stall_raw].value);
+        for (int k = 0; k < NUM_RAW_TYPES; k++) {
+          if (raw_stall[k] > 0) {
+            appendf(ret, ", %s:%s)", raw_type_names[k],
+                    raw_stall[k] < 32 ? reg_names[raw_stall[k]] : "?");
+            perf.m[k == RAW_LSU ? M_stall_raw_lsu : M_stall_raw_acc].add(extras[A_stall_raw].value);
+          }
+        }
+      }
+      if (extras[A_stall_lsu].truthy()) {
+        perf.m[M_stall_lsu].add(extras[A_stall_lsu].value);
+        appendf(ret, ", (%" PRId64 " lsu)", extras[A_stall_lsu].value);
+      }
+      if (extras[A_stall_acc].truthy()) {
+        perf.m[M_stall_acc].add(extras[A_stall_acc].value);
+        appendf(ret, ", (%" PRId64 " acc)", extras[A_stall_acc].value);
+      }
+      if (prev_wfi_time != 0) {
+        perf.m[M_stall_wfi].add(cycle - prev_wfi_time - 1);
+        appendf(ret, ", (%" PRId64 " wfi)", cycle - prev_wfi_time - 1);
+      }
+    } else if (extras[A_stall_ins].truthy() || extras[A_stall_raw].truthy() ||
+               extras[A_stall_lsu].truthy() || extras[A_stall_acc].truthy()) {
+      sep();
+      ret += "// Missed specific stall!!!";
+    } else if (cycle - last_cycle > 1) {
+      // We probably missed a stall if we skipped a cycle.
+      sep();
+      appendf(ret, "// Potentially missed stall cycle (%" PRId64 " cycles)!!!",
+              cycle - last_cycle - 1);
+    }
+    // We executed an instruction
+    retired_reg[RAW_LSU] = retired_reg[RAW_ACC] = -1;
+  }
+}
+
+static bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// Match "(\d+)\s+(\d+)\s+(0x[0-9A-Fa-fz]+)\s+([^#;]*)(\s*#;\s*(.*))?" at s[i].
+// fields[] are the begin and end of the groups 1, 2, 3, 4 and 6.
+static bool match_line(const std::string& s, size_t i, size_t fields[5][2])
+{
+  size_t n = s.size();
+  for (int f = 0; f < 2; f++) {
+    fields[f][0] = i;
+    while (i < n && is_digit(s[i]))
+      i++;
+    if (i == fields[f][0])
+      return false;
+    fields[f][1] = i;
+    size_t spaces = i;
+    while (i < n && is_space(s[i]))
+      i++;
+    if (i == spaces)
+      return false;
+  }
+  if (s.compare(i, 2, "0x") != 0)
+    return false;
+  fields[2][0] = i;
+  i += 2;
+  while (i < n && (isxdigit(s[i]) || s[i] == 'z'))
+    i++;
+  if (i == fields[2][0] + 2)
+    return false;
+  fields[2][1] = i;
+  size_t spaces = i;
+  while (i < n && is_space(s[i]))
+    i++;
+  if (i == spaces)
+    return false;
+  fields[3][0] = i;
+  while (i < n && s[i] != '#' && s[i] != ';')
+    i++;
+  fields[3][1] = i;
+  fields[4][0] = fields[4][1] = std::string::npos;
+  if (s.compare(i, 2, "#;") == 0) {
+    i += 2;
+    while (i < n && is_space(s[i]))
+      i++;
+    fields[4][0] = i;
+    fields[4][1] = n;
+  }
+  return true;
+}
+
+bool annotator_t::line(const std::string& s)
+{
+  size_t fields[5][2];
+  size_t i = 0;
+  for (; i < s.size(); i++) {
+    if (is_digit(s[i]) && match_line(s, i, fields))
+      break;
+  }
+  if (i == s.size()) {
+    trace.errors += "Not a valid trace line:\n" + s + "\n";
+    trace.failed = true;
+    return false;
+  }
+
+  auto field = [&](int f) { return s.substr(fields[f][0], fields[f][1] - fields[f][0]); };
+  int64_t line_time = strtoll(s.c_str() + fields[0][0], NULL, 10);
+  int64_t line_cycle = strtoll(s.c_str() + fields[1][0], NULL, 10);
+  bool show_time = line_time != time || line_cycle != cycle;
+  std::string pc_str = field(2);
+  std::string insn = field(3);
+  bool empty = false;
+
+  if (fields[4][0] != std::string::npos && fields[4][0] != fields[4][1]) {
+    read_annotations(field(4), extras);
+    annotation.clear();
+    annotate_snitch(extras, line_cycle, cycle, strtoull(pc_str.c_str(), NULL, 16), annotation);
+    if (trace.failed)
+      return false;
+    if (extras[A_stall].truthy()) {
+      insn.clear();
+      pc_str.clear();
+    } else {
+      sections.back().m[M_snitch_issues].add(1);
+    }
+    // Omit empty lines, due to double stalls and performance counters
+    empty = insn.empty() && annotation.empty();
+
+    size_t b = insn.find_first_not_of(" \t\n\r\f\v");
+    size_t e = insn.find_last_not_of(" \t\n\r\f\v");
+    bool wfi = b != std::string::npos && insn.compare(b, e - b + 1, "wfi") == 0;
+    prev_wfi_time = wfi ? line_cycle : 0;
+  } else {
+    annotation.clear();
+    prev_wfi_time = 0;
+  }
+
+  if (!empty) {
+    time = line_time;
+    cycle = line_cycle;
+
+    output.clear();
+    pad_left(output, show_time ? std::to_string(line_time) : "", 8);
+    output += ' ';
+    pad_left(output, show_time ? std::to_string(line_cycle) : "", 8);
+    output += ' ';
+    pad_left(output, pc_str, 10);
+    output += ' ';
+    pad_right(output, insn, 30);
+    if (fields[4][0] != std::string::npos && fields[4][0] != fields[4][1])
+      output += " #; " + annotation;
+    output += '\n';
+    fwrite(output.data(), 1, output.size(), out);
+  }
+
+  if (sections[0].m[M_start].kind == metric_t::NONE)
+    sections[0].m[M_start].set(cycle);
+
+  // Start a new section after every read of the trace or mcycle CSRs
+  if (s.find("trace") != std::string::npos || s.find("mcycle") != std::string::npos) {
+    sections.back().m[M_end].set(cycle);
+    sections.emplace_back();
+    sections.back().m[M_section].set(section++);
+    sections.back().m[M_start].set_none();
+  }
+  return true;
+}
+
+void annotator_t::finish()
+{
+  sections.back().m[M_end].set(cycle);
+  if (sections.back().m[M_start].kind == metric_t::NONE)
+    sections.pop_back();
+  if (sections.empty() || sections[0].m[M_start].kind == metric_t::NONE) {
+    trace.errors += "WARNING: Empty trace file (" + trace.path + ").\n";
+    return;
+  }
+
+  eval_perf_metrics(sections, trace.core_id);
+  for (auto& sec : sections)
+    sec.m[M_core].set(trace.core_id);
+
+  output = "\n## Performance metrics\n";
+  for (size_t idx = 0; idx < sections.size(); idx++) {
+    output += '\n';
+    fmt_perf_metrics(output, sections[idx], idx, config.allkeys);
+    sanity_check_perf_metrics(output, sections[idx]);
+    output += '\n';
+    sections[idx].m[M_section].set(idx);
+  }
+
+  if (config.csv) {
+    for (auto& sec : sections) {
+      for (size_t c = 0; c < sizeof(csv_columns) / sizeof(csv_columns[0]); c++) {
+        if (c)
+          trace.csv_rows += ',';
+        trace.csv_rows += csv_str(sec.m[csv_columns[c]]);
+      }
+      trace.csv_rows += "\r\n";
+    }
+    output += "\nWrote performance metrics to " + trace.csv_path + "\n\n";
+  }
+  fwrite(output.data(), 1, output.size(), out);
+
+  // Check for any loose ends
+  bool warn = false;
+  for (int rd : gpr_wb_order) {
+    if (!gpr_wb_info[rd].empty()) {
+      warn = true;
+      appendf(trace.errors, "WARNING: %zu transactions still in flight for %s.\n",
+              gpr_wb_info[rd].size(), rd < 32 ? reg_names[rd] : "?");
+    }
+  }
+  if (warn)
+    trace.errors += "WARNING: Inconsistent final state; performance metrics may "
+                    "be inaccurate. Is this trace complete?\n";
+}
+
+// ---------------------------------------------------------------------------
+// Reading the traces
+
+// Replace DASM(<hex>) by the disassembly of <hex>, like spike-dasm does.
+static void disassemble(const disassembler_t* disassembler,
+                        std::unordered_map<uint64_t, std::string>& cache, std::string& s)
+{
+  for (size_t pos = 0; (pos = s.find("DASM(", pos)) != std::string::npos; ) {
+    size_t start = pos;
+
+    pos += strlen("DASM(");
+
+    if (s[pos] == '0' && (s[pos+1] == 'x' || s[pos+1] == 'X'))
+      pos += 2;
+
+    if (!isxdigit(s[pos]))
+      continue;
+
+    char* endp;
+    int64_t bits = strtoull(&s[pos], &endp, 16);
+    if (*endp != ')')
+      continue;
+
+    size_t nbits = 4 * (endp - &s[pos]);
+    if (nbits < 64)
+      bits = bits << (64 - nbits) >> (64 - nbits);
+
+    // Traces are loops over few instructions; disassemble each only once.
+    auto it = cache.find(bits);
+    if (it == cache.end())
+      it = cache.emplace(bits, disassembler->disassemble(bits)).first;
+    const std::string& dis = it->second;
+    s.replace(start, endp - &s[0] + 1 - start, dis);
+    pos = start + dis.length();
+  }
+}
+
+static void process(const config_t& config, trace_t& trace)
+{
+  int fd = open(trace.path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    trace.errors += "Cannot read " + trace.path + ": " + strerror(errno) + "\n";
+    trace.failed = true;
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  const char* data = NULL;
+  size_t size = st.st_size;
+  if (size) {
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      trace.errors += "Cannot map " + trace.path + ": " + strerror(errno) + "\n";
+      trace.failed = true;
+      close(fd);
+      return;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    data = (const char*)map;
+  }
+  close(fd);
+
+  FILE* out = fopen(trace.out_path.c_str(), "w");
+  if (!out) {
+    trace.errors += "Cannot write " + trace.out_path + ": " + strerror(errno) + "\n";
+    trace.failed = true;
+  } else {
+    static const size_t BUFFER_SIZE = 1 << 20;
+    std::vector<char> buffer(BUFFER_SIZE);
+    setvbuf(out, buffer.data(), _IOFBF, BUFFER_SIZE);
+
+    annotator_t annotator(config, trace, out);
+    std::unordered_map<uint64_t, std::string> cache;
+    std::string line;
+    bool ok = true;
+    for (const char* p = data; ok && p < data + size; ) {
+      const char* nl = (const char*)memchr(p, '\n', data + size - p);
+      const char* end = nl ? nl : data + size;
+      line.assign(p, end);
+      p = end + 1;
+      disassemble(config.disassembler, cache, line);
+      ok = annotator.line(line);
+    }
+    if (ok)
+      annotator.finish();
+    fclose(out);
+  }
+
+  if (data)
+    munmap((void*)data, size);
+}
+
+static void help(int exit_code = 1)
+{
+  fprintf(stderr, "usage: snitch-trace [options] <trace_hart_*.dasm>...\n");
+  fprintf(stderr, "Annotates Snitch instruction traces and computes their performance metrics.\n");
+  fprintf(stderr, "Each <name>.dasm is written to <name>.trace.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -s, --saddr           Use signed decimal (not unsigned hex) for small addresses\n");
+  fprintf(stderr, "  -a, --allkeys         Include performance metrics measured to compute others\n");
+  fprintf(stderr, "  -p, --permissive      Ignore some state-related issues when they occur\n");
+  fprintf(stderr, "  --csv=<file>          Append the performance metrics to <file>, relative to\n");
+  fprintf(stderr, "                        the trace's directory if it has none\n");
+  fprintf(stderr, "  -j, --jobs=<n>        Annotate <n> traces in parallel [default all CPUs]\n");
+  fprintf(stderr, "  --num-cores=<n>       Number of cores [default $num_cores or 256]\n");
+  fprintf(stderr, "  --seq-mem-size=<n>    Bytes of sequential memory per core\n");
+  fprintf(stderr, "                        [default $seq_mem_size or 1024]\n");
+  fprintf(stderr, "  --isa=<name>          ISA to disassemble for [default %s]\n", DEFAULT_ISA);
+#ifdef HAVE_DLOPEN
+  fprintf(stderr, "  --extension=<name>    Disassemble the instructions of an extension\n");
+#endif
+  exit(exit_code);
+}
+
+static void suggest_help()
+{
+  fprintf(stderr, "Try 'snitch-trace --help' for more information.\n");
+  exit(1);
+}
+
+static long env_long(const char* name, long def)
+{
+  const char* value = getenv(name);
+  return value ? atol(value) : def;
+}
+
+int main(int argc, char** argv)
+{
+  const char* isa = DEFAULT_ISA;
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+  long num_cores = env_long("num_cores", 256);
+  long seq_mem_size = env_long("seq_mem_size", 1024);
+  config_t config = {};
+
+  std::function<extension_t*()> extension;
+  option_parser_t parser;
+  parser.help(&suggest_help);
+  parser.option('h', "help", 0, [&](const char* s){help(0);});
+  parser.option('s', "saddr", 0, [&](const char* s){config.saddr = true;});
+  parser.option('a', "allkeys", 0, [&](const char* s){config.allkeys = true;});
+  parser.option('p', "permissive", 0, [&](const char* s){config.permissive = true;});
+  parser.option(0, "csv", 1, [&](const char* s){config.csv = s;});
+  parser.option('j', "jobs", 1, [&](const char* s){jobs = std::max(1, atoi(s));});
+  parser.option(0, "num-cores", 1, [&](const char* s){num_cores = atol(s);});
+  parser.option(0, "seq-mem-size", 1, [&](const char* s){seq_mem_size = atol(s);});
+#ifdef HAVE_DLOPEN
+  parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
+#endif
+  parser.option(0, "isa", 1, [&](const char* s){isa = s;});
+  const char* const* args = parser.parse(argv);
+  if (!args[0])
+    help();
+
+  std::string lowercase;
+  for (const char *p = isa; *p; p++)
+    lowercase += std::tolower(*p);
+
+  int xlen;
+  if (lowercase.compare(0, 4, "rv32") == 0) {
+    xlen = 32;
+  } else if (lowercase.compare(0, 4, "rv64") == 0) {
+    xlen = 64;
+  } else {
+    fprintf(stderr, "bad ISA string: %s\n", isa);
+    return 1;
+  }
+
+  disassembler_t* disassembler = new disassembler_t(xlen);
+  if (extension) {
+    for (auto disasm_insn : extension()->get_disasms()) {
+      disassembler->add_insn(disasm_insn);
+    }
+  }
+  config.disassembler = disassembler;
+  config.num_tiles = num_cores / 4.0;
+  config.seq_mem_size = 4.0 * seq_mem_size;
+  config.tcdm_size = 16 * 1024 * config.num_tiles;
+
+  std::vector<trace_t> traces;
+  for (; *args; args++) {
+    trace_t trace;
+    trace.path = *args;
+    size_t slash = trace.path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : trace.path.substr(0, slash);
+    std::string name = trace.path.substr(slash == std::string::npos ? 0 : slash + 1);
+    std::string stem = trace.path;
+    if (stem.size() > 5 && stem.compare(stem.size() - 5, 5, ".dasm") == 0)
+      stem.resize(stem.size() - 5);
+    trace.out_path = stem + ".trace";
+
+    // The hart is the first hex (or else decimal) number in the file name.
+    size_t hex = name.find("0x");
+    size_t dec = name.find_first_of("0123456789");
+    if (hex != std::string::npos && isxdigit(name[hex + 2]))
+      trace.core_id = strtoll(name.c_str() + hex + 2, NULL, 16);
+    else if (dec != std::string::npos)
+      trace.core_id = strtoll(name.c_str() + dec, NULL, 10);
+    else
+      trace.core_id = -1;
+
+    if (config.csv) {
+      trace.csv_path = config.csv;
+      if (!strchr(config.csv, '/') && !dir.empty())
+        trace.csv_path = dir + "/" + config.csv;
+    }
+    trace.failed = false;
+    traces.push_back(trace);
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&] {
+    for (size_t t; (t = next++) < traces.size(); )
+      process(config, traces[t]);
+  };
+  std::vector<std::thread> threads;
+  for (unsigned j = 1; j < std::min<size_t>(jobs, traces.size()); j++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads)
+    thread.join();
+
+  int status = 0;
+  for (auto& trace : traces) {
+    fputs(trace.errors.c_str(), stderr);
+    if (trace.failed)
+      status = 1;
+    if (trace.csv_rows.empty())
+      continue;
+
+    bool write_header = access(trace.csv_path.c_str(), F_OK) != 0;
+    FILE* csv = fopen(trace.csv_path.c_str(), "a");
+    if (!csv) {
+      fprintf(stderr, "Cannot write %s: %s\n", trace.csv_path.c_str(), strerror(errno));
+      status = 1;
+      continue;
+    }
+    if (write_header) {
+      for (size_t c = 0; c < sizeof(csv_columns) / sizeof(csv_columns[0]); c++)
+        fprintf(csv, c ? ",%s" : "%s", metric_names[csv_columns[c]]);
+      fputs("\r\n", csv);
+    }
+    fputs(trace.csv_rows.c_str(), csv);
+    fclose(csv);
+  }
+
+  return status;
+}
@@ -0,0 +1,896 @@
+// See LICENSE for license details.
+
+// This program turns annotated Snitch traces (trace_hart_*.trace, as
+// written by snitch-trace) into a timeline of the functions and
+// instructions of every core, like scripts/tracevis.py does:
+//
+//   snitch-tracevis --output=tracevis.json app.elf build/*.trace
+//
+// The JSON is the same as that of tracevis.py and can be opened in
+// about:tracing or https://ui.perfetto.dev. With --output=<name>.pftrace (or
+// --format=perfetto), it writes Perfetto's protobuf trace format instead,
+// which is much smaller and faster to load.
+//
+// The traces are read three times, each time by several threads in
+// parallel: to collect the addresses of all instructions, to find the
+// order in which the functions first appear, and to write the events.
+// addr2line runs once on all addresses, and the events of each trace are
+// streamed to a temporary file and then appended to the output in the
+// order of the arguments, so memory use does not grow with the traces.
+
+#include <fesvr/option_parser.h>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct config_t
+{
+  bool use_time;          // use the trace's time instead of its cycles
+  bool banshee;           // parse Banshee traces
+  bool filter_benchmark;  // only mempool_start_benchmark() to _stop_benchmark()
+  bool compress_function; // only show function calls
+  bool perfetto;          // write Perfetto's protobuf format instead of JSON
+  long start, end;        // lines to parse, as a Python slice
+};
+
+// ---------------------------------------------------------------------------
+// Parsing trace lines
+
+struct span_t
+{
+  const char* p;
+  size_t n;
+
+  std::string str() const { return std::string(p, n); }
+};
+
+// The fields of an instruction in a trace, all stripped
+struct insn_line_t
+{
+  int64_t time, cycle;
+  span_t time_str, cycle_str, priv, pc, insn, args;
+};
+
+static bool is_space(char c)
+{
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static bool is_word(char c)
+{
+  return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static span_t strip(const char* p, size_t n)
+{
+  while (n && is_space(*p))
+    p++, n--;
+  while (n && is_space(p[n - 1]))
+    n--;
+  return {p, n};
+}
+
+static bool digits(const char* s, size_t n, size_t& i, span_t& field)
+{
+  size_t begin = i;
+  while (i < n && isdigit((unsigned char)s[i]))
+    i++;
+  field = {s + begin, i - begin};
+  return i > begin;
+}
+
+static bool spaces(const char* s, size_t n, size_t& i)
+{
+  size_t begin = i;
+  while (i < n && s[i] == ' ')
+    i++;
+  return i > begin;
+}
+
+static int64_t to_int(const span_t& field)
+{
+  int64_t value = 0;
+  for (size_t i = 0; i < field.n; i++)
+    value = value * 10 + (field.p[i] - '0');
+  return value;
+}
+
+// The rest of a line of the RTL after the privilege level:
+// " *(0x[0-9a-f]+) ([.\w]+) +(.+)#; (.*)"
+static bool match_rtl_rest(const char* s, size_t n, size_t i, insn_line_t& l)
+{
+  spaces(s, n, i);
+  if (i + 2 > n || s[i] != '0' || s[i + 1] != 'x')
+    return false;
+  size_t pc = i;
+  i += 2;
+  while (i < n && (isdigit((unsigned char)s[i]) || (s[i] >= 'a' && s[i] <= 'f')))
+    i++;
+  if (i == pc + 2 || i == n || s[i] != ' ')
+    return false;
+  l.pc = {s + pc, i - pc};
+  size_t insn = ++i;
+  while (i < n && is_word(s[i]))
+    i++;
+  if (i == insn || i + 4 >= n || s[i] != ' ')
+    return false;
+  l.insn = {s + insn, i - insn};
+  // The arguments run up to the last "#; ", and are at least a character.
+  for (size_t p = n - 2; p-- > i + 1; ) {
+    if (s[p] == '#' && s[p + 1] == ';' && s[p + 2] == ' ') {
+      l.args = strip(s + i, p - i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Snitch RTL simulation:
+//   101000 82      M         0x00001000 csrr    a0, mhartid     #; comment
+//   time   cycle   priv_lvl  pc         insn
+// MemPool RTL simulation:
+//   101000 82      0x00001000 csrr    a0, mhartid     #; comment
+//   time   cycle   pc         insn
+static bool match_rtl(const char* s, size_t n, insn_line_t& l)
+{
+  size_t i = 0;
+  spaces(s, n, i);
+  if (!digits(s, n, i, l.time_str) || !spaces(s, n, i) ||
+      !digits(s, n, i, l.cycle_str) || !spaces(s, n, i))
+    return false;
+  if (i < n && strchr("3M1S0U", s[i]) && match_rtl_rest(s, n, i + 1, l)) {
+    l.priv = {s + i, 1};
+    return true;
+  }
+  l.priv = {s + i, 0};
+  return match_rtl_rest(s, n, i, l);
+}
+
+// Banshee traces:
+//   00000432 00000206 0005     800101e0  x15:00000064 x15=00000065 # addi ...
+//   cycle    instret  hart_id  pc        register                    insn
+// as " *(\d+) (\d+) (\d+) ([0-9a-f]+) *.+ +.+# ([\w\.]*)( +)(.*)"
+static bool match_banshee(const char* s, size_t n, insn_line_t& l)
+{
+  size_t i = 0;
+  spaces(s, n, i);
+  span_t* fields[3] = {&l.time_str, &l.cycle_str, &l.priv};
+  for (span_t* field : fields) {
+    if (!digits(s, n, i, *field) || i == n || s[i] != ' ')
+      return false;
+    i++;
+  }
+  size_t pc = i;
+  while (i < n && (isdigit((unsigned char)s[i]) || (s[i] >= 'a' && s[i] <= 'f')))
+    i++;
+  if (i == pc)
+    return false;
+  l.pc = {s + pc, i - pc};
+
+  // The instruction follows the last "# " that has the register columns
+  // before it and an instruction name and spaces after it.
+  size_t first_space = n;
+  for (size_t q = i + 1; q < n; q++) {
+    if (s[q] == ' ') {
+      first_space = q;
+      break;
+    }
+  }
+  for (size_t p = n - 1; p-- > first_space + 1; ) {
+    if (s[p] != '#' || s[p + 1] != ' ')
+      continue;
+    size_t insn = p + 2, j = insn;
+    while (j < n && is_word(s[j]))
+      j++;
+    if (j == n || s[j] != ' ')
+      continue;
+    l.insn = {s + insn, j - insn};
+    l.args = {s + j, 0};
+    return true;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+// The traces
+
+// What addr2line knows about an address
+struct location_t
+{
+  std::string pc;       // as addr2line prints it
+  std::string func;
+  std::string file;
+  std::string inlined;  // the functions the code is inlined into
+};
+
+struct trace_t
+{
+  std::string path;
+  int64_t hartid;
+  const char* data;
+  size_t size;
+  size_t lines;
+  std::vector<uint64_t> pcs;            // of all instructions
+  std::vector<std::string> functions;   // in the order they first appear
+  size_t known_functions;               // in any trace up to this one
+  FILE* part;                           // the events of this trace
+};
+
+// Call f for each line of the trace, within the --start and --end slice.
+template <typename F>
+static void for_each_line(const config_t& config, trace_t& trace, F f)
+{
+  long n = trace.lines;
+  long first = config.start < 0 ? std::max(0L, config.start + n) : std::min(config.start, n);
+  long last = config.end < 0 ? std::max(0L, config.end + n) : std::min(config.end, n);
+  const char* p = trace.data;
+  const char* end = trace.data + trace.size;
+  for (long lineno = 0; lineno < last && p < end; lineno++) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    const char* eol = nl ? nl : end;
+    if (lineno >= first)
+      f(p, eol - p);
+    p = eol + 1;
+  }
+}
+
+// Call f for each instruction of the trace and the one after it. The last
+// instruction has none after it and is left out.
+template <typename F>
+static void for_each_insn(const config_t& config, trace_t& trace, F f)
+{
+  insn_line_t lines[2];
+  int cur = 0;
+  bool have_prev = false;
+  for_each_line(config, trace, [&](const char* s, size_t n) {
+    insn_line_t& l = lines[cur];
+    if (!(config.banshee ? match_banshee(s, n, l) : match_rtl(s, n, l)))
+      return;
+    l.time = to_int(l.time_str);
+    l.cycle = to_int(l.cycle_str);
+    if (have_prev)
+      f(lines[cur ^ 1], l);
+    have_prev = true;
+    cur ^= 1;
+  });
+}
+
+static uint64_t parse_pc(const span_t& pc)
+{
+  return strtoull(pc.str().c_str(), NULL, 16);
+}
+
+// The hart is the number in the file name, up to the first dot.
+static int64_t hartid_of(const std::string& path)
+{
+  std::string name = path.substr(path.rfind('/') + 1);
+  name = name.substr(0, name.find('.'));
+  size_t digit = name.find_first_of("0123456789");
+  if (digit == std::string::npos || digit + 1 == name.size())
+    return 0;
+  std::string num = name.substr(digit);
+  return strtoll(num.c_str(), NULL, num.find("0x") != std::string::npos ? 16 : 10);
+}
+
+static bool map_trace(trace_t& trace)
+{
+  int fd = open(trace.path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Cannot read %s: %s\n", trace.path.c_str(), strerror(errno));
+    return false;
+  }
+  trace.size = st.st_size;
+  trace.data = NULL;
+  if (trace.size) {
+    void* map = mmap(NULL, trace.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "Cannot map %s: %s\n", trace.path.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    trace.data = (const char*)map;
+  }
+  close(fd);
+
+  trace.lines = 0;
+  for (const char* p = trace.data; p < trace.data + trace.size; ) {
+    const char* nl = (const char*)memchr(p, '\n', trace.data + trace.size - p);
+    trace.lines++;
+    p = nl ? nl + 1 : trace.data + trace.size;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// The symbol table
+
+static std::string shell_quote(const std::string& s)
+{
+  std::string quoted = "'";
+  for (char c : s) {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+}
+
+// Look up all addresses with one run of addr2line.
+static bool read_symbols(const char* addr2line, const char* elf,
+                         const std::vector<uint64_t>& pcs,
+                         std::unordered_map<uint64_t, location_t>& symbols)
+{
+  char tmp[] = "/tmp/snitch-tracevis-XXXXXX";
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    perror("mkstemp");
+    return false;
+  }
+  FILE* addrs = fdopen(fd, "w");
+  for (uint64_t pc : pcs)
+    fprintf(addrs, "0x%" PRIx64 "\n", pc);
+  fclose(addrs);
+
+  std::string cmd = shell_quote(addr2line) + " -e " + shell_quote(elf) +
+                    " -f -a -i < " + shell_quote(tmp);
+  FILE* a2l = popen(cmd.c_str(), "r");
+  if (!a2l) {
+    perror("popen");
+    unlink(tmp);
+    return false;
+  }
+
+  // Each address is followed by the function and the file:line of the
+  // code, then of the functions that it is inlined into, if any.
+  std::vector<std::string> lines;
+  char* buf = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ((len = getline(&buf, &cap, a2l)) > 0) {
+    if (buf[len - 1] == '\n')
+      len--;
+    lines.emplace_back(buf, len);
+  }
+  free(buf);
+  int status = pclose(a2l);
+  unlink(tmp);
+
+  size_t next = 0;
+  for (size_t i = 0; i < lines.size(); ) {
+    if (lines[i].compare(0, 2, "0x") != 0 || i + 2 >= lines.size() || next == pcs.size()) {
+      i++;
+      continue;
+    }
+    location_t& loc = symbols[pcs[next++]];
+    loc.pc = lines[i];
+    loc.func = lines[i + 1];
+    loc.file = lines[i + 2];
+    for (i += 3; i < lines.size() && lines[i].compare(0, 2, "0x") != 0; i++)
+      loc.inlined += "(inlined by) " + lines[i];
+  }
+  if (status != 0 || next != pcs.size()) {
+    fprintf(stderr, "%s failed to look up the addresses in %s\n", addr2line, elf);
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// Writing events
+
+// The events of the instructions and functions of a trace. Functions are
+// numbered in the order in which they first appear in any trace, and each
+// function of each core has a track (a thread in about:tracing) of its own.
+class event_writer_t
+{
+ public:
+  virtual ~event_writer_t() {}
+  virtual void begin() {}
+  virtual void instruction(int64_t pid, size_t tid, const std::string& func,
+                           const location_t& loc, const insn_line_t& l,
+                           int64_t ts, int64_t dur) = 0;
+  virtual void function_begin(int64_t pid, size_t tid, const std::string& func,
+                              const location_t& loc, const insn_line_t& l, int64_t ts) = 0;
+  virtual void function_end(int64_t pid, size_t tid, const std::string& func, int64_t ts) = 0;
+  // Name the tracks of the first n functions of a core.
+  virtual void function_names(int64_t pid, const std::vector<std::string>& functions,
+                              size_t n) = 0;
+  // Name the cores up to and including the last one.
+  virtual void core_names(int64_t last) = 0;
+  virtual void end() {}
+};
+
+static std::string json_escape(const std::string& s)
+{
+  std::string escaped;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+// The JSON of about:tracing, as tracevis.py writes it
+class json_writer_t : public event_writer_t
+{
+ public:
+  json_writer_t(FILE* out) : out(out) {}
+
+  void begin() { fputs("{\"traceEvents\": [\n", out); }
+
+  void instruction(int64_t pid, size_t tid, const std::string& func,
+                   const location_t& loc, const insn_line_t& l, int64_t ts, int64_t dur)
+  {
+    std::string insn = json_escape(l.insn.str());
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"instruction\", \"ph\": \"X\", "
+            "\"ts\": %" PRId64 ", \"dur\": %" PRId64 ", \"pid\": %" PRId64 ", \"tid\": %zu, "
+            "\"args\": {\"pc\": \"%s\", \"instr\": \"%s %s\", \"time\": \"%s\", "
+            "\"Origin\": \"%s\", \"inline\": \"%s\", \"funcname\": \"%s\"}},\n",
+            insn.c_str(), ts, dur, pid, tid, json_escape(loc.pc).c_str(), insn.c_str(),
+            json_escape(l.args.str()).c_str(), l.cycle_str.str().c_str(),
+            json_escape(loc.file).c_str(), json_escape(loc.inlined).c_str(),
+            json_escape(func).c_str());
+  }
+
+  void function_begin(int64_t pid, size_t tid, const std::string& func,
+                      const location_t& loc, const insn_line_t& l, int64_t ts)
+  {
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"function\", \"ph\": \"B\", "
+            "\"ts\": %" PRId64 ", \"pid\": %" PRId64 ", \"tid\": %zu, "
+            "\"args\": {\"time\": \"%s\", \"Origin\": \"%s\"}},\n",
+            json_escape(func).c_str(), ts, pid, tid, l.cycle_str.str().c_str(),
+            json_escape(loc.file).c_str());
+  }
+
+  void function_end(int64_t pid, size_t tid, const std::string& func, int64_t ts)
+  {
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"function\", \"ph\": \"E\", "
+            "\"ts\": %" PRId64 ", \"pid\": %" PRId64 ", \"tid\": %zu},\n",
+            json_escape(func).c_str(), ts, pid, tid);
+  }
+
+  void function_names(int64_t pid, const std::vector<std::string>& functions, size_t n)
+  {
+    for (size_t tid = 0; tid < n; tid++)
+      fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %" PRId64 ", "
+              "\"tid\": %zu, \"args\": {\"name\" : \"%s\"}},\n",
+              pid, tid, json_escape(functions[tid]).c_str());
+  }
+
+  void core_names(int64_t last)
+  {
+    for (int64_t i = 0; i <= last; i++) {
+      fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %" PRId64 ", "
+              "\"args\": {\"name\" : \"Core %02" PRId64 "\"}},\n", i, i);
+      fprintf(out, "{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": %" PRId64 ", "
+              "\"args\": {\"sort_index\" : %" PRId64 "}},\n", i, i + 1);
+    }
+  }
+
+  void end() { fputs("{}]}\n", out); }
+
+ private:
+  FILE* out;
+};
+
+// Perfetto's protobuf trace format: a Trace message, which is a sequence
+// of TracePacket messages, each as field 1. Every core has a track, with a
+// track per function below it. Instructions are slices on the track of
+// their function. Timestamps are in nanoseconds, so a cycle is shown as a
+// microsecond, as in the JSON.
+class perfetto_writer_t : public event_writer_t
+{
+ public:
+  perfetto_writer_t(FILE* out, uint32_t sequence)
+    : out(out), sequence(sequence), first(true) {}
+
+  void instruction(int64_t pid, size_t tid, const std::string& func,
+                   const location_t& loc, const insn_line_t& l, int64_t ts, int64_t dur)
+  {
+    uint64_t track = describe(pid, tid, func);
+    std::string annotations;
+    annotation(annotations, "pc", loc.pc);
+    annotation(annotations, "instr", l.insn.str() + " " + l.args.str());
+    annotation(annotations, "time", l.cycle_str.str());
+    annotation(annotations, "Origin", loc.file);
+    annotation(annotations, "inline", loc.inlined);
+    annotation(annotations, "funcname", func);
+    if (dur < 0) {
+      event(ts, TYPE_INSTANT, track, l.insn.str(), "instruction", annotations);
+    } else {
+      event(ts, TYPE_SLICE_BEGIN, track, l.insn.str(), "instruction", annotations);
+      event(ts + dur, TYPE_SLICE_END, track, "", "", "");
+    }
+  }
+
+  void function_begin(int64_t pid, size_t tid, const std::string& func,
+                      const location_t& loc, const insn_line_t& l, int64_t ts)
+  {
+    uint64_t track = describe(pid, tid, func);
+    std::string annotations;
+    annotation(annotations, "time", l.cycle_str.str());
+    annotation(annotations, "Origin", loc.file);
+    event(ts, TYPE_SLICE_BEGIN, track, func, "function", annotations);
+  }
+
+  void function_end(int64_t pid, size_t tid, const std::string& func, int64_t ts)
+  {
+    event(ts, TYPE_SLICE_END, describe(pid, tid, func), "", "", "");
+  }
+
+  // The tracks are named when they are first used.
+  void function_names(int64_t pid, const std::vector<std::string>& functions, size_t n) {}
+  void core_names(int64_t last) {}
+
+ private:
+  enum { TYPE_SLICE_BEGIN = 1, TYPE_SLICE_END = 2, TYPE_INSTANT = 3 };
+
+  static void varint(std::string& s, uint64_t v)
+  {
+    while (v >= 0x80) {
+      s += char(v | 0x80);
+      v >>= 7;
+    }
+    s += char(v);
+  }
+
+  static void field_varint(std::string& s, unsigned field, uint64_t v)
+  {
+    varint(s, field << 3);
+    varint(s, v);
+  }
+
+  static void field_bytes(std::string& s, unsigned field, const std::string& bytes)
+  {
+    varint(s, field << 3 | 2);
+    varint(s, bytes.size());
+    s += bytes;
+  }
+
+  // DebugAnnotation {name = 10, string_value = 6}
+  static void annotation(std::string& s, const char* name, const std::string& value)
+  {
+    std::string a;
+    field_bytes(a, 10, name);
+    field_bytes(a, 6, value);
+    field_bytes(s, 4, a);
+  }
+
+  // TracePacket {trusted_packet_sequence_id = 10, sequence_flags = 13}
+  void packet(std::string& p)
+  {
+    field_varint(p, 10, sequence);
+    if (first) {
+      field_varint(p, 13, 1); // SEQ_INCREMENTAL_STATE_CLEARED
+      first = false;
+    }
+    std::string wrapped;
+    field_bytes(wrapped, 1, p);
+    fwrite(wrapped.data(), 1, wrapped.size(), out);
+  }
+
+  static uint64_t core_track(int64_t pid) { return uint64_t(pid + 1) << 32; }
+
+  // The track of a function of a core; describe it if it is new.
+  uint64_t describe(int64_t pid, size_t tid, const std::string& func)
+  {
+    uint64_t core = core_track(pid);
+    uint64_t track = core + tid + 1;
+    if (described.insert(core).second) {
+      // TrackDescriptor {uuid = 1, process = 3}, with
+      // ProcessDescriptor {pid = 1, process_name = 6}
+      char name[32];
+      snprintf(name, sizeof(name), "Core %02" PRId64, pid);
+      std::string process, descriptor, p;
+      field_varint(process, 1, pid);
+      field_bytes(process, 6, name);
+      field_varint(descriptor, 1, core);
+      field_bytes(descriptor, 3, process);
+      field_bytes(p, 60, descriptor);
+      packet(p);
+    }
+    if (described.insert(track).second) {
+      // TrackDescriptor {uuid = 1, name = 2, parent_uuid = 5}
+      std::string descriptor, p;
+      field_varint(descriptor, 1, track);
+      field_bytes(descriptor, 2, func);
+      field_varint(descriptor, 5, core);
+      field_bytes(p, 60, descriptor);
+      packet(p);
+    }
+    return track;
+  }
+
+  // TracePacket {timestamp = 8, track_event = 11}, with TrackEvent
+  // {debug_annotations = 4, type = 9, track_uuid = 11, categories = 22,
+  // name = 23}
+  void event(int64_t ts, int type, uint64_t track, const std::string& name,
+             const char* category, const std::string& annotations)
+  {
+    std::string e, p;
+    e += annotations;
+    field_varint(e, 9, type);
+    field_varint(e, 11, track);
+    if (*category)
+      field_bytes(e, 22, category);
+    if (!name.empty())
+      field_bytes(e, 23, name);
+    field_varint(p, 8, ts * 1000);
+    field_bytes(p, 11, e);
+    packet(p);
+  }
+
+  FILE* out;
+  uint32_t sequence;
+  bool first;
+  std::unordered_set<uint64_t> described;
+};
+
+// ---------------------------------------------------------------------------
+// The passes over the traces
+
+static void collect_pcs(const config_t& config, trace_t& trace)
+{
+  std::unordered_set<uint64_t> seen;
+  for_each_insn(config, trace, [&](const insn_line_t& l, const insn_line_t& next) {
+    uint64_t pc = parse_pc(l.pc);
+    if (seen.insert(pc).second)
+      trace.pcs.push_back(pc);
+  });
+}
+
+// Call f for each instruction that makes it into the timeline, with the
+// function it is in.
+template <typename F>
+static void for_each_event(const config_t& config, trace_t& trace,
+                           const std::unordered_map<uint64_t, location_t>& symbols, F f)
+{
+  bool in_benchmark = false;
+  for_each_insn(config, trace, [&](const insn_line_t& l, const insn_line_t& next) {
+    const location_t& loc = symbols.at(parse_pc(l.pc));
+    if (loc.func == "mempool_start_benchmark") {
+      in_benchmark = true;
+      return;
+    }
+    if (config.filter_benchmark && !in_benchmark)
+      return;
+    if (loc.func == "mempool_stop_benchmark")
+      in_benchmark = false;
+    f(l, next, loc);
+  });
+}
+
+static void collect_functions(const config_t& config, trace_t& trace,
+                              const std::unordered_map<uint64_t, location_t>& symbols)
+{
+  std::unordered_set<std::string> seen;
+  for_each_event(config, trace, symbols,
+                 [&](const insn_line_t& l, const insn_line_t& next, const location_t& loc) {
+    if (seen.insert(loc.func).second)
+      trace.functions.push_back(loc.func);
+  });
+}
+
+static void write_events(const config_t& config, trace_t& trace, uint32_t sequence,
+                         const std::unordered_map<uint64_t, location_t>& symbols,
+                         const std::unordered_map<std::string, size_t>& tids,
+                         const std::vector<std::string>& functions)
+{
+  std::unique_ptr<event_writer_t> writer;
+  if (config.perfetto)
+    writer.reset(new perfetto_writer_t(trace.part, sequence));
+  else
+    writer.reset(new json_writer_t(trace.part));
+
+  std::string prev_func;
+  int64_t prev_ts = 0;
+  bool have_prev = false;
+  for_each_event(config, trace, symbols,
+                 [&](const insn_line_t& l, const insn_line_t& next, const location_t& loc) {
+    int64_t ts = config.use_time ? l.time : l.cycle;
+    int64_t next_ts = config.use_time ? next.time : next.cycle;
+    // Every instruction takes a cycle, unless time runs backwards.
+    int64_t dur = next_ts - ts < 0 ? next_ts - ts : 1;
+    int64_t pid = trace.hartid;
+    if (config.banshee) {
+      // Banshee traces all harts in one file.
+      pid = to_int(l.priv);
+      dur = 1;
+    }
+    size_t tid = tids.at(loc.func);
+
+    if (!config.compress_function) {
+      writer->instruction(pid, tid, loc.func, loc, l, ts, dur);
+    } else if (!have_prev || loc.func != prev_func) {
+      if (have_prev)
+        writer->function_end(pid, tids.at(prev_func), prev_func, ts > prev_ts ? ts : prev_ts + 1);
+      writer->function_begin(pid, tid, loc.func, loc, l, ts);
+      prev_func = loc.func;
+      prev_ts = ts;
+      have_prev = true;
+    }
+  });
+
+  // Close the last function at the end of the trace
+  if (config.compress_function && have_prev)
+    writer->function_end(trace.hartid, tids.at(prev_func), prev_func, prev_ts + 1);
+  writer->function_names(trace.hartid, functions, trace.known_functions);
+  fflush(trace.part);
+}
+
+template <typename F>
+static void parallel(size_t jobs, std::vector<trace_t>& traces, F f)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&] {
+    for (size_t t; (t = next++) < traces.size(); )
+      f(t, traces[t]);
+  };
+  std::vector<std::thread> threads;
+  for (size_t j = 1; j < std::min(jobs, traces.size()); j++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads)
+    thread.join();
+}
+
+static void help(int exit_code = 1)
+{
+  fprintf(stderr, "usage: snitch-tracevis [options] <elf> <trace>...\n");
+  fprintf(stderr, "Creates a timeline of Snitch traces for about:tracing or Perfetto.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -o, --output=<file>     Output file [default chrome.json]\n");
+  fprintf(stderr, "  --format=json|perfetto  Output format [default perfetto for *.pftrace,\n");
+  fprintf(stderr, "                          json otherwise]\n");
+  fprintf(stderr, "  --addr2line=<path>      `addr2line` binary to use for parsing\n");
+  fprintf(stderr, "  -t, --time              Use the traces time instead of cycles\n");
+  fprintf(stderr, "  -b, --banshee           Parse Banshee traces\n");
+  fprintf(stderr, "  -s, --start=<line>      First line to parse\n");
+  fprintf(stderr, "  -e, --end=<line>        Last line to parse, exclusive [default -1]\n");
+  fprintf(stderr, "  --filter_benchmark      Only show the sections between mempool_start_benchmark()\n");
+  fprintf(stderr, "                          and mempool_stop_benchmark() calls\n");
+  fprintf(stderr, "  --compress_function     Only show function calls\n");
+  fprintf(stderr, "  -j, --jobs=<n>          Parse <n> traces in parallel [default all CPUs]\n");
+  exit(exit_code);
+}
+
+static void suggest_help()
+{
+  fprintf(stderr, "Try 'snitch-tracevis --help' for more information.\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  const char* output = "chrome.json";
+  const char* addr2line = "addr2line";
+  const char* format = NULL;
+  size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+  config_t config = {};
+  config.end = -1;
+
+  option_parser_t parser;
+  parser.help(&suggest_help);
+  parser.option('h', "help", 0, [&](const char* s){help(0);});
+  parser.option('o', "output", 1, [&](const char* s){output = s;});
+  parser.option(0, "format", 1, [&](const char* s){format = s;});
+  parser.option(0, "addr2line", 1, [&](const char* s){addr2line = s;});
+  parser.option('t', "time", 0, [&](const char* s){config.use_time = true;});
+  parser.option('b', "banshee", 0, [&](const char* s){config.banshee = true;});
+  parser.option(0, "no-cache", 0, [&](const char* s){});
+  parser.option('s', "start", 1, [&](const char* s){config.start = atol(s);});
+  parser.option('e', "end", 1, [&](const char* s){config.end = atol(s);});
+  parser.option(0, "filter_benchmark", 0, [&](const char* s){config.filter_benchmark = true;});
+  parser.option(0, "compress_function", 0, [&](const char* s){config.compress_function = true;});
+  parser.option('j', "jobs", 1, [&](const char* s){jobs = std::max(1, atoi(s));});
+  const char* const* args = parser.parse(argv);
+  if (!args[0] || !args[1])
+    help();
+  const char* elf = *args++;
+
+  std::string out_name = output;
+  if (format)
+    config.perfetto = !strcmp(format, "perfetto");
+  else
+    config.perfetto = out_name.size() > 8 && out_name.compare(out_name.size() - 8, 8, ".pftrace") == 0;
+  if (format && !config.perfetto && strcmp(format, "json")) {
+    fprintf(stderr, "unknown format: %s\n", format);
+    return 1;
+  }
+
+  std::vector<trace_t> traces;
+  for (; *args; args++) {
+    trace_t trace = {};
+    trace.path = *args;
+    trace.hartid = hartid_of(trace.path);
+    if (!map_trace(trace))
+      return 1;
+    traces.push_back(trace);
+  }
+
+  // Look up the functions of all instructions at once.
+  parallel(jobs, traces, [&](size_t t, trace_t& trace) { collect_pcs(config, trace); });
+  std::vector<uint64_t> pcs;
+  for (auto& trace : traces)
+    pcs.insert(pcs.end(), trace.pcs.begin(), trace.pcs.end());
+  std::sort(pcs.begin(), pcs.end());
+  pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+  std::unordered_map<uint64_t, location_t> symbols;
+  if (!pcs.empty() && !read_symbols(addr2line, elf, pcs, symbols))
+    return 1;
+
+  // Number the functions in the order they first appear.
+  parallel(jobs, traces, [&](size_t t, trace_t& trace) {
+    collect_functions(config, trace, symbols);
+  });
+  std::vector<std::string> functions;
+  std::unordered_map<std::string, size_t> tids;
+  for (auto& trace : traces) {
+    for (auto& func : trace.functions) {
+      if (tids.emplace(func, functions.size()).second)
+        functions.push_back(func);
+    }
+    trace.known_functions = functions.size();
+  }
+
+  parallel(jobs, traces, [&](size_t t, trace_t& trace) {
+    trace.part = tmpfile();
+    if (trace.part)
+      write_events(config, trace, t + 1, symbols, tids, functions);
+  });
+
+  FILE* out = fopen(output, "w");
+  if (!out) {
+    fprintf(stderr, "Cannot write %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+  std::unique_ptr<event_writer_t> writer;
+  if (config.perfetto)
+    writer.reset(new perfetto_writer_t(out, 0));
+  else
+    writer.reset(new json_writer_t(out));
+  writer->begin();
+
+  int status = 0;
+  std::vector<char> buf(1 << 20);
+  for (auto& trace : traces) {
+    fprintf(stderr, "Parsed hartid %" PRId64 " with trace %s\n", trace.hartid, trace.path.c_str());
+    if (!trace.part) {
+      fprintf(stderr, "Cannot create a temporary file: %s\n", strerror(errno));
+      status = 1;
+      continue;
+    }
+    rewind(trace.part);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), trace.part)) > 0)
+      fwrite(buf.data(), 1, n, out);
+    fclose(trace.part);
+    if (trace.data)
+      munmap((void*)trace.data, trace.size);
+  }
+
+  writer->core_names(traces.back().hartid);
+  writer->end();
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Cannot write %s: %s\n", output, strerror(errno));
+    status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,175 @@
+// See LICENSE for license details.
+
+// Measures how fast the bus resolves physical addresses, the way sim_t does
+// on every TLB refill (addr_to_mem) and on every uncached access (mmio_load
+// and mmio_store), and compares it with the std::map and dynamic_cast lookup
+// that the flat region table replaced. The address map is MemPool's: L1 at
+// 0, the boot ROM, the CLINT, the control registers, L2 and the UART. Most
+// accesses go to the control registers and the UART, as in apps that wake
+// up cores, poll the DMA or print. Both lookups must agree on every address.
+//
+// Build with "make bus-bench"; the optional argument is the number of
+// addresses to resolve.
+
+#include "devices.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// A register file that only remembers the last word written to it
+class regs_t : public abstract_device_t {
+ public:
+  regs_t(size_t size) : value(0), len(size) {}
+  bool load(reg_t addr, size_t len, uint8_t* bytes) {
+    if (addr + len > this->len)
+      return false;
+    memset(bytes, 0, len);
+    memcpy(bytes, &value, std::min(len, sizeof(value)));
+    return true;
+  }
+  bool store(reg_t addr, size_t len, const uint8_t* bytes) {
+    if (addr + len > this->len)
+      return false;
+    memcpy(&value, bytes, std::min(len, sizeof(value)));
+    return true;
+  }
+
+ private:
+  uint32_t value;
+  size_t len;
+};
+
+// The bus sim_t used before it had a flat region table.
+class map_bus_t {
+ public:
+  void add_device(reg_t addr, abstract_device_t* dev) { devices[addr] = dev; }
+
+  bool load(reg_t addr, size_t len, uint8_t* bytes) {
+    auto it = devices.upper_bound(addr);
+    if (devices.empty() || it == devices.begin())
+      return false;
+    it--;
+    return it->second->load(addr - it->first, len, bytes);
+  }
+
+  bool store(reg_t addr, size_t len, const uint8_t* bytes) {
+    auto it = devices.upper_bound(addr);
+    if (devices.empty() || it == devices.begin())
+      return false;
+    it--;
+    return it->second->store(addr - it->first, len, bytes);
+  }
+
+  char* addr_to_mem(reg_t addr) {
+    auto it = devices.upper_bound(addr);
+    if (devices.empty() || it == devices.begin())
+      return NULL;
+    it--;
+    if (auto mem = dynamic_cast<mem_t*>(it->second))
+      if (addr - it->first < mem->size())
+        return mem->contents() + (addr - it->first);
+    return NULL;
+  }
+
+ private:
+  std::map<reg_t, abstract_device_t*> devices;
+};
+
+struct region_t { reg_t base, size; unsigned weight; };
+
+// Addresses drawn from the regions by their weight, with random offsets
+static std::vector<reg_t> make_addrs(const std::vector<region_t>& regions, size_t n)
+{
+  std::vector<unsigned> weights;
+  for (auto& r : regions)
+    weights.push_back(r.weight);
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+  std::mt19937_64 rng(1);
+  std::vector<reg_t> addrs(n);
+  for (auto& a : addrs) {
+    const region_t& r = regions[pick(rng)];
+    a = r.base + (rng() % r.size & ~reg_t(3));
+  }
+  return addrs;
+}
+
+template<typename F>
+static double lookup_rate(const std::vector<reg_t>& addrs, uint64_t& sum, F lookup)
+{
+  sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (reg_t addr : addrs)
+    sum += lookup(addr);
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+  return addrs.size() / t.count() / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 24;
+
+  mem_t l1(0x100000), l2(0x1000000);
+  rom_device_t rom(std::vector<char>(0x1000));
+  regs_t clint(0xc0000), ctrl(0x10000), uart(0x10000);
+  std::vector<std::pair<reg_t, abstract_device_t*>> devices = {
+    {0x00000000, &l1}, {0x00001000, &rom}, {0x02000000, &clint},
+    {0x40000000, &ctrl}, {0x80000000, &l2}, {0xc0000000, &uart},
+  };
+  bus_t bus;
+  map_bus_t map_bus;
+  for (auto& d : devices) {
+    bus.add_device(d.first, d.second);
+    map_bus.add_device(d.first, d.second);
+  }
+
+  // Memories are resolved once per TLB refill, so they see fewer lookups
+  std::vector<reg_t> addrs = make_addrs({
+    {0x00000000, 0x100000, 1}, {0x00001000, 0x1000, 1}, {0x02000000, 0xc0000, 1},
+    {0x40000000, 0x10000, 6}, {0x80000000, 0x1000000, 1}, {0xc0000000, 0x10000, 4},
+    {0x20000000, 0x1000, 1}, // unmapped
+  }, n);
+
+  uint64_t map_sum, flat_sum;
+  auto mem_key = [](char* p) { return (uint64_t)(uintptr_t)p; };
+  double map_mem = lookup_rate(addrs, map_sum,
+    [&](reg_t a) { return mem_key(map_bus.addr_to_mem(a)); });
+  double flat_mem = lookup_rate(addrs, flat_sum,
+    [&](reg_t a) {
+      reg_t offset;
+      mem_t* mem = bus.find_mem(a, &offset);
+      return mem_key(mem ? mem->contents() + offset : NULL);
+    });
+  if (map_sum != flat_sum) {
+    fprintf(stderr, "memory lookups disagree\n");
+    return 1;
+  }
+
+  auto mmio = [](bool ok, uint32_t value) { return ok ? value + 1 : 0; };
+  double map_mmio = lookup_rate(addrs, map_sum,
+    [&](reg_t a) {
+      uint32_t v = (uint32_t)a;
+      bool ok = map_bus.store(a, 4, (uint8_t*)&v) && map_bus.load(a, 4, (uint8_t*)&v);
+      return mmio(ok, v);
+    });
+  double flat_mmio = lookup_rate(addrs, flat_sum,
+    [&](reg_t a) {
+      uint32_t v = (uint32_t)a;
+      bool ok = bus.store(a, 4, (uint8_t*)&v) && bus.load(a, 4, (uint8_t*)&v);
+      return mmio(ok, v);
+    });
+  if (map_sum != flat_sum) {
+    fprintf(stderr, "MMIO accesses disagree\n");
+    return 1;
+  }
+
+  printf("resolved %zu addresses\n", n);
+  printf("addr_to_mem, map:  %8.2f M/s\n", map_mem);
+  printf("addr_to_mem, flat: %8.2f M/s\n", flat_mem);
+  printf("MMIO store+load, map:  %8.2f M/s\n", map_mmio);
+  printf("MMIO store+load, flat: %8.2f M/s\n", flat_mmio);
+  return 0;
+}
@@ -0,0 +1,140 @@
+// See LICENSE for license details.
+
+// Measures how fast processor_t::decode_insn decodes instruction words that
+// do not repeat, which is what an icache refill sees, and compares it with
+// the linear search with move-to-front and direct-mapped opcode cache that
+// the decode table replaced. Both decoders must agree on every word.
+//
+// Build with "make decode-bench"; the optional argument is the number of
+// instruction words to decode.
+
+#include "processor.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// The decoder processor_t used before it had a decode table.
+class linear_decoder_t
+{
+ public:
+  linear_decoder_t()
+  {
+    #define DECLARE_INSN(name, match, mask) \
+      insn_bits_t name##_match = (match), name##_mask = (mask);
+    #include "encoding.h"
+    #undef DECLARE_INSN
+
+    #define DEFINE_INSN(name) \
+      REGISTER_INSN(this, name, name##_match, name##_mask)
+    #include "insn_list.h"
+    #undef DEFINE_INSN
+
+    register_insn({0, 0, &illegal_instruction, &illegal_instruction});
+
+    std::sort(instructions.begin(), instructions.end(),
+      [](const insn_desc_t& lhs, const insn_desc_t& rhs) {
+        if (lhs.match == rhs.match)
+          return lhs.mask > rhs.mask;
+        return lhs.match > rhs.match;
+      });
+
+    for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
+      opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction};
+  }
+
+  void register_insn(insn_desc_t desc) { instructions.push_back(desc); }
+
+  insn_func_t decode(insn_bits_t bits)
+  {
+    size_t idx = bits % OPCODE_CACHE_SIZE;
+    insn_desc_t desc = opcode_cache[idx];
+
+    if (unlikely(bits != desc.match)) {
+      insn_desc_t* p = &instructions[0];
+      while ((bits & p->mask) != p->match)
+        p++;
+      desc = *p;
+
+      if (p->mask != 0 && p > &instructions[0]) {
+        if (p->match != (p-1)->match && p->match != (p+1)->match) {
+          while (--p >= &instructions[0])
+            *(p+1) = *p;
+          instructions[0] = desc;
+        }
+      }
+
+      opcode_cache[idx] = desc;
+      opcode_cache[idx].match = bits;
+    }
+
+    return desc.rv32;
+  }
+
+ private:
+  static const size_t OPCODE_CACHE_SIZE = 8191;
+  std::vector<insn_desc_t> instructions;
+  insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
+};
+
+// Instruction words drawn uniformly from all encodings in encoding.h, with
+// random bits in the fields that the encodings leave open.
+static std::vector<insn_bits_t> make_words(size_t n)
+{
+  struct encoding_t { insn_bits_t match, mask; };
+  std::vector<encoding_t> encodings;
+  #define DECLARE_INSN(name, match, mask) encodings.push_back({(match), (mask)});
+  #include "encoding.h"
+  #undef DECLARE_INSN
+
+  std::mt19937_64 rng(1);
+  std::vector<insn_bits_t> words(n);
+  for (auto& w : words) {
+    const encoding_t& e = encodings[rng() % encodings.size()];
+    w = (e.match | (rng() & ~e.mask)) & 0xffffffff;
+    if ((w & 0x3) != 0x3)
+      w = (int16_t)w; // as mmu_t::refill_icache hands it to the decoder
+  }
+  return words;
+}
+
+template<typename F>
+static double decode_rate(const std::vector<insn_bits_t>& words,
+                          std::vector<insn_func_t>& funcs, F decode)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < words.size(); i++)
+    funcs[i] = decode(words[i]);
+  std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+  return words.size() / t.count() / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 22;
+  std::vector<insn_bits_t> words = make_words(n);
+  std::vector<insn_func_t> before(n), after(n);
+
+  linear_decoder_t linear;
+  processor_t proc("RV32IMAFDC", "MSU", DEFAULT_VARCH, NULL, 0, false, stdout);
+
+  double linear_rate = decode_rate(words, before,
+    [&](insn_bits_t bits) { return linear.decode(bits); });
+  double table_rate = decode_rate(words, after,
+    [&](insn_bits_t bits) { return proc.decode_insn(bits); });
+
+  for (size_t i = 0; i < n; i++) {
+    if (before[i] != after[i]) {
+      fprintf(stderr, "decoders disagree on 0x%08" PRIx64 "\n", words[i]);
+      return 1;
+    }
+  }
+
+  printf("decoded %zu instruction words\n", n);
+  printf("linear search: %8.2f Minsn/s\n", linear_rate);
+  printf("decode table:  %8.2f Minsn/s\n", table_rate);
+  return 0;
+}
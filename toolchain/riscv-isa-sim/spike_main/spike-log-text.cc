@@ -0,0 +1,65 @@
+// See LICENSE for license details.
+
+// This little program converts a binary commit log, as written by
+// spike --log-commits-binary, to the text form of --log-commits, e.g.
+//   core   0: 3 0x80000000 (0x00300413) x 8 0x00000003
+// so that spike-dasm and other tools for the text log can read it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include "fesvr/option_parser.h"
+#include "commit_log.h"
+
+static void help(int exit_code = 1)
+{
+  fprintf(stderr, "usage: spike-log-text [--core=<n>] <binary log>\n");
+  fprintf(stderr, "  --core=<n>   Only convert the records of hart <n>\n");
+  exit(exit_code);
+}
+
+static void suggest_help()
+{
+  fprintf(stderr, "Try 'spike-log-text --help' for more information.\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  long core = -1;
+
+  option_parser_t parser;
+  parser.help(&suggest_help);
+  parser.option('h', "help", 0, [&](const char* s){help(0);});
+  parser.option(0, "core", 1, [&](const char* s){core = atol(s);});
+  const char* const* args = parser.parse(argv);
+  if (!args[0] || args[1])
+    help();
+
+  try {
+    commit_log_reader_t reader(args[0]);
+    commit_log_record_t rec;
+
+    // With an index, skip the chunks of other harts without reading them.
+    if (core >= 0 && !reader.chunks().empty()) {
+      for (size_t i = 0; i < reader.chunks().size(); i++) {
+        if (reader.chunks()[i].hartid != core)
+          continue;
+        reader.seek_chunk(i);
+        for (size_t j = 0; j < reader.chunks()[i].nrecords && reader.next(rec); j++)
+          commit_log_print_record(stdout, rec);
+      }
+      return 0;
+    }
+
+    while (reader.next(rec)) {
+      if (core < 0 || rec.hartid == core)
+        commit_log_print_record(stdout, rec);
+    }
+  } catch (std::exception& e) {
+    fprintf(stderr, "spike-log-text: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -4,11 +4,13 @@
 #include "mmu.h"
 #include "remote_bitbang.h"
 #include "cachesim.h"
+#include "tcdm_sim.h"
 #include "extension.h"
 #include <dlfcn.h>
 #include <fesvr/option_parser.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <memory>
@@ -21,11 +23,27 @@ static void help(int exit_code = 1)
   fprintf(stderr, "usage: spike [host options] <target program> [target options]\n");
   fprintf(stderr, "Host Options:\n");
   fprintf(stderr, "  -p<n>                 Simulate <n> processors [default 1]\n");
+  fprintf(stderr, "  --threads=<n>         Step the processors on <n> host threads [default 1]\n");
+  fprintf(stderr, "  --quantum=<n>         Run each processor for <n> instructions at a time [default 5000]\n");
+  fprintf(stderr, "  --park-wfi            Don't schedule processors waiting in WFI until an\n");
+  fprintf(stderr, "                          interrupt is pending for them or --ctrl's wake-up\n");
+  fprintf(stderr, "                          registers wake them up\n");
   fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
   fprintf(stderr, "  -m<a:m,b:n,...>       Provide memory regions of size m and n bytes\n");
   fprintf(stderr, "                          at base addresses a and b (with 4 KiB alignment)\n");
+  fprintf(stderr, "  -m<a:m:file,...>      Start the region at a with the contents of file\n");
   fprintf(stderr, "  -d                    Interactive debug mode\n");
   fprintf(stderr, "  -g                    Track histogram of PCs\n");
+  fprintf(stderr, "  --profile=<path>      Write a profile of the executed code by symbol to\n");
+  fprintf(stderr, "                          <path>, and its call stacks to <path>.folded\n");
+  fprintf(stderr, "  --checkpoint=<path>   Save the state of the processors, the CLINT and the\n");
+  fprintf(stderr, "                          written memory to <path> at the --checkpoint-at\n");
+  fprintf(stderr, "                          trigger, and continue\n");
+  fprintf(stderr, "  --checkpoint-at=<t>   mcycle[:<n>] for a processor's first (n-th) read of\n");
+  fprintf(stderr, "                          the cycle counter, or a symbol or an address to\n");
+  fprintf(stderr, "                          stop at [default mcycle]\n");
+  fprintf(stderr, "  --restore=<path>      Start from a checkpoint of the same program, saved\n");
+  fprintf(stderr, "                          with the same -p and -m options\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
   fprintf(stderr, "  -h, --help            Print this help message\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
@@ -37,6 +55,13 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
   fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --tcdm=<config>       Model bank conflicts and latencies of MemPool's L1,\n");
+  fprintf(stderr, "                          configured by a comma-separated list of\n");
+  fprintf(stderr, "                          config/*.mk files and <name>=<value> settings\n");
+  fprintf(stderr, "  --uart=<base>         Attach MemPool's fake UART at <base> (0xc0000000), which\n");
+  fprintf(stderr, "                          prints the lines and binary log records of each hart\n");
+  fprintf(stderr, "  --ctrl=<base>         Attach MemPool's control registers at <base> (0x40000000),\n");
+  fprintf(stderr, "                          whose wake-up registers wake processors parked in WFI\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
@@ -44,6 +69,12 @@ static void help(int exit_code = 1)
   fprintf(stderr, "                          This flag can be used multiple times.\n");
   fprintf(stderr, "                          The extlib flag for the library must come first.\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
+  fprintf(stderr, "  --log-commits-binary=<path>\n");
+  fprintf(stderr, "                        Write a commit log to <path> in binary form,\n");
+  fprintf(stderr, "                          which spike-log-text converts to text\n");
+  fprintf(stderr, "  --log-async=<policy>  Write the logs from a separate thread. When a\n");
+  fprintf(stderr, "                          processor's log buffer is full, it waits\n");
+  fprintf(stderr, "                          (block) or its entries are dropped (drop)\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
   fprintf(stderr, "                        This flag can be used multiple times.\n");
@@ -153,6 +184,14 @@ static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg)
     if (!*p || *p != ':')
       help();
     auto size = strtoull(p + 1, &p, 0);
+    std::string file;
+    if (*p == ':') {
+      const char* end = strchr(p + 1, ',');
+      file.assign(p + 1, end ? end - (p + 1) : strlen(p + 1));
+      p += 1 + file.size();
+      if (file.empty())
+        help();
+    }
 
     // page-align base and size
     auto base0 = base, size0 = size;
@@ -170,7 +209,13 @@ static std::vector<std::pair<reg_t, mem_t*>> make_mems(const char* arg)
               base0, base0 + size0 - 1, PGSIZE / 1024, base, base + size - 1);
     }
 
-    res.push_back(std::make_pair(reg_t(base), new mem_t(size)));
+    if (!file.empty() && base != base0) {
+      fprintf(stderr, "The memory at 0x%llX starts with %s and must be page-aligned\n",
+              base0, file.c_str());
+      exit(1);
+    }
+
+    res.push_back(std::make_pair(reg_t(base), new mem_t(size, file.empty() ? nullptr : file.c_str())));
     if (!*p)
       break;
     if (*p != ',')
@@ -187,11 +232,18 @@ int main(int argc, char** argv)
   bool debug = false;
   bool halted = false;
   bool histogram = false;
+  const char* profile = NULL;
+  const char* checkpoint = NULL;
+  const char* checkpoint_at = "mcycle";
+  const char* restore = NULL;
   bool log = false;
   bool dump_dts = false;
   bool dtb_enabled = true;
   bool real_time_clint = false;
   size_t nprocs = 1;
+  size_t nthreads = 1;
+  size_t quantum = 5000;
+  bool park_wfi = false;
   const char* kernel = NULL;
   reg_t kernel_offset, kernel_size;
   size_t initrd_size;
@@ -203,9 +255,14 @@ int main(int argc, char** argv)
   std::unique_ptr<icache_sim_t> ic;
   std::unique_ptr<dcache_sim_t> dc;
   std::unique_ptr<cache_sim_t> l2;
+  std::unique_ptr<tcdm_sim_t> tcdm;
+  const char* uart = nullptr;
+  mempool_ctrl_t* ctrl = nullptr;
   bool log_cache = false;
   bool log_commits = false;
   const char *log_path = nullptr;
+  const char *commit_log_path = nullptr;
+  const char *log_async = nullptr;
   std::function<extension_t*()> extension;
   const char* initrd = NULL;
   const char* isa = DEFAULT_ISA;
@@ -287,8 +344,15 @@ int main(int argc, char** argv)
   parser.option('h', "help", 0, [&](const char* s){help(0);});
   parser.option('d', 0, 0, [&](const char* s){debug = true;});
   parser.option('g', 0, 0, [&](const char* s){histogram = true;});
+  parser.option(0, "profile", 1, [&](const char* s){profile = s;});
+  parser.option(0, "checkpoint", 1, [&](const char* s){checkpoint = s;});
+  parser.option(0, "checkpoint-at", 1, [&](const char* s){checkpoint_at = s;});
+  parser.option(0, "restore", 1, [&](const char* s){restore = s;});
   parser.option('l', 0, 0, [&](const char* s){log = true;});
   parser.option('p', 0, 1, [&](const char* s){nprocs = atoi(s);});
+  parser.option(0, "threads", 1, [&](const char* s){nthreads = atoi(s);});
+  parser.option(0, "quantum", 1, [&](const char* s){quantum = strtoull(s, 0, 0);});
+  parser.option(0, "park-wfi", 0, [&](const char* s){park_wfi = true;});
   parser.option('m', 0, 1, [&](const char* s){mems = make_mems(s);});
   // I wanted to use --halted, but for some reason that doesn't work.
   parser.option('H', 0, 0, [&](const char* s){halted = true;});
@@ -298,10 +362,16 @@ int main(int argc, char** argv)
   parser.option(0, "ic", 1, [&](const char* s){ic.reset(new icache_sim_t(s));});
   parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
+  parser.option(0, "tcdm", 1, [&](const char* s){tcdm.reset(new tcdm_sim_t(s));});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){priv = s;});
   parser.option(0, "varch", 1, [&](const char* s){varch = s;});
+  parser.option(0, "uart", 1, [&](const char* s){uart = s;});
+  parser.option(0, "ctrl", 1, [&](const char* s){
+    ctrl = new mempool_ctrl_t();
+    plugin_devices.emplace_back(strtoull(s, 0, 0), ctrl);
+  });
   parser.option(0, "device", 1, device_parser);
   parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
   parser.option(0, "dump-dts", 0, [&](const char *s){dump_dts = true;});
@@ -338,6 +408,10 @@ int main(int argc, char** argv)
       [&](const char* s){dm_config.support_haltgroups = false;});
   parser.option(0, "log-commits", 0,
                 [&](const char* s){log_commits = true;});
+  parser.option(0, "log-commits-binary", 1,
+                [&](const char* s){log_commits = true; commit_log_path = s;});
+  parser.option(0, "log-async", 1,
+                [&](const char* s){log_async = s;});
   parser.option(0, "log", 1,
                 [&](const char* s){log_path = s;});
 
@@ -349,6 +423,34 @@ int main(int argc, char** argv)
   if (!*argv1)
     help();
 
+  if (quantum == 0) {
+    fprintf(stderr, "--quantum must be at least 1\n");
+    exit(1);
+  }
+
+  if (log_async && strcmp(log_async, "block") != 0 && strcmp(log_async, "drop") != 0) {
+    fprintf(stderr, "--log-async must be block or drop\n");
+    exit(1);
+  }
+
+  if (nthreads > 1 && (debug || use_rbb || ic || dc || l2 || tcdm)) {
+    fprintf(stderr, "--threads cannot be combined with -d, --rbb-port or "
+                    "the --ic/--dc/--l2/--tcdm memory models\n");
+    exit(1);
+  }
+
+  if (uart) {
+    // The UART takes the format strings of the log records from the program
+    const char* program = "";
+    for (auto& arg : htif_args) {
+      if (arg[0] != '+' && arg[0] != '-') {
+        program = arg.c_str();
+        break;
+      }
+    }
+    plugin_devices.emplace_back(strtoull(uart, 0, 0), new mempool_uart_t(program));
+  }
+
   if (kernel && check_file_exists(kernel)) {
     kernel_size = get_file_size(kernel);
     if (isa[2] == '6' && isa[3] == '4')
@@ -358,6 +460,7 @@ int main(int argc, char** argv)
     for (auto& m : mems) {
       if (kernel_size && (kernel_offset + kernel_size) < m.second->size()) {
          read_file_bytes(kernel, 0, m.second->contents() + kernel_offset, kernel_size);
+         m.second->mark_dirty(kernel_offset, kernel_size);
          break;
       }
     }
@@ -370,6 +473,7 @@ int main(int argc, char** argv)
          initrd_end = m.first + m.second->size() - 0x1000;
          initrd_start = initrd_end - initrd_size;
          read_file_bytes(initrd, 0, m.second->contents() + (initrd_start - m.first), initrd_size);
+         m.second->mark_dirty(initrd_start - m.first, initrd_size);
          break;
       }
     }
@@ -399,12 +503,26 @@ int main(int argc, char** argv)
   {
     if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
     if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    if (tcdm) s.get_core(i)->get_mmu()->register_memtracer(tcdm->add_hart(s.get_core(i)));
     if (extension) s.get_core(i)->register_extension(extension());
   }
 
   s.set_debug(debug);
-  s.configure_log(log, log_commits);
+  if (log_async)
+    s.set_log_async(strcmp(log_async, "drop") == 0 ? async_log_t::DROP : async_log_t::BLOCK);
+  s.configure_log(log, log_commits, commit_log_path);
   s.set_histogram(histogram);
+  if (profile)
+    s.set_profile(profile);
+  s.set_nthreads(nthreads);
+  s.set_interleave(quantum);
+  s.set_park_wfi(park_wfi);
+  if (ctrl)
+    ctrl->on_wake_up([&s](reg_t hartid) { s.wake_up(hartid); });
+  if (checkpoint)
+    s.set_checkpoint(checkpoint, checkpoint_at);
+  if (restore)
+    s.set_restore(restore);
 
   auto return_code = s.run();
 